@@ -0,0 +1,53 @@
+#include "knit.h"
+#include <time.h>
+
+/*
+ * allocation microbenchmark: keeps a fixed fraction of the int heap class alive (rooted by a list on the stack)
+ * and measures how long it takes to allocate objects in the remaining free space
+*/
+
+static double bench_occupancy(int percent, int rounds) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_EXIT);
+    struct knit_heap_class *ints = &knit.ex.heap.classes[KNIT_HEAP_SMALL];
+    struct knit_int *integer;
+    struct knit_list *live;
+    int nlive = (long) ints->capacity * percent / 100;
+    if (knitx_list_new_gcobj(&knit, &live, nlive) != KNIT_OK) {
+        fprintf(stderr, "bench: failed to allocate the live list\n");
+        exit(1);
+    }
+    knitx_stack_rpush(&knit, &knit.ex.stack, (struct knit_obj *) live);
+    for (int i=0; i<nlive; i++) {
+        if (knitx_int_new_gcobj(&knit, &integer, i) != KNIT_OK) {
+            fprintf(stderr, "bench: failed to allocate live objects\n");
+            exit(1);
+        }
+        knitx_list_push(&knit, live, (struct knit_obj *) integer);
+    }
+    long nallocs = 0;
+    clock_t total = 0;
+    for (int r=0; r<rounds; r++) {
+        clock_t begin = clock();
+        while (knitx_int_new_gcobj(&knit, &integer, r) == KNIT_OK) {
+            nallocs++;
+        }
+        total += clock() - begin;
+        knit_gc_cycle(&knit, KNIT_GC_TRIGGER_EXPLICIT); //frees everything except the live objects
+    }
+    knitx_deinit(&knit);
+    if (!nallocs)
+        return 0;
+    return (double) total / CLOCKS_PER_SEC * 1e9 / nallocs;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 200;
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+    int percents[] = {10, 50, 95};
+    for (int i=0; i < (int) (sizeof percents / sizeof percents[0]); i++) {
+        printf("occupancy %2d%%: %8.2f ns/alloc\n", percents[i], bench_occupancy(percents[i], rounds));
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "knit.h"
+#include <time.h>
+
+/*
+ * instance cloning benchmark: compares setting up an instance by registering the stdlib and running a prelude
+ * (function definitions and some tables) with knitx_clone() of an instance that already did it.
+ * a request that changes a table is then run in the clone, to check the source instance doesn't see it
+*/
+
+static const char *bench_fragment =
+    "f%d = function(a, b) {\n"
+    "    t = [a, b, a * b + %d, 'str']\n"
+    "    if (a < b) {\n"
+    "        return t[0] + b\n"
+    "    }\n"
+    "    return len(t)\n"
+    "}\n";
+
+static const char *bench_tables =
+    "names = ['zero', 'one', 'two', 'three']\n"
+    "cfg = {}\n"
+    "for (i=0; i<%d; i=i+1) {\n"
+    "    cfg[i] = [i, names[i %% 4], {'id' : i}]\n"
+    "}\n"
+    "describe = function(i) {\n"
+    "    return cfg[i][1]\n"
+    "}\n";
+
+static char *bench_prelude(int nfuncs, int nentries) {
+    size_t cap = (strlen(bench_fragment) + 32) * nfuncs + strlen(bench_tables) + 32;
+    char *prelude = malloc(cap);
+    if (!prelude) {
+        fprintf(stderr, "bench: failed to allocate the prelude\n");
+        exit(1);
+    }
+    char *p = prelude;
+    for (int i=0; i<nfuncs; i++)
+        p += sprintf(p, bench_fragment, i, i);
+    sprintf(p, bench_tables, nentries);
+    return prelude;
+}
+
+static void bench_setup(struct knit *knit, const char *prelude) {
+    knitx_init(knit, KNIT_POLICY_EXIT);
+    knitxr_register_stdlib(knit);
+    knitx_exec_str(knit, prelude);
+}
+
+static double bench_elapsed(clock_t begin) {
+    return (double) (clock() - begin) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[]) {
+    int nfuncs = 2000;
+    int rounds = 20;
+    if (argc > 1)
+        nfuncs = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+    if (nfuncs < 1 || nfuncs > 7000 || rounds < 1) {
+        fprintf(stderr, "usage: bench_clone [NFUNCS (1-7000)] [ROUNDS]\n");
+        return 1;
+    }
+    char *prelude = bench_prelude(nfuncs, 2000);
+    double best_setup = 0, best_clone = 0;
+    struct knit warm;
+    bench_setup(&warm, prelude);
+    for (int r=0; r<rounds; r++) {
+        struct knit knit;
+        clock_t begin = clock();
+        bench_setup(&knit, prelude);
+        double secs = bench_elapsed(begin);
+        knitx_deinit(&knit);
+        if (!r || secs < best_setup)
+            best_setup = secs;
+
+        begin = clock();
+        knitx_clone(&knit, &warm);
+        secs = bench_elapsed(begin);
+        if (!r || secs < best_clone)
+            best_clone = secs;
+        knitx_deinit(&knit);
+    }
+
+    struct knit clone;
+    struct knit_str *before, *after, *source;
+    knitx_clone(&clone, &warm);
+    knitx_exec_str(&clone, "before = describe(5)\ncfg[5][1] = 'changed'\nafter = describe(5)\n");
+    knitx_exec_str(&warm, "source = describe(5)\n");
+    knitx_get_str(&clone, "before", &before);
+    knitx_get_str(&clone, "after", &after);
+    knitx_get_str(&warm, "source", &source);
+    printf("clone: %s -> %s, source: %s\n", before->str, after->str, source->str);
+    printf("%d functions: best of %d, setup %.3f ms, clone %.3f ms (%.1fx)\n",
+           nfuncs, rounds, best_setup * 1e3, best_clone * 1e3, best_setup / best_clone);
+    knitx_deinit(&clone);
+    knitx_deinit(&warm);
+    free(prelude);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "knit.h"
+#include <time.h>
+
+/*
+ * compile throughput benchmark: generates a script of function definitions (which run in next to no time,
+ * so it's mostly the lexer, the parser and the emitter that are measured).
+ * it's loaded with knitx_exec_str(), which leaves the bodies to be compiled when they are first called,
+ * and compiled completely, every body included, like the bytecode writers do.
+ * knitx_exec_str_parallel() compiles it completely too, split on NTHREADS threads (0, the default, is one per core).
+ * times are wall clock times, the parallel one is spent on several cores.
+ * every definition is assigned to the same variable and is one constant of the main block,
+ * which can only index about 16000 of them
+*/
+
+static const char *bench_fragment =
+    "f = function(a, b) {\n"
+    "    t = [a, b, a * b + %d, 'str']\n"
+    "    c = a - b\n"
+    "    d = c * 2 + a\n"
+    "    t.append(d)\n"
+    "    a = len(t)\n"
+    "    if (a < b and b > 0 or a == %d) {\n"
+    "        return t[0] + b * (a - 1)\n"
+    "    }\n"
+    "    else {\n"
+    "        for (i=0; i<b; i=i+1) {\n"
+    "            a = a + g.counter\n"
+    "        }\n"
+    "    }\n"
+    "    return a\n"
+    "}\n";
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *bench_script(int nfuncs, int *nlines) {
+    size_t cap = strlen(bench_fragment) + 64;
+    char *script = malloc(cap * nfuncs + 1);
+    if (!script) {
+        fprintf(stderr, "bench: failed to allocate the script\n");
+        exit(1);
+    }
+    char *p = script;
+    for (int i=0; i<nfuncs; i++)
+        p += sprintf(p, bench_fragment, i, i);
+    *p = '\0';
+    *nlines = 0;
+    for (p=script; *p; p++)
+        *nlines += *p == '\n';
+    return script;
+}
+
+int main(int argc, char *argv[]) {
+    int nfuncs = 8000;
+    int rounds = 5;
+    int nthreads = 0;
+    if (argc > 1)
+        nfuncs = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+    if (argc > 3)
+        nthreads = atoi(argv[3]);
+    if (nfuncs < 1 || nfuncs > 15000 || rounds < 1 || nthreads < 0) {
+        fprintf(stderr, "usage: bench_compile [NFUNCS (1-15000)] [ROUNDS] [NTHREADS]\n");
+        return 1;
+    }
+    int nlines;
+    char *script = bench_script(nfuncs, &nlines);
+    size_t len = strlen(script);
+    double best_load = 0, best = 0, best_parallel = 0;
+    for (int r=0; r<rounds; r++) {
+        struct knit knit;
+        knitx_init(&knit, KNIT_POLICY_EXIT);
+        double begin = bench_now();
+        knitx_exec_str(&knit, script);
+        double secs = bench_now() - begin;
+        knitx_deinit(&knit);
+        if (!r || secs < best_load)
+            best_load = secs;
+
+        struct knit_prs prs;
+        knitx_init(&knit, KNIT_POLICY_EXIT);
+        begin = bench_now();
+        knitx_compile_str(&knit, &prs, script);
+        knitx_block_compile_all(&knit, &prs.curblk->block);
+        secs = bench_now() - begin;
+        knitx_lexer_deinit(&knit, &prs.lex);
+        knitx_prs_deinit(&knit, &prs);
+        knitx_deinit(&knit);
+        if (!r || secs < best)
+            best = secs;
+
+        knitx_init(&knit, KNIT_POLICY_EXIT);
+        begin = bench_now();
+        knitx_exec_str_parallel(&knit, script, nthreads);
+        secs = bench_now() - begin;
+        knitx_deinit(&knit);
+        if (!r || secs < best_parallel)
+            best_parallel = secs;
+    }
+    printf("%d lines, %.2f MB: best of %d\n", nlines, len / 1e6, rounds);
+    printf("load    %.3f s, %.0f lines/s, %.2f MB/s\n", best_load, nlines / best_load, len / 1e6 / best_load);
+    printf("compile %.3f s, %.0f lines/s, %.2f MB/s\n", best, nlines / best, len / 1e6 / best);
+    printf("threads %.3f s, %.0f lines/s, %.2f MB/s (%d threads)\n", best_parallel, nlines / best_parallel, len / 1e6 / best_parallel,
+           nthreads ? nthreads : knit_parallel_ncores());
+    free(script);
+    return 0;
+}
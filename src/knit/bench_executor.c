@@ -0,0 +1,106 @@
+#include "knit.h"
+#include <time.h>
+
+/*
+ * executor throughput benchmark: NJOBS calls of a prelude function that loops ITERATIONS times,
+ * submitted all at once to executors of 1, 2, 4, ... up to MAXTHREADS workers (0, the default, is one per core).
+ * jobs don't share anything, so the throughput should grow with the workers until they run out of cores.
+ * every job's result is checked. times are wall clock times
+*/
+
+static const char *bench_prelude =
+    "work = function(n, seed) {\n"
+    "    acc = seed\n"
+    "    for (i=0; i<n; i=i+1) {\n"
+    "        acc = (acc * 7 + i) % 1000003\n"
+    "    }\n"
+    "    return acc\n"
+    "}\n";
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_expected(int n, int seed) {
+    int acc = seed;
+    for (int i=0; i<n; i++)
+        acc = (acc * 7 + i) % 1000003;
+    return acc;
+}
+
+//returns the wall time to run every job
+static double bench_run(const struct knit_program *prelude, int nthreads, int njobs, int iterations) {
+    struct knit_executor ex;
+    struct knit_job *jobs = calloc(njobs, sizeof jobs[0]);
+    struct knit_value *args = calloc(njobs * 2, sizeof args[0]);
+    if (!jobs || !args) {
+        fprintf(stderr, "bench: failed to allocate the jobs\n");
+        exit(1);
+    }
+    if (knitx_executor_init(&ex, nthreads, prelude, njobs) != KNIT_OK) {
+        fprintf(stderr, "bench: failed to start the executor\n");
+        exit(1);
+    }
+    for (int i=0; i<njobs; i++) {
+        args[i * 2]     = (struct knit_value) {.ktype = KNIT_INT, .integer = iterations};
+        args[i * 2 + 1] = (struct knit_value) {.ktype = KNIT_INT, .integer = i};
+        jobs[i] = (struct knit_job) {.func = "work", .args = &args[i * 2], .nargs = 2};
+    }
+    double begin = bench_now();
+    for (int i=0; i<njobs; i++)
+        knitx_executor_submit(&ex, &jobs[i]);
+    for (int i=0; i<njobs; i++)
+        knitx_job_wait(&ex, &jobs[i]);
+    double secs = bench_now() - begin;
+    for (int i=0; i<njobs; i++) {
+        if (jobs[i].rv != KNIT_OK || jobs[i].result.integer != bench_expected(iterations, i)) {
+            fprintf(stderr, "bench: job %d failed: %s\n", i, jobs[i].err_msg ? jobs[i].err_msg : "wrong result");
+            exit(1);
+        }
+        knitx_job_deinit(&jobs[i]);
+    }
+    knitx_executor_deinit(&ex);
+    free(args);
+    free(jobs);
+    return secs;
+}
+
+int main(int argc, char *argv[]) {
+    int njobs = 2000;
+    int iterations = 2000;
+    int maxthreads = 0;
+    if (argc > 1)
+        njobs = atoi(argv[1]);
+    if (argc > 2)
+        iterations = atoi(argv[2]);
+    if (argc > 3)
+        maxthreads = atoi(argv[3]);
+    if (njobs < 1 || iterations < 0 || maxthreads < 0) {
+        fprintf(stderr, "usage: bench_executor [NJOBS] [ITERATIONS] [MAXTHREADS]\n");
+        return 1;
+    }
+    if (!maxthreads)
+        maxthreads = knit_parallel_ncores();
+    struct knit knit;
+    struct knit_program *prelude;
+    knitx_init(&knit, KNIT_POLICY_EXIT);
+    knitx_program_compile(&knit, bench_prelude, &prelude);
+
+    double base = 0;
+    for (int nthreads = 1; ; nthreads *= 2) {
+        if (nthreads > maxthreads)
+            nthreads = maxthreads;
+        double secs = bench_run(prelude, nthreads, njobs, iterations);
+        if (nthreads == 1)
+            base = secs;
+        printf("%3d workers: %d jobs in %.3f ms, %.0f jobs/s, %.2fx\n",
+               nthreads, njobs, secs * 1e3, njobs / secs, base / secs);
+        if (nthreads == maxthreads)
+            break;
+    }
+    knitx_program_free(prelude);
+    knitx_deinit(&knit);
+    return 0;
+}
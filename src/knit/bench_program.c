@@ -0,0 +1,133 @@
+#include "knit.h"
+#include <time.h>
+
+/*
+ * shared program benchmark: NTHREADS instances, each on a thread of its own, run the same script.
+ * first each one compiles it with knitx_exec_str() (function bodies on their first call),
+ * then the script is compiled once with knitx_program_compile() and every instance runs it with knitx_exec_program().
+ * the script defines functions and calls a few of them in a loop, each instance prints the sum it computed.
+ * times are wall clock times
+*/
+
+static const char *bench_fragment =
+    "f%d = function(a, b) {\n"
+    "    t = [a, b, a * b + %d, 'str']\n"
+    "    if (a < b) {\n"
+    "        return t[0] + b\n"
+    "    }\n"
+    "    return len(t)\n"
+    "}\n";
+
+static const char *bench_main =
+    "sum = 0\n"
+    "for (i=0; i<%d; i=i+1) {\n"
+    "    sum = sum + f0(i, 7) + f1(3, i)\n"
+    "}\n";
+
+struct bench_thread {
+    pthread_t thread;
+    const char *script;
+    const struct knit_program *prog;
+    int sum;
+};
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *bench_script(int nfuncs, int iterations) {
+    size_t cap = (strlen(bench_fragment) + 32) * nfuncs + strlen(bench_main) + 32;
+    char *script = malloc(cap);
+    if (!script) {
+        fprintf(stderr, "bench: failed to allocate the script\n");
+        exit(1);
+    }
+    char *p = script;
+    for (int i=0; i<nfuncs; i++)
+        p += sprintf(p, bench_fragment, i, i);
+    sprintf(p, bench_main, iterations);
+    return script;
+}
+
+static void *bench_run(void *arg) {
+    struct bench_thread *t = arg;
+    struct knit knit;
+    struct knit_obj *sum = NULL;
+    knitx_init(&knit, KNIT_POLICY_EXIT);
+    knitxr_register_stdlib(&knit);
+    if (t->prog)
+        knitx_exec_program(&knit, t->prog);
+    else
+        knitx_exec_str(&knit, t->script);
+    knitx_getvar_(&knit, "sum", &sum);
+    t->sum = sum->u.integer.value;
+    knitx_deinit(&knit);
+    return NULL;
+}
+
+//runs every thread at once, returns the wall time
+static double bench_threads(struct bench_thread *threads, int nthreads) {
+    double begin = bench_now();
+    for (int i=0; i<nthreads; i++) {
+        if (pthread_create(&threads[i].thread, NULL, bench_run, &threads[i]) != 0) {
+            fprintf(stderr, "bench: failed to start a thread\n");
+            exit(1);
+        }
+    }
+    for (int i=0; i<nthreads; i++)
+        pthread_join(threads[i].thread, NULL);
+    return bench_now() - begin;
+}
+
+int main(int argc, char *argv[]) {
+    int nfuncs = 2000;
+    int nthreads = 4;
+    int iterations = 20000;
+    if (argc > 1)
+        nfuncs = atoi(argv[1]);
+    if (argc > 2)
+        nthreads = atoi(argv[2]);
+    if (argc > 3)
+        iterations = atoi(argv[3]);
+    if (nfuncs < 2 || nfuncs > 7000 || nthreads < 1 || nthreads > 256 || iterations < 0) {
+        fprintf(stderr, "usage: bench_program [NFUNCS (2-7000)] [NTHREADS (1-256)] [ITERATIONS]\n");
+        return 1;
+    }
+    char *script = bench_script(nfuncs, iterations);
+    struct bench_thread *threads = calloc(nthreads, sizeof threads[0]);
+    if (!threads) {
+        fprintf(stderr, "bench: failed to allocate the threads\n");
+        return 1;
+    }
+    for (int i=0; i<nthreads; i++)
+        threads[i].script = script;
+    double each = bench_threads(threads, nthreads);
+    int sum = threads[0].sum;
+
+    struct knit knit;
+    struct knit_program *prog;
+    knitx_init(&knit, KNIT_POLICY_EXIT);
+    double begin = bench_now();
+    knitx_program_compile(&knit, script, &prog);
+    double compile = bench_now() - begin;
+    for (int i=0; i<nthreads; i++)
+        threads[i].prog = prog;
+    double shared = bench_threads(threads, nthreads);
+    for (int i=0; i<nthreads; i++) {
+        if (threads[i].sum != sum) {
+            fprintf(stderr, "bench: instance %d got %d instead of %d\n", i, threads[i].sum, sum);
+            return 1;
+        }
+    }
+
+    printf("sum: %d in each instance\n", sum);
+    printf("%d functions, %d instances: each compiling %.3f ms, shared program %.3f ms (compiled once in %.3f ms)\n",
+           nfuncs, nthreads, each * 1e3, shared * 1e3, compile * 1e3);
+    knitx_program_free(prog);
+    knitx_deinit(&knit);
+    free(threads);
+    free(script);
+    return 0;
+}
@@ -11,10 +11,21 @@
 
 typedef _DELEM_TYPE_ darr_elem_type;
 
+#ifndef DYN_ALLOCATOR_DEFINED
+#define DYN_ALLOCATOR_DEFINED
+/*shared by every generated type, a NULL allocator means realloc()/free()*/
+struct dyn_allocator {
+    void *(*realloc)(void *ud, void *p, size_t sz);
+    void (*free)(void *ud, void *p);
+    void *ud;
+};
+#endif
+
 struct darr {
     darr_elem_type *data;
     int len;
     int cap;
+    const struct dyn_allocator *allocator;
 };
 enum DARR_DEF {
     DARR_OK,
@@ -30,7 +41,11 @@ static int darr_set_cap(struct darr *darr, int cap) {
         return darr_deinit(darr);
     }
     darr_assert(cap > 0, "invalid capacity requested");
-    void *new_mem = realloc(darr->data, cap * sizeof(darr_elem_type));
+    void *new_mem;
+    if (darr->allocator)
+        new_mem = darr->allocator->realloc(darr->allocator->ud, darr->data, cap * sizeof(darr_elem_type));
+    else
+        new_mem = realloc(darr->data, cap * sizeof(darr_elem_type));
     if (!new_mem) {
         return DARR_NOMEM;
     }
@@ -38,14 +53,21 @@ static int darr_set_cap(struct darr *darr, int cap) {
     darr->cap = cap;
     return DARR_OK;
 }
-static int darr_init(struct darr *darr, int cap) {
+static int darr_init_with_allocator(struct darr *darr, int cap, const struct dyn_allocator *allocator) {
     darr->data = NULL;
     darr->len = 0;
     darr->cap = 0;
+    darr->allocator = allocator;
     return darr_set_cap(darr, cap);
 }
+static int darr_init(struct darr *darr, int cap) {
+    return darr_init_with_allocator(darr, cap, NULL);
+}
 static int darr_deinit(struct darr *darr) {
-    free(darr->data);
+    if (darr->allocator)
+        darr->allocator->free(darr->allocator->ud, darr->data);
+    else
+        free(darr->data);
     darr->data = NULL;
     darr->len = 0;
     darr->cap = 0;
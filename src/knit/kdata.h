@@ -25,12 +25,23 @@ struct knit_list {
     KNIT_OBJ_HEAD;
     struct knit_obj **items;
     int len;
-    int cap;
+    int cap; //negative for a frozen list, items aren't owned by any instance (see knit_frozen.h)
 };
 
 
 #include "../jadwal/third_party/strhash/superfasthash.h" //in jadwal dirs
 
+//jadwal's tables come from the instance allocator, see knit_jadwal_alloc.h
+#include <stdlib.h>
+static void *knit_jadwal_malloc(size_t sz);
+static void *knit_jadwal_calloc(size_t n, size_t sz);
+static void *knit_jadwal_realloc(void *p, size_t sz);
+static void knit_jadwal_free(void *p);
+#define malloc(sz) knit_jadwal_malloc(sz)
+#define calloc(n, sz) knit_jadwal_calloc(n, sz)
+#define realloc(p, sz) knit_jadwal_realloc(p, sz)
+#define free(p) knit_jadwal_free(p)
+
 /*hashtable defs*/
     typedef struct knit_str    knit_vars_jadwal_key_type;   //internal notes: there is no indirection, init/deinit must be used on pair objects
 
@@ -49,10 +60,14 @@ struct knit_list {
 /*end of hashtable defs*/
 #define KOBJ_JADWAL_DATA_ARG
 #include "kobj_jadwal.h"  //autogenerated jadwal.h and prefixed by kobj_
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
 
 struct knit_dict {
     KNIT_OBJ_HEAD;
-    struct kobj_jadwal ht;
+    struct kobj_jadwal ht; //a frozen dict's userdata is NULL (see knit_frozen.h)
 };
 struct knit_int {
     KNIT_OBJ_HEAD;
@@ -71,12 +86,27 @@ struct knit_insn {
 };
 
 #include "insns_darray.h"
+//the instructions from ip on were emitted for a statement at lineno
+struct knit_line {
+    int ip;
+    int lineno;
+};
+#include "knit_lines_darray.h"
 struct knit_block { 
     //this can't contain self references, there is code that assumes it is memcopyable
     int nlocals;
     int nargs;
+    int gc_epoch; //the last heap compaction that patched the constants
+    int shared; //a knit_program's, its constants aren't in any heap and it's never written (see knit_program.h)
+    int lineno; //where the function is defined, 0 for file scope
+    int module; //the id of the module it was compiled for, 0 if it isn't a module's (see knit_module.h)
     struct insns_darray insns;
     struct knit_objp_darray constants;
+    struct knit_lines_darray lines; //an entry each time the line changes, sorted by ip
+    int generator; //it has a yield, calling it makes a generator (see knit_generator.h)
+    const char *src; //a function's source until its body is compiled on the first call (see knitx_kfunc_compile()), NULL after.
+                     //not null terminated, it points into the script if it was mapped
+    int srclen;
 };
 
 typedef int (*knit_func_type)(struct knit *);
@@ -86,7 +116,12 @@ struct knit_cfunc {
 };
 struct knit_kfunc {
     int ktype;
-    struct knit_block block;
+    struct knit_block *block; //out of line, to keep knit_obj small
+};
+struct knit_gen; //fwd
+struct knit_generator {
+    int ktype;
+    struct knit_gen *gen; //out of line too, the object moves but its frames and values don't
 };
 
 //this is used to store true, false, and null
@@ -101,9 +136,10 @@ struct knit_obj {
         struct knit_str str;
         struct knit_int integer;
         struct knit_cfunc cfunc;
-        struct knit_kfunc kfunc; //huge?
+        struct knit_kfunc kfunc;
         struct knit_bvalue bval; 
         struct knit_dict dict;
+        struct knit_generator generator;
     } u;
 };
 
@@ -124,6 +160,7 @@ enum KNIT_RV {
     //informational internal rvs (not errors)
     KNIT_CREATED_NEW = -2,
     KNIT_RETRIEVED   = -3,
+    KNIT_SUSPENDED   = -4, //a budgeted execution ran out of instructions, see knitx_exec_budget()
 };
 enum KNIT_TYPE {
     KNIT_NULL = 0xd6,
@@ -135,6 +172,8 @@ enum KNIT_TYPE {
     KNIT_KFUNC,
     KNIT_TRUE,
     KNIT_FALSE,
+    KNIT_CHANNEL, //never in a heap, see knit_channel.h
+    KNIT_GENERATOR,
 };
 enum KNIT_OPT {
     KNIT_POLICY_EXIT = 1, //default
@@ -178,24 +217,65 @@ struct knit_stack {
     struct knit_frame_darray frames; //contains information about function calls and IPs
     struct knit_objp_darray vals;    //contains the objects (ints, strs, lists ...) pushed on stack
 };
+enum KNIT_GEN_STATE {
+    KNIT_GEN_SUSPENDED, //not started, or stopped at a yield
+    KNIT_GEN_RUNNING,
+    KNIT_GEN_DONE,      //it returned or failed, its stack is empty
+};
+//see knit_generator.h
+struct knit_gen {
+    struct knit_stack stack; //its own frames and values while it's suspended, those of whoever resumed it while it runs
+    int state; //enum KNIT_GEN_STATE
+    struct knit_gen *prev, *next; //every generator of the instance, the gc finds values on their stacks like on the value stack
+};
 #include "knit_bitset_data.h"
 /*
-Currently the heap size cannot change once objects are allocated
-this can be implemented in the following ways:
-    1- being able to track and patch all pointers to a newly allocated heap
-        not very difficult to implement
-    2- maintaining multiple heaps
-        makes things complicated, makes tracing slower
-    3- not keeping pointers to gc objects, only offsets
+The heap size can only change during compaction (knit_gc_compact()), which moves objects and patches all pointers to them
 */
-struct knit_heap {
-    struct knit_bitset alloc_bitset; //whether a block is free or not
+//heap cells are segregated by size, an object's class is decided by its type at allocation time
+enum KNIT_HEAP_CLASS {
+    KNIT_HEAP_SMALL,  //ints
+    KNIT_HEAP_MEDIUM, //string and list headers
+    KNIT_HEAP_LARGE,  //dicts and everything else
+    KNIT_HEAP_NCLASSES,
+};
+
+struct knit_heap_class {
+    struct knit_bitset alloc_bitset; //whether a cell is free or not
     struct knit_bitset mark_bitset;  //cleared at each gc cycle
-    struct knit_obj *objects;
+    char *cells;
+    int cell_size;
+    int has_refs; //whether objects of this class can reference other objects, the tracer doesn't look inside cells otherwise
+    int *free_list; //stack of free cell indices, the lowest index is on top
+    int free_len;
+    int *refcounts; //deferred reference counts, references from the value stack are not counted
+    struct knit_bitset zct_bitset; //whether a cell is in the zero count table
+    struct knit_bitset remembered_bitset; //whether a cell is in the request arena's remembered set
     int count;
     int capacity;
+    int min_capacity; //compaction doesn't shrink the class below its initial size
+};
+
+//see knit_gc.h, arena cells are bumped from 0 to count and never freed one by one
+//alloc_bitset marks evacuated cells and free_list maps them to their heap index while evacuating
+struct knit_heap_arena {
+    struct knit_heap_class classes[KNIT_HEAP_NCLASSES];
+    int enabled; //the classes are allocated
+    int active;  //new objects come from the arena
+    int full;    //an object went to the heap because its arena class was full, the arena is reset at the next safe point
+    struct knit_objp_darray remembered; //heap lists and dicts that were given references to arena objects
+    int overflowed; //remembered couldn't grow, every heap object is scanned when evacuating
+};
+
+struct knit_heap {
+    struct knit_heap_class classes[KNIT_HEAP_NCLASSES];
+    int count; //live objects in all classes
+    int epoch; //incremented by each compaction
+    struct knit_objp_darray zct; //zero count table, objects that may be garbage unless they are on the value stack
+    struct knit_heap_arena arena;
 };
 
+struct knit_module_ref; //fwd, see knit_module.h
 struct knit_exec_state {
     struct knit_vars_jadwal global_ht;
     struct knit_stack stack;
@@ -203,7 +283,14 @@ struct knit_exec_state {
     int nresults; //the number of results returned by the last executed KRET statement
     int last_cond;
     struct knit_heap heap;
+    struct knit_objp_darray modules; //the globals of each module it imported by module id, NULL for the others (see knitxr_import())
+    struct knit_module_ref *imports; //the module cache entries it holds (see knit_module.h)
+    struct knit_gen *gens; //a list of the instance's generators
+    struct knit_objp_darray outside; //objects outside the heap the instance made (constants, functions), knitx_deinit() frees them
+    int64_t budget; //instructions left before a budgeted execution suspends, KNIT_BUDGET_NONE when none is running
+    int budget_depth; //the frame depth a budgeted execution started at, 0 when there's none (see knitx_exec_budget())
 };
+#define KNIT_BUDGET_NONE INT64_MAX
 
 struct knit_tok {
     int toktype;
@@ -215,17 +302,39 @@ struct knit_tok {
         int integer;
     } data;
 };
-#include "tok_darray.h"      //autogenerated darray.h and prefixed by tok_
 
 #include "knit_mem_stats_data.h"
+#include "knit_gc_stats_data.h"
+#include "knit_alloc_sample_data.h"
+#include "knit_arena_data.h"
+
+//all memory of a knit instance comes from its allocator, see knitx_init_with_allocator()
+struct knit_allocator {
+    void *(*alloc)(void *ud, size_t sz);
+    void *(*realloc)(void *ud, void *p, size_t sz); //p can be NULL
+    void (*free)(void *ud, void *p); //p can be NULL
+    void *ud;
+};
+
+//a file objects were loaded from, they use it in place (see knit_mapped.h)
+struct knit_mapped_file {
+    void *addr;
+    size_t len;
+    struct knit_mapped_file *next;
+};
 
 struct knit {
     struct knit_exec_state ex;
+    struct knit_allocator allocator;
+    struct dyn_allocator container_allocator; //the same functions, for darrays and bitsets
 
     char *err_msg;
     unsigned char is_err_msg_owned;
     int err;
     int err_policy;
+    struct knit_gc_stats gc_stats; //collected in every build, unlike mstats
+    struct knit_alloc_sampler alloc_sampler; //off unless started with knitx_alloc_sampling()
+    struct knit_mapped_file *mapped; //images and bytecode files, unmapped by knitx_deinit()
 #ifdef KNIT_MEM_STATS
     struct knit_mem_stats mstats;
 #endif
@@ -245,6 +354,7 @@ enum KNIT_TOKEN {
     KAT_ELSE,  
     KAT_FOR,   
     KAT_WHILE, 
+    KAT_YIELD, 
 
     KAT_LAND, //'and' keyword
     KAT_LOR,  //'or'  keyword
@@ -338,7 +448,9 @@ enum KSTMT {
     //not a statement type, but an option that can be passed to functions
     KLEAVE_SEMICOLON = 128,
 
-    KSTMT_ALL = KSTMT_ASSIGN | KSTMT_FOR | KSTMT_WHILE | KSTMT_RETURN | KSTMT_IF | KSTMT_EXPR,
+    KSTMT_YIELD    = 256,
+
+    KSTMT_ALL = KSTMT_ASSIGN | KSTMT_FOR | KSTMT_WHILE | KSTMT_RETURN | KSTMT_IF | KSTMT_EXPR | KSTMT_YIELD,
 };
 
 struct knit_stmt; //fwd
@@ -346,6 +458,7 @@ struct knit_stmt; //fwd
 
 struct knit_stmt {
     int stmttype; //enum KSTMT
+    int lineno;
     union {
         struct knit_expr *_expr;
         struct {
@@ -376,6 +489,7 @@ struct knit_stmt {
      * KSTMT_FOR: _for
      * KSTMT_WHILE: _while
      * KSTMT_RETURN: _expr (CAN BE NULL)
+     * KSTMT_YIELD: _expr
      * KSTMT_IF: _if
      * KSTMT_EXPR: _expr
      * KSTMT_SBLOCK: _sblock
@@ -574,9 +688,11 @@ enum KNIT_INSN {
     KMUL,  /*s[t-2] = s[t-2] * s[t-1]; pop 1;*/
     KDIV,  /*s[t-2] = s[t-2] / s[t-1]; pop 1;*/
     KMOD,  /*s[t-2] = s[t-2] % s[t-1]; pop 1;*/
+
+    KYIELD, /*inputs: (none)  op: suspends the generator, s[t-1] is the value next() returns*/
 };
 #define KINSN_FIRST KPUSH
-#define KINSN_LAST  KMOD
+#define KINSN_LAST  KYIELD
 #define KINSN_TVALID(type)  ((type) >= KINSN_FIRST && (type) <= KINSN_LAST)
 
 //Order is tied to enum
@@ -625,22 +741,26 @@ static struct knit_insninfo {
     {KMUL,  "KMUL",   0},
     {KDIV,  "KDIV",   0},
     {KMOD,  "KMOD",   0},
+    {KYIELD, "KYIELD", 0},
     {0, NULL, 0},
 };
-/* the lexer state, currently this saves all tokens, which is not ideal for performance
- * also this isn't aware of files, and doesn't support inclusion
+/* the lexer state, tokens are lexed when the parser asks for them and only the last few are kept,
+ * so the memory it uses doesn't depend on the size of the input
+ * this isn't aware of files, and doesn't support inclusion
  * */
+#define KNIT_LEX_WINDOW 8 //a power of 2. the parser looks one token ahead, a token stays valid for a few skips after it's current
 struct knit_lex {
     struct knit_str *filename;
     struct knit_str *input;
     int lineno;
     int colno;
     int offset;
-    int tokno; //refers to an index in .tokens
+    int tokno; //the current token, counted from the start of the input (see knitx_lexer_tok())
+    int ntokens; //tokens lexed so far
 
     int pbcd; //parent/bracket/curly bracket depth
 
-    struct tok_darray tokens;
+    struct knit_tok window[KNIT_LEX_WINDOW]; //a ring of the last tokens lexed
 };
 
 //describes where a variable is defined in varname
@@ -674,6 +794,10 @@ struct knit_curblk {
 struct knit_prs {
     struct knit_lex lex; //fwd
     struct knit_curblk *curblk;
+    int lineno; //line of the statement being emitted
+    struct knit_arena arena; //expressions, statements and their darrays, reset after each top level statement
+    struct dyn_allocator arena_allocator; //for darrays in the arena
+    int compile_body; //the next function's body is compiled instead of skipped, used by knitx_kfunc_compile()
 };
 
 
@@ -693,7 +817,16 @@ struct knit_builtins {
         struct knit_cfunc substr;
         struct knit_cfunc input;
         struct knit_cfunc gcwalk;
+        struct knit_cfunc gccompact;
         struct knit_cfunc meminfo;
+        struct knit_cfunc gcstats;
+        struct knit_cfunc import;
+        struct knit_cfunc send;
+        struct knit_cfunc recv;
+        struct knit_cfunc trysend;
+        struct knit_cfunc tryrecv;
+        struct knit_cfunc next;
+        struct knit_cfunc done;
     } funcs; //global functions
 };
 
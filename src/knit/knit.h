@@ -10,13 +10,17 @@
 
 #include "kdata.h" //data structures
 #include "knit_util.h" 
+#include "knit_jadwal_alloc.h"
+#include "knit_gc_stats.h" 
 #include "knit_gc.h" 
 #include "knit_bitset.h" 
 #include "knit_mem_stats.h"
+#include "knit_arena.h"
+#include "knit_scan.h"
 
 /*
-  ARC macros, currently not used in a meaningful way,
-  in the future ARC might be used as an alternative to garbage collection
+  reference counting macros, only references from heap objects, globals and block constants are counted
+  (deferred reference counting, see knit_gc.h), references from the value stack are not
 */
 #define kincref(p) knitx_obj_incref(knit, (struct knit_obj *)(p))
 #define kdecref(p) knitx_obj_decref(knit, (struct knit_obj *)(p))
@@ -34,11 +38,14 @@ static int knit_error(struct knit *knit, int err_type, const char *fmt, ...);
 static int knitx_emit_expr_eval(struct knit *knit, struct knit_prs *prs, struct knit_expr *expr, int eval_ctx, int nexpected); //fwd
 static int knitx_emit_ret(struct knit *knit, struct knit_prs *prs, int count);
 static int knitx_expr(struct knit *knit, struct knit_prs *prs);
-static int knitx_expr_destroy(struct knit *knit, struct knit_prs *prs, struct knit_expr *prs_expr);
 static int knitx_int_new(struct knit *knit, struct knit_int **integerp_out, int value);
 static int knitx_int_new_gcobj(struct knit *knit, struct knit_int **integerp_out, int value);
 static int knitx_lexer_deinit(struct knit *knit, struct knit_lex *lxr);
 static int knitx_lexer_init_str(struct knit *knit, struct knit_lex *lxr, const char *program);
+static int knitx_lexer_init_buf(struct knit *knit, struct knit_lex *lxr, const char *program, int len);
+static int knitx_init_with_allocator(struct knit *knit, int opts, const struct knit_allocator *allocator);
+static int knitx_deinit(struct knit *knit);
+static int knit_mapped_contains(struct knit *knit, const void *p);
 static int knitx_lexer_peek_cur(struct knit *knit, struct knit_lex *lxr, struct knit_tok **tokp);
 static int knitx_lexer_peek_la(struct knit *knit, struct knit_lex *lxr, struct knit_tok **tokp);
 static int knitx_obj_dump(struct knit *knit, struct knit_obj *obj);
@@ -158,9 +165,13 @@ static struct knit_list *knit_as_list(struct knit_obj *obj) {
 }
 
 static void knitx_obj_incref(struct knit *knit, struct knit_obj *obj) {
+    if (obj)
+        knit_gc_incref(knit, obj);
 }
 
 static void knitx_obj_decref(struct knit *knit, struct knit_obj *obj) {
+    if (obj)
+        knit_gc_decref(knit, obj);
 }
 
 
@@ -239,7 +250,7 @@ static int knitx_list_deinit(struct knit *knit, struct knit_list *list) {
 static int knitx_list_new_gcobj(struct knit *knit, struct knit_list **list, int isz) {
     int rv = KNIT_OK;
     void *p;
-    p = knit_gc_new_object(knit);
+    p = knit_gc_new_object(knit, KNIT_LIST);
     if (!p) {
         *list = p;
         return KNIT_GC_NOMEM;
@@ -274,19 +285,26 @@ static int knitx_list_resize(struct knit *knit, struct knit_list *list, int new_
 
 static int knitx_list_push(struct knit *knit, struct knit_list *list, struct knit_obj *obj) {
     int rv = KNIT_OK;
+    if (list->cap < 0)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "trying to change a frozen list");
     if (list->len >= list->cap) {
         rv = knitx_list_resize(knit, list, list->cap == 0 ? 8 : list->cap * 2); 
         if (rv != KNIT_OK)
             return rv;
     }
+    kincref(obj);
+    knit_gc_write_barrier(knit, ktobj(list), obj);
     list->items[list->len++] = obj;
     return KNIT_OK;
 }
 
 static int knitx_list_pop(struct knit *knit, struct knit_list *list) {
+    if (list->cap < 0)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "trying to change a frozen list");
     if (list->len <= 0) {
         return knit_error(knit, KNIT_OUT_OF_RANGE_ERR, "knitx_list_pop(): trying to pop from an empty list");
     }
+    kdecref(list->items[list->len - 1]);
     list->len--;
     return KNIT_OK;
 }
@@ -295,6 +313,7 @@ static int knitx_dict_init(struct knit *knit, struct knit_dict *dict, int isz) {
     int rv = KNIT_OK;
     if (isz < 0)
         isz = 0;
+    knit_jadwal_use(&knit->allocator);
     rv = kobj_jadwal_init_with_udata(&dict->ht, isz, knit);
 
     if (rv != KOBJ_JADWAL_OK) {
@@ -312,7 +331,7 @@ static int knitx_dict_deinit(struct knit *knit, struct knit_dict *dict) {
 
 static int knitx_dict_new_gcobj(struct knit *knit, struct knit_dict **dict, int isz) {
     int rv = KNIT_OK;
-    void *p = knit_gc_new_object(knit);
+    void *p = knit_gc_new_object(knit, KNIT_DICT);
     if (!p) {
         *dict = p;
         return KNIT_GC_NOMEM;
@@ -335,7 +354,15 @@ static int knitx_dict_destroy(struct knit *knit, struct knit_dict *dict) {
 
 static int knitx_dict_lookup(struct knit *knit, struct knit_dict *dict, struct knit_obj *key, struct knit_obj **value_out) {
     struct kobj_jadwal_iter iter;
-    int rv = kobj_jadwal_find(&dict->ht, &key, &iter);
+    struct kobj_jadwal *ht = &dict->ht;
+    struct kobj_jadwal bound;
+    if (!ht->userdata) {
+        //frozen, the keys are hashed and compared by the instance looking them up
+        bound = *ht;
+        bound.userdata = knit;
+        ht = &bound;
+    }
+    int rv = kobj_jadwal_find(ht, &key, &iter);
 #ifdef KNIT_CHECKS
     *value_out = NULL;
 #endif
@@ -351,9 +378,13 @@ static int knitx_dict_lookup(struct knit *knit, struct knit_dict *dict, struct k
 
 static int knitx_dict_set(struct knit *knit, struct knit_dict *dict, struct knit_obj *key, struct knit_obj *value) {
     struct kobj_jadwal_iter iter;
+    if (knit_obj_is_frozen(ktobj(dict)))
+        return knit_error(knit, KNIT_RUNTIME_ERR, "trying to change a frozen dict");
     int rv = kobj_jadwal_find(&dict->ht, &key, &iter);
     if (rv == KOBJ_JADWAL_OK) {
-        //todo destroy previous value 
+        kincref(value);
+        kdecref(iter.pair->value);
+        knit_gc_write_barrier(knit, ktobj(dict), value);
         iter.pair->value = value;
     }
     else if (rv == KOBJ_JADWAL_NOT_FOUND) {
@@ -361,7 +392,14 @@ static int knitx_dict_set(struct knit *knit, struct knit_dict *dict, struct knit
         rv = knitx_obj_copy(knit, &new_key, key); 
         if (rv != KNIT_OK)
             return rv;
+        knit_jadwal_use(&knit->allocator);
         rv = kobj_jadwal_insert(&dict->ht, &new_key, &value);
+        if (rv == KOBJ_JADWAL_OK) {
+            kincref(new_key);
+            kincref(value);
+            knit_gc_write_barrier(knit, ktobj(dict), new_key);
+            knit_gc_write_barrier(knit, ktobj(dict), value);
+        }
     }
     else {
         return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_dict_set(): assignment failed");
@@ -380,7 +418,7 @@ static int knitx_int_deinit(struct knit *knit, struct knit_int *integer) {
 }
 
 static int knitx_int_new_gcobj(struct knit *knit, struct knit_int **integerp_out, int value) {
-    void *p = knit_gc_new_object(knit);
+    void *p = knit_gc_new_object(knit, KNIT_INT);
     if (!p) {
         return KNIT_GC_NOMEM;
     }
@@ -440,7 +478,7 @@ static int knitx_str_new(struct knit *knit, struct knit_str **strp) {
 }
 
 static int knitx_str_new_gcobj(struct knit *knit, struct knit_str **strp) {
-    void *p = knit_gc_new_object(knit);
+    void *p = knit_gc_new_object(knit, KNIT_STR);
     if (!p) {
         *strp = NULL;
         return KNIT_GC_NOMEM;
@@ -810,9 +848,8 @@ static void knit_error_act(struct knit *knit, int err_type) {
             fprintf(stderr, "an unknown error occured (no err msg)\n");
         exit(1);
     }
-    else {
-        knit_fatal("other error handling policies are not implemented");
-    }
+    //KNIT_POLICY_CONTINUE: the error stays in knit->err and knit->err_msg, it's returned up to the caller.
+    //the stack is left as it was, an instance isn't usable after an error in an execution (see knit_executor.h)
 }
 
 static int knit_error(struct knit *knit, int err_type, const char *fmt, ...) {
@@ -832,6 +869,7 @@ static int knit_error(struct knit *knit, int err_type, const char *fmt, ...) {
     if (rv == KNIT_OK) {
         knit_assert_h(!!tmp.str, "");
         rv = knitx_rstrdup(knit, tmp.str, &knit->err_msg);
+        knit->is_err_msg_owned = rv == KNIT_OK;
     }
     knitx_str_deinit(knit, &tmp);
     knit_error_act(knit, err_type);
@@ -857,11 +895,13 @@ static int knitx_set_str(struct knit *knit, const char *key, const char *value)
     //ownership of key is transferred to the vars hashtable
     struct knit_obj *objp = (struct knit_obj *) val_strp; //defined operation?
     struct knit_exec_state *exs = &knit->ex;
+    knit_jadwal_use(&knit->allocator);
     rv = knit_vars_jadwal_insert(&exs->global_ht, &key_str, &objp);
     if (rv != KNIT_VARS_JADWAL_OK) {
         rv = knit_error(knit, KNIT_RUNTIME_ERR, "knitx_set_str(): inserting key into vars hashtable failed");
         goto cleanup_val;
     }
+    kincref(objp);
     return KNIT_OK;
 
 cleanup_val:
@@ -912,39 +952,51 @@ static int knitx_obj_get_property(struct knit *knit, struct knit_obj *obj, struc
 }
 
 static int knitx_lexer_init(struct knit *knit, struct knit_lex *lxr) {
+    lxr->filename = NULL;
+    lxr->input = NULL;
     lxr->lineno = 1;
     lxr->colno = 1;
     lxr->offset = 0;
     lxr->tokno = 0;
+    lxr->ntokens = 0;
     lxr->pbcd = 0;
-    int rv = tok_darray_init(&lxr->tokens, 100);
-    return rv;
+    return KNIT_OK;
 }
 
 
-static int knitx_lexer_init_str(struct knit *knit, struct knit_lex *lxr, const char *program) {
+//the program is borrowed, not copied, it must not change or be freed before the lexer is deinitialized.
+//it doesn't need to be null terminated
+static int knitx_lexer_init_buf(struct knit *knit, struct knit_lex *lxr, const char *program, int len) {
     int rv = knitx_lexer_init(knit, lxr);
     if (rv != KNIT_OK)
         return rv;
-    rv = knitx_str_new_strcpy(knit, &lxr->input, program);
+    rv = knitx_str_new(knit, &lxr->input);
     if (rv != KNIT_OK)
         goto lexer_cleanup;
+    lxr->input->str = (char *) program;
+    lxr->input->len = len;
+    lxr->input->cap = -1;
     rv = knitx_str_new_strcpy(knit, &lxr->filename, "<str-input>");
     if (rv != KNIT_OK)
-        goto input_cleanup;
+        goto lexer_cleanup;
     return KNIT_OK;
 
-input_cleanup:
-    knitx_str_destroy(knit, lxr->input);
 lexer_cleanup:
     knitx_lexer_deinit(knit, lxr);
     return rv;
 }
 
+static int knitx_lexer_init_str(struct knit *knit, struct knit_lex *lxr, const char *program) {
+    return knitx_lexer_init_buf(knit, lxr, program, strlen(program));
+}
+
 static int knitx_lexer_deinit(struct knit *knit, struct knit_lex *lxr) {
-    knitx_str_destroy(knit, lxr->input);
+    if (lxr->input)
+        knitx_str_destroy(knit, lxr->input);
     lxr->input = NULL;
-    tok_darray_deinit(&lxr->tokens);
+    if (lxr->filename)
+        knitx_str_destroy(knit, lxr->filename);
+    lxr->filename = NULL;
     return KNIT_OK;
 }
 
@@ -976,30 +1028,67 @@ static int knitx_lexer_deinit(struct knit *knit, struct knit_lex *lxr) {
 */
 
 static int knitx_block_init(struct knit *knit, struct knit_block *block) {
-    int rv = insns_darray_init(&block->insns, 256);
+    int rv = insns_darray_init_with_allocator(&block->insns, 256, &knit->container_allocator);
     if (rv != INSNS_DARRAY_OK) {
         return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_block_init(): initializing statements darray failed");
     }
-    rv = knit_objp_darray_init(&block->constants, 128);
+    rv = knit_objp_darray_init_with_allocator(&block->constants, 128, &knit->container_allocator);
     if (rv != KNIT_OK)
         goto fail_objp_darray;
+    rv = knit_lines_darray_init_with_allocator(&block->lines, 16, &knit->container_allocator);
+    if (rv != KNIT_LINES_DARRAY_OK) {
+        rv = knit_error(knit, KNIT_RUNTIME_ERR, "knitx_block_init(): initializing lines darray failed");
+        goto fail_lines_darray;
+    }
     block->nargs = 0;
     block->nlocals = 0;
+    block->gc_epoch = 0;
+    block->shared = 0;
+    block->lineno = 0;
+    block->module = 0;
+    block->generator = 0;
+    block->src = NULL;
+    block->srclen = 0;
     return KNIT_OK;
 
+fail_lines_darray:
+    knit_objp_darray_deinit(&block->constants);
 fail_objp_darray:
     insns_darray_deinit(&block->insns);
     return rv;
 }
 
-static int knitx_block_add_insn(struct knit *knit, struct knit_block *block, struct knit_insn *insn) {
+static int knitx_block_add_insn(struct knit *knit, struct knit_block *block, struct knit_insn *insn, int lineno) {
     int rv = insns_darray_push(&block->insns, insn);
     if (rv != INSNS_DARRAY_OK) {
         return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_block_add_insn(): adding a insn to insns darray failed");
     }
+    struct knit_lines_darray *lines = &block->lines;
+    if (!lines->len || lines->data[lines->len - 1].lineno != lineno) {
+        struct knit_line line = {.ip = block->insns.len - 1, .lineno = lineno};
+        if (knit_lines_darray_push(lines, &line) != KNIT_LINES_DARRAY_OK)
+            return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_block_add_insn(): adding a line to lines darray failed");
+    }
     return KNIT_OK;
 }
 
+//the line of the statement the instruction at ip was emitted for, 0 if unknown
+static int knitx_block_lineno(struct knit_block *block, int ip) {
+    struct knit_lines_darray *lines = &block->lines;
+    int lo = 0, hi = lines->len - 1, lineno = 0;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (lines->data[mid].ip <= ip) {
+            lineno = lines->data[mid].lineno;
+            lo = mid + 1;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    return lineno;
+}
+
 //block owns allocd_obj, it is expected to be a tmallocd ptr (TODO check)
 static int knitx_block_add_constant(struct knit *knit, struct knit_block *block, struct knit_obj *allocd_obj, int *index_out) {
     int rv = knit_objp_darray_push(&block->constants, &allocd_obj);
@@ -1007,6 +1096,7 @@ static int knitx_block_add_constant(struct knit *knit, struct knit_block *block,
         *index_out = -1;
         return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_block_add_constant(): adding a constant to darray failed");
     }
+    kincref(allocd_obj); //constants are never released, blocks outlive them
     knit_assert_s(block->constants.len > 0, "darray push silently failed");
     *index_out = block->constants.len - 1;
     return KNIT_OK;
@@ -1027,12 +1117,21 @@ static int knit_parse_error(struct knit_prs *prs, const char *fmt, ...) {
     return KNIT_SYNTAX_ERR;
 }
 
+//recorded like any other error, with KNIT_POLICY_CONTINUE the caller finds it in knit->err
 static int knit_runtime_error(struct knit *knit, const char *fmt, ...) {
+    char msg[256];
     va_list ap;
     va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
+    vsnprintf(msg, sizeof msg, fmt, ap);
     va_end(ap);
-    return KNIT_RUNTIME_ERR;
+    return knit_error(knit, KNIT_RUNTIME_ERR, "%s", msg);
+}
+
+//obj was allocated with knitx_tmalloc() and nothing else frees it, knitx_deinit() does
+static int knitx_own_object(struct knit *knit, struct knit_obj *obj) {
+    if (knit_objp_darray_push(&knit->ex.outside, &obj) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(knit, KNIT_NOMEM, "couldn't keep an object outside the heap");
+    return KNIT_OK;
 }
 
 //doesn't own src
@@ -1041,22 +1140,58 @@ static int knitx_current_block_add_strl_constant(struct knit *knit, struct knit_
     int rv = knitx_str_new(knit, &str); 
     if (rv != KNIT_OK)
         return rv;
+    if ((rv = knitx_own_object(knit, ktobj(str))) != KNIT_OK) {
+        knitx_str_destroy(knit, str);
+        return rv;
+    }
     rv = knitx_str_strlcpy(knit, str, src, len);  
     if (rv != KNIT_OK)
         return rv;
     return knitx_block_add_constant(knit, &prs->curblk->block, ktobj(str), index_out);
 }
 
+//the constants themselves aren't the block's, the instance or a knit_program owns them
 static int knitx_block_deinit(struct knit *knit, struct knit_block *block) {
     insns_darray_deinit(&block->insns);
+    knit_objp_darray_deinit(&block->constants);
+    knit_lines_darray_deinit(&block->lines);
     return KNIT_OK;
 }
 
+//bytecode that was loaded instead of compiled (see knit_image.h, knit_knb.h) is checked before it can run,
+//the vm trusts instruction types and the operands that index into the block. boolean
+static int knitx_block_insns_valid(struct knit_block *block) {
+    for (int i=0; i<block->insns.len; i++) {
+        struct knit_insn *insn = &block->insns.data[i];
+        if (!KINSN_TVALID(insn->insn_type))
+            return 0;
+        if (insn->insn_type == KCLOAD && (insn->op1 < 0 || insn->op1 >= block->constants.len))
+            return 0;
+        if ((insn->insn_type == KJMP || insn->insn_type == KJMPTRUE || insn->insn_type == KJMPFALSE) &&
+            (insn->op1 < 0 || insn->op1 >= block->insns.len))
+            return 0;
+    }
+    return 1;
+}
+//loaded bytecode doesn't say which functions are generators, they're those with a yield. boolean
+static int knitx_block_has_yield(struct knit_block *block) {
+    for (int i=0; i<block->insns.len; i++) {
+        if (block->insns.data[i].insn_type == KYIELD)
+            return 1;
+    }
+    return 0;
+}
+
 //never returns null
 static const char *knitx_obj_type_name(struct knit *knit, struct knit_obj *obj) {
     if (obj->u.ktype == KNIT_INT)      return "KNIT_INT";
     else if (obj->u.ktype == KNIT_STR) return "KNIT_STR";
     else if (obj->u.ktype == KNIT_LIST) return "KNIT_LIST";
+    else if (obj->u.ktype == KNIT_DICT) return "KNIT_DICT";
+    else if (obj->u.ktype == KNIT_KFUNC) return "KNIT_KFUNC";
+    else if (obj->u.ktype == KNIT_CFUNC) return "KNIT_CFUNC";
+    else if (obj->u.ktype == KNIT_CHANNEL) return "KNIT_CHANNEL";
+    else if (obj->u.ktype == KNIT_GENERATOR) return "KNIT_GENERATOR";
     return "ERR_UNKNOWN_TYPE";
 }
 
@@ -1190,6 +1325,16 @@ static int knitx_obj_rep(struct knit *knit, struct knit_obj *obj, struct knit_st
         if (rv != KNIT_OK)
             return rv;
     }
+    else if (obj->u.ktype == KNIT_CHANNEL) {
+        rv = knitx_str_strcpy(knit, outi_str, "<channel>");
+        if (rv != KNIT_OK)
+            return rv;
+    }
+    else if (obj->u.ktype == KNIT_GENERATOR) {
+        rv = knitx_str_strcpy(knit, outi_str, "<generator>");
+        if (rv != KNIT_OK)
+            return rv;
+    }
     else {
         rv = knitx_str_strcpy(knit, outi_str, "<unknown type>"); 
         if (rv != KNIT_OK)
@@ -1238,6 +1383,10 @@ static int knitx_block_rep(struct knit *knit, struct knit_block *block, struct k
 }
 
 static int knitx_block_dump(struct knit *knit, struct knit_block *block) { 
+    if (block->src) {
+        fprintf(stderr, "Not compiled yet:\n%.*s\n", block->srclen, block->src);
+        return KNIT_OK;
+    }
     knitx_block_dump_consts(knit, block);
     fprintf(stderr, "Instructions:\n");
     for (int i=0; i<block->insns.len; i++) {
@@ -1292,7 +1441,6 @@ static int knitx_curblock_dump(struct knit *knit, struct knit_curblk *curblk) {
 /*EXECUTION STATE FUNCS*/
 //initialize a frame for a call to a knit function
 static int knitx_frame_init_kf(struct knit *knit, struct knit_frame *frame, struct knit_block *block, int ip, int bsp, int nargs, int nexpret) {
-    kincref(block);
     frame->frame_type = KNIT_FRAME_KBLOCK;
     frame->u.kf.block = block;
     frame->u.kf.ip = ip;
@@ -1304,7 +1452,6 @@ static int knitx_frame_init_kf(struct knit *knit, struct knit_frame *frame, stru
 
 //initialize a frame for a call to a c function
 static int knitx_frame_init_cf(struct knit *knit, struct knit_frame *frame, struct knit_cfunc *cfunc, int bsp, int nargs, int nexpret) {
-    kincref(cfunc);
     frame->frame_type = KNIT_FRAME_CFUNC;
     frame->u.cf.cfunc = cfunc;
     frame->bsp = bsp;
@@ -1314,12 +1461,7 @@ static int knitx_frame_init_cf(struct knit *knit, struct knit_frame *frame, stru
 }
 
 static int knitx_frame_deinit(struct knit *knit, struct knit_frame *frame) {
-    if (frame->frame_type == KNIT_FRAME_KBLOCK)
-        kdecref(frame->u.kf.block);
-    else if (frame->frame_type == KNIT_FRAME_CFUNC)
-        kdecref(frame->u.cf.cfunc);
-    else
-        knit_assert_h(0, "invalid frame type");
+    knit_assert_h(frame->frame_type == KNIT_FRAME_KBLOCK || frame->frame_type == KNIT_FRAME_CFUNC, "invalid frame type");
     return KNIT_OK;
 }
 
@@ -1354,11 +1496,11 @@ cleanup_tmpstr:
 }
 
 static int knitx_stack_init(struct knit *knit, struct knit_stack *stack) {
-    int rv = knit_frame_darray_init(&stack->frames, 128);
+    int rv = knit_frame_darray_init_with_allocator(&stack->frames, 128, &knit->container_allocator);
     if (rv != KNIT_FRAME_DARRAY_OK) {
         return knit_error(knit, KNIT_RUNTIME_ERR, "knit_stack_init(): initializing frames stack failed");
     }
-    rv = knit_objp_darray_init(&stack->vals, 512);
+    rv = knit_objp_darray_init_with_allocator(&stack->vals, 512, &knit->container_allocator);
     if (rv != KNIT_OBJP_DARRAY_OK) {
         knit_frame_darray_deinit(&stack->frames);
         return knit_error(knit, KNIT_RUNTIME_ERR, "knit_stack_init(): initializing values stack failed");
@@ -1557,6 +1699,7 @@ static int knitx_stack_pop_frame(struct knit *knit, struct knit_stack *stack) {
 }
 
 static int knitx_exec_state_init(struct knit *knit, struct knit_exec_state *exs) {
+    knit_jadwal_use(&knit->allocator);
     int rv = knit_vars_jadwal_init_with_udata(&exs->global_ht, 32, knit);
     if (rv != KNIT_VARS_JADWAL_OK) {
         return knit_error(knit, KNIT_RUNTIME_ERR, "couldn't initialize vars hashtable");;
@@ -1567,7 +1710,23 @@ static int knitx_exec_state_init(struct knit *knit, struct knit_exec_state *exs)
     if ((rv = knit_heap_init(knit, &exs->heap, 32000)) != KNIT_OK) {
         goto cleanup_stack;
     }
+    if (knit_objp_darray_init_with_allocator(&exs->outside, 64, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        rv = knit_error(knit, KNIT_NOMEM, "couldn't initialize the objects outside the heap");
+        goto cleanup_heap;
+    }
+    if (knit_objp_darray_init_with_allocator(&exs->modules, 0, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        rv = knit_error(knit, KNIT_NOMEM, "couldn't initialize the modules");
+        goto cleanup_outside;
+    }
+    exs->imports = NULL;
+    exs->gens = NULL;
+    exs->budget = KNIT_BUDGET_NONE;
+    exs->budget_depth = 0;
     return KNIT_OK;
+cleanup_outside:
+    knit_objp_darray_deinit(&exs->outside);
+cleanup_heap:
+    knit_heap_deinit(knit, &exs->heap);
 cleanup_stack:
     knitx_stack_deinit(knit, &exs->stack);
 cleanup_vars_ht:
@@ -1575,10 +1734,23 @@ cleanup_vars_ht:
     return rv;
 }
 
+static void knit_module_release(struct knit *knit); //fwd, see knit_module.h
 static int knitx_exec_state_deinit(struct knit *knit, struct knit_exec_state *exs) {
+    //a name a script assigned borrows a constant's chars, knitx_set_str()'s and a clone's are owned
+    struct knit_vars_jadwal_iter iter;
+    knit_vars_jadwal_begin_iterator(&exs->global_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter); knit_vars_jadwal_iter_next(&exs->global_ht, &iter))
+        knitx_str_deinit(knit, &iter.pair->key);
     knit_vars_jadwal_deinit(&exs->global_ht);
     int rv = knitx_stack_deinit(knit, &exs->stack);
     knit_heap_deinit(knit, &exs->heap);
+    for (int i=0; i<exs->outside.len; i++) {
+        knit_obj_deinit(knit, exs->outside.data[i]);
+        knitx_tfree(knit, exs->outside.data[i]);
+    }
+    knit_objp_darray_deinit(&exs->outside);
+    knit_objp_darray_deinit(&exs->modules);
+    knit_module_release(knit);
     return rv;
 }
 
@@ -1641,6 +1813,11 @@ static int knitx_exec_state_deinit(struct knit *knit, struct knit_exec_state *ex
 
  */
 
+//token n of the input, it must be one of the last KNIT_LEX_WINDOW lexed
+static struct knit_tok *knitx_lexer_tok(struct knit_lex *lxr, int n) {
+    return &lxr->window[n & (KNIT_LEX_WINDOW - 1)];
+}
+
 static int knitx_lexer_add_tok(struct knit *knit,
                                 struct knit_lex *lxr,
                                 int toktype,
@@ -1663,10 +1840,8 @@ static int knitx_lexer_add_tok(struct knit *knit,
     else {
         knit_assert_h(!data, "knitx_lexer_add_tok(): adding token with data argument that is unused");
     }
-    int rv = tok_darray_push(&lxr->tokens, &tok);
-    if (rv != TOK_DARRAY_OK) {
-        return knit_error(knit, KNIT_RUNTIME_ERR, "couldn't push token to tokens buffer");
-    }
+    knit_assert_h(lxr->ntokens - lxr->tokno < KNIT_LEX_WINDOW, "knitx_lexer_add_tok(): the window is full of tokens that weren't skipped");
+    *knitx_lexer_tok(lxr, lxr->ntokens++) = tok;
     return KNIT_OK;
 }
 
@@ -1678,15 +1853,10 @@ static int knitx_lexer_add_strliteral(struct knit *knit, struct knit_lex *lxr) {
     knit_assert_h(delm == '\'' || delm == '"', "unexpected delimiter");
 
     lxr->offset++; //skip '
-    while (lxr->offset < lxr->input->len && lxr->input->str[lxr->offset] != delm) {
-        char *cur = lxr->input->str + lxr->offset;
-        if (*cur == '\\') {
-            lxr->offset += 2;
-            //TODO fix, replace escape seq by single char
-        }
-        else {
-            lxr->offset++;
-        }
+    while ((lxr->offset = knit_scan_quote(lxr->input->str, lxr->offset, lxr->input->len, delm)) < lxr->input->len &&
+           lxr->input->str[lxr->offset] == '\\') {
+        lxr->offset += 2;
+        //TODO fix, replace escape seq by single char
     }
     if (lxr->offset >= lxr->input->len) {
         return knit_error(knit, KNIT_SYNTAX_ERR, "unterminated string literal");
@@ -1701,11 +1871,9 @@ static int knitx_lexer_add_intliteral(struct knit *knit, struct knit_lex *lxr) {
     //TODO support 0b and 0x prefixes
     int num = 0;
     int beg = lxr->offset;
-    while (lxr->offset < lxr->input->len && lxr->input->str[lxr->offset] >= '0' && lxr->input->str[lxr->offset] <= '9') {
-        char *cur = lxr->input->str + lxr->offset;
-        num = num * 10 + (lxr->input->str[lxr->offset] - '0');
-        lxr->offset++;
-    }
+    lxr->offset = knit_scan_digits(lxr->input->str, lxr->offset, lxr->input->len);
+    for (int i=beg; i<lxr->offset; i++)
+        num = num * 10 + (lxr->input->str[i] - '0');
     return knitx_lexer_add_tok(knit, lxr, KAT_INTLITERAL, beg, lxr->offset - beg, lxr->lineno, lxr->colno, &num);
 }
 
@@ -1714,71 +1882,20 @@ static int knitx_lexer_add_keyword_or_var(struct knit *knit, struct knit_lex *lx
                   (lxr->input->str[lxr->offset] >= 'A' && lxr->input->str[lxr->offset] <= 'Z') ||
                   lxr->input->str[lxr->offset] == '_', "");
     int beg = lxr->offset;
-    while (lxr->offset < lxr->input->len && 
-                ((lxr->input->str[lxr->offset] >= 'a' && lxr->input->str[lxr->offset] <= 'z') || 
-                 (lxr->input->str[lxr->offset] >= 'A' && lxr->input->str[lxr->offset] <= 'Z') ||
-                 (lxr->input->str[lxr->offset] >= '0' && lxr->input->str[lxr->offset] <= '9') ||
-                 lxr->input->str[lxr->offset] == '_'                                               ))
-    {
-        lxr->offset++;
-    }
+    lxr->offset = knit_scan_ident(lxr->input->str, lxr->offset, lxr->input->len);
     int len = lxr->offset - beg;
-    int type = KAT_VAR; //assume it is a variable name
-    if (len == 8 && knit_strl_eq(lxr->input->str + beg, "function", 8)) {
-        type = KAT_FUNCTION;
-    }
-    else if (len == 6 && knit_strl_eq(lxr->input->str + beg, "return", 6)) {
-        type = KAT_RETURN;
-    }
-    else if (len == 5 && knit_strl_eq(lxr->input->str + beg, "false", 5)) {
-        type = KAT_FALSE;
-    }
-    else if (len == 5 && knit_strl_eq(lxr->input->str + beg, "while", 5)) {
-        type = KAT_WHILE;
-    }
-    else if (len == 4 && knit_strl_eq(lxr->input->str + beg, "true", 4)) {
-        type = KAT_TRUE;
-    }
-    else if (len == 4 && knit_strl_eq(lxr->input->str + beg, "null", 4)) {
-        type = KAT_NULL;
-    }
-    else if (len == 4 && knit_strl_eq(lxr->input->str + beg, "else", 4)) {
-        type = KAT_ELSE;
-    }
-    else if (len == 3 && knit_strl_eq(lxr->input->str + beg, "and", 3)) {
-        type = KAT_LAND;
-    }
-    else if (len == 3 && knit_strl_eq(lxr->input->str + beg, "for", 3)) {
-        type = KAT_FOR;
-    }
-    else if (len == 2 && knit_strl_eq(lxr->input->str + beg, "or", 2)) {
-        type = KAT_LOR;
-    }
-    else if (len == 2 && knit_strl_eq(lxr->input->str + beg, "if", 2)) {
-        type = KAT_IF;
-    }
+    int type = knit_scan_keyword(lxr->input->str + beg, len);
     return knitx_lexer_add_tok(knit, lxr, type, beg, len, lxr->lineno, lxr->colno, NULL);
 }
 
 static int knitx_lexer_skip_wspace(struct knit *knit, struct knit_lex *lxr) {
-    while (lxr->offset < lxr->input->len) 
-    {
-        int c = lxr->input->str[lxr->offset];
-        if (!(c == ' '  || c == '\t' || c == '\n' ||
-             c == '\r' || c == '\v' || c == '\f'   ))
-        {
-            break;
-        }
-        lxr->offset++;
-        if (c == '\n')
-            lxr->lineno++;
-    }
+    lxr->offset = knit_scan_space(lxr->input->str, lxr->offset, lxr->input->len, &lxr->lineno);
     return KNIT_OK;
 }
 
 static int knitx_lexer_skip_comment(struct knit *knit, struct knit_lex *lxr) {
-    while (lxr->offset < lxr->input->len && lxr->input->str[lxr->offset] != '\n')
-        lxr->offset++;
+    const char *nl = memchr(lxr->input->str + lxr->offset, '\n', lxr->input->len - lxr->offset);
+    lxr->offset = nl ? nl - lxr->input->str : lxr->input->len;
     return KNIT_OK;
 }
 
@@ -1787,7 +1904,7 @@ static int knitx_lexer_lex(struct knit *knit, struct knit_lex *lxr) {
     int nextchar = 0;
 again:
     if (lxr->offset >= lxr->input->len) {
-        if (!lxr->tokens.len || lxr->tokens.data[lxr->tokens.len-1].toktype != KAT_EOF) {
+        if (!lxr->ntokens || knitx_lexer_tok(lxr, lxr->ntokens - 1)->toktype != KAT_EOF) {
             return knitx_lexer_add_tok(knit, lxr, KAT_EOF, lxr->offset, 0, lxr->lineno, lxr->colno, NULL);
         }
         return KNIT_OK;
@@ -1888,12 +2005,11 @@ again:
 //skip token
 static int knitx_lexer_skip(struct knit *knit, struct knit_lex *lxr) {
     int rv = KNIT_OK;
-    knit_assert_h(lxr->tokno < lxr->tokens.len, "knitx_lexer_skip(): invalid .tokno");
-    knit_assert_h(lxr->tokno < lxr->tokens.len, "");
-    knit_assert_h(lxr->tokens.data[lxr->tokno].toktype != KAT_EOF, "attempting to advance past EOF");
+    knit_assert_h(lxr->tokno < lxr->ntokens, "knitx_lexer_skip(): invalid .tokno");
+    knit_assert_h(knitx_lexer_tok(lxr, lxr->tokno)->toktype != KAT_EOF, "attempting to advance past EOF");
     lxr->tokno++;
 
-    if (lxr->tokno >= lxr->tokens.len) {
+    if (lxr->tokno >= lxr->ntokens) {
         rv = knitx_lexer_lex(knit, lxr);
         if (rv != KNIT_OK)
             return rv;
@@ -1904,23 +2020,23 @@ static int knitx_lexer_skip(struct knit *knit, struct knit_lex *lxr) {
 static int knitx_lexer_peek_cur(struct knit *knit, struct knit_lex *lxr, struct knit_tok ** tokp) {
     int rv = KNIT_OK;
     *tokp = NULL;
-    if (lxr->tokno >= lxr->tokens.len) {
+    if (lxr->tokno >= lxr->ntokens) {
         rv = knitx_lexer_lex(knit, lxr);
         if (rv != KNIT_OK)
             return rv;
     }
-    knit_assert_h(lxr->tokno < lxr->tokens.len, "");
-    *tokp = &lxr->tokens.data[lxr->tokno];
+    knit_assert_h(lxr->tokno < lxr->ntokens, "");
+    *tokp = knitx_lexer_tok(lxr, lxr->tokno);
     return KNIT_OK;
 }
 
 static int knitx_lexer_peek_la(struct knit *knit, struct knit_lex *lxr, struct knit_tok **tokp) {
     for (int i=0; i<2; i++) {
-        if (lxr->tokno < lxr->tokens.len && lxr->tokens.data[lxr->tokno].toktype == KAT_EOF) {
-            *tokp = &lxr->tokens.data[lxr->tokno];
+        if (lxr->tokno < lxr->ntokens && knitx_lexer_tok(lxr, lxr->tokno)->toktype == KAT_EOF) {
+            *tokp = knitx_lexer_tok(lxr, lxr->tokno);
             return KNIT_OK;
         }
-        if (lxr->tokno + 1 >= lxr->tokens.len) {
+        if (lxr->tokno + 1 >= lxr->ntokens) {
             int rv = knitx_lexer_lex(knit, lxr);
             if (rv != KNIT_OK) {
                 *tokp = NULL;
@@ -1928,8 +2044,8 @@ static int knitx_lexer_peek_la(struct knit *knit, struct knit_lex *lxr, struct k
             }
         }
     }
-    knit_assert_h(lxr->tokno < lxr->tokens.len, "");
-    *tokp = &lxr->tokens.data[lxr->tokno];
+    knit_assert_h(lxr->tokno < lxr->ntokens, "");
+    *tokp = knitx_lexer_tok(lxr, lxr->tokno);
     return KNIT_OK;
 }
 
@@ -1996,6 +2112,7 @@ static const char *knit_knit_tok_name(int name) {
         {KAT_ELSE,  "KAT_ELSE"},
         {KAT_FOR,   "KAT_FOR"},
         {KAT_WHILE, "KAT_WHILE"},
+        {KAT_YIELD, "KAT_YIELD"},
         {KAT_LAND, "KAT_LAND"},
         {KAT_LOR,  "KAT_LOR"},
         {KAT_NULL,  "KAT_NULL"},
@@ -2081,7 +2198,7 @@ end:
 
 static int knitx_lexdump(struct knit *knit, struct knit_lex *lxr) {
     if (lxr->input->str)
-        fprintf(stderr, "Input: '''\n%s\n'''\n", lxr->input->str);
+        fprintf(stderr, "Input: '''\n%.*s\n'''\n", lxr->input->len, lxr->input->str);
     struct knit_tok *tok;
     struct knit_str *tokstr;
     int rv = knitx_str_new(knit, &tokstr);
@@ -2116,7 +2233,7 @@ static int knit_cur_block_new(struct knit *knit, struct knit_curblk **curblkp) {
     rv = knitx_block_init(knit, &nblk->block);     
     if (rv != KNIT_OK)
         return rv;
-    rv = knit_varname_darray_init(&nblk->locals, 8); 
+    rv = knit_varname_darray_init_with_allocator(&nblk->locals, 8, &knit->container_allocator); 
     if (rv != KNIT_OK)
         return rv;
     *curblkp = nblk;;
@@ -2136,10 +2253,10 @@ static int knit_cur_block_destroy(struct knit *knit, struct knit_curblk *curblk)
 }
 
 //assumes sets the new node's next to the current *outp pointer, so, at the beginning it must be NULL
-static int knit_patch_loc_new_or_insert(struct knit *knit, int instruction_address, struct knit_patch_list **outp) {
+static int knit_patch_loc_new_or_insert(struct knit *knit, struct knit_prs *prs, int instruction_address, struct knit_patch_list **outp) {
     struct knit_patch_list *node = NULL;
     void *p;
-    int rv = knitx_rmalloc(knit, sizeof *node, &p); 
+    int rv = knit_arena_alloc(&prs->arena, sizeof *node, &p); 
     if (rv != KNIT_OK)
         return rv;
     node = p;
@@ -2149,16 +2266,9 @@ static int knit_patch_loc_new_or_insert(struct knit *knit, int instruction_addre
     return KNIT_OK;
 }
 
-//destroys the whole list
+//the nodes are in the parser's arena, this only detaches them
 static int knit_patch_loc_list_destroy(struct knit *knit, struct knit_patch_list **outp) {
-    struct knit_patch_list *node = *outp;
-    struct knit_patch_list *next = NULL;
     *outp = NULL;
-    while (node) {
-        next = node->next;
-        knitx_rfree(knit, node);
-        node = next;
-    }
     return KNIT_OK;
 }
 
@@ -2181,6 +2291,10 @@ static int knit_patch_loc_list_patch_and_destroy(struct knit *knit, struct knit_
 //NOTE lexer must be initialized after this
 static int knitx_prs_init1(struct knit *knit, struct knit_prs *prs) {
     memset(prs, 0, sizeof(*prs));
+    knit_arena_init(knit, &prs->arena);
+    prs->arena_allocator.realloc = knit_arena_dyn_realloc;
+    prs->arena_allocator.free = knit_arena_dyn_free;
+    prs->arena_allocator.ud = &prs->arena;
     int rv = knit_cur_block_new(knit, &prs->curblk); 
     if (rv != KNIT_OK)
         return rv;
@@ -2193,6 +2307,7 @@ static int knitx_prs_deinit(struct knit *knit, struct knit_prs *prs) {
         knit_cur_block_destroy(knit, prs->curblk);
         prs->curblk = parent;
     }
+    knit_arena_deinit(&prs->arena);
     return KNIT_OK;
 }
 
@@ -2446,7 +2561,7 @@ L3:
 //NOTE: this does a shallow copy or a "move". some exprs have resources that they own (ex. str)
 static int knitx_save_expr(struct knit *knit, struct knit_prs *prs, struct knit_expr **exprp) {
     void *p;
-    int rv = knitx_tmalloc(knit, sizeof **exprp, &p); 
+    int rv = knit_arena_alloc(&prs->arena, sizeof **exprp, &p); 
     if (rv != KNIT_OK)
         return rv;
     memcpy(p, &prs->curblk->expr, sizeof **exprp);
@@ -2454,6 +2569,23 @@ static int knitx_save_expr(struct knit *knit, struct knit_prs *prs, struct knit_
     return KNIT_OK;
 }
 
+//the text of tok as a string in the parser's arena, it's not destroyed and lives until the arena is reset
+static int knitx_prs_tok_str_new(struct knit *knit, struct knit_prs *prs, struct knit_tok *tok, struct knit_str **strp) {
+    knit_assert_h(tok->offset < prs->lex.input->len, "");
+    void *p;
+    int rv = knit_arena_alloc(&prs->arena, sizeof(struct knit_str) + tok->len + 1, &p);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_str *str = p;
+    knitx_str_init(knit, str); //cap stays negative, the chars aren't owned
+    str->str = (char *) (str + 1);
+    memcpy(str->str, prs->lex.input->str + tok->offset, tok->len);
+    str->str[tok->len] = '\0';
+    str->len = tok->len;
+    *strp = str;
+    return KNIT_OK;
+}
+
 static struct knit_varname *knit_get_varname_by_idx(struct knit_curblk *curblk, int vn_idx) {
     return curblk->locals.data + vn_idx;
 }
@@ -2491,14 +2623,14 @@ static int kexpr_save_constant(struct knit *knit, struct knit_prs *prs,  struct
 //it'd start with prefix_expr = prefix_init(knit, var_ref: obj_a, obj_b)
 //then prefix_expr = prefix_add_name(knit, obj_c, prefix_expr)
 //prefix_expr = prefix_add_name(knit, obj_d, prefix_expr)
-static int knitx_expr_prefix_add_name(struct knit *knit, struct knit_str *name, struct knit_expr *out_expr)
+static int knitx_expr_prefix_add_name(struct knit *knit, struct knit_prs *prs, struct knit_str *name, struct knit_expr *out_expr)
 {
     knit_assert_h(!!out_expr->u.prefix.chain, "");
     struct knit_varname_chain *chain = out_expr->u.prefix.chain;
     while (chain->next)
         chain = chain->next;
     void *p = NULL;
-    int rv = knitx_tmalloc(knit, sizeof(struct knit_varname_chain), &p); 
+    int rv = knit_arena_alloc(&prs->arena, sizeof(struct knit_varname_chain), &p); 
     if (rv != KNIT_OK)
         return rv;
     chain->next = p;
@@ -2507,14 +2639,15 @@ static int knitx_expr_prefix_add_name(struct knit *knit, struct knit_str *name,
     return KNIT_OK;
 }
 
-//owns both name and child_name
+//name and child_name are in the parser's arena
 static int knitx_expr_prefix_init(struct knit *knit, 
+                                  struct knit_prs *prs,
                                   struct knit_expr *parent,
                                   struct knit_str *child_name,
                                   struct knit_expr *out_expr)
 {
     void *p = NULL;
-    int rv = knitx_tmalloc(knit, sizeof(struct knit_varname_chain), &p); 
+    int rv = knit_arena_alloc(&prs->arena, sizeof(struct knit_varname_chain), &p); 
     if (rv != KNIT_OK)
         return rv;
     out_expr->exptype = KAX_OBJ_DOT;
@@ -2639,74 +2772,25 @@ static int kexpr_func_call_arglist(struct knit *knit, struct knit_prs *prs, stru
     return KNIT_OK;
 }
 
-static int knit_expr_list_deinit(struct knit *knit, struct knit_prs *prs, struct knit_expr_darray *darray) {
-    for (int i=0; i<darray->len; i++) {
-        struct knit_expr *arg_expr = darray->data[i];
-        knitx_expr_destroy(knit, prs, arg_expr);
-    }
-    knit_expr_darray_deinit(darray);
-    return KNIT_OK;
-}
-
-static int knitx_expr_destroy_prefix(struct knit *knit, struct knit_expr *expr) {
-    knit_assert_h(!!expr->u.prefix.chain, "");
-    
-    return KNIT_OK;
-}
-
-static int knitx_expr_destroy(struct knit *knit, struct knit_prs *prs, struct knit_expr *prs_expr) {
-    if (prs_expr->exptype == KAX_CALL) {
-        knit_expr_list_deinit(knit, prs, &prs_expr->u.call.args);
-        knitx_expr_destroy(knit, prs, prs_expr->u.call.called); //how will this be destroyed?, how does it affect the block referenced
-    }
-    else if (prs_expr->exptype == KAX_LITERAL_LIST) {
-        knit_expr_list_deinit(knit, prs, &prs_expr->u.elist);
-    }
-    knitx_tfree(knit, prs_expr); 
-    return KNIT_OK;
-}
-
-static int knitx_stmt_deinit(struct knit *knit, struct knit_prs *prs, struct knit_stmt *stmt) {
-    //not implemented
-    if (stmt->stmttype == KSTMT_ASSIGN) {
-    }
-    else if (stmt->stmttype == KSTMT_FOR) {
-    }
-    else if (stmt->stmttype == KSTMT_WHILE) {
-    }
-    else if (stmt->stmttype == KSTMT_RETURN) {
-    }
-    else if (stmt->stmttype == KSTMT_IF) {
-
-    /*
-     * L1: if (C) { [false? jmp L2, True? exec block then jmp L3]
-     *  S1, S2 ...
-     *  jmp L3:
-     * }
-     * L2: else {
-     * }
-     * L3:
-     *
-     */
-    }
-    else if (stmt->stmttype == KSTMT_EXPR) {
-    }
-    else if (stmt->stmttype == KSTMT_SBLOCK) {
-    }
-    else {
-        knit_assert_h(0, "unknown stmt type");
-    }
-    return KNIT_OK;
-}
-
+/*
+    function bodies are compiled lazily: the body's tokens are only bracket matched and the function's source is kept,
+    knitx_kfunc_compile() compiles it the first time the function is called.
+    a body only sees its own arguments and locals and globals, so it compiles the same way later as it would now.
+    syntax errors in a body are reported when it's compiled, errors in the tokens when it's loaded
+*/
 static int kexpr_funcdef(struct knit *knit, struct knit_prs *prs) {
     knit_assert_s(K_TOKEN_MATCHES(KAT_FUNCTION),  "");
+    int compile_body = prs->compile_body;
+    prs->compile_body = 0; //functions defined in it are lazy again
+    int src_begin = K_TOKEN()->offset;
+    int src_end = 0;
     struct knit_curblk *curblk = NULL;
     int rv = knit_cur_block_new(knit, &curblk); 
     if (rv != KNIT_OK)
         return rv;
     curblk->parent = prs->curblk;
     prs->curblk = curblk;
+    curblk->block.lineno = K_TOKEN()->lineno;
     if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) 
         return rv;
     //TODO fix error handling
@@ -2719,10 +2803,7 @@ static int kexpr_funcdef(struct knit *knit, struct knit_prs *prs) {
 
     while (K_TOKEN_MATCHES(KAT_VAR)) {
         struct knit_str *arg_name = NULL;
-        rv = knitx_str_new(knit, &arg_name); 
-        if (rv != KNIT_OK)
-            return rv;
-        rv = knitx_tok_extract_to_str(knit, &prs->lex, K_TOKEN(), arg_name);  
+        rv = knitx_prs_tok_str_new(knit, prs, K_TOKEN(), &arg_name); 
         if (rv != KNIT_OK)
             return rv;
         int vn_idx = -1;
@@ -2753,18 +2834,32 @@ static int kexpr_funcdef(struct knit *knit, struct knit_prs *prs) {
     }
     if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv;
 
-    while (!K_TOKEN_MATCHES(KAT_EOF) && !K_TOKEN_MATCHES(KAT_CCURLY)) {
-        rv = knitx_stmt_prs_emit(knit, prs, KSTMT_ALL); 
+    if (compile_body) {
+        while (!K_TOKEN_MATCHES(KAT_EOF) && !K_TOKEN_MATCHES(KAT_CCURLY)) {
+            rv = knitx_stmt_prs_emit(knit, prs, KSTMT_ALL); 
+        }
+        if (rv != KNIT_OK)
+            return rv;
+        rv = knitx_emit_ret(knit, prs, 0); //this can be redundant if the function already has a return stmt
+        if (rv != KNIT_OK)
+            return rv;
+    }
+    else {
+        int depth = 1;
+        while (!K_TOKEN_MATCHES(KAT_EOF)) {
+            if (K_TOKEN_MATCHES(KAT_OCURLY))
+                depth++;
+            else if (K_TOKEN_MATCHES(KAT_CCURLY) && !--depth)
+                break;
+            if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK)
+                return rv;
+        }
     }
-    if (rv != KNIT_OK)
-        return rv;
-    rv = knitx_emit_ret(knit, prs, 0); //this can be redundant if the function already has a return stmt
-    if (rv != KNIT_OK)
-        return rv;
 
     if (!K_TOKEN_MATCHES(KAT_CCURLY)) {
         return knit_error_expected(knit, prs, "}", "");
     }
+    src_end = K_TOKEN()->offset + K_TOKEN()->len;
     if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv;
 
     prs->curblk = curblk->parent;
@@ -2778,16 +2873,40 @@ static int kexpr_funcdef(struct knit *knit, struct knit_prs *prs) {
 
     struct knit_kfunc *kfunc = p;
     kfunc->ktype = KNIT_KFUNC;
-    kfunc->block = curblk->block; //move the block itself, assumes no self references in it, takes ownership
+    rv  = knitx_tmalloc(knit, sizeof(struct knit_block), &p);
+    if (rv != KNIT_OK) {
+        knitx_tfree(knit, kfunc);
+        return rv;
+    }
+    kfunc->block = p;
+    *kfunc->block = curblk->block; //move the block itself, assumes no self references in it, takes ownership
+    if (!compile_body) {
+        //a script that was mapped stays mapped as long as the instance, the source is copied otherwise
+        const char *src = prs->lex.input->str + src_begin;
+        kfunc->block->srclen = src_end - src_begin;
+        if (knit_mapped_contains(knit, src)) {
+            kfunc->block->src = src;
+        }
+        else {
+            if ((rv = knitx_tmalloc(knit, kfunc->block->srclen, &p)) != KNIT_OK)
+                return rv;
+            memcpy(p, src, kfunc->block->srclen);
+            kfunc->block->src = p;
+        }
+    }
+    if ((rv = knitx_own_object(knit, ktobj(kfunc))) != KNIT_OK)
+        return rv;
 
 #ifdef KNIT_DEBUG_PRINT
     if (KNIT_DBG_PRINT) {
         knitx_curblock_dump(knit, curblk);
-        knitx_block_dump(knit, &kfunc->block);
+        knitx_block_dump(knit, kfunc->block);
     }
 #endif
 
     /*this destroys everything in curblock except .block itsel, (but what if we need debug info?, it should be optionally saved somewhere)f*/
+    for (int i=0; i<curblk->locals.len; i++)
+        knitx_str_deinit(knit, &curblk->locals.data[i].name);
     knit_varname_darray_deinit(&curblk->locals);
     knitx_tfree(knit, curblk);
 
@@ -2797,8 +2916,62 @@ static int kexpr_funcdef(struct knit *knit, struct knit_prs *prs) {
     return KNIT_OK;
 }
 
+static void knitx_block_free_src(struct knit *knit, struct knit_block *block) {
+    if (block->src && !knit_mapped_contains(knit, block->src))
+        knitx_tfree(knit, (void *) block->src);
+    block->src = NULL;
+}
+
+//compiles the body kexpr_funcdef() skipped, the block is filled in place so the frames and constants pointing to it stay valid
+static int knitx_kfunc_compile(struct knit *knit, struct knit_kfunc *kfunc) {
+    struct knit_block *block = kfunc->block;
+    struct knit_prs prs;
+    if (!block->src)
+        return KNIT_OK;
+    //this can run in the middle of an execution, the constants must not come from the request arena
+    int arena_active = knit->ex.heap.arena.active;
+    knit->ex.heap.arena.active = 0;
+    knitx_prs_init1(knit, &prs);
+    knitx_lexer_init_buf(knit, &prs.lex, block->src, block->srclen);
+    prs.lex.lineno = block->lineno;
+    prs.compile_body = 1;
+    int rv = kexpr_funcdef(knit, &prs);
+    knitx_lexer_deinit(knit, &prs.lex);
+    if (rv == KNIT_OK) {
+        struct knit_kfunc *compiled = prs.curblk->expr.u.kfunc;
+        //kexpr_funcdef() kept it last, after the functions and constants in its body
+        knit_assert_h(knit->ex.outside.data[knit->ex.outside.len - 1] == ktobj(compiled), "");
+        knit->ex.outside.len--;
+        knitx_block_free_src(knit, block);
+        knitx_block_deinit(knit, block);
+        *block = *compiled->block;
+        knitx_tfree(knit, compiled->block);
+        knitx_tfree(knit, compiled);
+    }
+    knitx_prs_deinit(knit, &prs);
+    knit->ex.heap.arena.active = arena_active;
+    return rv;
+}
+
+//compiles every function a block defines, and the functions they define. for writers of bytecode files
+static int knitx_block_compile_all(struct knit *knit, struct knit_block *block) {
+    for (int i=0; i<block->constants.len; i++) {
+        struct knit_obj *obj = block->constants.data[i];
+        if (!obj || obj->u.ktype != KNIT_KFUNC)
+            continue;
+        int rv = knitx_kfunc_compile(knit, &obj->u.kfunc);
+        if (rv == KNIT_OK)
+            rv = knitx_block_compile_all(knit, obj->u.kfunc.block);
+        if (rv != KNIT_OK)
+            return rv;
+    }
+    return KNIT_OK;
+}
+
 static void knit_kfunc_deinit(struct knit *knit, struct knit_kfunc *kfunc) {
-    knitx_block_deinit(knit, &kfunc->block);
+    knitx_block_free_src(knit, kfunc->block);
+    knitx_block_deinit(knit, kfunc->block);
+    knitx_tfree(knit, kfunc->block);
 }
 
 static void knit_kfunc_destroy(struct knit *knit, struct knit_kfunc *kfunc) {
@@ -2823,13 +2996,10 @@ static int kexpr_prefix(struct knit *knit, struct knit_prs *prs) {
             if (rv != KNIT_OK)
                 return rv;
             struct knit_str *child_name = NULL;
-            rv = knitx_str_new(knit, &child_name); 
-            if (rv != KNIT_OK)
-                return rv;
-            rv = knitx_tok_extract_to_str(knit, &prs->lex, K_TOKEN(), child_name);  
+            rv = knitx_prs_tok_str_new(knit, prs, K_TOKEN(), &child_name); 
             if (rv != KNIT_OK)
                 return rv;
-            rv = knitx_expr_prefix_init(knit, rootexpr, child_name, &prs->curblk->expr);  
+            rv = knitx_expr_prefix_init(knit, prs, rootexpr, child_name, &prs->curblk->expr);  
             if (rv != KNIT_OK)
                 return rv; 
             if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv;
@@ -2838,13 +3008,10 @@ static int kexpr_prefix(struct knit *knit, struct knit_prs *prs) {
                 if (!K_TOKEN_MATCHES(KAT_VAR)) {
                     return knit_error_expected(knit, prs, "a variable name", ""); 
                 }
-                rv = knitx_str_new(knit, &child_name); 
-                if (rv != KNIT_OK)
-                    return rv;
-                rv = knitx_tok_extract_to_str(knit, &prs->lex, K_TOKEN(), child_name);  
+                rv = knitx_prs_tok_str_new(knit, prs, K_TOKEN(), &child_name); 
                 if (rv != KNIT_OK)
                     return rv;
-                rv = knitx_expr_prefix_add_name(knit, child_name, &prs->curblk->expr);  
+                rv = knitx_expr_prefix_add_name(knit, prs, child_name, &prs->curblk->expr);  
                 if (rv != KNIT_OK)
                     return rv;
                 if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv;
@@ -2858,7 +3025,7 @@ static int kexpr_prefix(struct knit *knit, struct knit_prs *prs) {
                 return rv;
 
             struct knit_expr_darray arglist =  {0};
-            rv = knit_expr_darray_init(&arglist, 2); 
+            rv = knit_expr_darray_init_with_allocator(&arglist, 2, &prs->arena_allocator); 
             if (rv != KNIT_EXPR_DARRAY_OK) {
                 return knit_error(knit, KNIT_RUNTIME_ERR, "couldn't initialize arg expressions dynamic array"); 
             }
@@ -2965,20 +3132,15 @@ static int kexpr_atom(struct knit *knit, struct knit_prs *prs) {
         if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv;
     }
     else if (K_TOKEN_MATCHES(KAT_VAR)) {
-        struct knit_str name;
-        rv = knitx_str_init(knit, &name);  
+        struct knit_str *name = NULL;
+        rv = knitx_prs_tok_str_new(knit, prs, K_TOKEN(), &name);  
         if (rv != KNIT_OK)
             return rv;
-        rv = knitx_tok_extract_to_str(knit, &prs->lex, K_TOKEN(), &name);  
-        if (rv != KNIT_OK)
-            return rv;
-        if (knitx_str_streqc(knit, &name, "g")) {
+        if (knitx_str_streqc(knit, name, "g")) {
             prs_expr->exptype = KAX_G;
-            knitx_str_deinit(knit, &name);
         }
         else {
-            rv = knitx_get_or_add_block_var(knit, prs->curblk, &name, &prs_expr->u.varref.varname_idx);
-            knitx_str_deinit(knit, &name);
+            rv = knitx_get_or_add_block_var(knit, prs->curblk, name, &prs_expr->u.varref.varname_idx);
             prs_expr->exptype = KAX_VAR_REF;
             if (rv != KNIT_RETRIEVED && rv != KNIT_NOT_FOUND) {
                 return rv; 
@@ -3008,7 +3170,7 @@ static int kexpr_atom(struct knit *knit, struct knit_prs *prs) {
         if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv; //[
 
         struct knit_expr_darray explist =  {0};
-        rv = knit_expr_darray_init(&explist, 0); 
+        rv = knit_expr_darray_init_with_allocator(&explist, 0, &prs->arena_allocator); 
         if (rv != KNIT_OK)
             return rv;
         while (!K_TOKEN_MATCHES(KAT_CBRACKET)) {
@@ -3043,7 +3205,7 @@ static int kexpr_atom(struct knit *knit, struct knit_prs *prs) {
         //dictionary literal
         if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv; //{
         struct knit_expr_darray explist =  {0};
-        rv = knit_expr_darray_init(&explist, 0); 
+        rv = knit_expr_darray_init_with_allocator(&explist, 0, &prs->arena_allocator); 
         if (rv != KNIT_OK)
             return rv;
         while (!K_TOKEN_MATCHES(KAT_CCURLY)) {
@@ -3102,7 +3264,7 @@ static int knitx_emit_1(struct knit *knit, struct knit_prs *prs, int opcode) {
     struct knit_insn insn;
     insn.insn_type = opcode;
     insn.op1 = -1;
-    int rv = knitx_block_add_insn(knit, &prs->curblk->block, &insn); 
+    int rv = knitx_block_add_insn(knit, &prs->curblk->block, &insn, prs->lineno); 
     if (rv != KNIT_OK)
         return rv; 
     return KNIT_OK;
@@ -3114,7 +3276,7 @@ static int knitx_emit_2(struct knit *knit, struct knit_prs *prs, int opcode, int
     struct knit_insn insn;
     insn.insn_type = opcode;
     insn.op1 = arg1;
-    int rv = knitx_block_add_insn(knit, &prs->curblk->block, &insn); 
+    int rv = knitx_block_add_insn(knit, &prs->curblk->block, &insn, prs->lineno); 
     if (rv != KNIT_OK)
         return rv; 
     return KNIT_OK;
@@ -3313,7 +3475,7 @@ static int knitx_emit_logical_operation(struct knit *knit,
         return knit_parse_error(prs, "unexpected binary logical operator");
     }
 
-    rv = knit_patch_loc_new_or_insert(knit, block->insns.len - 1, &expr->u.logic_bin.plist); 
+    rv = knit_patch_loc_new_or_insert(knit, prs, block->insns.len - 1, &expr->u.logic_bin.plist); 
     if (rv != KNIT_OK)
         return rv;
     //in case of KEVAL_VALUE and KAT_LAND at this point execution at this point implies the first test succeeded, so it needs to be discarded
@@ -3845,7 +4007,7 @@ static int knit_prs_sblock_into_darray(struct knit *knit, struct knit_prs *prs,
     int rv = KNIT_OK;
     if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv; //'{'
 
-    knit_stmt_darray_init(stmt_array_out, 1);
+    rv = knit_stmt_darray_init_with_allocator(stmt_array_out, 1, &prs->arena_allocator);
     if (rv != KNIT_STMT_DARRAY_OK) {
         return knit_error(knit, KNIT_RUNTIME_ERR, "couldn't initialize stmt dynamic array"); 
     }
@@ -3868,14 +4030,13 @@ static int knit_prs_sblock_into_darray(struct knit *knit, struct knit_prs *prs,
 
 static int knit_prs_sblock_stmt_new(struct knit *knit, struct knit_prs *prs, struct knit_stmt **stmt_out) {
     void *p = NULL;
-    int rv  = knitx_tmalloc(knit, sizeof(struct knit_stmt), &p);  
+    int rv  = knit_arena_alloc(&prs->arena, sizeof(struct knit_stmt), &p);  
     if (rv != KNIT_OK)
         return rv;
     struct knit_stmt *sblock_stmt = p;
     struct knit_stmt_darray *array = &sblock_stmt->u._sblock.body;
     rv = knit_prs_sblock_into_darray(knit, prs, array); 
     if (rv != KNIT_OK) {
-        knitx_tfree(knit, p);
         return knit_error(knit, KNIT_RUNTIME_ERR, "failed to allocate mmeory for sblock stmt"); 
     }
     sblock_stmt->stmttype = KSTMT_SBLOCK;
@@ -3897,7 +4058,6 @@ static int knitx_prs_if_stmt(struct knit *knit, struct knit_prs *prs, struct kni
     rv = knitx_save_expr(knit, prs, &condition);  
     if (rv != KNIT_OK)
         return rv;
-    //?knitx_expr_destroy(knit, prs, root_expr);
 
     struct knit_stmt_darray *stmt_array = &stmt_out->u._if.body;
     rv = knit_prs_sblock_into_darray(knit, prs, stmt_array); 
@@ -3938,15 +4098,13 @@ static int knitx_prs_if_stmt(struct knit *knit, struct knit_prs *prs, struct kni
 static int knitx_prs_if_stmt_new(struct knit *knit, struct knit_prs *prs, struct knit_stmt **if_stmt_out) {
     void *p = NULL;
 
-    int rv  = knitx_tmalloc(knit, sizeof(struct knit_stmt), &p);  
+    int rv  = knit_arena_alloc(&prs->arena, sizeof(struct knit_stmt), &p);  
     if (rv != KNIT_OK)
         return rv;
     struct knit_stmt *if_stmt = p;
     rv = knitx_prs_if_stmt(knit, prs, if_stmt);
-    if (rv != KNIT_OK) {
-        knitx_tfree(knit, if_stmt);
+    if (rv != KNIT_OK)
         return rv;
-    }
     *if_stmt_out = if_stmt;
     return KNIT_OK;
 }
@@ -4050,6 +4208,7 @@ static int knitx_stmt_prs(struct knit *knit, struct knit_prs *prs, int allowed_s
     rv = knitx_skip_nl(knit, prs);
     if (rv != KNIT_OK)
         return rv;
+    stmt_out->lineno = K_TOKEN()->lineno;
     if (((a & KSTMT_ASSIGN) || (a & KSTMT_EXPR)) && knitx_curtok_in_first_of_expr(knit, prs)) {
         rv = knitx_expr(knit, prs); 
         if (rv != KNIT_OK)
@@ -4072,7 +4231,6 @@ static int knitx_stmt_prs(struct knit *knit, struct knit_prs *prs, int allowed_s
             if (rv != KNIT_OK)
                 return rv;
 
-            //?knitx_expr_destroy(knit, prs, root_expr);
             stmt_out->stmttype = KSTMT_ASSIGN;
             stmt_out->u._assign.lhs = lhs_expr;
             stmt_out->u._assign.rhs = rhs_expr;
@@ -4082,7 +4240,6 @@ static int knitx_stmt_prs(struct knit *knit, struct knit_prs *prs, int allowed_s
             rv = knitx_save_expr(knit, prs, &root_expr);  
             if (rv != KNIT_OK)
                 return rv;
-            //?knitx_expr_destroy(knit, prs, root_expr);
             stmt_out->stmttype = KSTMT_EXPR;
             stmt_out->u._expr = root_expr;
         }
@@ -4118,13 +4275,29 @@ static int knitx_stmt_prs(struct knit *knit, struct knit_prs *prs, int allowed_s
         rv = knitx_save_expr(knit, prs, &root_expr);  
         if (rv != KNIT_OK)
             return rv;
-        //?knitx_expr_destroy(knit, prs, root_expr);
         stmt_out->u._expr = root_expr;
         stmt_out->stmttype = KSTMT_RETURN;
         if (skip_semicolon && K_TOKEN_MATCHES(KAT_SEMICOLON)) {
             if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv; //skip ';'
         }
     }
+    else if ((a & KSTMT_YIELD) && K_TOKEN_MATCHES(KAT_YIELD)) {
+        if (knitx_is_in_filescope(knit, prs))
+            return knit_error(knit, KNIT_SYNTAX_ERR, "line %d: yield is only allowed in a function", prs->lex.lineno);
+        if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv; //yield
+        rv = knitx_expr(knit, prs);
+        if (rv != KNIT_OK)
+            return rv;
+        struct knit_expr *root_expr = NULL;
+        rv = knitx_save_expr(knit, prs, &root_expr);
+        if (rv != KNIT_OK)
+            return rv;
+        stmt_out->u._expr = root_expr;
+        stmt_out->stmttype = KSTMT_YIELD;
+        if (skip_semicolon && K_TOKEN_MATCHES(KAT_SEMICOLON)) {
+            if ((rv = knitx_lexer_skip(knit, &prs->lex)) != KNIT_OK) return rv; //skip ';'
+        }
+    }
     else {
         return knit_error_expected(knit, prs, "a statement", "");
     }
@@ -4141,6 +4314,7 @@ static int knitx_emit_ret(struct knit *knit, struct knit_prs *prs, int count) {
 
 static int knitx_stmt_emit(struct knit *knit, struct knit_prs *prs, struct knit_stmt *stmt) {
     int rv = KNIT_OK;
+    prs->lineno = stmt->lineno;
     if (stmt->stmttype == KSTMT_EXPR) {
         rv = knitx_emit_expr_eval(knit, prs,  stmt->u._expr, KEVAL_VALUE, KRES_UNKNOWN_DISCARD_RET); 
         if (rv != KNIT_OK)
@@ -4169,7 +4343,7 @@ static int knitx_stmt_emit(struct knit *knit, struct knit_prs *prs, struct knit_
             return rv; 
         struct knit_patch_list *L4_pos = NULL; //L2
         //reference the KJMPFALSE instruction which will be backpatched
-        rv = knit_patch_loc_new_or_insert(knit, prs->curblk->block.insns.len - 1, &L4_pos); 
+        rv = knit_patch_loc_new_or_insert(knit, prs, prs->curblk->block.insns.len - 1, &L4_pos); 
         if (rv != KNIT_OK)
             return rv;
 
@@ -4227,10 +4401,9 @@ static int knitx_stmt_emit(struct knit *knit, struct knit_prs *prs, struct knit_
         rv = knitx_emit_expr_eval(knit, prs, stmt->u._while.cond, KEVAL_BOOLEAN, 0);  
         if (rv != KNIT_OK)
             return rv;
-        //?knitx_expr_destroy(knit, prs, condition);
         knitx_emit_2(knit, prs, KJMPFALSE, KINSN_ADDR_UNK); // will be backpatched to point to L2
         struct knit_patch_list *L2_pos = NULL; //L2
-        rv = knit_patch_loc_new_or_insert(knit, prs->curblk->block.insns.len - 1, &L2_pos); 
+        rv = knit_patch_loc_new_or_insert(knit, prs, prs->curblk->block.insns.len - 1, &L2_pos); 
         if (rv != KNIT_OK)
             return rv;
 
@@ -4253,6 +4426,15 @@ static int knitx_stmt_emit(struct knit *knit, struct knit_prs *prs, struct knit_
         if (rv != KNIT_OK)
             return rv;
     }
+    else if (stmt->stmttype == KSTMT_YIELD) {
+        rv = knitx_emit_expr_eval(knit, prs, stmt->u._expr, KEVAL_VALUE, 1);
+        if (rv != KNIT_OK)
+            return rv;
+        prs->curblk->block.generator = 1; //calling the function makes a generator
+        rv = knitx_emit_1(knit, prs, KYIELD);
+        if (rv != KNIT_OK)
+            return rv;
+    }
     else if (stmt->stmttype == KSTMT_IF) {
 
         /*
@@ -4272,7 +4454,7 @@ static int knitx_stmt_emit(struct knit *knit, struct knit_prs *prs, struct knit_
 
         struct knit_patch_list *L2_pos = NULL;
         knitx_emit_2(knit, prs, KJMPFALSE, KINSN_ADDR_UNK); //jump to the else part, or the statement after if in case there wasnt an else
-        rv = knit_patch_loc_new_or_insert(knit, prs->curblk->block.insns.len - 1, &L2_pos); 
+        rv = knit_patch_loc_new_or_insert(knit, prs, prs->curblk->block.insns.len - 1, &L2_pos); 
         if (rv != KNIT_OK)
             return rv;
 
@@ -4284,7 +4466,7 @@ static int knitx_stmt_emit(struct knit *knit, struct knit_prs *prs, struct knit_
         if (stmt->u._if._else != NULL) {
             //we jmp unconditionally in the if { block .. JMP }, this jmp is only needed if there is an else
             knitx_emit_2(knit, prs, KJMP, KINSN_ADDR_UNK); //jump the else body in case the initial if was matched
-            rv = knit_patch_loc_new_or_insert(knit, prs->curblk->block.insns.len - 1, &L3_pos); 
+            rv = knit_patch_loc_new_or_insert(knit, prs, prs->curblk->block.insns.len - 1, &L3_pos); 
             if (rv != KNIT_OK)
                 return rv;
         }
@@ -4318,12 +4500,14 @@ static int knitx_stmt_emit(struct knit *knit, struct knit_prs *prs, struct knit_
 }
 
 static int knitx_stmt_array_emit(struct knit *knit, struct knit_prs *prs, struct knit_stmt_darray *array) {
+    int lineno = prs->lineno; //what follows the body belongs to the enclosing statement
     for (int i=0; i<array->len; i++) {
         struct knit_stmt *stmt = array->data[i];
         int rv = knitx_stmt_emit(knit, prs, stmt); 
         if (rv != KNIT_OK)
             return rv;
     }
+    prs->lineno = lineno;
     return KNIT_OK;
 }
 
@@ -4332,7 +4516,7 @@ static int knitx_stmt_prs_new(struct knit *knit, struct knit_prs *prs, int allow
     int rv = KNIT_OK;
     struct knit_stmt *stmt;
     void *p;
-    rv  = knitx_tmalloc(knit, sizeof(struct knit_stmt), &p);  
+    rv  = knit_arena_alloc(&prs->arena, sizeof(struct knit_stmt), &p);  
     if (rv != KNIT_OK)
         return rv;
     stmt = p;
@@ -4341,12 +4525,6 @@ static int knitx_stmt_prs_new(struct knit *knit, struct knit_prs *prs, int allow
     return rv;
 }
 
-static int knitx_stmt_destroy(struct knit *knit, struct knit_prs *prs, struct knit_stmt *stmt) {
-    knitx_stmt_deinit(knit, prs, stmt);
-    knitx_tfree(knit, stmt);
-    return KNIT_OK;
-}
-
 //parse and emit a statement
 static int knitx_stmt_prs_emit(struct knit *knit, struct knit_prs *prs, int allowed_stmts) {
     /*
@@ -4366,7 +4544,6 @@ static int knitx_stmt_prs_emit(struct knit *knit, struct knit_prs *prs, int allo
     rv = knitx_stmt_emit(knit, prs, &stmt); 
     if (rv != KNIT_OK)
         return rv;
-    knitx_stmt_deinit(knit, prs, &stmt);
     return KNIT_OK;
 
 }
@@ -4375,6 +4552,8 @@ static int knitx_prog(struct knit *knit, struct knit_prs *prs) {
     int rv = KNIT_OK;
     while (!K_TOKEN_MATCHES(KAT_EOF) && rv == KNIT_OK) {
         rv = knitx_stmt_prs_emit(knit, prs, KSTMT_ALL); 
+        //nothing parsed for a top level statement is needed once it's emitted
+        knit_arena_reset(&prs->arena);
     }
     
     if (rv != KNIT_OK)
@@ -4482,8 +4661,6 @@ static int knitx_op_exec_binop(struct knit *knit, struct knit_stack *stack, int
     int rv = knitx_op_do_binop(knit, a, b, &r, op);
     if (rv != KNIT_OK)
         return rv;
-    knitx_obj_decref(knit, a);
-    knitx_obj_decref(knit, b);
     knitx_stack_assign_range_null(knit, stack, stack->vals.len - 1, stack->vals.len);
     knit_assert_h((rv == KNIT_OK && r) || (rv != KNIT_OK && !r), "");
     knitx_stack_assign_o(knit, stack, stack->vals.len - 2, ktobj(r));
@@ -4529,16 +4706,25 @@ static int knitx_op_exec_test_binop(struct knit *knit, struct knit_stack *stack,
     int rv = knitx_op_do_test_binop(knit, a, b, op);
     if (rv != KNIT_OK)
         return rv;
-    knitx_obj_decref(knit, a);
-    knitx_obj_decref(knit, b);
     knitx_stack_assign_range_null(knit, stack, stack->vals.len - 1, stack->vals.len);
     stack->vals.len -= 2; //pop2
     return rv;
 }
 
-//pushes it to stack
-static int knitx_do_global_load(struct knit *knit, struct knit_str *name) {
+//the globals of the module block was compiled for, NULL if it isn't a module's (see knitxr_import())
+static struct knit_dict *knitx_block_module(struct knit *knit, struct knit_block *block) {
+    struct knit_objp_darray *modules = &knit->ex.modules;
+    if (block->module <= 0 || block->module >= modules->len || !modules->data[block->module])
+        return NULL;
+    return &modules->data[block->module]->u.dict;
+}
+
+//pushes it to stack, a module's names that it didn't assign (like the builtins) are the instance's
+static int knitx_do_global_load(struct knit *knit, struct knit_dict *module, struct knit_str *name) {
     struct knit_exec_state *exs = &knit->ex;
+    struct knit_obj *value = NULL;
+    if (module && knitx_dict_lookup(knit, module, ktobj(name), &value) == KNIT_OK)
+        return knitx_stack_rpush(knit, &exs->stack, value);
     struct knit_vars_jadwal_iter iter;
     int rv = knit_vars_jadwal_find(&exs->global_ht, name, &iter);
     if (rv != KNIT_VARS_JADWAL_OK) {
@@ -4553,21 +4739,25 @@ static int knitx_do_global_load(struct knit *knit, struct knit_str *name) {
     return KNIT_OK;
 }
 
-//doesn't own name
-static int knitx_do_global_assign(struct knit *knit, struct knit_str *name, struct knit_obj *rhs) {
+//doesn't own name, module is where a module's code assigns its globals, NULL for the instance's
+static int knitx_do_global_assign(struct knit *knit, struct knit_dict *module, struct knit_str *name, struct knit_obj *rhs) {
+    if (module)
+        return knitx_dict_set(knit, module, ktobj(name), rhs);
     struct knit_exec_state *exs = &knit->ex;
     struct knit_vars_jadwal_iter iter;
     int rv = knit_vars_jadwal_find(&exs->global_ht, name, &iter);
     if (rv == KNIT_VARS_JADWAL_OK) {
-        //todo destroy previous value 
+        kincref(rhs);
+        kdecref(iter.pair->value);
         iter.pair->value = rhs;
     }
     else if (rv == KNIT_VARS_JADWAL_NOT_FOUND) {
-        struct knit_str *new_str;
-        rv = knitx_str_new_strcpy_gcobj(knit, &new_str, name->str); 
-        if (rv != KNIT_OK)
-            return rv;
-        rv = knit_vars_jadwal_insert(&exs->global_ht, name, &rhs);
+        struct knit_str key = *name;
+        key.cap = -1; //borrowed
+        knit_jadwal_use(&knit->allocator);
+        rv = knit_vars_jadwal_insert(&exs->global_ht, &key, &rhs);
+        if (rv == KNIT_VARS_JADWAL_OK)
+            kincref(rhs);
     }
 
     if (rv != KNIT_VARS_JADWAL_OK) {
@@ -4591,18 +4781,31 @@ static int knitx_eval_index_expr(struct knit *knit, struct knit_prs *prs, struct
 //useless function used as a debugging breakpoint
 static inline void kstepi() { return; }
 
-static int knitx_exec(struct knit *knit) {
+static int knitx_gen_call(struct knit *knit, struct knit_kfunc *func, int nargs); //fwd, see knit_generator.h
+//runs until the frame at entry_depth returns. a budgeted execution returns KNIT_SUSPENDED once knit->ex.budget runs out,
+//it's only counted down at backward jumps and calls
+static int knitx_exec_frames(struct knit *knit, int entry_depth, int budgeted) {
     struct knit_stack *stack = &knit->ex.stack;
     struct knit_frame_darray *frames = &knit->ex.stack.frames;
     struct knit_objp_darray *stack_vals = &knit->ex.stack.vals;
 
-    knit_assert_h(frames->len > 0, "");
+    knit_assert_h(frames->len > 0 && entry_depth > 0 && entry_depth <= frames->len, "");
     struct knit_frame *top_frm = &frames->data[frames->len-1];
     struct knit_block *block = top_frm->u.kf.block;
     knit_assert_h(top_frm->bsp >= 0 && top_frm->bsp <= stack_vals->len, "");
 
     int rv = KNIT_OK;
     while (1) {
+        //between instructions every live object is either on the stack or counted
+        if (knit->ex.heap.zct.len >= KNIT_ZCT_SCAN_THRESHOLD) {
+            knit_gc_zct_scan(knit);
+        }
+        //a full arena is reset early, like a nursery, so that long executions don't spill everything to the heap
+        if (knit->ex.heap.arena.full) {
+            if ((rv = knit_gc_arena_reset(knit)) != KNIT_OK)
+                return rv;
+            knit->ex.heap.arena.active = 1;
+        }
         knit_assert_s(top_frm->u.kf.ip < block->insns.len, "executing out of range instruction");
         struct knit_insn *insn = &block->insns.data[top_frm->u.kf.ip];
         int t = stack_vals->len; //values stack size, top of stack is stack_vals->data[t-1]
@@ -4617,10 +4820,6 @@ static int knitx_exec(struct knit *knit) {
         }
         else if (op == KPOP) {
             knit_assert_s(insn->op1 > 0 && insn->op1 <= stack_vals->len, "popping too many values");
-
-            for (int i=stack_vals->len - insn->op1; i < stack_vals->len; i++) {
-                kdecref(stack_vals->data[i]);
-            }
             rv = knitx_stack_rpop(knit, stack, insn->op1); 
             if (rv != KNIT_OK)
                 return rv;
@@ -4655,7 +4854,7 @@ static int knitx_exec(struct knit *knit) {
             rv = knitx_stack_rpop(knit, stack, 1); //pop name
             if (rv != KNIT_OK)
                 return rv; 
-            rv = knitx_do_global_load(knit, knit_as_str(var_name)); //value is pushed
+            rv = knitx_do_global_load(knit, knitx_block_module(knit, block), knit_as_str(var_name)); //value is pushed
         }
         else if (op == K_GLB_STORE) {
             /*inputs: (none)                       op: globals[s[t-2]] = s[t-1] */
@@ -4665,7 +4864,7 @@ static int knitx_exec(struct knit *knit) {
             struct knit_obj *lhs = stack_vals->data[stack_vals->len - 2];
             struct knit_obj *rhs = stack_vals->data[stack_vals->len - 1];
             //tmp global assumption
-            rv = knitx_do_global_assign(knit, knit_as_str(lhs), rhs);
+            rv = knitx_do_global_assign(knit, knitx_block_module(knit, block), knit_as_str(lhs), rhs);
             rv = knitx_stack_rpop(knit, stack, 2);
         }
         else if (op == KCALL) {
@@ -4714,12 +4913,28 @@ static int knitx_exec(struct knit *knit) {
                 knit_assert_h(top_frm->bsp >= 0 && top_frm->bsp <= stack_vals->len, "");
             }
             else if (func->u.ktype == KNIT_KFUNC) {
-                rv = knitx_stack_push_frame_for_kcall(knit, &func->u.kfunc.block, nargs, nexpected_returns);
-                //it is executed in the loop
-                top_frm = &frames->data[frames->len-1];
-                block   = top_frm->u.kf.block;
-                top_frm->u.kf.ip = -1; //undo the addition that happens at end of the loop
-                //the rest is handled in KRET
+                if (func->u.kfunc.block->src && (rv = knitx_kfunc_compile(knit, &func->u.kfunc)) != KNIT_OK)
+                    return rv;
+                if (func->u.kfunc.block->generator) {
+                    //it isn't run, like a C function it returns a generator (see knit_generator.h)
+                    if (nexpected_returns != 1 && nexpected_returns != KRES_UNKNOWN_KEEP_RET && nexpected_returns != KRES_UNKNOWN_DISCARD_RET) {
+                        return knit_error(knit, KNIT_RUNTIME_ERR, "calling a generator function returns a generator, expected %d values", nexpected_returns);
+                    }
+                    rv = knitx_gen_call(knit, &func->u.kfunc, nargs);
+                    if (rv != KNIT_OK)
+                        return rv;
+                }
+                else {
+                    rv = knitx_stack_push_frame_for_kcall(knit, func->u.kfunc.block, nargs, nexpected_returns);
+                    //it is executed in the loop
+                    top_frm = &frames->data[frames->len-1];
+                    block   = top_frm->u.kf.block;
+                    top_frm->u.kf.ip = -1; //undo the addition that happens at end of the loop
+                    //the rest is handled in KRET
+                    //charged the length of the function, deep recursion runs long without a loop
+                    if ((knit->ex.budget -= block->insns.len) <= 0 && budgeted)
+                        goto suspend;
+                }
             }
             else {
                 return knit_error(knit, KNIT_RUNTIME_ERR, "tried to call a non-callable type") /*ml?*/;
@@ -4781,6 +4996,12 @@ static int knitx_exec(struct knit *knit) {
                 if (idx->value < 0 || idx->value >= list->len) {
                     return knit_error(knit, KNIT_OUT_OF_RANGE_ERR, "index is out of range");
                 }
+                if (list->cap < 0) {
+                    return knit_error(knit, KNIT_RUNTIME_ERR, "trying to change a frozen list");
+                }
+                kincref(value);
+                kdecref(list->items[idx->value]);
+                knit_gc_write_barrier(knit, indexed, value);
                 list->items[idx->value] = value;
                 rv = knitx_stack_rpop(knit, stack, 3); 
                 if (rv != KNIT_OK)
@@ -4874,7 +5095,7 @@ static int knitx_exec(struct knit *knit) {
             rv = knitx_stack_pop_frame(knit, stack); 
 if (rv != KNIT_OK)
     return rv;
-            if (frames->len == 0) {
+            if (frames->len < entry_depth) {
                 goto done; //end of execution
             }
             top_frm = &frames->data[frames->len-1];
@@ -4884,7 +5105,16 @@ if (rv != KNIT_OK)
             knit_assert_h(top_frm->bsp >= 0 && top_frm->bsp <= stack_vals->len, "");
         }
         else if (op == KJMP) {
-            top_frm->u.kf.ip = insn->op1 - 1; 
+            if (insn->op1 <= top_frm->u.kf.ip) {
+                //a loop, charged the instructions from its start
+                knit->ex.budget -= top_frm->u.kf.ip - insn->op1 + 1;
+                top_frm->u.kf.ip = insn->op1 - 1;
+                if (knit->ex.budget <= 0 && budgeted)
+                    goto suspend;
+            }
+            else {
+                top_frm->u.kf.ip = insn->op1 - 1;
+            }
         }
         else if (op == KJMPTRUE) {
             if (knit->ex.last_cond)
@@ -4945,6 +5175,12 @@ if (rv != KNIT_OK)
         else if (op == KADD || op == KSUB || op == KMUL || op == KDIV || op == KMOD) {
             rv = knitx_op_exec_binop(knit, stack, op);
         }
+        else if (op == KYIELD) {
+            //the generator's frame is the only one on its stack, next() gets the value from the top (see knit_generator.h)
+            knit_assert_h(frames->len == 1 && entry_depth == 1, "yield outside of a generator's frame");
+            top_frm->u.kf.ip++; //it continues after the yield
+            goto done;
+        }
         else {
             return knit_runtime_error(knit, "insn not supported: %s", knit_insn_name(op));
         }
@@ -4956,6 +5192,14 @@ if (rv != KNIT_OK)
     }
 done:
     return KNIT_OK;
+suspend:
+    top_frm->u.kf.ip++; //it continues with the next instruction
+    return KNIT_SUSPENDED;
+}
+
+//runs the frames on top of the stack, a C function can run code (see knitxr_import()), this returns when the frame it was called for does
+static int knitx_exec(struct knit *knit) {
+    return knitx_exec_frames(knit, knit->ex.stack.frames.len, 0);
 }
 
 static int knitx_block_exec(struct knit *knit, struct knit_block *block, int nargs, int nexpret) {
@@ -4971,41 +5215,76 @@ static int knitx_block_exec(struct knit *knit, struct knit_block *block, int nar
     return KNIT_OK;
 }
 
-static int knitx_exec_str(struct knit *knit, const char *program) {
-    struct knit_prs prs;
-    int rv = KNIT_OK;
+//C-API
+//calls the knit function in the global name with the nargs values on top of the stack as its arguments, the first one on top
+//(the vm pushes them last to first). they're replaced by its return value
+static int knitx_call_global(struct knit *knit, const char *name, int nargs) {
+    struct knit_obj *func = NULL;
+    int rv = knitx_getvar_(knit, name, &func);
+    if (rv != KNIT_OK)
+        return rv;
+    if (func->u.ktype != KNIT_KFUNC)
+        return knit_error(knit, KNIT_INVALID_TYPE_ERR, "knitx_call_global(): '%s' isn't a function written in knit", name);
+    if (func->u.kfunc.block->src && (rv = knitx_kfunc_compile(knit, &func->u.kfunc)) != KNIT_OK)
+        return rv;
+    if (knit_objp_darray_push(&knit->ex.stack.vals, &func) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_call_global(): pushing the function failed");
+    if (func->u.kfunc.block->generator)
+        return knitx_gen_call(knit, &func->u.kfunc, nargs);
+    rv = knitx_stack_push_frame_for_kcall(knit, func->u.kfunc.block, nargs, 1);
+    if (rv != KNIT_OK)
+        return rv;
+    return knitx_exec(knit);
+}
 
+//runs a compiled program, used by knitx_exec_str() and the bytecode functions
+static int knitx_exec_toplevel(struct knit *knit, struct knit_block *block) {
 #ifdef KNIT_DEBUG_PRINT
     if (KNIT_DBG_PRINT) {
-        knitx_prs_init1(knit, &prs);
-        knitx_lexer_init_str(knit, &prs.lex, program);
-        knitx_lexdump(knit, &prs.lex);
-        knitx_lexer_deinit(knit, &prs.lex);
-        knitx_prs_deinit(knit, &prs);
+        knitx_block_dump(knit, block);
     }
-#endif 
+#endif
 
-    knitx_prs_init1(knit, &prs);
-    knitx_lexer_init_str(knit, &prs.lex, program);
-    knitx_prog(knit, &prs);
+    //the program's constants were created while compiling, they never come from the arena
+    knit->ex.heap.arena.active = knit->ex.heap.arena.enabled;
+    int rv = knitx_block_exec(knit, block, 0, 0);
+    if (knit->ex.heap.arena.enabled)
+        knit_gc_arena_reset(knit);
 
 #ifdef KNIT_DEBUG_PRINT
     if (KNIT_DBG_PRINT) {
-        knitx_block_dump(knit, &prs.curblk->block);
+        knitx_stack_dump(knit, &knit->ex.stack, -1, -1);
     }
 #endif
+    return rv;
+}
 
-    knitx_block_exec(knit, &prs.curblk->block, 0, 0);
-
+//the compiled program is prs.curblk->block, the caller deinitializes prs and its lexer before program goes away
+static int knitx_compile_buf(struct knit *knit, struct knit_prs *prs, const char *program, int len) {
 #ifdef KNIT_DEBUG_PRINT
     if (KNIT_DBG_PRINT) {
-        knitx_stack_dump(knit, &knit->ex.stack, -1, -1);
+        knitx_prs_init1(knit, prs);
+        knitx_lexer_init_buf(knit, &prs->lex, program, len);
+        knitx_lexdump(knit, &prs->lex);
+        knitx_lexer_deinit(knit, &prs->lex);
+        knitx_prs_deinit(knit, prs);
     }
-#endif
+#endif 
+
+    knitx_prs_init1(knit, prs);
+    knitx_lexer_init_buf(knit, &prs->lex, program, len);
+    return knitx_prog(knit, prs);
+}
+static int knitx_compile_str(struct knit *knit, struct knit_prs *prs, const char *program) {
+    return knitx_compile_buf(knit, prs, program, strlen(program));
+}
 
+static int knitx_exec_str(struct knit *knit, const char *program) {
+    struct knit_prs prs;
+    knitx_compile_str(knit, &prs, program);
+    knitx_exec_toplevel(knit, &prs.curblk->block);
     knitx_lexer_deinit(knit, &prs.lex);
     knitx_prs_deinit(knit, &prs);
-
     return KNIT_OK; //dummy
 }
 
@@ -5056,7 +5335,30 @@ static int knit_can_exec(const char *buf, int len) {
     return maxto;
 }
 
-static int knitx_init(struct knit *knit, int opts) {
+#include "knit_heap_profile.h"
+#include "knit_alloc_sample.h"
+#include "knit_objmap.h"
+#include "knit_mapped.h"
+#include "knit_knb.h"
+#include "knit_image.h"
+#include "knit_clone.h"
+#include "knit_parallel.h"
+#include "knit_program.h"
+#include "knit_frozen.h"
+#include "knit_module.h"
+static int knitxr_register_stdlib(struct knit *kstate); //fwd, see kruntime.h
+#include "knit_executor.h"
+#include "knit_channel.h"
+#include "knit_generator.h"
+
+//allocator is copied, NULL means libc. every allocation the instance makes goes through it
+static int knitx_init_with_allocator(struct knit *knit, int opts, const struct knit_allocator *allocator) {
+    if (!allocator)
+        allocator = &knit_libc_allocator;
+    knit->allocator = *allocator;
+    knit->container_allocator.realloc = allocator->realloc;
+    knit->container_allocator.free = allocator->free;
+    knit->container_allocator.ud = allocator->ud;
     if (opts & KNIT_POLICY_CONTINUE)
         knit_set_error_policy(knit, KNIT_POLICY_CONTINUE);
     else 
@@ -5064,11 +5366,18 @@ static int knitx_init(struct knit *knit, int opts) {
 #ifdef KNIT_MEM_STATS
     knit_mem_stats_init(&knit->mstats);
 #endif
+    knit_gc_stats_init(&knit->gc_stats);
+    knit_alloc_sampler_init(&knit->alloc_sampler);
+    knit->mapped = NULL;
     knit->ex.nresults = 0;
     knit->err_msg = NULL;
+    knit->is_err_msg_owned = 0;
     knit->err = KNIT_OK;
     return knitx_exec_state_init(knit, &knit->ex);
 }
+static int knitx_init(struct knit *knit, int opts) {
+    return knitx_init_with_allocator(knit, opts, NULL);
+}
 
 static void knit_obj_deinit(struct knit *knit, struct knit_obj *obj) {
     switch (obj->u.ktype) {
@@ -5079,15 +5388,471 @@ static void knit_obj_deinit(struct knit *knit, struct knit_obj *obj) {
         case KNIT_INT: break;
         case KNIT_CFUNC: break;
         case KNIT_KFUNC: knit_kfunc_deinit(knit, (struct knit_kfunc *)obj); break;
+        case KNIT_GENERATOR: knit_gen_free(knit, obj->u.generator.gen); break;
         case KNIT_TRUE: break;
         case KNIT_FALSE: break;
         default: knit_assert_h(0, "invalid type");
     }
 }
 
-static int knitx_deinit(struct knit *knit) {
+//collects garbage, then moves live objects together and resizes the heap to fit them
+//this invalidates pointers to gc objects held by C code
+static int knitx_gc_compact(struct knit *knit) {
+    return knit_gc_compact(knit);
+}
+
+//statistics of the collections done so far, knit_gc_stats.h has helpers for percentiles and the gc time share
+static const struct knit_gc_stats *knitx_gc_stats(struct knit *knit) {
+    return &knit->gc_stats;
+}
+static void knitx_gc_stats_dump(struct knit *knit) {
+    knit_gc_stats_dump(&knit->gc_stats);
+}
+
+//objects created while knitx_exec_str() runs a program come from an arena of ncells cells per size class (dicts get a quarter).
+//when it returns (or earlier, when the arena fills up), those still reachable from the value stack or globals are moved
+//to the heap and the arena is reset, so pointers to them that C code got during the execution are no longer valid. 0 turns the arena off
+static int knitx_request_arena(struct knit *knit, int ncells) {
+    struct knit_heap_arena *arena = &knit->ex.heap.arena;
+    if (arena->active)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_request_arena(): can't be changed during an execution");
+    if (arena->enabled) {
+        //objects are left over if the last reset failed
+        int rv = knit_gc_arena_reset(knit);
+        if (rv != KNIT_OK)
+            return rv;
+        knit_heap_arena_deinit(knit, arena);
+    }
+    if (ncells <= 0)
+        return KNIT_OK;
+    return knit_heap_arena_init(knit, arena, ncells);
+}
+
+//initializes dst as a copy of src: its globals, heap objects and compiled functions, with the same allocator and error policy.
+//this is much cheaper than registering the same functions and running the same prelude again.
+//src can't be executing, have generators or objects left in its request arena (if any). the builtins are shared, C functions the host registered are copied
+static int knitx_clone(struct knit *dst, struct knit *src) {
+    if (src->ex.stack.frames.len)
+        return knit_error(src, KNIT_RUNTIME_ERR, "knitx_clone(): can't clone an instance during an execution");
+    for (int c=0; c<KNIT_HEAP_NCLASSES && src->ex.heap.arena.enabled; c++) {
+        if (src->ex.heap.arena.classes[c].count)
+            return knit_error(src, KNIT_RUNTIME_ERR, "knitx_clone(): the request arena has objects that weren't evacuated");
+    }
+    if (src->ex.gens)
+        knit_gc_zct_scan(src); //generators that were dropped
+    if (src->ex.gens)
+        return knit_error(src, KNIT_RUNTIME_ERR, "knitx_clone(): generators can't be cloned");
+    int rv = knitx_init_with_allocator(dst, src->err_policy, &src->allocator);
+    if (rv != KNIT_OK)
+        return rv;
+    return knit_clone(dst, src);
+}
+
+//writes the heap, globals and compiled functions to path, knitx_load_image() starts an instance from them
+//without running anything. the value stack isn't saved, C functions registered by the host and generators can't be
+static int knitx_save_image(struct knit *knit, const char *path) {
+    if (knit->ex.stack.frames.len)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_save_image(): can't save an image during an execution");
+    for (int c=0; c<KNIT_HEAP_NCLASSES && knit->ex.heap.arena.enabled; c++) {
+        if (knit->ex.heap.arena.classes[c].count)
+            return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_save_image(): the request arena has objects that weren't evacuated");
+    }
+    if (knit->ex.gens)
+        knit_gc_zct_scan(knit); //generators that were dropped
+    if (knit->ex.gens)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_save_image(): generators can't be saved");
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_save_image(): couldn't open '%s' for writing", path);
+    int rv = knit_image_save(knit, f);
+    if (fclose(f) != 0 && rv == KNIT_OK)
+        rv = knit_error(knit, KNIT_RUNTIME_ERR, "knitx_save_image(): couldn't write '%s'", path);
+    return rv;
+}
+//initializes knit from an image written by knitx_save_image(), the file stays mapped until knitx_deinit()
+static int knitx_load_image(struct knit *knit, int opts, const char *path) {
+    int rv = knitx_init(knit, opts);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_mapped_file *mf;
+    if ((rv = knit_map_file(knit, "knitx_load_image()", path, &mf)) != KNIT_OK)
+        return rv;
+    return knit_image_load(knit, mf->addr, mf->len);
+}
+
+//compiles program and writes its bytecode to path (see knit_knb.h) without running it
+static int knitx_save_bytecode(struct knit *knit, const char *program, const char *path) {
+    struct knit_prs prs;
+    int rv = knitx_compile_str(knit, &prs, program);
+    if (rv == KNIT_OK)
+        rv = knitx_block_compile_all(knit, &prs.curblk->block);
+    if (rv == KNIT_OK && knit_knb_save_file(knit, &prs.curblk->block, program, strlen(program), path) != KNIT_OK)
+        rv = knit_error(knit, KNIT_RUNTIME_ERR, "knitx_save_bytecode(): couldn't write '%s'", path);
+    knitx_lexer_deinit(knit, &prs.lex);
+    knitx_prs_deinit(knit, &prs);
+    return rv;
+}
+//block was read by knit_knb_read()
+static int knitx_exec_knb_block(struct knit *knit, struct knit_block *block) {
+    int rv = knitx_exec_toplevel(knit, block);
+    knitx_block_deinit(knit, block);
+    knitx_tfree(knit, block);
+    return knit->err != KNIT_OK ? knit->err : rv;
+}
+static int knitx_exec_knb(struct knit *knit, struct knit_mapped_file *mf) {
+    struct knit_block *block;
+    int rv = knit_knb_read(knit, mf->addr, mf->len, 0, &block);
+    if (rv != KNIT_OK)
+        return rv;
+    return knitx_exec_knb_block(knit, block);
+}
+//runs bytecode written by knitx_save_bytecode(), the file stays mapped until knitx_deinit()
+static int knitx_exec_bytecode(struct knit *knit, const char *path) {
+    struct knit_mapped_file *mf;
+    int rv = knit_map_file(knit, "knitx_exec_bytecode()", path, &mf);
+    if (rv != KNIT_OK)
+        return rv;
+    if (!knit_knb_matches(mf->addr, mf->len, NULL, 0)) {
+        knit_unmap_file(knit, mf);
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_exec_bytecode(): '%s' wasn't written by this version", path);
+    }
+    return knitx_exec_knb(knit, mf);
+}
+//runs program from the bytecode in cache_path if it was compiled from the same source, otherwise compiles program,
+//writes its bytecode to cache_path and runs it. the cache is best effort, failing to write it isn't an error,
+//and a file whose header matches but whose contents don't load is written again
+static int knitx_exec_cached_buf(struct knit *knit, const char *program, int len, const char *cache_path) {
+    struct knit_mapped_file *mf;
+    if (knit_map_file(knit, NULL, cache_path, &mf) == KNIT_OK) {
+        struct knit_block *block;
+        if (knit_knb_matches(mf->addr, mf->len, program, len) && knit_knb_read(knit, mf->addr, mf->len, 1, &block) == KNIT_OK)
+            return knitx_exec_knb_block(knit, block);
+        //nothing references the constants read before a corrupt part, they can point into an unmapped file
+        knit_unmap_file(knit, mf);
+    }
+    struct knit_prs prs;
+    int rv = knitx_compile_buf(knit, &prs, program, len);
+    //the cache is only written on a miss, later runs get every function compiled for free
+    if (rv == KNIT_OK)
+        rv = knitx_block_compile_all(knit, &prs.curblk->block);
+    if (rv == KNIT_OK) {
+        knit_knb_save_file(knit, &prs.curblk->block, program, len, cache_path);
+        rv = knitx_exec_toplevel(knit, &prs.curblk->block);
+    }
+    knitx_lexer_deinit(knit, &prs.lex);
+    knitx_prs_deinit(knit, &prs);
+    return knit->err != KNIT_OK ? knit->err : rv;
+}
+static int knitx_exec_cached(struct knit *knit, const char *program, const char *cache_path) {
+    return knitx_exec_cached_buf(knit, program, strlen(program), cache_path);
+}
+/*
+    runs the script in path without reading it into memory: it's mapped until knitx_deinit(),
+    the functions that aren't compiled yet keep pointing into it instead of copying their source.
+    with cache_path it's like knitx_exec_cached().
+    KNIT_NOT_FOUND is returned without an error when path is empty or can't be mapped (a pipe, no mmap() support),
+    the caller can read it another way. otherwise it's KNIT_OK or the error that stopped the script (knit->err)
+*/
+static int knitx_exec_file(struct knit *knit, const char *path, const char *cache_path) {
+#ifdef KNIT_HAVE_MMAP
+    struct knit_mapped_file *mf;
+    int rv = knit_map_file(knit, NULL, path, &mf);
+    if (rv != KNIT_OK)
+        return rv;
+    if (cache_path)
+        return knitx_exec_cached_buf(knit, mf->addr, mf->len, cache_path);
+    struct knit_prs prs;
+    rv = knitx_compile_buf(knit, &prs, mf->addr, mf->len);
+    if (rv == KNIT_OK)
+        rv = knitx_exec_toplevel(knit, &prs.curblk->block);
+    knitx_lexer_deinit(knit, &prs.lex);
+    knitx_prs_deinit(knit, &prs);
+    return knit->err != KNIT_OK ? knit->err : rv;
+#else
+    return KNIT_NOT_FOUND; //it would only be read into memory
+#endif
+}
+
+/*
+    compiles n programs on nthreads threads (0 uses one per core), then runs them one after the other as if they were one script.
+    unlike knitx_exec_str() every function is compiled before anything runs, so a syntax error anywhere stops the whole program.
+    lens[i] is the length of programs[i], which doesn't need to be null terminated. see knit_parallel.h
+*/
+static int knitx_exec_parallel(struct knit *knit, const char **programs, const int *lens, int n, int nthreads) {
+    struct knit_parallel_unit *units = NULL;
+    if (n <= 0)
+        return KNIT_OK;
+    int rv = knitx_rmalloc(knit, n * sizeof units[0], (void **) &units);
+    if (rv != KNIT_OK)
+        return rv;
+    for (int i=0; i<n; i++) {
+        units[i].src = programs[i];
+        units[i].len = lens[i];
+        units[i].lineno = 1;
+    }
+    rv = knit_parallel_exec(knit, units, n, nthreads);
+    knitx_rfree(knit, units);
+    return rv;
+}
+//like knitx_exec_parallel() for one program, it's split after top level statements into a few units per thread
+static int knitx_exec_str_parallel(struct knit *knit, const char *program, int nthreads) {
+    struct knit_parallel_unit *units = NULL;
+    int len = strlen(program);
+    if (nthreads <= 0)
+        nthreads = knit_parallel_ncores();
+    int unitlen = len / (nthreads * KNIT_PARALLEL_UNITS_PER_THREAD);
+    if (unitlen < KNIT_PARALLEL_MIN_UNIT)
+        unitlen = KNIT_PARALLEL_MIN_UNIT;
+    int rv = knitx_rmalloc(knit, (len / unitlen + 1) * sizeof units[0], (void **) &units);
+    if (rv != KNIT_OK)
+        return rv;
+    int n = knit_parallel_split(program, len, unitlen, units);
+    rv = knit_parallel_exec(knit, units, n, nthreads);
+    knitx_rfree(knit, units);
+    return rv;
+}
+
+/*
+    compiles program into a knit_program that belongs to no instance, any number of them can run it at the same time
+    on their own threads (see knit_program.h). knit is only where errors are reported. every function is compiled,
+    a syntax error anywhere fails the compilation
+*/
+static int knitx_program_compile_buf(struct knit *knit, const char *program, int len, struct knit_program **progp) {
+    return knit_program_build(knit, "knitx_program_compile()", program, len, progp);
+}
+static int knitx_program_compile(struct knit *knit, const char *program, struct knit_program **progp) {
+    return knitx_program_compile_buf(knit, program, strlen(program), progp);
+}
+//runs prog like knitx_exec_str() runs a script, prog is only read
+static int knitx_exec_program(struct knit *knit, const struct knit_program *prog) {
+    return knitx_exec_toplevel(knit, prog->block);
+}
+/*
+    budgeted execution, to run many scripts on one thread in turns with a bounded latency:
+    knitx_exec_budget() runs the frames on top of the stack like knitx_exec() but returns KNIT_SUSPENDED after about
+    n_insns instructions, everything needed to continue stays in knit->ex. knitx_resume() continues with another budget,
+    until it returns something other than KNIT_SUSPENDED. the count is approximate, it's only charged at backward jumps
+    (the length of the loop) and calls (the length of the function), code without either runs to its next check.
+    only the budgeted execution itself suspends: code run by a C function (next() of a generator, import()) runs to its end
+    and the budget is checked again after it. while it's suspended the instance can run other code on top of its frames,
+    but not another budgeted execution
+*/
+static int knitx_resume(struct knit *knit, int64_t n_insns) {
+    if (!knit->ex.budget_depth)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_resume(): there is no suspended execution");
+    if (knit->ex.budget != KNIT_BUDGET_NONE)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_resume(): the budgeted execution is running");
+    knit_assert_h(knit->ex.stack.frames.len >= knit->ex.budget_depth, "the suspended frames were popped");
+    knit->ex.budget = n_insns > 0 && n_insns < KNIT_BUDGET_NONE ? n_insns : KNIT_BUDGET_NONE - 1;
+    int rv = knitx_exec_frames(knit, knit->ex.budget_depth, 1);
+    knit->ex.budget = KNIT_BUDGET_NONE;
+    if (rv != KNIT_SUSPENDED)
+        knit->ex.budget_depth = 0;
+    return rv;
+}
+static int knitx_exec_budget(struct knit *knit, int64_t n_insns) {
+    if (knit->ex.budget_depth)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_exec_budget(): a budgeted execution is already running or suspended");
+    if (knit->ex.stack.frames.len == 0)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_exec_budget(): there is nothing to run");
+    knit->ex.budget_depth = knit->ex.stack.frames.len;
+    return knitx_resume(knit, n_insns);
+}
+//starts prog like knitx_exec_program() in a budgeted execution. it allocates from the heap, the request arena isn't used
+static int knitx_exec_program_budget(struct knit *knit, const struct knit_program *prog, int64_t n_insns) {
+    int rv = knitx_stack_rpush(knit, &knit->ex.stack, ktobj(&knull));
+    if (rv != KNIT_OK)
+        return rv;
+    if ((rv = knitx_stack_push_frame_for_kcall(knit, prog->block, 0, 0)) != KNIT_OK)
+        return rv;
+    return knitx_exec_budget(knit, n_insns);
+}
+//every instance that ran prog must be deinitialized first, their globals may borrow names from it
+static void knitx_program_free(struct knit_program *prog) {
+    knit_program_free(prog);
+}
+
+/*
+    moves the list, dict or string the global varname holds into a frozen region of its own (see knit_frozen.h),
+    varname is rebound to the frozen copy and the heap objects are collected once nothing else references them.
+    the region is never written again, so it can be published to other instances on other threads
+*/
+static int knitx_freeze(struct knit *knit, const char *varname, struct knit_frozen **frozenp) {
+    struct knit_obj *obj = NULL;
+    int rv = knitx_getvar_(knit, varname, &obj);
+    if (rv != KNIT_OK)
+        return rv;
+    if ((rv = knit_frozen_build(knit, obj, frozenp)) != KNIT_OK)
+        return rv;
+    struct knit_str name;
+    if ((rv = knitx_str_init_const_str(knit, &name, varname)) != KNIT_OK)
+        return rv;
+    return knitx_do_global_assign(knit, NULL, &name, (*frozenp)->root);
+}
+//binds the global name to frozen's root without copying anything. name is borrowed like knitx_register_cfunction()'s
+static int knitx_frozen_publish(struct knit *knit, const char *name, const struct knit_frozen *frozen) {
+    struct knit_str name_str;
+    int rv = knitx_str_init_const_str(knit, &name_str, name);
+    if (rv != KNIT_OK)
+        return rv;
+    return knitx_do_global_assign(knit, NULL, &name_str, frozen->root);
+}
+//every instance frozen was published to (and the one that froze it) must be deinitialized first, or never read it again
+static void knitx_frozen_free(struct knit_frozen *frozen) {
+    knit_frozen_free(frozen);
+}
+
+#ifdef KNIT_HAVE_PTHREADS
+static void knitx_executor_deinit(struct knit_executor *ex); //fwd
+/*
+    starts nthreads workers (0 is one per core), each with an instance that has the stdlib and ran prelude (NULL for none).
+    the queue holds queue_len jobs, rounded up to a power of two. see knit_executor.h.
+    if a worker's instance couldn't be made every worker is stopped and that error is returned
+*/
+static int knitx_executor_init(struct knit_executor *ex, int nthreads, const struct knit_program *prelude, int queue_len) {
+    if (nthreads <= 0)
+        nthreads = knit_parallel_ncores();
+    memset(ex, 0, sizeof *ex);
+    ex->workers = calloc(nthreads, sizeof ex->workers[0]);
+    if (!ex->workers || !knit_ring_init(&ex->queue, queue_len)) {
+        free(ex->workers);
+        return KNIT_NOMEM;
+    }
+    ex->prelude = prelude;
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->wake, NULL);
+    pthread_cond_init(&ex->finished, NULL);
+    int created = 1;
+    for (int i=0; i<nthreads && created; i++) {
+        struct knit_executor_worker *w = &ex->workers[i];
+        w->ex = ex;
+        w->index = i;
+        created = pthread_create(&w->thread, NULL, knit_executor_work, w) == 0;
+        ex->nworkers += created;
+    }
+    pthread_mutex_lock(&ex->lock);
+    if (!created && ex->start_rv == KNIT_OK)
+        ex->start_rv = KNIT_RUNTIME_ERR;
+    while (ex->nstarted < ex->nworkers)
+        pthread_cond_wait(&ex->finished, &ex->lock);
+    int rv = ex->start_rv;
+    pthread_mutex_unlock(&ex->lock);
+    if (rv != KNIT_OK)
+        knitx_executor_deinit(ex);
+    return rv;
+}
+//job runs on a worker, it must stay valid until knitx_job_wait() returns or its done callback is called.
+//this waits for room when the queue is full
+static void knitx_executor_submit(struct knit_executor *ex, struct knit_job *job) {
+    atomic_init(&job->finished, 0);
+    while (!knit_ring_push(&ex->queue, job))
+        sched_yield();
+    knit_executor_wake(ex, 0);
+}
+//returns job->rv, job can't have a done callback
+static int knitx_job_wait(struct knit_executor *ex, struct knit_job *job) {
+    for (int i=0; i<KNIT_EXECUTOR_SPINS && !atomic_load(&job->finished); i++) {
+        if (i % 64 == 63)
+            sched_yield();
+    }
+    if (!atomic_load(&job->finished)) {
+        pthread_mutex_lock(&ex->lock);
+        atomic_fetch_add(&ex->nwaiting, 1);
+        while (!atomic_load(&job->finished))
+            pthread_cond_wait(&ex->finished, &ex->lock);
+        atomic_fetch_sub(&ex->nwaiting, 1);
+        pthread_mutex_unlock(&ex->lock);
+    }
+    return job->rv;
+}
+//frees what the worker allocated for a finished job
+static void knitx_job_deinit(struct knit_job *job) {
+    if (job->result.ktype == KNIT_STR)
+        free((char *) job->result.str);
+    free(job->err_msg);
+    job->result = (struct knit_value) {.ktype = KNIT_NULL};
+    job->err_msg = NULL;
+}
+//the jobs in the queue are run, then the workers stop
+static void knitx_executor_deinit(struct knit_executor *ex) {
+    atomic_store(&ex->stopping, 1);
+    pthread_mutex_lock(&ex->lock);
+    pthread_cond_broadcast(&ex->wake);
+    pthread_mutex_unlock(&ex->lock);
+    for (int i=0; i<ex->nworkers; i++)
+        pthread_join(ex->workers[i].thread, NULL);
+    pthread_cond_destroy(&ex->finished);
+    pthread_cond_destroy(&ex->wake);
+    pthread_mutex_destroy(&ex->lock);
+    free(ex->workers);
+    knit_ring_deinit(&ex->queue);
+}
+
+//a channel holds len messages, rounded up to a power of two. see knit_channel.h
+static int knitx_channel_init(struct knit_channel *ch, int len) {
+    memset(ch, 0, sizeof *ch);
+    if (!knit_ring_init(&ch->ring, len))
+        return KNIT_NOMEM;
+    ch->ktype = KNIT_CHANNEL;
+    pthread_mutex_init(&ch->lock, NULL);
+    pthread_cond_init(&ch->changed, NULL);
     return KNIT_OK;
 }
+//binds the global name to ch, name is borrowed like knitx_register_cfunction()'s
+static int knitx_channel_publish(struct knit *knit, const char *name, struct knit_channel *ch) {
+    struct knit_str name_str;
+    int rv = knitx_str_init_const_str(knit, &name_str, name);
+    if (rv != KNIT_OK)
+        return rv;
+    return knitx_do_global_assign(knit, NULL, &name_str, ktobj(ch));
+}
+//sending fails from now on, receivers get what was sent before and then null instead of waiting
+static void knitx_channel_close(struct knit_channel *ch) {
+    atomic_store(&ch->closed, 1);
+    pthread_mutex_lock(&ch->lock);
+    pthread_cond_broadcast(&ch->changed);
+    pthread_mutex_unlock(&ch->lock);
+}
+//nothing may use ch anymore, the messages nobody received are dropped
+static void knitx_channel_deinit(struct knit_channel *ch) {
+    struct knit_channel_msg *msg;
+    while ((msg = knit_ring_pop(&ch->ring)) != NULL)
+        free(msg);
+    pthread_cond_destroy(&ch->changed);
+    pthread_mutex_destroy(&ch->lock);
+    knit_ring_deinit(&ch->ring);
+}
+#endif
+
+//writes a json heap snapshot to path (see knit_heap_profile.h)
+static int knitx_heap_snapshot(struct knit *knit, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_heap_snapshot(): couldn't open '%s' for writing", path);
+    int rv = knit_heap_profile_snapshot(knit, f);
+    if (fclose(f) != 0 && rv == KNIT_OK)
+        rv = knit_error(knit, KNIT_RUNTIME_ERR, "knitx_heap_snapshot(): couldn't write '%s'", path);
+    return rv;
+}
+
+//samples the call stack every interval allocated bytes, 0 stops sampling (see knit_alloc_sample.h)
+static void knitx_alloc_sampling(struct knit *knit, size_t interval) {
+    knit_alloc_sampler_start(&knit->alloc_sampler, interval);
+}
+//writes the samples taken so far as folded stacks
+static void knitx_alloc_sample_report(struct knit *knit, FILE *f) {
+    knit_alloc_sample_report(knit, &knit->alloc_sampler, f);
+}
+
+//frees everything the instance has. the programs, frozen regions and channels it used aren't its own.
+//the files go last, the functions it loaded from them check where their source is
+static int knitx_deinit(struct knit *knit) {
+    int rv = knitx_exec_state_deinit(knit, &knit->ex);
+    knit_clear_error(knit);
+    knit_alloc_sampler_deinit(knit, &knit->alloc_sampler);
+    knit_unmap_files(knit);
+    return rv;
+}
 
 #include "kruntime.h" //runtime functions
 #endif
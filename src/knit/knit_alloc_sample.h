@@ -0,0 +1,170 @@
+#ifndef KNIT_ALLOC_SAMPLE_H
+#define KNIT_ALLOC_SAMPLE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include "kdata.h"
+
+/*
+    allocation sampling:
+    every interval allocated bytes (gc cells and knitx_rmalloc/knitx_rrealloc memory) the current call stack is recorded,
+    and charged with interval bytes, so sites that allocate a lot show up in proportion to how much they allocate.
+    samples with the same stack are merged when recorded. the report is in the folded format
+    used by flamegraph.pl and speedscope: one line per stack, frames separated by ';' and followed by the bytes,
+    a frame is main:LINE for file scope code, function@DEFLINE:LINE for code in a function.
+    the sampler's own memory comes from the instance allocator directly, not knitx_rmalloc(), so that it doesn't sample itself.
+*/
+#define KNIT_ALLOC_SAMPLE_DEFAULT_INTERVAL 4096
+
+static void knit_alloc_sampler_init(struct knit_alloc_sampler *s) {
+    memset(s, 0, sizeof *s);
+}
+static void knit_alloc_sampler_deinit(struct knit *knit, struct knit_alloc_sampler *s) {
+    knit->allocator.free(knit->allocator.ud, s->samples);
+    knit->allocator.free(knit->allocator.ud, s->frames);
+    knit->allocator.free(knit->allocator.ud, s->index);
+    knit_alloc_sampler_init(s);
+}
+static void knit_alloc_sampler_start(struct knit_alloc_sampler *s, size_t interval) {
+    s->interval = interval;
+    s->countdown = interval;
+}
+static int knit_alloc_sampler_reserve(struct knit *knit, void **arr, int *cap, int needed, size_t elem_sz) {
+    if (needed <= *cap)
+        return KNIT_OK;
+    int new_cap = *cap ? *cap : 64;
+    while (new_cap < needed)
+        new_cap *= 2;
+    void *p = knit->allocator.realloc(knit->allocator.ud, *arr, new_cap * elem_sz);
+    if (!p)
+        return KNIT_NOMEM;
+    *arr = p;
+    *cap = new_cap;
+    return KNIT_OK;
+}
+static unsigned knit_alloc_frames_hash(struct knit_alloc_frame *frames, int n) {
+    unsigned h = 2166136261u;
+    for (int i=0; i<n; i++) {
+        h = (h ^ (unsigned) frames[i].kind)    * 16777619u;
+        h = (h ^ (unsigned) frames[i].defline) * 16777619u;
+        h = (h ^ (unsigned) frames[i].lineno)  * 16777619u;
+    }
+    return h;
+}
+//index maps stack hashes to samples, open addressing, -1 is an empty slot
+static int knit_alloc_sampler_reindex(struct knit *knit, struct knit_alloc_sampler *s, int cap) {
+    int *index = knit->allocator.alloc(knit->allocator.ud, cap * sizeof index[0]);
+    if (!index)
+        return KNIT_NOMEM;
+    for (int i=0; i<cap; i++)
+        index[i] = -1;
+    for (int i=0; i<s->nsamples; i++) {
+        unsigned slot = s->samples[i].hash & (cap - 1);
+        while (index[slot] != -1)
+            slot = (slot + 1) & (cap - 1);
+        index[slot] = i;
+    }
+    knit->allocator.free(knit->allocator.ud, s->index);
+    s->index = index;
+    s->index_cap = cap;
+    return KNIT_OK;
+}
+static int knit_alloc_sample_same_stack(struct knit_alloc_sampler *s, struct knit_alloc_sample *sample, struct knit_alloc_frame *frames, int n) {
+    return sample->nframes == n && !memcmp(&s->frames[sample->first_frame], frames, n * sizeof frames[0]);
+}
+static void knit_alloc_sample_record(struct knit *knit, size_t bytes) {
+    struct knit_alloc_sampler *s = &knit->alloc_sampler;
+    struct knit_frame_darray *kframes = &knit->ex.stack.frames;
+    int n = kframes->len ? kframes->len : 1;
+    //samples are dropped if the sampler runs out of memory, the profile is only statistical anyway
+    if (knit_alloc_sampler_reserve(knit, (void **) &s->frames, &s->frames_cap, s->nframes + n, sizeof s->frames[0]) != KNIT_OK)
+        return;
+    if (s->index_cap < (s->nsamples + 1) * 2) {
+        int cap = s->index_cap ? s->index_cap : 128;
+        while (cap < (s->nsamples + 1) * 2)
+            cap *= 2;
+        if (knit_alloc_sampler_reindex(knit, s, cap) != KNIT_OK)
+            return;
+    }
+
+    //the stack is written after the recorded frames, and kept only if it wasn't seen before
+    struct knit_alloc_frame *frames = &s->frames[s->nframes];
+    if (!kframes->len) {
+        frames[0].kind = -1;
+        frames[0].defline = 0;
+        frames[0].lineno = 0;
+    }
+    for (int i=0; i<kframes->len; i++) {
+        struct knit_frame *frame = &kframes->data[i];
+        frames[i].kind = frame->frame_type;
+        frames[i].defline = 0;
+        frames[i].lineno = 0;
+        if (frame->frame_type == KNIT_FRAME_KBLOCK) {
+            struct knit_block *block = frame->u.kf.block;
+            frames[i].defline = block->lineno;
+            //a frame that was just pushed has ip -1 until its first instruction runs
+            frames[i].lineno = knitx_block_lineno(block, frame->u.kf.ip < 0 ? 0 : frame->u.kf.ip);
+        }
+    }
+    unsigned hash = knit_alloc_frames_hash(frames, n);
+    unsigned slot = hash & (s->index_cap - 1);
+    for (; s->index[slot] != -1; slot = (slot + 1) & (s->index_cap - 1)) {
+        struct knit_alloc_sample *sample = &s->samples[s->index[slot]];
+        if (sample->hash == hash && knit_alloc_sample_same_stack(s, sample, frames, n)) {
+            sample->bytes += bytes;
+            return;
+        }
+    }
+    if (knit_alloc_sampler_reserve(knit, (void **) &s->samples, &s->samples_cap, s->nsamples + 1, sizeof s->samples[0]) != KNIT_OK)
+        return;
+    struct knit_alloc_sample *sample = &s->samples[s->nsamples];
+    sample->first_frame = s->nframes;
+    sample->nframes = n;
+    sample->bytes = bytes;
+    sample->hash = hash;
+    s->index[slot] = s->nsamples++;
+    s->nframes += n;
+}
+//called for every allocation while sampling is on, sz can span several intervals
+static void knit_alloc_sample(struct knit *knit, size_t sz) {
+    struct knit_alloc_sampler *s = &knit->alloc_sampler;
+    if (sz < s->countdown) {
+        s->countdown -= sz;
+        return;
+    }
+    size_t over = sz - s->countdown;
+    s->countdown = s->interval - over % s->interval;
+    knit_alloc_sample_record(knit, (over / s->interval + 1) * s->interval);
+}
+
+static int knit_alloc_sample_cmp_bytes(const void *a, const void *b) {
+    const struct knit_alloc_sample *sa = a, *sb = b;
+    if (sa->bytes != sb->bytes)
+        return sa->bytes < sb->bytes ? 1 : -1;
+    return 0;
+}
+//writes the folded stacks, biggest first
+static void knit_alloc_sample_report(struct knit *knit, struct knit_alloc_sampler *s, FILE *f) {
+    qsort(s->samples, s->nsamples, sizeof s->samples[0], knit_alloc_sample_cmp_bytes);
+    //the index refers to the old order
+    knit->allocator.free(knit->allocator.ud, s->index);
+    s->index = NULL;
+    s->index_cap = 0;
+    for (int i=0; i<s->nsamples; i++) {
+        struct knit_alloc_sample *sample = &s->samples[i];
+        for (int j=0; j<sample->nframes; j++) {
+            struct knit_alloc_frame *frame = &s->frames[sample->first_frame + j];
+            if (j)
+                fputc(';', f);
+            if (frame->kind == -1)
+                fprintf(f, "<compile>");
+            else if (frame->kind == KNIT_FRAME_CFUNC)
+                fprintf(f, "<builtin>");
+            else if (frame->defline == 0)
+                fprintf(f, "main:%d", frame->lineno);
+            else
+                fprintf(f, "function@%d:%d", frame->defline, frame->lineno);
+        }
+        fprintf(f, " %llu\n", (unsigned long long) sample->bytes);
+    }
+}
+#endif
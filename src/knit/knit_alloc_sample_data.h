@@ -0,0 +1,29 @@
+#ifndef KNIT_ALLOC_SAMPLE_DATA_H
+#define KNIT_ALLOC_SAMPLE_DATA_H
+#include <stddef.h>
+
+//a frame of a sampled call stack, resolved to lines when sampled since blocks can be freed before the report
+struct knit_alloc_frame {
+    int kind; //enum KNIT_FRAME_TYPE, or -1 for allocations made while compiling
+    int defline; //the line the function is defined at, 0 for file scope
+    int lineno;
+};
+struct knit_alloc_sample {
+    int first_frame; //index in frames
+    int nframes;
+    size_t bytes; //the allocated bytes this sample stands for
+    unsigned hash; //of the frames
+};
+struct knit_alloc_sampler {
+    size_t interval; //a sample is taken every interval allocated bytes, 0 disables sampling
+    size_t countdown; //bytes left until the next sample
+    struct knit_alloc_sample *samples;
+    int nsamples;
+    int samples_cap;
+    struct knit_alloc_frame *frames;
+    int nframes;
+    int frames_cap;
+    int *index; //hash table of samples, to merge samples with the same stack
+    int index_cap;
+};
+#endif
@@ -0,0 +1,118 @@
+#ifndef KNIT_ARENA_H
+#define KNIT_ARENA_H
+#include "kdata.h"
+
+/*
+    bump arena for compile time structures (expressions, statements, patch lists, name chains, token strings).
+    they all die together, either after a top level statement is emitted or when the parser is released,
+    so nothing is freed individually. chunks come from knitx_rmalloc().
+    knit_arena_dyn_realloc() and knit_arena_dyn_free() let darrays live in the arena too,
+    those blocks are prefixed by their size so they can be copied when they grow.
+*/
+
+static size_t knit_arena_align(size_t sz) {
+    return (sz + KNIT_ARENA_ALIGN - 1) & ~(size_t) (KNIT_ARENA_ALIGN - 1);
+}
+static char *knit_arena_chunk_data(struct knit_arena_chunk *chunk) {
+    return (char *) chunk + knit_arena_align(sizeof *chunk);
+}
+static void knit_arena_init(struct knit *knit, struct knit_arena *arena) {
+    memset(arena, 0, sizeof *arena);
+    arena->knit = knit;
+}
+static int knit_arena_chunk_new(struct knit_arena *arena, size_t sz, struct knit_arena_chunk **chunkp) {
+    void *p = NULL;
+    int rv = knitx_rmalloc(arena->knit, knit_arena_align(sizeof **chunkp) + sz, &p);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_arena_chunk *chunk = p;
+    chunk->sz = sz;
+    *chunkp = chunk;
+    return KNIT_OK;
+}
+static int knit_arena_alloc(struct knit_arena *arena, size_t sz, void **m) {
+    sz = knit_arena_align(sz ? sz : 1);
+    *m = NULL;
+    if (sz > (size_t) (arena->end - arena->cur)) {
+        struct knit_arena_chunk *chunk;
+        if (sz > KNIT_ARENA_CHUNK_SZ / 4 && arena->chunks) {
+            //a dedicated chunk behind the current one, so the space left in the current one isn't wasted
+            int rv = knit_arena_chunk_new(arena, sz, &chunk);
+            if (rv != KNIT_OK)
+                return rv;
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+            arena->used += sz;
+            *m = knit_arena_chunk_data(chunk);
+            return KNIT_OK;
+        }
+        int rv = knit_arena_chunk_new(arena, sz > KNIT_ARENA_CHUNK_SZ ? sz : KNIT_ARENA_CHUNK_SZ, &chunk);
+        if (rv != KNIT_OK)
+            return rv;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->cur = knit_arena_chunk_data(chunk);
+        arena->end = arena->cur + chunk->sz;
+    }
+    arena->last = arena->cur;
+    arena->cur += sz;
+    arena->used += sz;
+    *m = arena->last;
+    return KNIT_OK;
+}
+//frees everything but the newest chunk, which is reused
+static void knit_arena_reset(struct knit_arena *arena) {
+    if (!arena->chunks)
+        return;
+    struct knit_arena_chunk *chunk = arena->chunks->next;
+    while (chunk) {
+        struct knit_arena_chunk *next = chunk->next;
+        knitx_rfree(arena->knit, chunk);
+        chunk = next;
+    }
+    arena->chunks->next = NULL;
+    arena->cur = knit_arena_chunk_data(arena->chunks);
+    arena->end = arena->cur + arena->chunks->sz;
+    arena->last = NULL;
+    arena->used = 0;
+}
+static void knit_arena_deinit(struct knit_arena *arena) {
+    knit_arena_reset(arena);
+    if (arena->chunks)
+        knitx_rfree(arena->knit, arena->chunks);
+    knit_arena_init(arena->knit, arena);
+}
+
+//ud is the arena
+static void *knit_arena_dyn_realloc(void *ud, void *p, size_t sz) {
+    struct knit_arena *arena = ud;
+    size_t hdr = knit_arena_align(sizeof(size_t));
+    if (p) {
+        char *block = (char *) p - hdr;
+        size_t old_sz = *(size_t *) block;
+        //the last allocation grows in place
+        if (block == arena->last && knit_arena_align(hdr + sz) <= (size_t) (arena->end - block)) {
+            size_t new_end = knit_arena_align(hdr + sz);
+            arena->used += new_end - (arena->cur - block);
+            arena->cur = block + new_end;
+            *(size_t *) block = sz;
+            return p;
+        }
+        if (sz <= old_sz) {
+            *(size_t *) block = sz;
+            return p;
+        }
+    }
+    void *m = NULL;
+    if (knit_arena_alloc(arena, hdr + sz, &m) != KNIT_OK)
+        return NULL;
+    *(size_t *) m = sz;
+    if (p)
+        memcpy((char *) m + hdr, p, *(size_t *) ((char *) p - hdr));
+    return (char *) m + hdr;
+}
+static void knit_arena_dyn_free(void *ud, void *p) {
+    (void) ud;
+    (void) p;
+}
+#endif
@@ -0,0 +1,22 @@
+#ifndef KNIT_ARENA_DATA_H
+#define KNIT_ARENA_DATA_H
+#include <stddef.h>
+
+#define KNIT_ARENA_CHUNK_SZ (64 * 1024) //allocations bigger than a quarter of this get their own chunk
+#define KNIT_ARENA_ALIGN 16
+
+struct knit_arena_chunk {
+    struct knit_arena_chunk *next; //the previous chunk
+    size_t sz; //usable bytes after the (aligned) header
+};
+
+//bump allocator, nothing is freed individually, see knit_arena.h
+struct knit_arena {
+    struct knit *knit;
+    struct knit_arena_chunk *chunks; //newest first, allocations are bumped in the newest
+    char *cur;
+    char *end;
+    char *last; //the last allocation, it can be grown in place
+    size_t used; //bytes handed out since the last reset
+};
+#endif
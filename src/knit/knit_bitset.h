@@ -67,6 +67,12 @@ static void bitset_andn(struct knit_bitset *a, struct knit_bitset *b) {
     }
 }
 
+// a[bit] = b[bit], both must have the same length
+static void bitset_copy(struct knit_bitset *a, struct knit_bitset *b) {
+    knit_assert_h(a->bit_len == b->bit_len, "");
+    memcpy(a->data, b->data, sizeof(a->data[0]) * n_needed_unsigneds(a->bit_len));
+}
+
 static void bitset_set_all(struct knit_bitset *bitset, bool state, size_t up_to) {
     /*
     0000 0001
@@ -83,13 +89,19 @@ static void bitset_set_all(struct knit_bitset *bitset, bool state, size_t up_to)
     sb |= sb << 1;
     memset(bitset->data, sb, sizeof(bitset->data[0]) * n_needed_unsigneds(bitset->bit_len));
 }
-static int bitset_init(struct knit_bitset *bitset, size_t bit_len) 
+static void *bitset_mem_realloc(struct knit_bitset *bitset, void *p, size_t sz) {
+    if (bitset->allocator)
+        return bitset->allocator->realloc(bitset->allocator->ud, p, sz);
+    return realloc(p, sz);
+}
+static int bitset_init(struct knit_bitset *bitset, size_t bit_len, const struct dyn_allocator *allocator) 
 {
     size_t sz = 0;
     unsigned *data = NULL;
+    bitset->allocator = allocator;
     if (bit_len) {
        sz = n_needed_unsigneds(bit_len) * sizeof(unsigned);
-       data = malloc(sz);
+       data = bitset_mem_realloc(bitset, NULL, sz);
        if (!data) {
            return KNIT_NOMEM;
        }
@@ -107,7 +119,7 @@ static int bitset_realloc(struct knit_bitset *bitset, size_t new_bit_len)
         return KNIT_OK;
     }
     if (!bitset->bit_len) {
-        return bitset_init(bitset, new_bit_len);
+        return bitset_init(bitset, new_bit_len, bitset->allocator);
     }
     struct idx_pair last_idx = resolve_bit_idx(bitset->bit_len - 1);
     last_idx.bit_idx++;
@@ -118,7 +130,7 @@ static int bitset_realloc(struct knit_bitset *bitset, size_t new_bit_len)
 
     size_t old_sz = (last_idx.unsigned_idx + 1) * sizeof(unsigned);
     size_t new_sz = n_needed_unsigneds(new_bit_len) * sizeof(unsigned);
-    void *p = realloc(bitset->data, new_sz);
+    void *p = bitset_mem_realloc(bitset, bitset->data, new_sz);
     if (!p) {
         return KNIT_NOMEM;
     }
@@ -130,7 +142,10 @@ static int bitset_realloc(struct knit_bitset *bitset, size_t new_bit_len)
     return KNIT_OK;
 }
 static void bitset_deinit(struct knit_bitset *bitset) {
-    free(bitset->data);
+    if (bitset->allocator)
+        bitset->allocator->free(bitset->allocator->ud, bitset->data);
+    else
+        free(bitset->data);
     bitset->data = NULL;
     bitset->bit_len = 0;
 }
@@ -148,6 +163,8 @@ static void bitset_set_bit(struct knit_bitset *bitset, size_t bit_idx, bool stat
 
 static long bitset_find_false_bit(struct knit_bitset *bitset,  size_t start_at_bit_idx)
 {
+    if (start_at_bit_idx >= bitset->bit_len)
+        return -1;
     struct idx_pair last_idx = resolve_bit_idx(bitset->bit_len - 1);
     struct idx_pair start_idx = resolve_bit_idx(start_at_bit_idx);
     long start_at = start_idx.unsigned_idx; 
@@ -191,6 +208,8 @@ found:
 
 static long bitset_find_true_bit(struct knit_bitset *bitset,  size_t start_at_bit_idx)
 {
+    if (start_at_bit_idx >= bitset->bit_len)
+        return -1;
     struct idx_pair last_idx = resolve_bit_idx(bitset->bit_len - 1);
     struct idx_pair start_idx = resolve_bit_idx(start_at_bit_idx);
     long start_at = start_idx.unsigned_idx;
@@ -1,7 +1,9 @@
 #ifndef KNIT_BITSET_DATA_H
 #define KNIT_BITSET_DATA_H
+struct dyn_allocator; //fwd, from darray.h
 struct knit_bitset {
     unsigned *data;
     size_t bit_len;
+    const struct dyn_allocator *allocator; //NULL means malloc()/realloc()/free()
 };
 #endif
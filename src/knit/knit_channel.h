@@ -0,0 +1,365 @@
+#ifndef KNIT_CHANNEL_H
+#define KNIT_CHANNEL_H
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "kdata.h"
+#include "knit_objmap.h"
+#include "knit_parallel.h"
+#include "knit_ring.h"
+
+/*
+    channels (see knitx_channel_init()):
+    a channel moves values between instances, typically on threads of their own: one parses input and sends what it read,
+    others receive it and transform it. any number of instances can send and receive on the same channel.
+    it's a bounded lock free queue (see knit_ring.h) of messages. a message is a value the sender serialized into
+    a malloc()ed buffer, the receiver rebuilds it in its heap, so the two never share an object:
+    each value is a tag byte, then an int's value zigzagged as a varint, a string's length and bytes,
+    a list's length and items, a dict's pair count and keys and values.
+    a list or dict seen before in the same message is a reference to the index it was written with,
+    so shared and cyclic references arrive the way they were sent.
+    frozen lists and dicts (see knit_frozen.h) aren't copied, their address is sent, the region must outlive the receivers.
+    functions, generators and channels can't be sent.
+    send() and recv() block, they spin for a while and then sleep until the channel changes.
+    trysend() returns false when the channel is full and tryrecv() returns null when it's empty.
+    a closed channel (see knitx_channel_close()) refuses messages, recv() returns null once it's empty, that ends a receiving loop.
+    a channel is an object outside every heap like a C function, scripts get it from a global (see knitx_channel_publish())
+*/
+#ifdef KNIT_HAVE_PTHREADS
+#include <sched.h>
+
+#define KNIT_CHANNEL_SPINS 1000 //tries before a blocked sender or receiver sleeps
+
+enum KNIT_CHANNEL_TAG {
+    KNIT_CHANNEL_TAG_NULL,
+    KNIT_CHANNEL_TAG_TRUE,
+    KNIT_CHANNEL_TAG_FALSE,
+    KNIT_CHANNEL_TAG_INT,
+    KNIT_CHANNEL_TAG_STR,
+    KNIT_CHANNEL_TAG_LIST,
+    KNIT_CHANNEL_TAG_DICT,
+    KNIT_CHANNEL_TAG_REF,    //plus the index of a list or dict written before
+    KNIT_CHANNEL_TAG_FROZEN, //plus the address of a frozen list or dict
+};
+
+struct knit_channel_msg {
+    size_t len;
+    unsigned char data[];
+};
+struct knit_channel {
+    KNIT_OBJ_HEAD; //KNIT_CHANNEL
+    struct knit_ring ring; //of messages
+    atomic_int nsleeping; //senders and receivers waiting on changed
+    atomic_int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed; //a message was sent or received, or the channel was closed
+};
+
+/*WRITING*/
+struct knit_channel_writer {
+    struct knit *knit;
+    struct knit_channel_msg *msg;
+    size_t cap; //of msg->data
+    struct knit_objmap ids; //lists and dicts written so far to their index
+    int nids;
+};
+static int knit_channel_put(struct knit_channel_writer *w, const void *p, size_t n) {
+    if (w->msg->len + n > w->cap) {
+        size_t cap = w->cap * 2 > w->msg->len + n ? w->cap * 2 : w->msg->len + n;
+        struct knit_channel_msg *msg = realloc(w->msg, sizeof *msg + cap);
+        if (!msg)
+            return knit_error(w->knit, KNIT_NOMEM, "send(): couldn't grow a message");
+        w->msg = msg;
+        w->cap = cap;
+    }
+    memcpy(w->msg->data + w->msg->len, p, n);
+    w->msg->len += n;
+    return KNIT_OK;
+}
+static int knit_channel_put_tag(struct knit_channel_writer *w, int tag) {
+    unsigned char b = tag;
+    return knit_channel_put(w, &b, 1);
+}
+static int knit_channel_put_uvar(struct knit_channel_writer *w, uint32_t v) {
+    unsigned char buf[5];
+    int n = 0;
+    for (; v >= 0x80; v >>= 7)
+        buf[n++] = (v & 0x7f) | 0x80;
+    buf[n++] = v;
+    return knit_channel_put(w, buf, n);
+}
+static int knit_channel_write(struct knit_channel_writer *w, struct knit_obj *obj) {
+    int rv;
+    uintptr_t id;
+    switch (obj->u.ktype) {
+        case KNIT_NULL:  return knit_channel_put_tag(w, KNIT_CHANNEL_TAG_NULL);
+        case KNIT_TRUE:  return knit_channel_put_tag(w, KNIT_CHANNEL_TAG_TRUE);
+        case KNIT_FALSE: return knit_channel_put_tag(w, KNIT_CHANNEL_TAG_FALSE);
+        case KNIT_INT: {
+            uint32_t v = obj->u.integer.value;
+            if ((rv = knit_channel_put_tag(w, KNIT_CHANNEL_TAG_INT)) != KNIT_OK)
+                return rv;
+            return knit_channel_put_uvar(w, (v << 1) ^ (obj->u.integer.value < 0 ? 0xffffffffu : 0)); //small negatives stay short
+        }
+        case KNIT_STR:
+            if ((rv = knit_channel_put_tag(w, KNIT_CHANNEL_TAG_STR)) != KNIT_OK ||
+                (rv = knit_channel_put_uvar(w, obj->u.str.len)) != KNIT_OK)
+                return rv;
+            return knit_channel_put(w, obj->u.str.str, obj->u.str.len);
+        case KNIT_LIST:
+        case KNIT_DICT:
+            break;
+        default:
+            return knit_error(w->knit, KNIT_INVALID_TYPE_ERR, "send(): a %s can't be sent", knitx_obj_type_name(w->knit, obj));
+    }
+    if (knit_obj_is_frozen(obj)) {
+        if ((rv = knit_channel_put_tag(w, KNIT_CHANNEL_TAG_FROZEN)) != KNIT_OK)
+            return rv;
+        return knit_channel_put(w, &obj, sizeof obj);
+    }
+    if (knit_objmap_find(&w->ids, obj, &id)) {
+        if ((rv = knit_channel_put_tag(w, KNIT_CHANNEL_TAG_REF)) != KNIT_OK)
+            return rv;
+        return knit_channel_put_uvar(w, id);
+    }
+    if (knit_objmap_insert(&w->ids, obj, w->nids++) != KNIT_OK)
+        return knit_error(w->knit, KNIT_NOMEM, "send(): couldn't grow the object map");
+    if (obj->u.ktype == KNIT_LIST) {
+        struct knit_list *list = &obj->u.list;
+        if ((rv = knit_channel_put_tag(w, KNIT_CHANNEL_TAG_LIST)) != KNIT_OK ||
+            (rv = knit_channel_put_uvar(w, list->len)) != KNIT_OK)
+            return rv;
+        for (int i=0; i<list->len; i++) {
+            if ((rv = knit_channel_write(w, list->items[i])) != KNIT_OK)
+                return rv;
+        }
+        return KNIT_OK;
+    }
+    struct kobj_jadwal *ht = &obj->u.dict.ht;
+    struct kobj_jadwal_iter iter;
+    uint32_t npairs = 0;
+    kobj_jadwal_begin_iterator(ht, &iter);
+    for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter))
+        npairs++;
+    if ((rv = knit_channel_put_tag(w, KNIT_CHANNEL_TAG_DICT)) != KNIT_OK ||
+        (rv = knit_channel_put_uvar(w, npairs)) != KNIT_OK)
+        return rv;
+    kobj_jadwal_begin_iterator(ht, &iter);
+    for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter)) {
+        if ((rv = knit_channel_write(w, iter.pair->key)) != KNIT_OK ||
+            (rv = knit_channel_write(w, iter.pair->value)) != KNIT_OK)
+            return rv;
+    }
+    return KNIT_OK;
+}
+//the message is malloc()ed, the receiver frees it
+static int knit_channel_serialize(struct knit *knit, struct knit_obj *obj, struct knit_channel_msg **msgp) {
+    struct knit_channel_writer w = {.knit = knit, .cap = 64};
+    w.msg = malloc(sizeof *w.msg + w.cap);
+    if (!w.msg)
+        return knit_error(knit, KNIT_NOMEM, "send(): couldn't allocate a message");
+    w.msg->len = 0;
+    knit_objmap_init(knit, &w.ids);
+    int rv = knit_channel_write(&w, obj);
+    knit_objmap_deinit(&w.ids);
+    if (rv != KNIT_OK) {
+        free(w.msg);
+        return rv;
+    }
+    *msgp = w.msg;
+    return KNIT_OK;
+}
+
+/*READING*/
+//messages come from this process, so they aren't checked beyond what keeps reading in bounds
+struct knit_channel_reader {
+    struct knit *knit;
+    const unsigned char *p;
+    const unsigned char *end;
+    struct knit_objp_darray ids; //lists and dicts read so far, in index order
+};
+static int knit_channel_get_uvar(struct knit_channel_reader *r, uint32_t *v) {
+    *v = 0;
+    for (int shift=0; r->p < r->end && shift < 35; shift += 7) {
+        unsigned char b = *r->p++;
+        *v |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return KNIT_OK;
+    }
+    return knit_error(r->knit, KNIT_RUNTIME_ERR, "recv(): a message is truncated");
+}
+static int knit_channel_read(struct knit_channel_reader *r, struct knit_obj **objp) {
+    uint32_t v;
+    int rv;
+    if (r->p >= r->end)
+        return knit_error(r->knit, KNIT_RUNTIME_ERR, "recv(): a message is truncated");
+    int tag = *r->p++;
+    switch (tag) {
+        case KNIT_CHANNEL_TAG_NULL:  *objp = ktobj(&knull);  return KNIT_OK;
+        case KNIT_CHANNEL_TAG_TRUE:  *objp = ktobj(&ktrue);  return KNIT_OK;
+        case KNIT_CHANNEL_TAG_FALSE: *objp = ktobj(&kfalse); return KNIT_OK;
+        case KNIT_CHANNEL_TAG_INT: {
+            struct knit_int *integer;
+            if ((rv = knit_channel_get_uvar(r, &v)) != KNIT_OK)
+                return rv;
+            if ((rv = knitx_int_new_gcobj(r->knit, &integer, (int) ((v >> 1) ^ -(v & 1)))) != KNIT_OK)
+                return rv;
+            *objp = ktobj(integer);
+            return KNIT_OK;
+        }
+        case KNIT_CHANNEL_TAG_STR: {
+            struct knit_str *str;
+            if ((rv = knit_channel_get_uvar(r, &v)) != KNIT_OK)
+                return rv;
+            if (v > (size_t) (r->end - r->p))
+                return knit_error(r->knit, KNIT_RUNTIME_ERR, "recv(): a message is truncated");
+            if ((rv = knitx_str_new_strlcpy_gcobj(r->knit, &str, (const char *) r->p, v)) != KNIT_OK)
+                return rv;
+            r->p += v;
+            *objp = ktobj(str);
+            return KNIT_OK;
+        }
+        case KNIT_CHANNEL_TAG_REF:
+            if ((rv = knit_channel_get_uvar(r, &v)) != KNIT_OK)
+                return rv;
+            if (v >= (uint32_t) r->ids.len)
+                return knit_error(r->knit, KNIT_RUNTIME_ERR, "recv(): a message has a bad reference");
+            *objp = r->ids.data[v];
+            return KNIT_OK;
+        case KNIT_CHANNEL_TAG_FROZEN:
+            if ((size_t) (r->end - r->p) < sizeof *objp)
+                return knit_error(r->knit, KNIT_RUNTIME_ERR, "recv(): a message is truncated");
+            memcpy(objp, r->p, sizeof *objp);
+            r->p += sizeof *objp;
+            return KNIT_OK;
+        case KNIT_CHANNEL_TAG_LIST:
+        case KNIT_CHANNEL_TAG_DICT:
+            break;
+        default:
+            return knit_error(r->knit, KNIT_RUNTIME_ERR, "recv(): a message has an unknown tag");
+    }
+    //objects aren't collected while a builtin runs, the ones being read don't need to be on the stack
+    struct knit_obj *obj = NULL;
+    if ((rv = knit_channel_get_uvar(r, &v)) != KNIT_OK)
+        return rv;
+    if (tag == KNIT_CHANNEL_TAG_LIST)
+        rv = knitx_list_new_gcobj(r->knit, (struct knit_list **) &obj, v);
+    else
+        rv = knitx_dict_new_gcobj(r->knit, (struct knit_dict **) &obj, v);
+    if (rv != KNIT_OK)
+        return rv;
+    if (knit_objp_darray_push(&r->ids, &obj) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(r->knit, KNIT_NOMEM, "recv(): couldn't grow the object table");
+    *objp = obj;
+    for (uint32_t i=0; i<v; i++) {
+        struct knit_obj *item = NULL, *value = NULL;
+        if ((rv = knit_channel_read(r, &item)) != KNIT_OK)
+            return rv;
+        if (tag == KNIT_CHANNEL_TAG_LIST) {
+            rv = knitx_list_push(r->knit, &obj->u.list, item);
+        }
+        else if ((rv = knit_channel_read(r, &value)) == KNIT_OK) {
+            rv = knitx_dict_set(r->knit, &obj->u.dict, item, value);
+        }
+        if (rv != KNIT_OK)
+            return rv;
+    }
+    return KNIT_OK;
+}
+//msg isn't freed
+static int knit_channel_deserialize(struct knit *knit, const struct knit_channel_msg *msg, struct knit_obj **objp) {
+    struct knit_channel_reader r = {.knit = knit, .p = msg->data, .end = msg->data + msg->len};
+    if (knit_objp_darray_init_with_allocator(&r.ids, 16, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(knit, KNIT_NOMEM, "recv(): couldn't allocate the object table");
+    int rv = knit_channel_read(&r, objp);
+    knit_objp_darray_deinit(&r.ids);
+    return rv;
+}
+
+/*
+    blocking: like an executor's workers (see knit_executor_take()), a sleeper counts itself and checks again under the lock
+    before it waits, whoever changes the channel makes the change visible, then checks the count and wakes every sleeper.
+    senders and receivers sleep on the same condition, they all check again what they were waiting for
+*/
+static void knit_channel_changed(struct knit_channel *ch) {
+    atomic_thread_fence(memory_order_seq_cst); //the push or pop is seen before the count is read
+    if (!atomic_load(&ch->nsleeping))
+        return;
+    pthread_mutex_lock(&ch->lock);
+    pthread_cond_broadcast(&ch->changed);
+    pthread_mutex_unlock(&ch->lock);
+}
+//boolean, 0 if block is 0 and the channel is full. msg is the channel's once it's sent
+static int knit_channel_push(struct knit_channel *ch, struct knit_channel_msg *msg, int block) {
+    int sent = 0;
+    for (int i=0; i<KNIT_CHANNEL_SPINS && !sent && !atomic_load(&ch->closed); i++) {
+        if (!(sent = knit_ring_push(&ch->ring, msg)) && !block)
+            return 0;
+        if (i % 64 == 63)
+            sched_yield();
+    }
+    if (!sent) {
+        pthread_mutex_lock(&ch->lock);
+        atomic_fetch_add(&ch->nsleeping, 1);
+        while (!atomic_load(&ch->closed) && !(sent = knit_ring_push(&ch->ring, msg)))
+            pthread_cond_wait(&ch->changed, &ch->lock);
+        atomic_fetch_sub(&ch->nsleeping, 1);
+        pthread_mutex_unlock(&ch->lock);
+    }
+    if (sent)
+        knit_channel_changed(ch);
+    return sent;
+}
+//NULL if the channel is empty and block is 0 or it's closed
+static struct knit_channel_msg *knit_channel_pop(struct knit_channel *ch, int block) {
+    struct knit_channel_msg *msg = NULL;
+    for (int i=0; i<KNIT_CHANNEL_SPINS && !msg; i++) {
+        if (!(msg = knit_ring_pop(&ch->ring)) && (!block || atomic_load(&ch->closed)))
+            break;
+        if (i % 64 == 63)
+            sched_yield();
+    }
+    if (!msg && block && !atomic_load(&ch->closed)) {
+        pthread_mutex_lock(&ch->lock);
+        atomic_fetch_add(&ch->nsleeping, 1);
+        while (!(msg = knit_ring_pop(&ch->ring)) && !atomic_load(&ch->closed))
+            pthread_cond_wait(&ch->changed, &ch->lock);
+        atomic_fetch_sub(&ch->nsleeping, 1);
+        pthread_mutex_unlock(&ch->lock);
+    }
+    if (!msg)
+        msg = knit_ring_pop(&ch->ring); //closed, but something was sent before
+    if (msg)
+        knit_channel_changed(ch);
+    return msg;
+}
+
+//sets *sent to 0 if block is 0 and the channel is full, sending to a closed channel is an error
+static int knit_channel_send(struct knit *knit, struct knit_channel *ch, struct knit_obj *value, int block, int *sent) {
+    struct knit_channel_msg *msg = NULL;
+    if (atomic_load(&ch->closed))
+        return knit_error(knit, KNIT_RUNTIME_ERR, "send(): the channel is closed");
+    int rv = knit_channel_serialize(knit, value, &msg);
+    if (rv != KNIT_OK)
+        return rv;
+    *sent = knit_channel_push(ch, msg, block);
+    if (!*sent) {
+        free(msg);
+        if (block)
+            return knit_error(knit, KNIT_RUNTIME_ERR, "send(): the channel was closed");
+    }
+    return KNIT_OK;
+}
+//*objp is null if block is 0 and the channel is empty, or if it's closed and empty
+static int knit_channel_recv(struct knit *knit, struct knit_channel *ch, int block, struct knit_obj **objp) {
+    struct knit_channel_msg *msg = knit_channel_pop(ch, block);
+    if (!msg) {
+        *objp = ktobj(&knull);
+        return KNIT_OK;
+    }
+    int rv = knit_channel_deserialize(knit, msg, objp);
+    free(msg);
+    return rv;
+}
+#endif
+#endif
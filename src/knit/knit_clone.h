@@ -0,0 +1,321 @@
+#ifndef KNIT_CLONE_H
+#define KNIT_CLONE_H
+#include "kdata.h"
+#include "knit_objmap.h"
+#include "knit_mapped.h"
+#include "knit_module.h"
+
+/*
+    instance cloning:
+    knitx_clone() starts a new instance where another one is, typically after the stdlib was registered and a prelude ran.
+    the heap classes are copied cell for cell, so an object keeps its cell index and references to it are relocated
+    by address arithmetic, refcounts and the zero count table carry over as they are.
+    the memory objects own (string buffers, list items, dict tables) is duplicated.
+    objects outside the heap (string constants and functions made by the compiler, C functions the host registered)
+    are copied once each, a map from an object to its copy keeps them shared the way they were, and the clone owns the copies. their blocks are copied too,
+    compaction patches constants in place and a function's first call compiles its body into it,
+    so two instances can't share a block.
+    true, false, null, the builtins, the functions of a knit_program and frozen lists and dicts never change
+    and are shared with the source instance, so are channels.
+    if copying fails the cells whose contents weren't copied yet are made nulls, so knitx_deinit() doesn't free the source's memory
+*/
+
+struct knit_clone {
+    struct knit *dst;
+    struct knit *src;
+    struct knit_objmap copies; //objects outside the heap to their copies
+};
+
+static int knit_clone_contents(struct knit_clone *cl, struct knit_obj *obj); //fwd
+
+//objects outside the heap are copied the first time they are seen
+static int knit_clone_outside(struct knit_clone *cl, struct knit_obj *obj, struct knit_obj **ref) {
+    uintptr_t copy;
+    if (knit_objmap_find(&cl->copies, obj, &copy)) {
+        *ref = (struct knit_obj *) copy;
+        return KNIT_OK;
+    }
+    size_t sz = knit_obj_type_size(obj->u.ktype);
+    void *p = NULL;
+    int rv = knitx_tmalloc(cl->dst, sz, &p);
+    if (rv != KNIT_OK)
+        return rv;
+    memcpy(p, obj, sz);
+    //mapped before its contents, in case they lead back to it
+    if (knit_objmap_insert(&cl->copies, obj, (uintptr_t) p) != KNIT_OK) {
+        knitx_tfree(cl->dst, p);
+        return knit_error(cl->dst, KNIT_NOMEM, "knitx_clone(): couldn't grow the object map");
+    }
+    *ref = p;
+    if ((rv = knit_clone_contents(cl, p)) != KNIT_OK)
+        return rv;
+    return knitx_own_object(cl->dst, p);
+}
+//*ref points into the source instance, it's changed to point to the same object in the clone
+static int knit_clone_ref(struct knit_clone *cl, struct knit_obj **ref) {
+    struct knit_obj *obj = *ref;
+    if (!obj)
+        return KNIT_OK;
+    struct knit_heap_class *cls = NULL;
+    long idx = knit_gc_object_index(cl->src, obj, &cls);
+    if (idx != -1) {
+        *ref = knit_heap_class_object(&cl->dst->ex.heap.classes[cls - cl->src->ex.heap.classes], idx);
+        return KNIT_OK;
+    }
+    switch (obj->u.ktype) {
+        case KNIT_TRUE:
+        case KNIT_FALSE:
+        case KNIT_NULL:
+        case KNIT_CHANNEL:
+            return KNIT_OK;
+        case KNIT_CFUNC:
+            if ((const char *) obj >= (const char *) &kbuiltins && (const char *) obj < (const char *) (&kbuiltins + 1))
+                return KNIT_OK;
+            break;
+        case KNIT_KFUNC:
+            if (obj->u.kfunc.block->shared)
+                return KNIT_OK; //a knit_program's, it outlives both instances
+            break;
+        case KNIT_LIST:
+        case KNIT_DICT:
+            if (knit_obj_is_frozen(obj))
+                return KNIT_OK; //a knit_frozen's, like a program
+            break;
+    }
+    return knit_clone_outside(cl, obj, ref);
+}
+
+static int knit_clone_block(struct knit_clone *cl, struct knit_block **blockp) {
+    struct knit_block *src = *blockp;
+    void *p = NULL;
+    int rv = knitx_tmalloc(cl->dst, sizeof(struct knit_block), &p);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_block *block = p;
+    *block = *src;
+    if (insns_darray_init_with_allocator(&block->insns, src->insns.len, &cl->dst->container_allocator) != INSNS_DARRAY_OK) {
+        rv = knit_error(cl->dst, KNIT_NOMEM, "knitx_clone(): couldn't copy a block's instructions");
+        goto cleanup_block;
+    }
+    if (knit_objp_darray_init_with_allocator(&block->constants, src->constants.len, &cl->dst->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        rv = knit_error(cl->dst, KNIT_NOMEM, "knitx_clone(): couldn't copy a block's constants");
+        goto cleanup_insns;
+    }
+    if (knit_lines_darray_init_with_allocator(&block->lines, src->lines.len, &cl->dst->container_allocator) != KNIT_LINES_DARRAY_OK) {
+        rv = knit_error(cl->dst, KNIT_NOMEM, "knitx_clone(): couldn't copy a block's lines");
+        goto cleanup_constants;
+    }
+    if (src->insns.len) //a lazy block has no code yet
+        memcpy(block->insns.data, src->insns.data, src->insns.len * sizeof src->insns.data[0]);
+    block->insns.len = src->insns.len;
+    if (src->constants.len)
+        memcpy(block->constants.data, src->constants.data, src->constants.len * sizeof src->constants.data[0]);
+    block->constants.len = src->constants.len;
+    if (src->lines.len)
+        memcpy(block->lines.data, src->lines.data, src->lines.len * sizeof src->lines.data[0]);
+    block->lines.len = src->lines.len;
+    if (src->src) {
+        //not compiled yet, compiling frees the source and a mapped script is the source instance's
+        if ((rv = knitx_tmalloc(cl->dst, src->srclen, &p)) != KNIT_OK)
+            goto cleanup_lines;
+        memcpy(p, src->src, src->srclen);
+        block->src = p;
+    }
+    *blockp = block;
+    for (int i=0; i<block->constants.len; i++) {
+        if ((rv = knit_clone_ref(cl, &block->constants.data[i])) != KNIT_OK)
+            return rv;
+    }
+    return KNIT_OK;
+
+cleanup_lines:
+    knit_lines_darray_deinit(&block->lines);
+cleanup_constants:
+    knit_objp_darray_deinit(&block->constants);
+cleanup_insns:
+    insns_darray_deinit(&block->insns);
+cleanup_block:
+    knitx_tfree(cl->dst, block);
+    return rv;
+}
+
+//obj is a shallow copy in the clone, what it owns is still the source's
+static int knit_clone_contents(struct knit_clone *cl, struct knit_obj *obj) {
+    int rv = KNIT_OK;
+    void *p = NULL;
+    if (obj->u.ktype == KNIT_STR) {
+        struct knit_str *str = &obj->u.str;
+        //not owned, it outlives both instances unless it's in a file src mapped
+        if (str->cap <= 0 && !knit_mapped_contains(cl->src, str->str))
+            return KNIT_OK;
+        if (str->cap <= 0)
+            str->cap = str->len + 1;
+        if ((rv = knitx_tmalloc(cl->dst, str->cap, &p)) != KNIT_OK)
+            return rv;
+        memcpy(p, str->str, str->len + 1);
+        str->str = p;
+    }
+    else if (obj->u.ktype == KNIT_LIST) {
+        struct knit_list *list = &obj->u.list;
+        if (!list->items)
+            return KNIT_OK;
+        if ((rv = knitx_tmalloc(cl->dst, list->cap * sizeof(list->items[0]), &p)) != KNIT_OK)
+            return rv;
+        memcpy(p, list->items, list->len * sizeof(list->items[0]));
+        list->items = p;
+        for (int i=0; i<list->len; i++) {
+            if ((rv = knit_clone_ref(cl, &list->items[i])) != KNIT_OK)
+                return rv;
+        }
+    }
+    else if (obj->u.ktype == KNIT_DICT) {
+        //the table is rebuilt, keys are hashed by value so they can be inserted before their own contents are copied
+        struct kobj_jadwal src_ht = obj->u.dict.ht;
+        if ((rv = knitx_dict_init(cl->dst, &obj->u.dict, 0)) != KNIT_OK)
+            return rv;
+        struct kobj_jadwal_iter iter;
+        kobj_jadwal_begin_iterator(&src_ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(&src_ht, &iter)) {
+            struct knit_obj *key = iter.pair->key;
+            struct knit_obj *value = iter.pair->value;
+            if ((rv = knit_clone_ref(cl, &key)) != KNIT_OK)
+                return rv;
+            if ((rv = knit_clone_ref(cl, &value)) != KNIT_OK)
+                return rv;
+            knit_jadwal_use(&cl->dst->allocator);
+            if (kobj_jadwal_insert(&obj->u.dict.ht, &key, &value) != KOBJ_JADWAL_OK)
+                return knit_error(cl->dst, KNIT_NOMEM, "knitx_clone(): couldn't copy a dict");
+        }
+    }
+    else if (obj->u.ktype == KNIT_KFUNC) {
+        return knit_clone_block(cl, &obj->u.kfunc.block);
+    }
+    return rv;
+}
+
+//the cells from class c's cell i on still own the source's memory, they're made nulls
+static void knit_clone_forget(struct knit_clone *cl, int c, long i) {
+    for (; c<KNIT_HEAP_NCLASSES; c++, i=0) {
+        struct knit_heap_class *cls = &cl->dst->ex.heap.classes[c];
+        if (!cls->has_refs)
+            continue;
+        for (i = bitset_find_true_bit(&cls->alloc_bitset, i); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1))
+            knit_gc_obj_null(cl->dst, knit_heap_class_object(cls, i));
+    }
+}
+
+//the clone's heap was just initialized, its classes are replaced by copies of the source's
+static int knit_clone_heap(struct knit_clone *cl) {
+    struct knit_heap *src = &cl->src->ex.heap;
+    struct knit_heap *dst = &cl->dst->ex.heap;
+    struct knit_heap_class classes[KNIT_HEAP_NCLASSES];
+    int rv = KNIT_OK;
+    int c;
+    for (c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        if ((rv = knit_heap_class_clone(cl->dst, &classes[c], &src->classes[c])) != KNIT_OK)
+            goto cleanup_classes;
+    }
+    if (src->arena.enabled) {
+        if ((rv = knit_heap_arena_init(cl->dst, &dst->arena, src->arena.classes[KNIT_HEAP_SMALL].capacity)) != KNIT_OK)
+            goto cleanup_classes;
+    }
+    for (c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        knit_heap_class_deinit(cl->dst, &dst->classes[c]);
+        dst->classes[c] = classes[c];
+    }
+    dst->count = src->count;
+    dst->epoch = src->epoch;
+
+    for (int i=0; i<src->zct.len; i++) {
+        struct knit_obj *obj = src->zct.data[i];
+        if ((rv = knit_clone_ref(cl, &obj)) == KNIT_OK && knit_objp_darray_push(&dst->zct, &obj) != KNIT_OBJP_DARRAY_OK)
+            rv = knit_error(cl->dst, KNIT_NOMEM, "knitx_clone(): couldn't copy the zero count table");
+        if (rv != KNIT_OK) {
+            knit_clone_forget(cl, 0, 0);
+            return rv;
+        }
+    }
+    for (c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &dst->classes[c];
+        if (!cls->has_refs)
+            continue;
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+            if ((rv = knit_clone_contents(cl, knit_heap_class_object(cls, i))) != KNIT_OK) {
+                knit_clone_forget(cl, c, i);
+                return rv;
+            }
+        }
+    }
+    return KNIT_OK;
+
+cleanup_classes:
+    while (c--)
+        knit_heap_class_deinit(cl->dst, &classes[c]);
+    return rv;
+}
+
+//global names are borrowed by the table (see knitx_do_global_assign()), the clone gets its own copies, freed by knitx_deinit()
+static int knit_clone_globals(struct knit_clone *cl) {
+    struct knit_vars_jadwal *src_ht = &cl->src->ex.global_ht;
+    struct knit_vars_jadwal_iter iter;
+    knit_vars_jadwal_begin_iterator(src_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter); knit_vars_jadwal_iter_next(src_ht, &iter)) {
+        struct knit_str name = iter.pair->key;
+        struct knit_obj *value = iter.pair->value;
+        void *p = NULL;
+        int rv = knitx_tmalloc(cl->dst, name.len + 1, &p);
+        if (rv != KNIT_OK)
+            return rv;
+        memcpy(p, name.str, name.len);
+        ((char *) p)[name.len] = '\0';
+        name.str = p;
+        name.cap = name.len + 1;
+        if ((rv = knit_clone_ref(cl, &value)) != KNIT_OK) {
+            knitx_tfree(cl->dst, p);
+            return rv;
+        }
+        //the reference was already counted in the source, and the refcounts were copied
+        knit_jadwal_use(&cl->dst->allocator);
+        if (knit_vars_jadwal_insert(&cl->dst->ex.global_ht, &name, &value) != KNIT_VARS_JADWAL_OK) {
+            knitx_tfree(cl->dst, p);
+            return knit_error(cl->dst, KNIT_NOMEM, "knitx_clone(): couldn't copy the globals");
+        }
+    }
+    return KNIT_OK;
+}
+
+//dst was just initialized with src's allocator
+static int knit_clone(struct knit *dst, struct knit *src) {
+    struct knit_clone cl = {.dst = dst, .src = src};
+    int rv;
+    knit_objmap_init(dst, &cl.copies);
+    if ((rv = knit_clone_heap(&cl)) != KNIT_OK)
+        goto cleanup_map;
+    if ((rv = knit_clone_globals(&cl)) != KNIT_OK)
+        goto cleanup_map;
+    //the module ids are the process's, a module's functions find its globals in the clone the way they did in src
+    if ((rv = knit_module_hold_imports(dst, src)) != KNIT_OK)
+        goto cleanup_map;
+    for (int i=0; i<src->ex.modules.len; i++) {
+        struct knit_obj *obj = src->ex.modules.data[i];
+        if (obj && (rv = knit_clone_ref(&cl, &obj)) != KNIT_OK)
+            goto cleanup_map;
+        if (knit_objp_darray_push(&dst->ex.modules, &obj) != KNIT_OBJP_DARRAY_OK) {
+            rv = knit_error(dst, KNIT_NOMEM, "knitx_clone(): couldn't copy the modules");
+            goto cleanup_map;
+        }
+    }
+    for (int i=0; i<src->ex.stack.vals.len; i++) {
+        struct knit_obj *obj = src->ex.stack.vals.data[i];
+        if ((rv = knit_clone_ref(&cl, &obj)) != KNIT_OK)
+            goto cleanup_map;
+        if (knit_objp_darray_push(&dst->ex.stack.vals, &obj) != KNIT_OBJP_DARRAY_OK) {
+            rv = knit_error(dst, KNIT_NOMEM, "knitx_clone(): couldn't copy the value stack");
+            goto cleanup_map;
+        }
+    }
+cleanup_map:
+    knit_objmap_deinit(&cl.copies);
+    return rv;
+}
+#endif
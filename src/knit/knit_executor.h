@@ -0,0 +1,258 @@
+#ifndef KNIT_EXECUTOR_H
+#define KNIT_EXECUTOR_H
+#include <stdlib.h>
+#include <string.h>
+#include "kdata.h"
+#include "knit_parallel.h"
+#include "knit_program.h"
+#include "knit_ring.h"
+
+/*
+    executors (see knitx_executor_init()):
+    a pool of worker threads, each with an instance of its own that has the stdlib and ran the same prelude, a knit_program.
+    jobs are a script, a program or a call of a global function with arguments. any thread can submit them to a bounded
+    lock free queue (see knit_ring.h) that every worker takes from.
+    an idle worker spins for a while and then sleeps until a job is submitted.
+    a job is its own future: its submitter waits for it with knitx_job_wait(), or it has a callback the worker calls.
+    values only cross between threads as knit_values, ints, strings, booleans and null.
+    a job sees the globals the jobs before it on the same worker left. an error doesn't leave an instance usable,
+    so the worker deinitializes it and makes a new one. if that fails the jobs the worker takes later fail with its error.
+    nothing else is shared: programs are never written, the module cache has a lock and KNIT_DBG_PRINT is only read
+*/
+#ifdef KNIT_HAVE_PTHREADS
+#include <sched.h>
+#include <stdatomic.h>
+
+#define KNIT_EXECUTOR_SPINS 1000 //tries before an idle worker or a waiting submitter sleeps
+
+//a value that crosses between instances
+struct knit_value {
+    int ktype; //KNIT_INT, KNIT_STR, KNIT_TRUE, KNIT_FALSE or KNIT_NULL
+    int integer;
+    const char *str; //null terminated. an argument's is borrowed, a result's is malloc()ed and freed by knitx_job_deinit()
+};
+
+struct knit_job {
+    //set by the submitter, one of script, prog and func
+    const char *script; //compiled by the worker like knitx_exec_str() does
+    const struct knit_program *prog;
+    const char *func; //the name of a global function, called with args
+    const struct knit_value *args;
+    int nargs;
+    void (*done)(struct knit_job *job, void *ud); //optional, called by the worker, then it doesn't touch the job again
+    void *ud;
+    //set by the worker
+    int rv; //KNIT_OK or the error's type
+    char *err_msg; //malloc()ed, NULL if rv is KNIT_OK
+    struct knit_value result; //func's return value, null for scripts and programs
+    int worker; //the index of the worker that ran it
+    atomic_int finished; //only without done
+};
+
+struct knit_executor_worker {
+    struct knit_executor *ex;
+    struct knit_parallel_worker inst; //the instance (see knit_parallel.h)
+    int index;
+    pthread_t thread;
+    int broken_rv; //KNIT_OK, or why the instance couldn't be made again after a failed job
+    char *broken_msg; //malloc()ed
+};
+struct knit_executor {
+    struct knit_ring queue; //of jobs
+    atomic_int nsleeping; //idle workers waiting on wake
+    atomic_int nwaiting; //submitters waiting on finished
+    atomic_int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; //a job was pushed or the executor is stopping
+    pthread_cond_t finished; //a job finished
+    const struct knit_program *prelude;
+    struct knit_executor_worker *workers;
+    int nworkers;
+    int nstarted; //under lock, the workers that made their instance
+    int start_rv; //under lock, the first worker that couldn't
+};
+
+/*
+    sleeping: a sleeper counts itself and checks again under the lock before it waits, whoever wakes it
+    makes its change visible, then checks the count and signals under the lock. one of the two sees the other's change
+*/
+//NULL when the executor is stopping and there's nothing left to do
+static struct knit_job *knit_executor_take(struct knit_executor *ex) {
+    struct knit_job *job;
+    for (int i=0; i<KNIT_EXECUTOR_SPINS; i++) {
+        if ((job = knit_ring_pop(&ex->queue)) != NULL)
+            return job;
+        if (atomic_load(&ex->stopping))
+            return NULL;
+        if (i % 64 == 63)
+            sched_yield();
+    }
+    pthread_mutex_lock(&ex->lock);
+    atomic_fetch_add(&ex->nsleeping, 1);
+    while ((job = knit_ring_pop(&ex->queue)) == NULL && !atomic_load(&ex->stopping))
+        pthread_cond_wait(&ex->wake, &ex->lock);
+    atomic_fetch_sub(&ex->nsleeping, 1);
+    pthread_mutex_unlock(&ex->lock);
+    return job;
+}
+static void knit_executor_wake(struct knit_executor *ex, int all) {
+    atomic_thread_fence(memory_order_seq_cst); //the push is seen before the count is read
+    if (!atomic_load(&ex->nsleeping))
+        return;
+    pthread_mutex_lock(&ex->lock);
+    if (all)
+        pthread_cond_broadcast(&ex->wake);
+    else
+        pthread_cond_signal(&ex->wake);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+/*WORKERS*/
+//what a job or the prelude ended with, the recorded error if there is one
+static int knit_executor_status(struct knit *knit, int rv) {
+    if (knit->err != KNIT_OK)
+        return knit->err;
+    return rv == KNIT_OK ? KNIT_OK : KNIT_RUNTIME_ERR;
+}
+static int knit_executor_instance_init(struct knit_executor_worker *w) {
+    knit_parallel_worker_init(&w->inst, NULL, w->index, KNIT_POLICY_CONTINUE);
+    int rv = w->inst.init_rv;
+    if (rv == KNIT_OK)
+        rv = knitxr_register_stdlib(&w->inst.knit);
+    if (rv == KNIT_OK && w->ex->prelude)
+        rv = knit_executor_status(&w->inst.knit, knitx_exec_toplevel(&w->inst.knit, w->ex->prelude->block));
+    return rv;
+}
+
+static char *knit_executor_strdup(const char *s) {
+    char *copy = malloc(strlen(s) + 1);
+    if (copy)
+        strcpy(copy, s);
+    return copy;
+}
+static int knit_executor_push_value(struct knit *knit, const struct knit_value *v) {
+    struct knit_obj *obj = NULL;
+    int rv = KNIT_OK;
+    if (v->ktype == KNIT_INT) {
+        struct knit_int *integer;
+        rv = knitx_int_new_gcobj(knit, &integer, v->integer);
+        obj = ktobj(integer);
+    }
+    else if (v->ktype == KNIT_STR) {
+        struct knit_str *str;
+        rv = knitx_str_new_strcpy_gcobj(knit, &str, v->str);
+        obj = ktobj(str);
+    }
+    else if (v->ktype == KNIT_TRUE || v->ktype == KNIT_FALSE || v->ktype == KNIT_NULL) {
+        obj = v->ktype == KNIT_TRUE ? ktobj(&ktrue) : v->ktype == KNIT_FALSE ? ktobj(&kfalse) : ktobj(&knull);
+    }
+    else {
+        return knit_error(knit, KNIT_INVALID_TYPE_ERR, "knitx_executor_submit(): an argument can only be an int, a str, a boolean or null");
+    }
+    if (rv != KNIT_OK)
+        return rv;
+    if (knit_objp_darray_push(&knit->ex.stack.vals, &obj) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_executor_submit(): pushing an argument failed");
+    return KNIT_OK;
+}
+static int knit_executor_get_result(struct knit *knit, struct knit_obj *obj, struct knit_value *v) {
+    *v = (struct knit_value) {.ktype = obj->u.ktype};
+    if (obj->u.ktype == KNIT_INT) {
+        v->integer = obj->u.integer.value;
+    }
+    else if (obj->u.ktype == KNIT_STR) {
+        if ((v->str = knit_executor_strdup(obj->u.str.str)) == NULL)
+            return knit_error(knit, KNIT_NOMEM, "knitx_executor_submit(): couldn't copy the result");
+    }
+    else if (obj->u.ktype != KNIT_TRUE && obj->u.ktype != KNIT_FALSE && obj->u.ktype != KNIT_NULL) {
+        v->ktype = KNIT_NULL;
+        return knit_error(knit, KNIT_INVALID_TYPE_ERR, "knitx_executor_submit(): a %s result can't leave its instance", knitx_obj_type_name(knit, obj));
+    }
+    return KNIT_OK;
+}
+
+static int knit_executor_exec_script(struct knit *knit, const char *script) {
+    struct knit_prs prs;
+    int rv = knitx_compile_str(knit, &prs, script);
+    if (rv == KNIT_OK)
+        rv = knitx_exec_toplevel(knit, &prs.curblk->block);
+    knitx_lexer_deinit(knit, &prs.lex);
+    knitx_prs_deinit(knit, &prs);
+    return knit_executor_status(knit, rv);
+}
+static int knit_executor_call(struct knit *knit, struct knit_job *job) {
+    struct knit_objp_darray *vals = &knit->ex.stack.vals;
+    int base = vals->len;
+    int rv = KNIT_OK;
+    for (int i = job->nargs - 1; i >= 0 && rv == KNIT_OK; i--)
+        rv = knit_executor_push_value(knit, &job->args[i]);
+    if (rv == KNIT_OK)
+        rv = knitx_call_global(knit, job->func, job->nargs);
+    if (rv == KNIT_OK && knit->err == KNIT_OK)
+        rv = knit_executor_get_result(knit, vals->data[vals->len - 1], &job->result);
+    rv = knit_executor_status(knit, rv);
+    if (rv == KNIT_OK)
+        knitx_stack_rpop(knit, &knit->ex.stack, vals->len - base);
+    return rv;
+}
+
+static void knit_executor_run(struct knit_executor_worker *w, struct knit_job *job) {
+    struct knit *knit = &w->inst.knit;
+    job->worker = w->index;
+    job->result = (struct knit_value) {.ktype = KNIT_NULL};
+    job->err_msg = NULL;
+    if (w->broken_rv != KNIT_OK) {
+        job->rv = w->broken_rv;
+        job->err_msg = knit_executor_strdup(w->broken_msg ? w->broken_msg : "the worker has no instance");
+        return;
+    }
+    if (job->func)
+        job->rv = knit_executor_call(knit, job);
+    else if (job->prog)
+        job->rv = knit_executor_status(knit, knitx_exec_toplevel(knit, job->prog->block));
+    else
+        job->rv = knit_executor_exec_script(knit, job->script);
+    if (job->rv != KNIT_OK) {
+        job->err_msg = knit_executor_strdup(knit->err_msg ? knit->err_msg : "the job failed");
+        //the stack and the error state are left as they were when it happened
+        knit_parallel_worker_deinit(&w->inst);
+        int rv = knit_executor_instance_init(w);
+        if (rv != KNIT_OK) {
+            w->broken_rv = rv;
+            w->broken_msg = knit_executor_strdup(w->inst.init_rv == KNIT_OK && w->inst.knit.err_msg ?
+                                                 w->inst.knit.err_msg : "the worker couldn't make a new instance");
+        }
+    }
+}
+
+static void *knit_executor_work(void *arg) {
+    struct knit_executor_worker *w = arg;
+    struct knit_executor *ex = w->ex;
+    int rv = knit_executor_instance_init(w);
+    pthread_mutex_lock(&ex->lock);
+    ex->nstarted++;
+    if (rv != KNIT_OK && ex->start_rv == KNIT_OK)
+        ex->start_rv = rv;
+    pthread_cond_broadcast(&ex->finished);
+    pthread_mutex_unlock(&ex->lock);
+
+    struct knit_job *job;
+    while ((job = knit_executor_take(ex)) != NULL) {
+        knit_executor_run(w, job);
+        if (job->done) {
+            job->done(job, job->ud);
+            continue;
+        }
+        atomic_store(&job->finished, 1);
+        if (atomic_load(&ex->nwaiting)) {
+            pthread_mutex_lock(&ex->lock);
+            pthread_cond_broadcast(&ex->finished);
+            pthread_mutex_unlock(&ex->lock);
+        }
+    }
+    knit_parallel_worker_deinit(&w->inst);
+    free(w->broken_msg);
+    return NULL;
+}
+#endif
+#endif
@@ -0,0 +1,166 @@
+#ifndef KNIT_FROZEN_H
+#define KNIT_FROZEN_H
+#include <stdlib.h>
+#include <string.h>
+#include "kdata.h"
+#include "knit_objmap.h"
+#include "knit_parallel.h"
+
+/*
+    frozen regions (see knitx_freeze()):
+    a lookup table a prelude builds ends up in the heap of every instance that runs it.
+    freezing moves a list, dict or string and everything it references out of the heap into a region of its own:
+    the graph is copied once (an object map keeps shared and cyclic references the way they were),
+    the global that held it is rebound to the copy and the heap objects are left to the gc.
+    like a knit_program's constants the copies aren't in any heap, refcounting skips them,
+    the gc never marks them or walks into them (they only reference each other) and they never move.
+    a frozen list has a negative cap, its items aren't owned by an instance, like a constant string's memory.
+    a frozen dict's table has no instance in its userdata, keys are hashed and compared by the instance looking them up
+    (see knitx_dict_lookup()). KINDX_SET, append() and every other way of changing them is an error.
+    nothing writes a region after it's made, any number of instances can read it at the same time on their own threads.
+    knitx_frozen_publish() binds it to a global of another instance, nothing is copied.
+    its memory comes from malloc(), the dict tables too (see knit_jadwal_alloc.h), they're deinitialized with the region
+*/
+struct knit_frozen {
+    struct knit_parallel_pool pool; //everything the region owns, released at once by knitx_frozen_free()
+    struct dyn_allocator allocator; //the pool, for dicts
+    struct knit_objp_darray dicts; //their tables aren't in the pool
+    struct knit_obj *root;
+};
+
+struct knit_freeze {
+    struct knit *knit;
+    struct knit_frozen *frozen;
+    struct knit_objmap copies; //objects to their frozen copies
+};
+
+static void *knit_frozen_alloc(struct knit_frozen *frozen, size_t sz) {
+    return knit_parallel_pool_alloc(&frozen->pool, sz);
+}
+
+static void knit_frozen_free(struct knit_frozen *frozen) {
+    if (!frozen)
+        return;
+    for (int i=0; i<frozen->dicts.len; i++)
+        kobj_jadwal_deinit(&frozen->dicts.data[i]->u.dict.ht);
+    knit_parallel_pool_release(&frozen->pool);
+    free(frozen);
+}
+
+static int knit_freeze_contents(struct knit_freeze *fz, struct knit_obj *obj, struct knit_obj *copy); //fwd
+//*ref is changed to point to the frozen copy of what it points to
+static int knit_freeze_ref(struct knit_freeze *fz, struct knit_obj **ref) {
+    struct knit_obj *obj = *ref;
+    uintptr_t copy;
+    switch (obj->u.ktype) {
+        case KNIT_TRUE:
+        case KNIT_FALSE:
+        case KNIT_NULL:
+            return KNIT_OK; //there is one of each for the process
+        case KNIT_INT:
+        case KNIT_STR:
+        case KNIT_LIST:
+        case KNIT_DICT:
+            break;
+        default:
+            return knit_error(fz->knit, KNIT_INVALID_TYPE_ERR, "knitx_freeze(): a %s can't be frozen", knitx_obj_type_name(fz->knit, obj));
+    }
+    if (knit_objmap_find(&fz->copies, obj, &copy)) {
+        *ref = (struct knit_obj *) copy;
+        return KNIT_OK;
+    }
+    struct knit_obj *p = knit_frozen_alloc(fz->frozen, knit_obj_type_size(obj->u.ktype));
+    if (!p)
+        return knit_error(fz->knit, KNIT_NOMEM, "knitx_freeze(): couldn't allocate a frozen object");
+    //mapped before its contents, in case they lead back to it
+    if (knit_objmap_insert(&fz->copies, obj, (uintptr_t) p) != KNIT_OK)
+        return knit_error(fz->knit, KNIT_NOMEM, "knitx_freeze(): couldn't grow the object map");
+    *ref = p;
+    return knit_freeze_contents(fz, obj, p);
+}
+
+static int knit_freeze_contents(struct knit_freeze *fz, struct knit_obj *obj, struct knit_obj *copy) {
+    int rv = KNIT_OK;
+    if (obj->u.ktype == KNIT_INT) {
+        copy->u.integer = obj->u.integer;
+    }
+    else if (obj->u.ktype == KNIT_STR) {
+        struct knit_str *str = &obj->u.str;
+        char *s = knit_frozen_alloc(fz->frozen, str->len + 1);
+        if (!s)
+            return knit_error(fz->knit, KNIT_NOMEM, "knitx_freeze(): couldn't copy a string");
+        memcpy(s, str->str, str->len);
+        s[str->len] = '\0';
+        copy->u.str = (struct knit_str) {.ktype = KNIT_STR, .str = s, .len = str->len, .cap = -1};
+    }
+    else if (obj->u.ktype == KNIT_LIST) {
+        struct knit_list *list = &obj->u.list;
+        struct knit_obj **items = NULL;
+        if (list->len && !(items = knit_frozen_alloc(fz->frozen, list->len * sizeof items[0])))
+            return knit_error(fz->knit, KNIT_NOMEM, "knitx_freeze(): couldn't copy a list");
+        copy->u.list = (struct knit_list) {.ktype = KNIT_LIST, .items = items, .len = list->len, .cap = -1};
+        for (int i=0; i<list->len; i++) {
+            items[i] = list->items[i];
+            if ((rv = knit_freeze_ref(fz, &items[i])) != KNIT_OK)
+                return rv;
+        }
+    }
+    else if (obj->u.ktype == KNIT_DICT) {
+        //the table is built by this instance, it's unbound from it once every key is in
+        struct knit_dict *dict = &copy->u.dict;
+        knit_jadwal_use(NULL); //libc, the region outlives the instance
+        if (kobj_jadwal_init_with_udata(&dict->ht, 0, fz->knit) != KOBJ_JADWAL_OK)
+            return knit_error(fz->knit, KNIT_NOMEM, "knitx_freeze(): couldn't copy a dict");
+        dict->ktype = KNIT_DICT;
+        if (knit_objp_darray_push(&fz->frozen->dicts, &copy) != KNIT_OBJP_DARRAY_OK) {
+            kobj_jadwal_deinit(&dict->ht);
+            return knit_error(fz->knit, KNIT_NOMEM, "knitx_freeze(): couldn't copy a dict");
+        }
+        struct kobj_jadwal *ht = &obj->u.dict.ht;
+        struct kobj_jadwal_iter iter;
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter)) {
+            struct knit_obj *key = iter.pair->key;
+            struct knit_obj *value = iter.pair->value;
+            if ((rv = knit_freeze_ref(fz, &key)) != KNIT_OK)
+                return rv;
+            if ((rv = knit_freeze_ref(fz, &value)) != KNIT_OK)
+                return rv;
+            knit_jadwal_use(NULL);
+            if (kobj_jadwal_insert(&dict->ht, &key, &value) != KOBJ_JADWAL_OK)
+                return knit_error(fz->knit, KNIT_NOMEM, "knitx_freeze(): couldn't copy a dict");
+        }
+        dict->ht.userdata = NULL;
+    }
+    return rv;
+}
+
+//obj and what it references are copied into a new region, obj itself is left as it is
+static int knit_frozen_build(struct knit *knit, struct knit_obj *obj, struct knit_frozen **frozenp) {
+    struct knit_frozen *frozen = malloc(sizeof *frozen);
+    if (!frozen)
+        return knit_error(knit, KNIT_NOMEM, "knitx_freeze(): couldn't allocate a region");
+    knit_parallel_pool_init(&frozen->pool);
+    frozen->allocator = (struct dyn_allocator) {
+        .realloc = knit_parallel_pool_realloc,
+        .free = knit_parallel_pool_free,
+        .ud = &frozen->pool,
+    };
+    if (knit_objp_darray_init_with_allocator(&frozen->dicts, 8, &frozen->allocator) != KNIT_OBJP_DARRAY_OK) {
+        knit_parallel_pool_release(&frozen->pool);
+        free(frozen);
+        return knit_error(knit, KNIT_NOMEM, "knitx_freeze(): couldn't allocate a region");
+    }
+    struct knit_freeze fz = {.knit = knit, .frozen = frozen};
+    knit_objmap_init(knit, &fz.copies);
+    frozen->root = obj;
+    int rv = knit_freeze_ref(&fz, &frozen->root);
+    knit_objmap_deinit(&fz.copies);
+    if (rv != KNIT_OK) {
+        knit_frozen_free(frozen);
+        return rv;
+    }
+    *frozenp = frozen;
+    return KNIT_OK;
+}
+#endif
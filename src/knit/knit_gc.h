@@ -6,70 +6,436 @@
 
 static void knit_obj_deinit(struct knit *knit, struct knit_obj *obj); //fwd
 
-//size: number of objects
+#define KNIT_ZCT_SCAN_THRESHOLD 1024 //the zero count table is scanned by the vm when it has this many entries
+#define KNIT_REQUEST_ARENA_DEFAULT_CELLS 8192
+
+static void knit_gc_obj_null(struct knit *knit, struct knit_obj *obj) {
+    obj->u.ktype = KNIT_NULL;
+}
+
+static int knit_heap_class_init(struct knit *knit, struct knit_heap_class *cls, int cell_size, int has_refs, int ncells) {
+    cls->cell_size = cell_size;
+    cls->has_refs = has_refs;
+    cls->capacity = ncells;
+    cls->min_capacity = ncells;
+    cls->count = 0;
+    int rv;
+    void *p;
+    if ((rv = bitset_init(&cls->alloc_bitset, ncells, &knit->container_allocator)) != 0) {
+        return rv;
+    }
+    if ((rv = bitset_init(&cls->mark_bitset, ncells, &knit->container_allocator)) != 0) {
+        goto cleanup_alloc_bitset;
+    }
+    if ((rv = bitset_init(&cls->zct_bitset, ncells, &knit->container_allocator)) != 0) {
+        goto cleanup_mark_bitset;
+    }
+    if ((rv = bitset_init(&cls->remembered_bitset, ncells, &knit->container_allocator)) != 0) {
+        goto cleanup_zct_bitset;
+    }
+    if ((rv = knitx_rmalloc(knit, (size_t) ncells * cell_size, &p)) != KNIT_OK) {
+        goto cleanup_remembered_bitset;
+    }
+    cls->cells = p;
+    if ((rv = knitx_rmalloc(knit, ncells * sizeof(cls->free_list[0]), &p)) != KNIT_OK) {
+        goto cleanup_cells;
+    }
+    cls->free_list = p;
+    if ((rv = knitx_rmalloc(knit, ncells * sizeof(cls->refcounts[0]), &p)) != KNIT_OK) {
+        goto cleanup_free_list;
+    }
+    cls->refcounts = p;
+    cls->free_len = 0;
+    for (int i=ncells - 1; i >= 0; i--) {
+        cls->free_list[cls->free_len++] = i;
+    }
+    return KNIT_OK;
+
+cleanup_free_list:
+    knitx_rfree(knit, cls->free_list);
+cleanup_cells:
+    knitx_rfree(knit, cls->cells);
+cleanup_remembered_bitset:
+    bitset_deinit(&cls->remembered_bitset);
+cleanup_zct_bitset:
+    bitset_deinit(&cls->zct_bitset);
+cleanup_mark_bitset:
+    bitset_deinit(&cls->mark_bitset);
+cleanup_alloc_bitset:
+    bitset_deinit(&cls->alloc_bitset);
+    return rv;
+}
+static void knit_heap_class_deinit(struct knit *knit, struct knit_heap_class *cls) {
+    bitset_deinit(&cls->alloc_bitset);
+    bitset_deinit(&cls->mark_bitset);
+    bitset_deinit(&cls->zct_bitset);
+    bitset_deinit(&cls->remembered_bitset);
+    knitx_rfree(knit, cls->cells);
+    knitx_rfree(knit, cls->free_list);
+    knitx_rfree(knit, cls->refcounts);
+}
+
+//initializes dst as a copy of src, cell for cell, knit is the instance dst belongs to (see knit_clone.h)
+//the objects in the cells are copied as they are, their references and the memory they own are left to the caller
+static int knit_heap_class_clone(struct knit *knit, struct knit_heap_class *dst, struct knit_heap_class *src) {
+    int rv = knit_heap_class_init(knit, dst, src->cell_size, src->has_refs, src->capacity);
+    if (rv != KNIT_OK)
+        return rv;
+    dst->min_capacity = src->min_capacity;
+    dst->count = src->count;
+    memcpy(dst->cells, src->cells, (size_t) src->capacity * src->cell_size);
+    memcpy(dst->refcounts, src->refcounts, src->capacity * sizeof(src->refcounts[0]));
+    memcpy(dst->free_list, src->free_list, src->free_len * sizeof(src->free_list[0]));
+    dst->free_len = src->free_len;
+    bitset_copy(&dst->alloc_bitset, &src->alloc_bitset);
+    bitset_copy(&dst->zct_bitset, &src->zct_bitset);
+    return KNIT_OK;
+}
+
+//size: number of objects of each class. a class doesn't grow when it's full, so dicts get as many cells as the others
 int knit_heap_init(struct knit *knit, struct knit_heap *heap, int heap_sz) {
-    heap->capacity = heap_sz;
-    heap->count = 0;
     int rv;
-    if ((rv = bitset_init(&heap->alloc_bitset, heap_sz)) != 0) {
+    heap->count = 0;
+    heap->epoch = 0;
+    memset(&heap->arena, 0, sizeof heap->arena);
+    if (knit_objp_darray_init_with_allocator(&heap->zct, 256, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        return KNIT_NOMEM;
+    }
+    size_t medium_sz = sizeof(struct knit_str) > sizeof(struct knit_list) ? sizeof(struct knit_str) : sizeof(struct knit_list);
+    if ((rv = knit_heap_class_init(knit, &heap->classes[KNIT_HEAP_SMALL], sizeof(struct knit_int), 0, heap_sz)) != KNIT_OK) {
+        knit_objp_darray_deinit(&heap->zct);
         return rv;
     }
-    if ((rv = bitset_init(&heap->mark_bitset, heap_sz)) != 0) {
-        bitset_deinit(&heap->alloc_bitset);
+    if ((rv = knit_heap_class_init(knit, &heap->classes[KNIT_HEAP_MEDIUM], medium_sz, 1, heap_sz)) != KNIT_OK) {
+        knit_heap_class_deinit(knit, &heap->classes[KNIT_HEAP_SMALL]);
+        knit_objp_darray_deinit(&heap->zct);
         return rv;
     }
-    void *p;
-    if ((rv = knitx_rmalloc(knit, heap_sz * sizeof(heap->objects[0]), &p)) != KNIT_OK) {
-        bitset_deinit(&heap->alloc_bitset);
-        bitset_deinit(&heap->mark_bitset);
+    if ((rv = knit_heap_class_init(knit, &heap->classes[KNIT_HEAP_LARGE], sizeof(struct knit_obj), 1, heap_sz)) != KNIT_OK) {
+        knit_heap_class_deinit(knit, &heap->classes[KNIT_HEAP_SMALL]);
+        knit_heap_class_deinit(knit, &heap->classes[KNIT_HEAP_MEDIUM]);
+        knit_objp_darray_deinit(&heap->zct);
         return rv;
     }
-    heap->objects = p;
     return KNIT_OK;
 }
+static void knit_heap_arena_deinit(struct knit *knit, struct knit_heap_arena *arena); //fwd
+static struct knit_obj *knit_heap_class_object(struct knit_heap_class *cls, long idx); //fwd
+//the objects that are still allocated are deinitialized, ints own nothing
 void knit_heap_deinit(struct knit *knit, struct knit_heap *heap) {
-    bitset_deinit(&heap->alloc_bitset);
-    bitset_deinit(&heap->mark_bitset);
-    knitx_rfree(knit, heap->objects);
+    for (int i=0; i<KNIT_HEAP_NCLASSES; i++) {
+        struct knit_heap_class *cls = &heap->classes[i];
+        for (long j = cls->has_refs ? bitset_find_true_bit(&cls->alloc_bitset, 0) : -1; j != -1; j = bitset_find_true_bit(&cls->alloc_bitset, j + 1))
+            knit_obj_deinit(knit, knit_heap_class_object(cls, j));
+        knit_heap_class_deinit(knit, cls);
+    }
+    knit_objp_darray_deinit(&heap->zct);
+    knit_heap_arena_deinit(knit, &heap->arena);
+}
+static int knit_heap_class_of_type(int ktype) {
+    switch (ktype) {
+        case KNIT_INT:  return KNIT_HEAP_SMALL;
+        case KNIT_STR:
+        case KNIT_LIST: return KNIT_HEAP_MEDIUM;
+        default:        return KNIT_HEAP_LARGE;
+    }
 }
-struct knit_obj *knit_gc_new_object(struct knit *knit) {
-    if (knit->ex.heap.count >= knit->ex.heap.capacity) {
+//the size of an object allocated outside the heap
+static size_t knit_obj_type_size(int ktype) {
+    switch (ktype) {
+        case KNIT_INT:   return sizeof(struct knit_int);
+        case KNIT_STR:   return sizeof(struct knit_str);
+        case KNIT_LIST:  return sizeof(struct knit_list);
+        case KNIT_DICT:  return sizeof(struct knit_dict);
+        case KNIT_KFUNC: return sizeof(struct knit_kfunc);
+        case KNIT_CFUNC: return sizeof(struct knit_cfunc);
+        default: knit_assert_h(0, "knit_obj_type_size(): unexpected type");
+    }
+    return 0;
+}
+static struct knit_obj *knit_heap_class_object(struct knit_heap_class *cls, long idx) {
+    return (struct knit_obj *) (cls->cells + idx * cls->cell_size);
+}
+static void knit_gc_zct_add(struct knit *knit, struct knit_heap_class *cls, long idx); //fwd
+//O(1), pops the lowest free index off the free list
+//new objects have no counted references, so they start in the zero count table
+static struct knit_obj *knit_heap_class_new_object(struct knit *knit, struct knit_heap_class *cls) {
+    if (cls->free_len == 0) {
         return NULL;
     }
-    struct knit_bitset *b = &knit->ex.heap.alloc_bitset;
-    long idx = bitset_find_false_bit(b, 0);
-    knit_assert_h(idx >= 0, "");
-    bitset_set_bit(b, idx, 1);
+    int idx = cls->free_list[--cls->free_len];
+    knit_assert_h(!bitset_get_bit(&cls->alloc_bitset, idx), "");
+    bitset_set_bit(&cls->alloc_bitset, idx, 1);
+    cls->refcounts[idx] = 0;
+    cls->count++;
     knit->ex.heap.count++;
-    return knit->ex.heap.objects + idx;
+    knit_gc_zct_add(knit, cls, idx);
+    return knit_heap_class_object(cls, idx);
+}
+//objects come from the request arena while it's active and has room, from the class that fits ktype otherwise
+struct knit_obj *knit_gc_new_object(struct knit *knit, int ktype) {
+    int c = knit_heap_class_of_type(ktype);
+    struct knit_heap_arena *arena = &knit->ex.heap.arena;
+    struct knit_heap_class *cls = &arena->classes[c];
+    if (arena->active) {
+        if (cls->count < cls->capacity) {
+            KALLOC_SAMPLE(knit, cls->cell_size);
+            return knit_heap_class_object(cls, cls->count++);
+        }
+        arena->full = 1;
+    }
+    cls = &knit->ex.heap.classes[c];
+    struct knit_obj *obj = knit_heap_class_new_object(knit, cls);
+    if (obj)
+        KALLOC_SAMPLE(knit, cls->cell_size);
+    return obj;
+}
+//pushes free indices from the highest to the lowest, so that allocation keeps filling the class from the bottom
+static void knit_gc_rebuild_free_list(struct knit *knit, struct knit_heap_class *cls) {
+    cls->free_len = 0;
+    for (int i=cls->capacity - 1; i >= 0; i--) {
+        if (!bitset_get_bit(&cls->alloc_bitset, i)) {
+            cls->free_list[cls->free_len++] = i;
+        }
+    }
+    knit_assert_h(cls->free_len == cls->capacity - cls->count, "");
 }
 
-static long knit_gc_object_index(struct knit *knit, struct knit_obj *obj) {
+//returns the index of obj inside its class and sets *clsp, or -1 if obj is not in the heap
+static long knit_gc_object_index(struct knit *knit, struct knit_obj *obj, struct knit_heap_class **clsp) {
     char *ptr = (char *) obj;
-    char *heap_begin = (char *) knit->ex.heap.objects;
-    char *heap_end   = (char *) (knit->ex.heap.objects + knit->ex.heap.capacity);
-    if (ptr >= heap_begin &&
-        ptr < heap_end      ) {
-        return obj - knit->ex.heap.objects;
+    for (int i=0; i<KNIT_HEAP_NCLASSES; i++) {
+        struct knit_heap_class *cls = &knit->ex.heap.classes[i];
+        char *heap_begin = cls->cells;
+        char *heap_end   = cls->cells + (size_t) cls->capacity * cls->cell_size;
+        if (ptr >= heap_begin &&
+            ptr < heap_end      ) {
+            *clsp = cls;
+            return (ptr - heap_begin) / cls->cell_size;
+        }
     }
     return -1;
 }
 static int knit_gc_is_gc_object(struct knit *knit, struct knit_obj *obj) {
-    return knit_gc_object_index(knit, obj) != -1;
+    struct knit_heap_class *cls;
+    return knit_gc_object_index(knit, obj, &cls) != -1;
+}
+//frozen objects are outside every heap, they never change and only reference each other (see knit_frozen.h)
+static int knit_obj_is_frozen(struct knit_obj *obj) {
+    return (obj->u.ktype == KNIT_LIST && obj->u.list.cap < 0) ||
+           (obj->u.ktype == KNIT_DICT && !obj->u.dict.ht.userdata);
+}
+//like knit_gc_object_index() for the request arena, -1 if obj is not an arena object
+static long knit_gc_arena_index(struct knit *knit, struct knit_obj *obj, struct knit_heap_class **clsp) {
+    struct knit_heap_arena *arena = &knit->ex.heap.arena;
+    if (!arena->enabled)
+        return -1;
+    char *ptr = (char *) obj;
+    for (int i=0; i<KNIT_HEAP_NCLASSES; i++) {
+        struct knit_heap_class *cls = &arena->classes[i];
+        if (ptr >= cls->cells && ptr < cls->cells + (size_t) cls->count * cls->cell_size) {
+            *clsp = cls;
+            return (ptr - cls->cells) / cls->cell_size;
+        }
+    }
+    return -1;
+}
+
+/*
+    deferred reference counting:
+    only references from other heap objects, globals and block constants are counted, the value stack
+    and the stacks of generators (see knit_generator.h) are not.
+    an object whose count drops to zero is put in the zero count table (zct), it might still be on the stack,
+    so it is only freed when a zct scan at a safe point doesn't find it there.
+    cycles are never freed this way, knit_gc_cycle() collects them.
+    objects in the request arena aren't counted at all, knit_gc_object_index() doesn't find them.
+*/
+static void knit_gc_zct_add(struct knit *knit, struct knit_heap_class *cls, long idx) {
+    if (bitset_get_bit(&cls->zct_bitset, idx))
+        return;
+    struct knit_obj *obj = knit_heap_class_object(cls, idx);
+    if (knit_objp_darray_push(&knit->ex.heap.zct, &obj) != KNIT_OBJP_DARRAY_OK)
+        return; //not fatal, the object will be reclaimed by the next gc cycle
+    bitset_set_bit(&cls->zct_bitset, idx, 1);
+}
+static void knit_gc_incref(struct knit *knit, struct knit_obj *obj) {
+    struct knit_heap_class *cls;
+    long idx = knit_gc_object_index(knit, obj, &cls);
+    if (idx == -1)
+        return;
+    cls->refcounts[idx]++;
+}
+static void knit_gc_decref(struct knit *knit, struct knit_obj *obj) {
+    struct knit_heap_class *cls;
+    long idx = knit_gc_object_index(knit, obj, &cls);
+    if (idx == -1)
+        return;
+    knit_assert_h(cls->refcounts[idx] > 0, "knit_gc_decref(): refcount underflow");
+    if (--cls->refcounts[idx] == 0) {
+        knit_gc_zct_add(knit, cls, idx);
+    }
+}
+//must be called when a reference to value is stored in the list or dict container.
+//heap containers that get references to arena objects are remembered, they are the only heap objects
+//(besides globals) that can point into the arena. they are pinned with a count until the arena is reset
+static void knit_gc_write_barrier(struct knit *knit, struct knit_obj *container, struct knit_obj *value) {
+    struct knit_heap_arena *arena = &knit->ex.heap.arena;
+    struct knit_heap_class *cls;
+    if (!arena->active || !value || knit_gc_arena_index(knit, value, &cls) == -1)
+        return;
+    long idx = knit_gc_object_index(knit, container, &cls);
+    if (idx == -1 || bitset_get_bit(&cls->remembered_bitset, idx))
+        return;
+    if (knit_objp_darray_push(&arena->remembered, &container) != KNIT_OBJP_DARRAY_OK) {
+        arena->overflowed = 1;
+        return;
+    }
+    bitset_set_bit(&cls->remembered_bitset, idx, 1);
+    cls->refcounts[idx]++;
+}
+static void knit_gc_release_ref(struct knit *knit, struct knit_obj *obj, int skip_dead) {
+    struct knit_heap_class *cls;
+    long idx;
+    if (!obj)
+        return;
+    if (skip_dead && (idx = knit_gc_object_index(knit, obj, &cls)) != -1 && bitset_get_bit(&cls->mark_bitset, idx))
+        return;
+    knit_gc_decref(knit, obj);
+}
+//drops the references obj holds, skip_dead is used while sweeping, dead children are about to be freed anyway
+static void knit_gc_release_children(struct knit *knit, struct knit_obj *obj, int skip_dead) {
+    if (obj->u.ktype == KNIT_LIST) {
+        struct knit_list *list = &obj->u.list;
+        for (int i=0; i<list->len; i++) {
+            knit_gc_release_ref(knit, list->items[i], skip_dead);
+        }
+    }
+    else if (obj->u.ktype == KNIT_DICT) {
+        struct kobj_jadwal *ht = &obj->u.dict.ht;
+        struct kobj_jadwal_iter iter;
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter)) {
+            knit_gc_release_ref(knit, iter.pair->key, skip_dead);
+            knit_gc_release_ref(knit, iter.pair->value, skip_dead);
+        }
+    }
+}
+//memory released by freeing obj, dict tables are estimated from their entry count since their load factor isn't exposed
+static size_t knit_gc_object_bytes(struct knit_heap_class *cls, struct knit_obj *obj) {
+    size_t bytes = cls->cell_size;
+    if (obj->u.ktype == KNIT_STR && obj->u.str.cap > 0) {
+        bytes += obj->u.str.cap;
+    }
+    else if (obj->u.ktype == KNIT_LIST) {
+        bytes += obj->u.list.cap * sizeof(obj->u.list.items[0]);
+    }
+    else if (obj->u.ktype == KNIT_DICT) {
+        struct kobj_jadwal *ht = &obj->u.dict.ht;
+        struct kobj_jadwal_iter iter;
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter)) {
+            bytes += sizeof *iter.pair;
+        }
+    }
+    else if (obj->u.ktype == KNIT_KFUNC) {
+        struct knit_block *block = obj->u.kfunc.block;
+        bytes += sizeof *block;
+        bytes += block->insns.cap * sizeof(block->insns.data[0]);
+        bytes += block->constants.cap * sizeof(block->constants.data[0]);
+    }
+    else if (obj->u.ktype == KNIT_GENERATOR) {
+        struct knit_stack *stack = &obj->u.generator.gen->stack;
+        bytes += sizeof(struct knit_gen);
+        bytes += stack->frames.cap * sizeof(stack->frames.data[0]);
+        bytes += stack->vals.cap * sizeof(stack->vals.data[0]);
+    }
+    return bytes;
+}
+//returns the number of bytes freed
+static size_t knit_gc_free_object(struct knit *knit, struct knit_heap_class *cls, long idx) {
+    struct knit_obj *obj = knit_heap_class_object(cls, idx);
+    size_t bytes = knit_gc_object_bytes(cls, obj);
+    knit_obj_deinit(knit, obj);
+    knit_gc_obj_null(knit, obj);
+    bitset_set_bit(&cls->alloc_bitset, idx, 0);
+    cls->free_list[cls->free_len++] = idx;
+    cls->count--;
+    knit->ex.heap.count--;
+    return bytes;
+}
+static void knit_gc_mark_vals(struct knit *knit, struct knit_objp_darray *vals, int state) {
+    for (int i=0; i<vals->len; i++) {
+        struct knit_heap_class *cls;
+        long idx = vals->data[i] ? knit_gc_object_index(knit, vals->data[i], &cls) : -1;
+        if (idx != -1)
+            bitset_set_bit(&cls->mark_bitset, idx, state);
+    }
+}
+//marks objects referenced from the value stack and generators, mark bits are only used by gc cycles otherwise
+static void knit_gc_mark_stack(struct knit *knit, int state) {
+    knit_gc_mark_vals(knit, &knit->ex.stack.vals, state);
+    for (struct knit_gen *gen = knit->ex.gens; gen; gen = gen->next) {
+        knit_gc_mark_vals(knit, &gen->stack.vals, state);
+    }
+}
+//must be called at a point where every live object is either counted or on the value stack
+static void knit_gc_zct_scan(struct knit *knit) {
+    struct knit_objp_darray *zct = &knit->ex.heap.zct;
+    struct knit_gc_cycle_stats *cs = knit_gc_stats_begin(&knit->gc_stats, KNIT_GC_TRIGGER_ZCT);
+    uint64_t t0 = knit_gc_stats_now_ns();
+    knit_gc_mark_stack(knit, 1);
+    uint64_t t1 = knit_gc_stats_now_ns();
+    int kept = 0;
+    //freeing an object can append its children to the table, they are handled in the same scan
+    for (int i=0; i<zct->len; i++) {
+        struct knit_obj *obj = zct->data[i];
+        struct knit_heap_class *cls = NULL;
+        long idx = knit_gc_object_index(knit, obj, &cls);
+        knit_assert_h(idx != -1, "");
+        if (cls->refcounts[idx] > 0) {
+            bitset_set_bit(&cls->zct_bitset, idx, 0);
+        }
+        else if (bitset_get_bit(&cls->mark_bitset, idx)) {
+            zct->data[kept++] = obj; //still on the stack
+        }
+        else {
+            bitset_set_bit(&cls->zct_bitset, idx, 0);
+            knit_gc_release_children(knit, obj, 0);
+            cs->bytes_freed += knit_gc_free_object(knit, cls, idx);
+            cs->freed++;
+        }
+    }
+    zct->len = kept;
+    knit_gc_mark_stack(knit, 0);
+    cs->marked = kept;
+    cs->mark_ns = knit_gc_stats_elapsed_ns(t0, t1);
+    cs->sweep_ns = knit_gc_stats_elapsed_ns(t1, knit_gc_stats_now_ns());
+    knit_gc_stats_end(&knit->gc_stats, cs);
 }
 
 
 
+static void knit_gc_walk_block(struct knit *knit, struct knit_block *block); //fwd
+static void knit_gc_walk_stack(struct knit *knit, struct knit_stack *stack); //fwd
 static void knit_gc_walk_object(struct knit *knit, struct knit_obj *obj) {
     if (!obj)
         return;
-    long obj_idx = knit_gc_object_index(knit, obj);
+    struct knit_heap_class *cls;
+    long obj_idx = knit_gc_object_index(knit, obj, &cls);
+    if (obj_idx == -1)
+        obj_idx = knit_gc_arena_index(knit, obj, &cls); //marked too, arena objects can form cycles
     if (obj_idx != -1) {
-        struct knit_bitset *mbs = &knit->ex.heap.mark_bitset;
+        struct knit_bitset *mbs = &cls->mark_bitset;
         if (bitset_get_bit(mbs, obj_idx)) {
             return;
         }
         bitset_set_bit(mbs, obj_idx, 1);
+        if (!cls->has_refs) {
+            return;
+        }
+    }
+    else if (knit_obj_is_frozen(obj)) {
+        return; //always live, other instances may be reading it
     }
     else {
         #ifdef KNIT_DEBUG_GC
@@ -101,22 +467,44 @@ static void knit_gc_walk_object(struct knit *knit, struct knit_obj *obj) {
     }
     else if (obj->u.ktype == KNIT_KFUNC) {
         struct knit_kfunc *kfunc = (struct knit_kfunc*) obj;
-        for (int i=0; i<kfunc->block.constants.len; i++) {
-            struct knit_obj *elem = kfunc->block.constants.data[i];
-            knit_gc_walk_object(knit, elem);
-        }
+        knit_gc_walk_block(knit, kfunc->block);
+    }
+    else if (obj->u.ktype == KNIT_GENERATOR) {
+        //a running generator holds its resumer's stack, that's a root
+        struct knit_gen *gen = obj->u.generator.gen;
+        if (gen->state == KNIT_GEN_SUSPENDED)
+            knit_gc_walk_stack(knit, &gen->stack);
     }
     
 }
+static void knit_gc_walk_block(struct knit *knit, struct knit_block *block) {
+    for (int i=0; i<block->constants.len; i++) {
+        knit_gc_walk_object(knit, block->constants.data[i]);
+    }
+}
 
-static int knit_gc_walk_workingset(struct knit *knit) {
-    struct knit_exec_state *exec_state = &knit->ex;
-    struct knit_stack *stack = &knit->ex.stack;
-    struct knit_vars_jadwal *vars_ht = &knit->ex.global_ht;
+static void knit_gc_walk_stack(struct knit *knit, struct knit_stack *stack) {
     struct knit_objp_darray *stack_vals = &stack->vals;
     for (int i=0; i<stack_vals->len; i++) {
         knit_gc_walk_object(knit, stack_vals->data[i]);
     }
+    //constants of blocks that are being executed
+    struct knit_frame_darray *frames = &stack->frames;
+    for (int i=0; i<frames->len; i++) {
+        if (frames->data[i].frame_type == KNIT_FRAME_KBLOCK) {
+            knit_gc_walk_block(knit, frames->data[i].u.kf.block);
+        }
+    }
+}
+
+static int knit_gc_walk_workingset(struct knit *knit) {
+    struct knit_exec_state *exec_state = &knit->ex;
+    struct knit_vars_jadwal *vars_ht = &knit->ex.global_ht;
+    knit_gc_walk_stack(knit, &knit->ex.stack);
+    for (struct knit_gen *gen = knit->ex.gens; gen; gen = gen->next) {
+        if (gen->state == KNIT_GEN_RUNNING)
+            knit_gc_walk_stack(knit, &gen->stack);
+    }
 
     struct knit_vars_jadwal_iter iter;
     knit_vars_jadwal_begin_iterator(vars_ht, &iter);
@@ -125,29 +513,554 @@ static int knit_gc_walk_workingset(struct knit *knit) {
         struct knit_obj *value = iter.pair->value;
         knit_gc_walk_object(knit, value);
     }
+    for (int i=0; i<exec_state->modules.len; i++) {
+        if (exec_state->modules.data[i])
+            knit_gc_walk_object(knit, exec_state->modules.data[i]);
+    }
+    //arena objects are only collected when the arena is reset, so whatever they reference stays alive
+    struct knit_heap_arena *arena = &knit->ex.heap.arena;
+    for (int c=0; c<KNIT_HEAP_NCLASSES && arena->enabled; c++) {
+        struct knit_heap_class *cls = &arena->classes[c];
+        for (int i=0; i<cls->count; i++) {
+            knit_gc_walk_object(knit, knit_heap_class_object(cls, i));
+        }
+    }
     return KNIT_OK;
 }
-static void knit_gc_obj_null(struct knit *knit, struct knit_obj *obj) {
-    obj->u.ktype = KNIT_NULL;
-}
-static void knit_gc_cycle(struct knit *knit) {
-    bitset_set_all(&knit->ex.heap.mark_bitset, 0, 0);
+//a full mark and sweep, fills in the timings and counts of cs
+static void knit_gc_collect(struct knit *knit, struct knit_gc_cycle_stats *cs) {
+    struct knit_heap *heap = &knit->ex.heap;
+    uint64_t t0 = knit_gc_stats_now_ns();
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        bitset_set_all(&heap->classes[c].mark_bitset, 0, 0);
+    }
     knit_gc_walk_workingset(knit);
-    bitset_andn(&knit->ex.heap.mark_bitset, &knit->ex.heap.alloc_bitset);
+    uint64_t t1 = knit_gc_stats_now_ns();
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        bitset_andn(&cls->mark_bitset, &cls->alloc_bitset);
+    }
     //mark_bitset should contain dead objects
-    struct knit_bitset *mbs = &knit->ex.heap.mark_bitset;
-    long i = bitset_find_true_bit(mbs, 0);
-    while (i != -1) {
-        #ifdef KNIT_DEBUG_GC
-        printf("Object %i is dead!\n", (int)i);
-        knitx_obj_dump(knit, knit->ex.heap.objects + i);
-        #endif
-        struct knit_obj *obj = knit->ex.heap.objects + i;
-        knit_obj_deinit(knit, obj);
-        bitset_set_bit(&knit->ex.heap.alloc_bitset, i, 0);
-        i = bitset_find_true_bit(mbs, i + 1);
-        knit->ex.heap.count--;
+
+    //dead objects are dropped from the zero count table, and release their references to live objects
+    struct knit_objp_darray *zct = &heap->zct;
+    int kept = 0;
+    for (int i=0; i<zct->len; i++) {
+        struct knit_heap_class *cls = NULL;
+        long idx = knit_gc_object_index(knit, zct->data[i], &cls);
+        knit_assert_h(idx != -1, "");
+        if (bitset_get_bit(&cls->mark_bitset, idx))
+            bitset_set_bit(&cls->zct_bitset, idx, 0);
+        else
+            zct->data[kept++] = zct->data[i];
+    }
+    zct->len = kept;
+    //same for the remembered set, dead containers are freed whatever their pin count is
+    struct knit_objp_darray *remembered = &heap->arena.remembered;
+    kept = 0;
+    for (int i=0; i<remembered->len && heap->arena.enabled; i++) {
+        struct knit_heap_class *cls = NULL;
+        long idx = knit_gc_object_index(knit, remembered->data[i], &cls);
+        if (bitset_get_bit(&cls->mark_bitset, idx))
+            bitset_set_bit(&cls->remembered_bitset, idx, 0);
+        else
+            remembered->data[kept++] = remembered->data[i];
     }
+    remembered->len = kept;
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        if (!cls->has_refs)
+            continue;
+        for (long i = bitset_find_true_bit(&cls->mark_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->mark_bitset, i + 1)) {
+            knit_gc_release_children(knit, knit_heap_class_object(cls, i), 1);
+        }
+    }
+
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        struct knit_bitset *mbs = &cls->mark_bitset;
+        long i = bitset_find_true_bit(mbs, 0);
+        while (i != -1) {
+            struct knit_obj *obj = knit_heap_class_object(cls, i);
+            #ifdef KNIT_DEBUG_GC
+            printf("Object %i of class %d is dead!\n", (int)i, c);
+            knitx_obj_dump(knit, obj);
+            #endif
+            cs->bytes_freed += knit_gc_object_bytes(cls, obj);
+            cs->freed++;
+            knit_obj_deinit(knit, obj);
+            knit_gc_obj_null(knit, obj);
+            bitset_set_bit(&cls->alloc_bitset, i, 0);
+            i = bitset_find_true_bit(mbs, i + 1);
+            cls->count--;
+            heap->count--;
+        }
+        knit_gc_rebuild_free_list(knit, cls);
+    }
+    //the mark bits of dead objects are left set, the zct scan expects them to be clear
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        bitset_set_all(&heap->classes[c].mark_bitset, 0, 0);
+        if (heap->arena.enabled)
+            bitset_set_all(&heap->arena.classes[c].mark_bitset, 0, 0);
+    }
+    cs->marked = heap->count;
+    cs->mark_ns = knit_gc_stats_elapsed_ns(t0, t1);
+    cs->sweep_ns = knit_gc_stats_elapsed_ns(t1, knit_gc_stats_now_ns());
+}
+static void knit_gc_cycle(struct knit *knit, int trigger) {
+    struct knit_gc_cycle_stats *cs = knit_gc_stats_begin(&knit->gc_stats, trigger);
+    knit_gc_collect(knit, cs);
+    knit_gc_stats_end(&knit->gc_stats, cs);
+}
+
+/*
+    compaction:
+    slides live objects to the beginning of their class, resizes the class to fit them,
+    then patches every reference: the value stack and generators' stacks, globals, constants of executing blocks and reachable functions,
+    list items, dict keys and values, and the zero count table. refcounts move with their cells.
+    free_list doubles as the forwarding table (old index -> new index) while compacting, it is rebuilt at the end.
+    this moves objects, so it must only be called at points where C code doesn't hold pointers to gc objects
+    (between executions, or from a builtin like gccompact())
+*/
+struct knit_gc_compaction {
+    uintptr_t old_begin[KNIT_HEAP_NCLASSES];
+    uintptr_t old_end[KNIT_HEAP_NCLASSES];
+};
+static struct knit_obj *knit_gc_forward(struct knit *knit, struct knit_gc_compaction *cpt, struct knit_obj *obj) {
+    uintptr_t ptr = (uintptr_t) obj;
+    for (int i=0; i<KNIT_HEAP_NCLASSES; i++) {
+        if (ptr >= cpt->old_begin[i] && ptr < cpt->old_end[i]) {
+            struct knit_heap_class *cls = &knit->ex.heap.classes[i];
+            long idx = (ptr - cpt->old_begin[i]) / cls->cell_size;
+            return knit_heap_class_object(cls, cls->free_list[idx]);
+        }
+    }
+    return obj;
+}
+static void knit_gc_fixup_block(struct knit *knit, struct knit_gc_compaction *cpt, struct knit_block *block); //fwd
+static void knit_gc_fixup_ref(struct knit *knit, struct knit_gc_compaction *cpt, struct knit_obj **ref) {
+    if (!*ref)
+        return;
+    *ref = knit_gc_forward(knit, cpt, *ref);
+    if ((*ref)->u.ktype == KNIT_KFUNC) {
+        knit_gc_fixup_block(knit, cpt, (*ref)->u.kfunc.block);
+    }
+}
+//a block can be reachable from many places, its constants must be patched exactly once.
+//a shared block has nothing to patch and other instances read it
+static void knit_gc_fixup_block(struct knit *knit, struct knit_gc_compaction *cpt, struct knit_block *block) {
+    if (block->shared || block->gc_epoch == knit->ex.heap.epoch)
+        return;
+    block->gc_epoch = knit->ex.heap.epoch;
+    for (int i=0; i<block->constants.len; i++) {
+        knit_gc_fixup_ref(knit, cpt, &block->constants.data[i]);
+    }
+}
+static void knit_gc_fixup_object(struct knit *knit, struct knit_gc_compaction *cpt, struct knit_obj *obj) {
+    if (obj->u.ktype == KNIT_DICT) {
+        struct kobj_jadwal *ht = &obj->u.dict.ht;
+        struct kobj_jadwal_iter iter;
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter)) {
+            //keys are hashed by value, so they keep their buckets
+            knit_gc_fixup_ref(knit, cpt, &iter.pair->key);
+            knit_gc_fixup_ref(knit, cpt, &iter.pair->value);
+        }
+    }
+    else if (obj->u.ktype == KNIT_LIST) {
+        struct knit_list *list = &obj->u.list;
+        for (int i=0; i<list->len; i++) {
+            knit_gc_fixup_ref(knit, cpt, &list->items[i]);
+        }
+    }
+}
+
+//the class keeps some room to grow, but gives back memory after spikes
+static int knit_heap_class_fit_capacity(struct knit_heap_class *cls) {
+    int cap = cls->count * 2;
+    return cap > cls->min_capacity ? cap : cls->min_capacity;
+}
+
+//moves live objects to the front and resizes the class if possible, records the old address range in cpt
+//this doesn't fail, when memory can't be allocated the class keeps its capacity
+static void knit_gc_compact_class(struct knit *knit, struct knit_heap_class *cls, struct knit_gc_compaction *cpt, int c) {
+    int new_cap = knit_heap_class_fit_capacity(cls);
+    cpt->old_begin[c] = (uintptr_t) cls->cells;
+    cpt->old_end[c] = (uintptr_t) (cls->cells + (size_t) cls->capacity * cls->cell_size);
+
+    if (new_cap > cls->capacity) {
+        //the per cell arrays must be able to hold the new capacity, they are shrunk at the end of compaction
+        void *p = NULL;
+        if (knitx_rrealloc(knit, cls->free_list, new_cap * sizeof(cls->free_list[0]), &p) == KNIT_OK)
+            cls->free_list = p;
+        else
+            new_cap = cls->capacity;
+        if (new_cap > cls->capacity) {
+            if (knitx_rrealloc(knit, cls->refcounts, new_cap * sizeof(cls->refcounts[0]), &p) == KNIT_OK)
+                cls->refcounts = p;
+            else
+                new_cap = cls->capacity;
+        }
+    }
+    int next = 0;
+    for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+        cls->free_list[i] = next;
+        if (next != i) {
+            memmove(cls->cells + (size_t) next * cls->cell_size, cls->cells + (size_t) i * cls->cell_size, cls->cell_size);
+            cls->refcounts[next] = cls->refcounts[i];
+        }
+        next++;
+    }
+    knit_assert_h(next == cls->count, "");
+
+    if (new_cap != cls->capacity) {
+        struct knit_bitset alloc_bitset, mark_bitset, zct_bitset, remembered_bitset;
+        void *p = NULL;
+        if (bitset_init(&alloc_bitset, new_cap, &knit->container_allocator) != KNIT_OK) {
+            goto keep_capacity;
+        }
+        if (bitset_init(&mark_bitset, new_cap, &knit->container_allocator) != KNIT_OK) {
+            goto cleanup_alloc_bitset;
+        }
+        if (bitset_init(&zct_bitset, new_cap, &knit->container_allocator) != KNIT_OK) {
+            goto cleanup_mark_bitset;
+        }
+        if (bitset_init(&remembered_bitset, new_cap, &knit->container_allocator) != KNIT_OK) {
+            goto cleanup_zct_bitset;
+        }
+        if (knitx_rrealloc(knit, cls->cells, (size_t) new_cap * cls->cell_size, &p) != KNIT_OK) {
+            goto cleanup_remembered_bitset;
+        }
+        bitset_deinit(&cls->alloc_bitset);
+        bitset_deinit(&cls->mark_bitset);
+        bitset_deinit(&cls->zct_bitset);
+        bitset_deinit(&cls->remembered_bitset);
+        cls->alloc_bitset = alloc_bitset;
+        cls->mark_bitset = mark_bitset;
+        cls->zct_bitset = zct_bitset;
+        cls->remembered_bitset = remembered_bitset;
+        cls->cells = p;
+        cls->capacity = new_cap;
+        goto keep_capacity;
+
+cleanup_remembered_bitset:
+        bitset_deinit(&remembered_bitset);
+cleanup_zct_bitset:
+        bitset_deinit(&zct_bitset);
+cleanup_mark_bitset:
+        bitset_deinit(&mark_bitset);
+cleanup_alloc_bitset:
+        bitset_deinit(&alloc_bitset);
+    }
+keep_capacity:
+    bitset_set_all(&cls->alloc_bitset, 0, 0);
+    for (int i=0; i<cls->count; i++) {
+        bitset_set_bit(&cls->alloc_bitset, i, 1);
+    }
+}
+
+static void knit_gc_fixup_stack(struct knit *knit, struct knit_gc_compaction *cpt, struct knit_stack *stack) {
+    for (int i=0; i<stack->vals.len; i++) {
+        knit_gc_fixup_ref(knit, cpt, &stack->vals.data[i]);
+    }
+    for (int i=0; i<stack->frames.len; i++) {
+        if (stack->frames.data[i].frame_type == KNIT_FRAME_KBLOCK) {
+            knit_gc_fixup_block(knit, cpt, stack->frames.data[i].u.kf.block);
+        }
+    }
+}
+
+static int knit_gc_compact(struct knit *knit) {
+    struct knit_heap *heap = &knit->ex.heap;
+    struct knit_gc_compaction cpt;
+
+    struct knit_gc_cycle_stats *cs = knit_gc_stats_begin(&knit->gc_stats, KNIT_GC_TRIGGER_COMPACT);
+    knit_gc_collect(knit, cs);
+    uint64_t t0 = knit_gc_stats_now_ns();
+    heap->epoch++;
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        knit_gc_compact_class(knit, &heap->classes[c], &cpt, c);
+    }
+
+    knit_gc_fixup_stack(knit, &cpt, &knit->ex.stack);
+    for (struct knit_gen *gen = knit->ex.gens; gen; gen = gen->next) {
+        knit_gc_fixup_stack(knit, &cpt, &gen->stack);
+    }
+    struct knit_vars_jadwal_iter iter;
+    knit_vars_jadwal_begin_iterator(&knit->ex.global_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter); knit_vars_jadwal_iter_next(&knit->ex.global_ht, &iter)) {
+        knit_gc_fixup_ref(knit, &cpt, &iter.pair->value);
+    }
+    for (int i=0; i<knit->ex.modules.len; i++) {
+        knit_gc_fixup_ref(knit, &cpt, &knit->ex.modules.data[i]);
+    }
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        if (!cls->has_refs)
+            continue;
+        for (int i=0; i<cls->count; i++) {
+            knit_gc_fixup_object(knit, &cpt, knit_heap_class_object(cls, i));
+        }
+    }
+
+    for (int i=0; i<heap->zct.len; i++) {
+        knit_gc_fixup_ref(knit, &cpt, &heap->zct.data[i]);
+    }
+    //arena objects don't move, but they can point to heap objects
+    for (int c=0; c<KNIT_HEAP_NCLASSES && heap->arena.enabled; c++) {
+        struct knit_heap_class *cls = &heap->arena.classes[c];
+        for (int i=0; i<cls->count && cls->has_refs; i++) {
+            knit_gc_fixup_object(knit, &cpt, knit_heap_class_object(cls, i));
+        }
+    }
+    for (int i=0; i<heap->arena.remembered.len; i++) {
+        knit_gc_fixup_ref(knit, &cpt, &heap->arena.remembered.data[i]);
+    }
+
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        void *p = NULL;
+        //shrinking can't really fail, but if it does the bigger arrays are still usable
+        if (knitx_rrealloc(knit, cls->free_list, cls->capacity * sizeof(cls->free_list[0]), &p) == KNIT_OK)
+            cls->free_list = p;
+        if (knitx_rrealloc(knit, cls->refcounts, cls->capacity * sizeof(cls->refcounts[0]), &p) == KNIT_OK)
+            cls->refcounts = p;
+        knit_gc_rebuild_free_list(knit, cls);
+        bitset_set_all(&cls->zct_bitset, 0, 0);
+        bitset_set_all(&cls->remembered_bitset, 0, 0);
+    }
+    for (int i=0; i<heap->zct.len; i++) {
+        struct knit_heap_class *cls = NULL;
+        long idx = knit_gc_object_index(knit, heap->zct.data[i], &cls);
+        knit_assert_h(idx != -1, "");
+        bitset_set_bit(&cls->zct_bitset, idx, 1);
+    }
+    for (int i=0; i<heap->arena.remembered.len; i++) {
+        struct knit_heap_class *cls = NULL;
+        long idx = knit_gc_object_index(knit, heap->arena.remembered.data[i], &cls);
+        knit_assert_h(idx != -1, "");
+        bitset_set_bit(&cls->remembered_bitset, idx, 1);
+    }
+    cs->compact_ns = knit_gc_stats_elapsed_ns(t0, knit_gc_stats_now_ns());
+    knit_gc_stats_end(&knit->gc_stats, cs);
+    return KNIT_OK;
+}
+
+/*
+    request arena:
+    while the arena is active (one top level execution, see knitx_exec_str()) new objects are bumped from
+    a second set of classes, they aren't counted and never enter the zero count table.
+    at the end the objects reachable from the value stack, generators' stacks, globals and remembered heap containers
+    are copied to the heap (references to them are counted as they are patched), the rest are dropped.
+    dropping an int is free, strings, lists and dicts still have their memory released one by one.
+    if a class fills up during the execution the arena is reset at the next safe point in the vm loop and refilled.
+*/
+static int knit_heap_arena_init(struct knit *knit, struct knit_heap_arena *arena, int ncells) {
+    int rv;
+    size_t medium_sz = sizeof(struct knit_str) > sizeof(struct knit_list) ? sizeof(struct knit_str) : sizeof(struct knit_list);
+    if ((rv = knit_heap_class_init(knit, &arena->classes[KNIT_HEAP_SMALL], sizeof(struct knit_int), 0, ncells)) != KNIT_OK)
+        return rv;
+    if ((rv = knit_heap_class_init(knit, &arena->classes[KNIT_HEAP_MEDIUM], medium_sz, 1, ncells)) != KNIT_OK)
+        goto cleanup_small;
+    if ((rv = knit_heap_class_init(knit, &arena->classes[KNIT_HEAP_LARGE], sizeof(struct knit_obj), 1, ncells / 4 + 1)) != KNIT_OK)
+        goto cleanup_medium;
+    if (knit_objp_darray_init_with_allocator(&arena->remembered, 64, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        rv = KNIT_NOMEM;
+        goto cleanup_large;
+    }
+    //cells are handed out in order, the free lists are only used as forwarding tables
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        arena->classes[c].free_len = 0;
+    }
+    arena->enabled = 1;
+    arena->active = 0;
+    arena->overflowed = 0;
+    return KNIT_OK;
+
+cleanup_large:
+    knit_heap_class_deinit(knit, &arena->classes[KNIT_HEAP_LARGE]);
+cleanup_medium:
+    knit_heap_class_deinit(knit, &arena->classes[KNIT_HEAP_MEDIUM]);
+cleanup_small:
+    knit_heap_class_deinit(knit, &arena->classes[KNIT_HEAP_SMALL]);
+    return rv;
+}
+static void knit_heap_arena_deinit(struct knit *knit, struct knit_heap_arena *arena) {
+    if (!arena->enabled)
+        return;
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &arena->classes[c];
+        for (int i=0; i<cls->count && c != KNIT_HEAP_SMALL; i++) {
+            knit_obj_deinit(knit, knit_heap_class_object(cls, i));
+        }
+        knit_heap_class_deinit(knit, cls);
+    }
+    knit_objp_darray_deinit(&arena->remembered);
+    memset(arena, 0, sizeof *arena);
+}
+
+//the arena is reset in two passes over the same references: the first marks and counts the survivors,
+//the second copies them to the heap and patches the references
+struct knit_gc_arena_pass {
+    int evacuate;
+    int survivors[KNIT_HEAP_NCLASSES];
+};
+static void knit_gc_arena_ref(struct knit *knit, struct knit_gc_arena_pass *pass, struct knit_obj **ref, int counted); //fwd
+//references held by a list or dict are always counted
+static void knit_gc_arena_children(struct knit *knit, struct knit_gc_arena_pass *pass, struct knit_obj *obj) {
+    if (obj->u.ktype == KNIT_LIST) {
+        struct knit_list *list = &obj->u.list;
+        for (int i=0; i<list->len; i++) {
+            knit_gc_arena_ref(knit, pass, &list->items[i], 1);
+        }
+    }
+    else if (obj->u.ktype == KNIT_DICT) {
+        struct kobj_jadwal *ht = &obj->u.dict.ht;
+        struct kobj_jadwal_iter iter;
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter)) {
+            //keys are hashed by value, so they keep their buckets
+            knit_gc_arena_ref(knit, pass, &iter.pair->key, 1);
+            knit_gc_arena_ref(knit, pass, &iter.pair->value, 1);
+        }
+    }
+}
+static void knit_gc_arena_ref(struct knit *knit, struct knit_gc_arena_pass *pass, struct knit_obj **ref, int counted) {
+    struct knit_heap_class *cls;
+    struct knit_obj *obj = *ref;
+    long idx = obj ? knit_gc_arena_index(knit, obj, &cls) : -1;
+    if (idx == -1)
+        return;
+    int c = cls - knit->ex.heap.arena.classes;
+    if (!pass->evacuate) {
+        if (bitset_get_bit(&cls->mark_bitset, idx))
+            return;
+        bitset_set_bit(&cls->mark_bitset, idx, 1);
+        pass->survivors[c]++;
+        knit_gc_arena_children(knit, pass, obj);
+        return;
+    }
+    struct knit_heap_class *heap_cls = &knit->ex.heap.classes[c];
+    if (!bitset_get_bit(&cls->alloc_bitset, idx)) {
+        struct knit_obj *copy = knit_heap_class_new_object(knit, heap_cls);
+        knit_assert_h(!!copy, "knit_gc_arena_ref(): no room was made for a survivor");
+        memcpy(copy, obj, heap_cls->cell_size);
+        bitset_set_bit(&cls->alloc_bitset, idx, 1);
+        cls->free_list[idx] = ((char *) copy - heap_cls->cells) / heap_cls->cell_size;
+        knit_gc_arena_children(knit, pass, copy);
+    }
+    *ref = knit_heap_class_object(heap_cls, cls->free_list[idx]);
+    if (counted)
+        heap_cls->refcounts[cls->free_list[idx]]++;
+}
+static void knit_gc_arena_roots(struct knit *knit, struct knit_gc_arena_pass *pass) {
+    struct knit_heap *heap = &knit->ex.heap;
+    struct knit_objp_darray *vals = &knit->ex.stack.vals;
+    for (int i=0; i<vals->len; i++) {
+        knit_gc_arena_ref(knit, pass, &vals->data[i], 0);
+    }
+    for (struct knit_gen *gen = knit->ex.gens; gen; gen = gen->next) {
+        for (int i=0; i<gen->stack.vals.len; i++) {
+            knit_gc_arena_ref(knit, pass, &gen->stack.vals.data[i], 0);
+        }
+    }
+    struct knit_vars_jadwal_iter iter;
+    knit_vars_jadwal_begin_iterator(&knit->ex.global_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter); knit_vars_jadwal_iter_next(&knit->ex.global_ht, &iter)) {
+        knit_gc_arena_ref(knit, pass, &iter.pair->value, 1);
+    }
+    for (int i=0; i<knit->ex.modules.len; i++) {
+        knit_gc_arena_ref(knit, pass, &knit->ex.modules.data[i], 1);
+    }
+    if (!heap->arena.overflowed) {
+        for (int i=0; i<heap->arena.remembered.len; i++) {
+            knit_gc_arena_children(knit, pass, heap->arena.remembered.data[i]);
+        }
+        return;
+    }
+    //some containers weren't remembered, any of them might point into the arena
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        if (!cls->has_refs)
+            continue;
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+            knit_gc_arena_children(knit, pass, knit_heap_class_object(cls, i));
+        }
+    }
+}
+static int knit_gc_arena_fits(struct knit *knit, struct knit_gc_arena_pass *pass) {
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        if (pass->survivors[c] > knit->ex.heap.classes[c].free_len)
+            return 0;
+    }
+    return 1;
+}
+static void knit_gc_arena_clear_marks(struct knit_heap_arena *arena) {
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        bitset_set_all(&arena->classes[c].mark_bitset, 0, 0);
+    }
+}
+//ends the execution that used the arena. if the heap can't take the survivors even after a collection
+//the arena is left as it is and KNIT_GC_NOMEM is returned, the next execution keeps filling it
+static int knit_gc_arena_reset(struct knit *knit) {
+    struct knit_heap *heap = &knit->ex.heap;
+    struct knit_heap_arena *arena = &heap->arena;
+    struct knit_gc_arena_pass pass = {0};
+    arena->active = 0;
+    uint64_t t0 = knit_gc_stats_now_ns();
+    knit_gc_arena_roots(knit, &pass);
+    if (!knit_gc_arena_fits(knit, &pass)) {
+        knit_gc_arena_clear_marks(arena);
+        knit_gc_cycle(knit, KNIT_GC_TRIGGER_ARENA); //arena objects are roots for it
+        memset(&pass, 0, sizeof pass);
+        t0 = knit_gc_stats_now_ns();
+        knit_gc_arena_roots(knit, &pass);
+        if (!knit_gc_arena_fits(knit, &pass)) {
+            knit_gc_arena_clear_marks(arena);
+            return knit_error(knit, KNIT_GC_NOMEM, "knit_gc_arena_reset(): the heap has no room for the objects that outlive the arena");
+        }
+    }
+    struct knit_gc_cycle_stats *cs = knit_gc_stats_begin(&knit->gc_stats, KNIT_GC_TRIGGER_ARENA);
+    uint64_t t1 = knit_gc_stats_now_ns();
+    pass.evacuate = 1;
+    knit_gc_arena_roots(knit, &pass);
+
+    //containers are unpinned, they may be garbage themselves by now
+    for (int i=0; i<arena->remembered.len; i++) {
+        struct knit_heap_class *cls = NULL;
+        long idx = knit_gc_object_index(knit, arena->remembered.data[i], &cls);
+        bitset_set_bit(&cls->remembered_bitset, idx, 0);
+        knit_gc_decref(knit, arena->remembered.data[i]);
+    }
+    arena->remembered.len = 0;
+    arena->overflowed = 0;
+    arena->full = 0;
+
+    //what wasn't copied is dropped, only objects that own memory are looked at
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &arena->classes[c];
+        long dead = cls->count - pass.survivors[c];
+        if (c == KNIT_HEAP_SMALL) {
+            cs->bytes_freed += dead * cls->cell_size;
+        }
+        else {
+            for (long i = bitset_find_false_bit(&cls->alloc_bitset, 0); i != -1 && i < cls->count; i = bitset_find_false_bit(&cls->alloc_bitset, i + 1)) {
+                struct knit_obj *obj = knit_heap_class_object(cls, i);
+                cs->bytes_freed += knit_gc_object_bytes(cls, obj);
+                knit_gc_release_children(knit, obj, 0);
+                knit_obj_deinit(knit, obj);
+            }
+        }
+        cs->freed += dead;
+        cs->marked += pass.survivors[c];
+        bitset_set_all(&cls->mark_bitset, 0, 0);
+        bitset_set_all(&cls->alloc_bitset, 0, 0);
+        cls->count = 0;
+    }
+    cs->mark_ns = knit_gc_stats_elapsed_ns(t0, t1);
+    cs->sweep_ns = knit_gc_stats_elapsed_ns(t1, knit_gc_stats_now_ns());
+    knit_gc_stats_end(&knit->gc_stats, cs);
+    return KNIT_OK;
 }
 
 #endif //KNIT_GC
@@ -0,0 +1,126 @@
+#ifndef KNIT_GC_STATS_H
+#define KNIT_GC_STATS_H
+#include <stdio.h>
+#include <time.h>
+#include "kdata.h"
+
+/*
+    gc statistics are always collected, a cycle costs two clock reads per phase,
+    which is small next to marking or scanning the zero count table
+*/
+
+//a monotonic clock, so setting the system time doesn't change pauses. pauses and the share are wall time, not cpu time
+static uint64_t knit_gc_stats_now_ns(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+#else
+    if (timespec_get(&ts, TIME_UTC) != TIME_UTC)
+        return 0;
+#endif
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+//without CLOCK_MONOTONIC the clock can step backwards, that counts as zero time
+static uint64_t knit_gc_stats_elapsed_ns(uint64_t begin, uint64_t end) {
+    return end > begin ? end - begin : 0;
+}
+static void knit_gc_stats_init(struct knit_gc_stats *st) {
+    memset(st, 0, sizeof *st);
+    st->start_ns = knit_gc_stats_now_ns();
+}
+//returns the ring entry the cycle fills, it stays valid until knit_gc_stats_end()
+static struct knit_gc_cycle_stats *knit_gc_stats_begin(struct knit_gc_stats *st, int trigger) {
+    struct knit_gc_cycle_stats *cs = &st->ring[st->ncycles % KNIT_GC_STATS_RING_SZ];
+    memset(cs, 0, sizeof *cs);
+    cs->trigger = trigger;
+    return cs;
+}
+static int knit_gc_stats_bucket(uint64_t pause_ns) {
+    int b = 0;
+    while (pause_ns && b < KNIT_GC_STATS_NBUCKETS - 1) {
+        pause_ns >>= 1;
+        b++;
+    }
+    return b;
+}
+static void knit_gc_stats_end(struct knit_gc_stats *st, struct knit_gc_cycle_stats *cs) {
+    uint64_t pause = cs->mark_ns + cs->sweep_ns + cs->compact_ns;
+    st->ncycles++;
+    st->ncycles_by_trigger[cs->trigger]++;
+    st->pause_hist[knit_gc_stats_bucket(pause)]++;
+    st->total_pause_ns += pause;
+    if (pause > st->max_pause_ns)
+        st->max_pause_ns = pause;
+    st->total_freed += cs->freed;
+    st->total_bytes_freed += cs->bytes_freed;
+}
+//the n-th most recent cycle, 0 is the last one, NULL if it's no longer (or not yet) in the ring
+static const struct knit_gc_cycle_stats *knit_gc_stats_cycle(const struct knit_gc_stats *st, int n) {
+    if (n < 0 || n >= KNIT_GC_STATS_RING_SZ || (uint64_t) n >= st->ncycles)
+        return NULL;
+    return &st->ring[(st->ncycles - 1 - n) % KNIT_GC_STATS_RING_SZ];
+}
+//approximated from the histogram: the upper bound of the bucket holding the percentile, never more than the max
+static uint64_t knit_gc_stats_pause_percentile(const struct knit_gc_stats *st, int percent) {
+    if (!st->ncycles)
+        return 0;
+    uint64_t rank = (st->ncycles * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int b=0; b<KNIT_GC_STATS_NBUCKETS; b++) {
+        seen += st->pause_hist[b];
+        if (seen >= rank && seen) {
+            uint64_t upper = b ? (uint64_t) 1 << b : 0;
+            return upper < st->max_pause_ns ? upper : st->max_pause_ns;
+        }
+    }
+    return st->max_pause_ns;
+}
+//fraction of the wall time since initialization spent in gc pauses
+static double knit_gc_stats_share(const struct knit_gc_stats *st) {
+    uint64_t elapsed = knit_gc_stats_elapsed_ns(st->start_ns, knit_gc_stats_now_ns());
+    if (!elapsed)
+        return 0;
+    return (double) st->total_pause_ns / elapsed;
+}
+static const char *knit_gc_trigger_name(int trigger) {
+    switch (trigger) {
+        case KNIT_GC_TRIGGER_EXPLICIT: return "explicit";
+        case KNIT_GC_TRIGGER_ZCT:      return "zct";
+        case KNIT_GC_TRIGGER_COMPACT:  return "compact";
+        case KNIT_GC_TRIGGER_ARENA:    return "arena";
+    }
+    return "unknown";
+}
+static void knit_gc_stats_dump(const struct knit_gc_stats *st) {
+    fprintf(stderr, "[GC report]\n"
+                    "Cycles:              %llu (explicit %llu, zct %llu, compact %llu, arena %llu)\n"
+                    "Objects freed:       %llu\n"
+                    "Bytes freed:         %llu\n"
+                    "Pause p50:           %llu ns\n"
+                    "Pause p99:           %llu ns\n"
+                    "Pause max:           %llu ns\n"
+                    "GC time share:       %.3f%%\n",
+                     (unsigned long long) st->ncycles,
+                     (unsigned long long) st->ncycles_by_trigger[KNIT_GC_TRIGGER_EXPLICIT],
+                     (unsigned long long) st->ncycles_by_trigger[KNIT_GC_TRIGGER_ZCT],
+                     (unsigned long long) st->ncycles_by_trigger[KNIT_GC_TRIGGER_COMPACT],
+                     (unsigned long long) st->ncycles_by_trigger[KNIT_GC_TRIGGER_ARENA],
+                     (unsigned long long) st->total_freed,
+                     (unsigned long long) st->total_bytes_freed,
+                     (unsigned long long) knit_gc_stats_pause_percentile(st, 50),
+                     (unsigned long long) knit_gc_stats_pause_percentile(st, 99),
+                     (unsigned long long) st->max_pause_ns,
+                     knit_gc_stats_share(st) * 100);
+    const struct knit_gc_cycle_stats *cs = knit_gc_stats_cycle(st, 0);
+    if (cs) {
+        fprintf(stderr, "Last cycle:          %s, mark %llu ns, sweep %llu ns, compact %llu ns, %ld live, %ld freed\n",
+                        knit_gc_trigger_name(cs->trigger),
+                        (unsigned long long) cs->mark_ns,
+                        (unsigned long long) cs->sweep_ns,
+                        (unsigned long long) cs->compact_ns,
+                        cs->marked,
+                        cs->freed);
+    }
+}
+#endif
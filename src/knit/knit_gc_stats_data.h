@@ -0,0 +1,37 @@
+#ifndef KNIT_GC_STATS_DATA_H
+#define KNIT_GC_STATS_DATA_H
+#include <stdint.h>
+
+enum KNIT_GC_TRIGGER {
+    KNIT_GC_TRIGGER_EXPLICIT, //gcwalk() or a call from C
+    KNIT_GC_TRIGGER_ZCT,      //the zero count table reached KNIT_ZCT_SCAN_THRESHOLD
+    KNIT_GC_TRIGGER_COMPACT,  //gccompact(), the collection and the compaction are recorded as one pause
+    KNIT_GC_TRIGGER_ARENA,    //the end of an execution with the request arena, survivors are evacuated
+    KNIT_GC_NTRIGGERS,
+};
+
+#define KNIT_GC_STATS_RING_SZ 64 //number of recent cycles kept
+#define KNIT_GC_STATS_NBUCKETS 40 //pause histogram buckets, bucket i counts pauses in [2^(i-1), 2^i) ns
+
+struct knit_gc_cycle_stats {
+    int trigger;
+    uint64_t mark_ns;
+    uint64_t sweep_ns;
+    uint64_t compact_ns;
+    long marked; //objects found live
+    long freed;
+    size_t bytes_freed; //heap cells plus the memory they owned (see knit_gc_object_bytes())
+};
+
+struct knit_gc_stats {
+    struct knit_gc_cycle_stats ring[KNIT_GC_STATS_RING_SZ];
+    uint64_t ncycles; //ring[(ncycles - 1) % KNIT_GC_STATS_RING_SZ] is the last cycle
+    uint64_t ncycles_by_trigger[KNIT_GC_NTRIGGERS];
+    uint64_t pause_hist[KNIT_GC_STATS_NBUCKETS];
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+    uint64_t total_freed;
+    uint64_t total_bytes_freed;
+    uint64_t start_ns; //when the knit instance was initialized
+};
+#endif
@@ -0,0 +1,123 @@
+#ifndef KNIT_GENERATOR_H
+#define KNIT_GENERATOR_H
+#include "kdata.h"
+
+/*
+    generators:
+    calling a function that has a yield doesn't run it, it makes a generator (a struct knit_gen) with a stack of its own:
+    the function and its arguments are moved there and the function's frame is pushed on top of them.
+    next(g) swaps the generator's stack with the value stack, knitx_exec() continues the function where it stopped,
+    and they are swapped back when it yields or returns. nothing is copied on a switch, the stacks only trade places.
+    a function that yields is a generator itself, so a yield always runs in the bottom frame of a generator's stack,
+    in the execution next() started.
+    like the value stack, a generator's stack holds references that aren't counted. the zct scan, compaction and
+    the request arena go through the stacks of all the generators of the instance (knit->ex.gens), a full collection
+    walks a suspended generator's stack when it reaches the generator and the stack a running one holds
+    (its resumer's) as a root.
+    knitx_clone() and images can't copy a generator's frames, an instance with generators can't be cloned or saved
+*/
+
+static void knit_gen_free(struct knit *knit, struct knit_gen *gen) {
+    if (gen->prev)
+        gen->prev->next = gen->next;
+    else
+        knit->ex.gens = gen->next;
+    if (gen->next)
+        gen->next->prev = gen->prev;
+    knitx_stack_deinit(knit, &gen->stack);
+    knitx_tfree(knit, gen);
+}
+
+//func and the nargs arguments under it are on top of the value stack, they're moved to a new generator's stack
+static int knit_gen_new(struct knit *knit, struct knit_kfunc *func, int nargs, struct knit_gen **genp) {
+    struct knit_block *block = func->block;
+    if (block->nargs != nargs)
+        return knit_error(knit, KNIT_NARGS, "calling a function with the wrong number of arguments, expected %d, called with %d", block->nargs, nargs);
+    void *p = NULL;
+    int rv = knitx_tmalloc(knit, sizeof(struct knit_gen), &p);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_gen *gen = p;
+    //the same room as the value stack, pushing a temporary doesn't grow it
+    if ((rv = knitx_stack_init(knit, &gen->stack)) != KNIT_OK) {
+        knitx_tfree(knit, gen);
+        return rv;
+    }
+    gen->state = KNIT_GEN_SUSPENDED;
+    gen->prev = NULL;
+    gen->next = knit->ex.gens;
+    if (gen->next)
+        gen->next->prev = gen;
+    knit->ex.gens = gen;
+
+    struct knit_objp_darray *vals = &knit->ex.stack.vals;
+    for (int i = vals->len - nargs - 1; i < vals->len; i++) {
+        if (knit_objp_darray_push(&gen->stack.vals, &vals->data[i]) != KNIT_OBJP_DARRAY_OK) {
+            knit_gen_free(knit, gen);
+            return knit_error(knit, KNIT_NOMEM, "couldn't make a generator's stack");
+        }
+    }
+    struct knit_frame frm;
+    knitx_frame_init_kf(knit, &frm, block, 0, gen->stack.vals.len, nargs, KRES_UNKNOWN_DISCARD_RET);
+    if (knit_frame_darray_push(&gen->stack.frames, &frm) != KNIT_FRAME_DARRAY_OK) {
+        knit_gen_free(knit, gen);
+        return knit_error(knit, KNIT_NOMEM, "couldn't make a generator's stack");
+    }
+    if ((rv = knitx_stack_reserve_values(knit, &gen->stack, block->nlocals)) != KNIT_OK) {
+        knit_gen_free(knit, gen);
+        return rv;
+    }
+    *genp = gen;
+    return KNIT_OK;
+}
+
+//replaces func and its nargs arguments on top of the value stack with a generator that runs it
+static int knitx_gen_call(struct knit *knit, struct knit_kfunc *func, int nargs) {
+    struct knit_gen *gen = NULL;
+    int rv = knit_gen_new(knit, func, nargs, &gen);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_obj *obj = knit_gc_new_object(knit, KNIT_GENERATOR);
+    if (!obj) {
+        knit_gen_free(knit, gen);
+        return knit_error(knit, KNIT_GC_NOMEM, "the heap has no room for a generator");
+    }
+    obj->u.generator = (struct knit_generator) {.ktype = KNIT_GENERATOR, .gen = gen};
+    struct knit_stack *stack = &knit->ex.stack;
+    knitx_stack_rpush(knit, stack, obj);
+    return knitx_stack_moveup(knit, stack, stack->vals.len - nargs - 2, 1);
+}
+
+//runs the generator until it yields, *valuep is the yielded value. it's null once the generator returned
+static int knitx_gen_resume(struct knit *knit, struct knit_gen *gen, struct knit_obj **valuep) {
+    *valuep = ktobj(&knull);
+    if (gen->state == KNIT_GEN_DONE)
+        return KNIT_OK;
+    if (gen->state == KNIT_GEN_RUNNING)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "next(): the generator is already running");
+    struct knit_stack resumer = knit->ex.stack;
+    knit->ex.stack = gen->stack;
+    gen->stack = resumer;
+    gen->state = KNIT_GEN_RUNNING;
+
+    int rv = knitx_exec(knit);
+    struct knit_stack *stack = &knit->ex.stack;
+    if (rv == KNIT_OK && stack->frames.len) {
+        //it yielded, the value is on top
+        *valuep = stack->vals.data[stack->vals.len - 1];
+        stack->vals.len--;
+        gen->state = KNIT_GEN_SUSPENDED;
+    }
+    else {
+        //returned or failed, what it returned is dropped
+        stack->frames.len = 0;
+        stack->vals.len = 0;
+        gen->state = KNIT_GEN_DONE;
+    }
+
+    resumer = gen->stack;
+    gen->stack = knit->ex.stack;
+    knit->ex.stack = resumer;
+    return rv;
+}
+#endif
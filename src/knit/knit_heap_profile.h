@@ -0,0 +1,382 @@
+#ifndef KNIT_HEAP_PROFILE_H
+#define KNIT_HEAP_PROFILE_H
+#include <stdio.h>
+#include "kdata.h"
+
+/*
+    heap profiler:
+    walks the heap from the roots (globals, value stack slots and constants of executing blocks) like a gc cycle does,
+    every object is attributed to the first root that reaches it and remembers the object it was reached from.
+    the bytes attributed to a root approximate what it retains (a spanning tree instead of a dominator tree,
+    objects shared between roots are only counted once, for the first one), and following the parents of an object
+    gives a retention path like kept[3]['name'].
+    objects that are allocated but not reached are garbage waiting for the next gc cycle.
+    the snapshot is written as json so that two of them can be diffed.
+*/
+#define KNIT_HEAP_PROFILE_NLARGEST 10
+#define KNIT_HEAP_PROFILE_NTYPES (KNIT_FALSE - KNIT_NULL + 1)
+
+enum KNIT_HEAP_PROFILE_EDGE {
+    KNIT_HEAP_EDGE_ROOT,  //reached directly from a root
+    KNIT_HEAP_EDGE_INDEX, //list item, or constant of a function
+    KNIT_HEAP_EDGE_KEY,   //dict key
+    KNIT_HEAP_EDGE_VALUE, //dict value
+};
+enum KNIT_HEAP_PROFILE_ROOT {
+    KNIT_HEAP_ROOT_GLOBAL,
+    KNIT_HEAP_ROOT_STACK,
+    KNIT_HEAP_ROOT_FRAME,
+};
+struct knit_heap_profile_node {
+    struct knit_obj *parent;
+    struct knit_obj *key; //the dict key for KNIT_HEAP_EDGE_VALUE
+    int edge;
+    int index;
+    int root; //-1 if not reached
+};
+struct knit_heap_profile_root {
+    int kind;
+    int index;              //stack slot or frame
+    struct knit_str *name;  //global name
+    long objects;
+    size_t bytes;
+};
+struct knit_heap_profile {
+    struct knit_heap_profile_node *nodes[KNIT_HEAP_NCLASSES];
+    struct knit_heap_profile_root *roots;
+    int nroots;
+    int roots_cap;
+    struct knit_objp_darray work;
+    long type_count[KNIT_HEAP_PROFILE_NTYPES];
+    size_t type_bytes[KNIT_HEAP_PROFILE_NTYPES];
+    struct knit_obj *largest[KNIT_HEAP_PROFILE_NLARGEST]; //sorted by size, biggest first
+    size_t largest_bytes[KNIT_HEAP_PROFILE_NLARGEST];
+    int nlargest;
+    long objects;
+    size_t bytes;
+    long unreachable;
+    size_t unreachable_bytes;
+};
+
+static const char *knit_heap_profile_type_name(int ktype) {
+    switch (ktype) {
+        case KNIT_NULL:  return "null";
+        case KNIT_STR:   return "str";
+        case KNIT_LIST:  return "list";
+        case KNIT_DICT:  return "dict";
+        case KNIT_INT:   return "int";
+        case KNIT_CFUNC: return "cfunc";
+        case KNIT_KFUNC: return "function";
+        case KNIT_GENERATOR: return "generator";
+        case KNIT_TRUE:  return "true";
+        case KNIT_FALSE: return "false";
+    }
+    return "unknown";
+}
+static struct knit_heap_profile_node *knit_heap_profile_node_of(struct knit *knit, struct knit_heap_profile *prof, struct knit_obj *obj) {
+    struct knit_heap_class *cls = NULL;
+    long idx = obj ? knit_gc_object_index(knit, obj, &cls) : -1;
+    if (idx == -1)
+        return NULL;
+    return &prof->nodes[cls - knit->ex.heap.classes][idx];
+}
+static int knit_heap_profile_init(struct knit *knit, struct knit_heap_profile *prof) {
+    int rv;
+    void *p;
+    memset(prof, 0, sizeof *prof);
+    int c = 0;
+    for (; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &knit->ex.heap.classes[c];
+        rv = knitx_tmalloc(knit, (cls->capacity ? cls->capacity : 1) * sizeof(prof->nodes[c][0]), &p);
+        if (rv != KNIT_OK)
+            goto cleanup_nodes;
+        prof->nodes[c] = p;
+        for (int i=0; i<cls->capacity; i++) {
+            prof->nodes[c][i].root = -1;
+        }
+    }
+    if (knit_objp_darray_init_with_allocator(&prof->work, 64, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        rv = knit_error(knit, KNIT_NOMEM, "knit_heap_profile_init(): couldn't allocate the work stack");
+        goto cleanup_nodes;
+    }
+    return KNIT_OK;
+
+cleanup_nodes:
+    while (c-- > 0) {
+        knitx_tfree(knit, prof->nodes[c]);
+    }
+    return rv;
+}
+static void knit_heap_profile_deinit(struct knit *knit, struct knit_heap_profile *prof) {
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        knitx_tfree(knit, prof->nodes[c]);
+    }
+    if (prof->roots)
+        knitx_tfree(knit, prof->roots);
+    knit_objp_darray_deinit(&prof->work);
+}
+static int knit_heap_profile_add_root(struct knit *knit, struct knit_heap_profile *prof, int kind, int index, struct knit_str *name) {
+    if (prof->nroots == prof->roots_cap) {
+        void *p = NULL;
+        int cap = prof->roots_cap ? prof->roots_cap * 2 : 64;
+        int rv = knitx_trealloc(knit, prof->roots, cap * sizeof(prof->roots[0]), &p);
+        if (rv != KNIT_OK)
+            return rv;
+        prof->roots = p;
+        prof->roots_cap = cap;
+    }
+    struct knit_heap_profile_root *root = &prof->roots[prof->nroots++];
+    memset(root, 0, sizeof *root);
+    root->kind = kind;
+    root->index = index;
+    root->name = name;
+    return KNIT_OK;
+}
+//attributes obj to the current root if nothing reached it before
+static int knit_heap_profile_reach(struct knit *knit, struct knit_heap_profile *prof, struct knit_obj *obj, struct knit_obj *parent, int edge, int index, struct knit_obj *key) {
+    struct knit_heap_profile_node *node = knit_heap_profile_node_of(knit, prof, obj);
+    if (!node || node->root != -1)
+        return KNIT_OK;
+    node->parent = parent;
+    node->key = key;
+    node->edge = edge;
+    node->index = index;
+    node->root = prof->nroots - 1;
+    if (knit_objp_darray_push(&prof->work, &obj) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(knit, KNIT_NOMEM, "knit_heap_profile_reach(): couldn't grow the work stack");
+    return KNIT_OK;
+}
+static int knit_heap_profile_reach_block(struct knit *knit, struct knit_heap_profile *prof, struct knit_block *block, struct knit_obj *parent) {
+    int rv = KNIT_OK;
+    int edge = parent ? KNIT_HEAP_EDGE_INDEX : KNIT_HEAP_EDGE_ROOT;
+    for (int i=0; i<block->constants.len && rv == KNIT_OK; i++) {
+        rv = knit_heap_profile_reach(knit, prof, block->constants.data[i], parent, edge, i, NULL);
+    }
+    return rv;
+}
+//depth first walk of everything reachable from what the current root pushed, iterative since lists can nest deeply
+static int knit_heap_profile_drain(struct knit *knit, struct knit_heap_profile *prof) {
+    int rv = KNIT_OK;
+    struct knit_heap_profile_root *root = &prof->roots[prof->nroots - 1];
+    while (prof->work.len && rv == KNIT_OK) {
+        struct knit_obj *obj = prof->work.data[--prof->work.len];
+        struct knit_heap_class *cls = NULL;
+        knit_gc_object_index(knit, obj, &cls);
+        root->objects++;
+        root->bytes += knit_gc_object_bytes(cls, obj);
+        if (obj->u.ktype == KNIT_LIST) {
+            struct knit_list *list = &obj->u.list;
+            for (int i=0; i<list->len && rv == KNIT_OK; i++) {
+                rv = knit_heap_profile_reach(knit, prof, list->items[i], obj, KNIT_HEAP_EDGE_INDEX, i, NULL);
+            }
+        }
+        else if (obj->u.ktype == KNIT_DICT) {
+            struct kobj_jadwal *ht = &obj->u.dict.ht;
+            struct kobj_jadwal_iter iter;
+            kobj_jadwal_begin_iterator(ht, &iter);
+            for (; kobj_jadwal_iter_check(&iter) && rv == KNIT_OK; kobj_jadwal_iter_next(ht, &iter)) {
+                rv = knit_heap_profile_reach(knit, prof, iter.pair->key, obj, KNIT_HEAP_EDGE_KEY, 0, iter.pair->key);
+                if (rv == KNIT_OK)
+                    rv = knit_heap_profile_reach(knit, prof, iter.pair->value, obj, KNIT_HEAP_EDGE_VALUE, 0, iter.pair->key);
+            }
+        }
+        else if (obj->u.ktype == KNIT_KFUNC) {
+            rv = knit_heap_profile_reach_block(knit, prof, obj->u.kfunc.block, obj);
+        }
+    }
+    return rv;
+}
+static void knit_heap_profile_add_largest(struct knit_heap_profile *prof, struct knit_obj *obj, size_t bytes) {
+    int i = prof->nlargest;
+    if (i == KNIT_HEAP_PROFILE_NLARGEST) {
+        if (bytes <= prof->largest_bytes[i - 1])
+            return;
+        i--;
+    }
+    else {
+        prof->nlargest++;
+    }
+    for (; i > 0 && prof->largest_bytes[i - 1] < bytes; i--) {
+        prof->largest[i] = prof->largest[i - 1];
+        prof->largest_bytes[i] = prof->largest_bytes[i - 1];
+    }
+    prof->largest[i] = obj;
+    prof->largest_bytes[i] = bytes;
+}
+static int knit_heap_profile_build(struct knit *knit, struct knit_heap_profile *prof) {
+    int rv = KNIT_OK;
+    struct knit_stack *stack = &knit->ex.stack;
+    struct knit_vars_jadwal *vars_ht = &knit->ex.global_ht;
+    struct knit_vars_jadwal_iter iter;
+    knit_vars_jadwal_begin_iterator(vars_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter) && rv == KNIT_OK; knit_vars_jadwal_iter_next(vars_ht, &iter)) {
+        rv = knit_heap_profile_add_root(knit, prof, KNIT_HEAP_ROOT_GLOBAL, 0, &iter.pair->key);
+        if (rv == KNIT_OK)
+            rv = knit_heap_profile_reach(knit, prof, iter.pair->value, NULL, KNIT_HEAP_EDGE_ROOT, 0, NULL);
+        if (rv == KNIT_OK)
+            rv = knit_heap_profile_drain(knit, prof);
+    }
+    for (int i=0; i<stack->vals.len && rv == KNIT_OK; i++) {
+        rv = knit_heap_profile_add_root(knit, prof, KNIT_HEAP_ROOT_STACK, i, NULL);
+        if (rv == KNIT_OK)
+            rv = knit_heap_profile_reach(knit, prof, stack->vals.data[i], NULL, KNIT_HEAP_EDGE_ROOT, 0, NULL);
+        if (rv == KNIT_OK)
+            rv = knit_heap_profile_drain(knit, prof);
+    }
+    for (int i=0; i<stack->frames.len && rv == KNIT_OK; i++) {
+        if (stack->frames.data[i].frame_type != KNIT_FRAME_KBLOCK)
+            continue;
+        rv = knit_heap_profile_add_root(knit, prof, KNIT_HEAP_ROOT_FRAME, i, NULL);
+        if (rv == KNIT_OK)
+            rv = knit_heap_profile_reach_block(knit, prof, stack->frames.data[i].u.kf.block, NULL);
+        if (rv == KNIT_OK)
+            rv = knit_heap_profile_drain(knit, prof);
+    }
+    if (rv != KNIT_OK)
+        return rv;
+
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &knit->ex.heap.classes[c];
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+            struct knit_obj *obj = knit_heap_class_object(cls, i);
+            size_t bytes = knit_gc_object_bytes(cls, obj);
+            if (prof->nodes[c][i].root == -1) {
+                prof->unreachable++;
+                prof->unreachable_bytes += bytes;
+                continue;
+            }
+            int t = obj->u.ktype - KNIT_NULL;
+            knit_assert_h(t >= 0 && t < KNIT_HEAP_PROFILE_NTYPES, "invalid type");
+            prof->type_count[t]++;
+            prof->type_bytes[t] += bytes;
+            prof->objects++;
+            prof->bytes += bytes;
+            knit_heap_profile_add_largest(prof, obj, bytes);
+        }
+    }
+    return KNIT_OK;
+}
+
+static void knit_heap_profile_json_chars(FILE *f, const char *s, int len) {
+    for (int i=0; i<len; i++) {
+        unsigned char ch = s[i];
+        if (ch == '"' || ch == '\\')
+            fprintf(f, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(f, "\\u%04x", ch);
+        else
+            fputc(ch, f);
+    }
+}
+static void knit_heap_profile_write_root(FILE *f, struct knit_heap_profile_root *root) {
+    if (root->kind == KNIT_HEAP_ROOT_GLOBAL)
+        knit_heap_profile_json_chars(f, root->name->str, root->name->len);
+    else if (root->kind == KNIT_HEAP_ROOT_STACK)
+        fprintf(f, "<stack %d>", root->index);
+    else
+        fprintf(f, "<frame %d>", root->index);
+}
+static void knit_heap_profile_write_key(FILE *f, struct knit_obj *key) {
+    if (key->u.ktype == KNIT_INT) {
+        fprintf(f, "%d", key->u.integer.value);
+    }
+    else if (key->u.ktype == KNIT_STR) {
+        fputc('\'', f);
+        knit_heap_profile_json_chars(f, key->u.str.str, key->u.str.len);
+        fputc('\'', f);
+    }
+    else {
+        fprintf(f, "<%s>", knit_heap_profile_type_name(key->u.ktype));
+    }
+}
+//writes the chain of parents from the root down to obj, without the surrounding quotes
+static void knit_heap_profile_write_path(struct knit *knit, FILE *f, struct knit_heap_profile *prof, struct knit_obj *obj) {
+    prof->work.len = 0;
+    for (struct knit_obj *o = obj; o; o = knit_heap_profile_node_of(knit, prof, o)->parent) {
+        if (knit_objp_darray_push(&prof->work, &o) != KNIT_OBJP_DARRAY_OK) {
+            fprintf(f, "<path too long>");
+            return;
+        }
+    }
+    struct knit_heap_profile_node *top = knit_heap_profile_node_of(knit, prof, prof->work.data[prof->work.len - 1]);
+    knit_heap_profile_write_root(f, &prof->roots[top->root]);
+    for (int i = prof->work.len - 1; i >= 0; i--) {
+        struct knit_obj *o = prof->work.data[i];
+        struct knit_heap_profile_node *node = knit_heap_profile_node_of(knit, prof, o);
+        struct knit_obj *parent = node->parent;
+        if (node->edge == KNIT_HEAP_EDGE_ROOT) {
+            if (prof->roots[node->root].kind == KNIT_HEAP_ROOT_FRAME)
+                fprintf(f, ".<const %d>", node->index);
+        }
+        else if (node->edge == KNIT_HEAP_EDGE_INDEX) {
+            if (parent->u.ktype == KNIT_KFUNC)
+                fprintf(f, ".<const %d>", node->index);
+            else
+                fprintf(f, "[%d]", node->index);
+        }
+        else if (node->edge == KNIT_HEAP_EDGE_KEY) {
+            fprintf(f, ".<key ");
+            knit_heap_profile_write_key(f, node->key);
+            fputc('>', f);
+        }
+        else {
+            fputc('[', f);
+            knit_heap_profile_write_key(f, node->key);
+            fputc(']', f);
+        }
+    }
+}
+static int knit_heap_profile_cmp_roots(const void *a, const void *b) {
+    const struct knit_heap_profile_root *ra = a, *rb = b;
+    if (ra->bytes != rb->bytes)
+        return ra->bytes < rb->bytes ? 1 : -1;
+    return 0;
+}
+static void knit_heap_profile_write(struct knit *knit, FILE *f, struct knit_heap_profile *prof) {
+    fprintf(f, "{\n  \"objects\": %ld,\n  \"bytes\": %llu,\n", prof->objects, (unsigned long long) prof->bytes);
+    fprintf(f, "  \"unreachable\": {\"objects\": %ld, \"bytes\": %llu},\n", prof->unreachable, (unsigned long long) prof->unreachable_bytes);
+    fprintf(f, "  \"types\": {");
+    int first = 1;
+    for (int t=0; t<KNIT_HEAP_PROFILE_NTYPES; t++) {
+        if (!prof->type_count[t])
+            continue;
+        fprintf(f, "%s\n    \"%s\": {\"count\": %ld, \"bytes\": %llu}", first ? "" : ",",
+                knit_heap_profile_type_name(KNIT_NULL + t), prof->type_count[t], (unsigned long long) prof->type_bytes[t]);
+        first = 0;
+    }
+    fprintf(f, "\n  },\n  \"largest\": [");
+    for (int i=0; i<prof->nlargest; i++) {
+        fprintf(f, "%s\n    {\"type\": \"%s\", \"bytes\": %llu, \"path\": \"", i ? "," : "",
+                knit_heap_profile_type_name(prof->largest[i]->u.ktype), (unsigned long long) prof->largest_bytes[i]);
+        knit_heap_profile_write_path(knit, f, prof, prof->largest[i]);
+        fprintf(f, "\"}");
+    }
+    //paths are written, the roots can be reordered now
+    qsort(prof->roots, prof->nroots, sizeof prof->roots[0], knit_heap_profile_cmp_roots);
+    fprintf(f, "\n  ],\n  \"roots\": [");
+    first = 1;
+    for (int i=0; i<prof->nroots; i++) {
+        struct knit_heap_profile_root *root = &prof->roots[i];
+        if (!root->objects)
+            continue;
+        fprintf(f, "%s\n    {\"root\": \"", first ? "" : ",");
+        knit_heap_profile_write_root(f, root);
+        fprintf(f, "\", \"objects\": %ld, \"retained_bytes\": %llu}", root->objects, (unsigned long long) root->bytes);
+        first = 0;
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+//writes a json snapshot of the live heap to f
+static int knit_heap_profile_snapshot(struct knit *knit, FILE *f) {
+    struct knit_heap_profile prof;
+    int rv = knit_heap_profile_init(knit, &prof);
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knit_heap_profile_build(knit, &prof);
+    if (rv == KNIT_OK)
+        knit_heap_profile_write(knit, f, &prof);
+    knit_heap_profile_deinit(knit, &prof);
+    return rv;
+}
+#endif
@@ -0,0 +1,669 @@
+#ifndef KNIT_IMAGE_H
+#define KNIT_IMAGE_H
+#include <stdio.h>
+#include <stdint.h>
+#include "kdata.h"
+#include "knit_objmap.h"
+
+/*
+    heap images:
+    knitx_save_image() writes the state a prelude leaves behind (the heap, globals and compiled functions) to a file,
+    knitx_load_image() makes an instance from it without lexing, compiling or running anything.
+    an image has no addresses in it, every reference is a tagged index (see KNIT_IMAGE_REF), so it loads anywhere.
+    layout, all integers are 32 bit in the byte order of the machine that wrote it:
+        header: magic, version, byte order mark, nclasses, then capacity, count and cell size of each class
+        the alloc bitset of each class
+        the types of the objects outside the heap (string constants and functions made by the compiler)
+        each allocated cell in class and index order: its refcount and the object
+        each object outside the heap
+        globals: name and reference
+    objects are their type followed by: an int's value, a string's length and bytes (plus a '\0'),
+    a list's length and references, a dict's pair count and key and value references,
+    a function's block (nargs, nlocals, lineno, instructions, constant references and lines).
+    the value stack isn't saved, objects only it referenced have no counted references and end up in the zero count table.
+    loaded strings point into the image instead of being copied, so the image stays mapped until knitx_deinit() (see knit_mapped.h).
+    C functions are saved as their index in kbuiltins, functions the host registered can't be saved.
+    neither can a module's functions, they find the module's globals by an id that only means something in this process.
+    an image is trusted like a script: its structure and references are checked, not what the code does.
+*/
+#define KNIT_IMAGE_MAGIC "KNITIMG"
+#define KNIT_IMAGE_VERSION 1
+#define KNIT_IMAGE_BYTE_ORDER 0x01020304u
+
+//a reference is a tag in the top bits and an index
+enum KNIT_IMAGE_REF {
+    KNIT_IMAGE_REF_NULL,     //a NULL pointer
+    KNIT_IMAGE_REF_HEAP,     //plus the class, the index is the cell
+    KNIT_IMAGE_REF_OUTSIDE = KNIT_IMAGE_REF_HEAP + KNIT_HEAP_NCLASSES, //the index of an object outside the heap
+    KNIT_IMAGE_REF_VALUE,    //0 true, 1 false, 2 null
+    KNIT_IMAGE_REF_BUILTIN,  //the index of a C function in kbuiltins
+};
+#define KNIT_IMAGE_REF_SHIFT 28
+#define KNIT_IMAGE_REF_INDEX_MASK ((1u << KNIT_IMAGE_REF_SHIFT) - 1)
+
+//kbuiltins is only made of cfuncs, so it's used as an array of them
+#define KNIT_IMAGE_NBUILTINS ((int) (sizeof kbuiltins / sizeof(struct knit_cfunc)))
+static int knit_image_builtin_index(struct knit_obj *obj) {
+    const struct knit_cfunc *builtins = (const struct knit_cfunc *) &kbuiltins;
+    for (int i=0; i<KNIT_IMAGE_NBUILTINS; i++) {
+        if ((const struct knit_cfunc *) obj == &builtins[i])
+            return i;
+    }
+    return -1;
+}
+
+/*SAVING*/
+struct knit_image_writer {
+    struct knit *knit;
+    FILE *f;
+    struct knit_objmap ids; //objects outside the heap to their index
+    struct knit_objp_darray outside; //in index order
+};
+
+static void knit_image_put(struct knit_image_writer *w, const void *p, size_t n) {
+    fwrite(p, 1, n, w->f);
+}
+static void knit_image_put_u32(struct knit_image_writer *w, uint32_t v) {
+    knit_image_put(w, &v, sizeof v);
+}
+
+//gives objects outside the heap an index the first time they are seen
+static int knit_image_discover(struct knit_image_writer *w, struct knit_obj *obj) {
+    struct knit_heap_class *cls = NULL;
+    uintptr_t id;
+    if (!obj || knit_gc_object_index(w->knit, obj, &cls) != -1)
+        return KNIT_OK;
+    switch (obj->u.ktype) {
+        case KNIT_TRUE:
+        case KNIT_FALSE:
+        case KNIT_NULL:
+            return KNIT_OK;
+        case KNIT_CFUNC:
+            if (knit_image_builtin_index(obj) == -1)
+                return knit_error(w->knit, KNIT_RUNTIME_ERR, "knitx_save_image(): C functions registered by the host can't be saved");
+            return KNIT_OK;
+        case KNIT_INT:
+        case KNIT_STR:
+        case KNIT_LIST:
+        case KNIT_DICT:
+        case KNIT_KFUNC:
+            break;
+        default:
+            return knit_error(w->knit, KNIT_RUNTIME_ERR, "knitx_save_image(): unexpected object type");
+    }
+    if (knit_objmap_find(&w->ids, obj, &id))
+        return KNIT_OK;
+    if (knit_objmap_insert(&w->ids, obj, w->outside.len) != KNIT_OK ||
+        knit_objp_darray_push(&w->outside, &obj) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(w->knit, KNIT_NOMEM, "knitx_save_image(): couldn't index the objects outside the heap");
+    return KNIT_OK;
+}
+static int knit_image_discover_children(struct knit_image_writer *w, struct knit_obj *obj) {
+    int rv = KNIT_OK;
+    if (obj->u.ktype == KNIT_LIST) {
+        for (int i=0; i<obj->u.list.len && rv == KNIT_OK; i++)
+            rv = knit_image_discover(w, obj->u.list.items[i]);
+    }
+    else if (obj->u.ktype == KNIT_DICT) {
+        struct kobj_jadwal *ht = &obj->u.dict.ht;
+        struct kobj_jadwal_iter iter;
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter) && rv == KNIT_OK; kobj_jadwal_iter_next(ht, &iter)) {
+            if ((rv = knit_image_discover(w, iter.pair->key)) == KNIT_OK)
+                rv = knit_image_discover(w, iter.pair->value);
+        }
+    }
+    else if (obj->u.ktype == KNIT_KFUNC) {
+        if (obj->u.kfunc.block->module)
+            return knit_error(w->knit, KNIT_RUNTIME_ERR, "knitx_save_image(): functions of imported modules can't be saved");
+        //images only hold compiled functions, the new constants are indexed before anything is written
+        if ((rv = knitx_kfunc_compile(w->knit, &obj->u.kfunc)) != KNIT_OK)
+            return rv;
+        struct knit_block *block = obj->u.kfunc.block;
+        for (int i=0; i<block->constants.len && rv == KNIT_OK; i++)
+            rv = knit_image_discover(w, block->constants.data[i]);
+    }
+    return rv;
+}
+
+static uint32_t knit_image_ref(struct knit_image_writer *w, struct knit_obj *obj) {
+    struct knit_heap_class *cls = NULL;
+    uintptr_t id = 0;
+    if (!obj)
+        return KNIT_IMAGE_REF_NULL;
+    long idx = knit_gc_object_index(w->knit, obj, &cls);
+    if (idx != -1)
+        return ((uint32_t) (KNIT_IMAGE_REF_HEAP + (cls - w->knit->ex.heap.classes)) << KNIT_IMAGE_REF_SHIFT) | (uint32_t) idx;
+    switch (obj->u.ktype) {
+        case KNIT_TRUE:  return (uint32_t) KNIT_IMAGE_REF_VALUE << KNIT_IMAGE_REF_SHIFT;
+        case KNIT_FALSE: return (uint32_t) KNIT_IMAGE_REF_VALUE << KNIT_IMAGE_REF_SHIFT | 1;
+        case KNIT_NULL:  return (uint32_t) KNIT_IMAGE_REF_VALUE << KNIT_IMAGE_REF_SHIFT | 2;
+        case KNIT_CFUNC: return (uint32_t) KNIT_IMAGE_REF_BUILTIN << KNIT_IMAGE_REF_SHIFT | (uint32_t) knit_image_builtin_index(obj);
+    }
+    knit_objmap_find(&w->ids, obj, &id);
+    return (uint32_t) KNIT_IMAGE_REF_OUTSIDE << KNIT_IMAGE_REF_SHIFT | (uint32_t) id;
+}
+
+static void knit_image_put_object(struct knit_image_writer *w, struct knit_obj *obj) {
+    knit_image_put_u32(w, obj->u.ktype);
+    if (obj->u.ktype == KNIT_INT) {
+        knit_image_put_u32(w, (uint32_t) obj->u.integer.value);
+    }
+    else if (obj->u.ktype == KNIT_STR) {
+        knit_image_put_u32(w, obj->u.str.len);
+        knit_image_put(w, obj->u.str.str, obj->u.str.len);
+        knit_image_put(w, "", 1);
+    }
+    else if (obj->u.ktype == KNIT_LIST) {
+        knit_image_put_u32(w, obj->u.list.len);
+        for (int i=0; i<obj->u.list.len; i++)
+            knit_image_put_u32(w, knit_image_ref(w, obj->u.list.items[i]));
+    }
+    else if (obj->u.ktype == KNIT_DICT) {
+        struct kobj_jadwal *ht = &obj->u.dict.ht;
+        struct kobj_jadwal_iter iter;
+        uint32_t npairs = 0;
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter))
+            npairs++;
+        knit_image_put_u32(w, npairs);
+        kobj_jadwal_begin_iterator(ht, &iter);
+        for (; kobj_jadwal_iter_check(&iter); kobj_jadwal_iter_next(ht, &iter)) {
+            knit_image_put_u32(w, knit_image_ref(w, iter.pair->key));
+            knit_image_put_u32(w, knit_image_ref(w, iter.pair->value));
+        }
+    }
+    else if (obj->u.ktype == KNIT_KFUNC) {
+        struct knit_block *block = obj->u.kfunc.block;
+        knit_image_put_u32(w, block->nargs);
+        knit_image_put_u32(w, block->nlocals);
+        knit_image_put_u32(w, block->lineno);
+        knit_image_put_u32(w, block->insns.len);
+        for (int i=0; i<block->insns.len; i++)
+            knit_image_put_u32(w, (uint32_t) (unsigned char) block->insns.data[i].insn_type | (uint32_t) (unsigned short) block->insns.data[i].op1 << 16);
+        knit_image_put_u32(w, block->constants.len);
+        for (int i=0; i<block->constants.len; i++)
+            knit_image_put_u32(w, knit_image_ref(w, block->constants.data[i]));
+        knit_image_put_u32(w, block->lines.len);
+        for (int i=0; i<block->lines.len; i++) {
+            knit_image_put_u32(w, block->lines.data[i].ip);
+            knit_image_put_u32(w, block->lines.data[i].lineno);
+        }
+    }
+}
+
+static int knit_image_save(struct knit *knit, FILE *f) {
+    struct knit_heap *heap = &knit->ex.heap;
+    struct knit_vars_jadwal_iter iter;
+    struct knit_image_writer w = {.knit = knit, .f = f};
+    int rv = KNIT_OK;
+    knit_objmap_init(knit, &w.ids);
+    if (knit_objp_darray_init_with_allocator(&w.outside, 64, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK)
+        return knit_error(knit, KNIT_NOMEM, "knitx_save_image(): couldn't index the objects outside the heap");
+
+    for (int c=0; c<KNIT_HEAP_NCLASSES && rv == KNIT_OK; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1 && cls->has_refs && rv == KNIT_OK; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1))
+            rv = knit_image_discover_children(&w, knit_heap_class_object(cls, i));
+    }
+    knit_vars_jadwal_begin_iterator(&knit->ex.global_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter) && rv == KNIT_OK; knit_vars_jadwal_iter_next(&knit->ex.global_ht, &iter))
+        rv = knit_image_discover(&w, iter.pair->value);
+    //the list grows while it's walked
+    for (int i=0; i<w.outside.len && rv == KNIT_OK; i++)
+        rv = knit_image_discover_children(&w, w.outside.data[i]);
+    if (rv != KNIT_OK)
+        goto cleanup;
+
+    knit_image_put(&w, KNIT_IMAGE_MAGIC, sizeof KNIT_IMAGE_MAGIC);
+    knit_image_put_u32(&w, KNIT_IMAGE_VERSION);
+    knit_image_put_u32(&w, KNIT_IMAGE_BYTE_ORDER);
+    knit_image_put_u32(&w, KNIT_HEAP_NCLASSES);
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        knit_image_put_u32(&w, heap->classes[c].capacity);
+        knit_image_put_u32(&w, heap->classes[c].count);
+        knit_image_put_u32(&w, heap->classes[c].cell_size);
+    }
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_bitset *alloc_bitset = &heap->classes[c].alloc_bitset;
+        knit_image_put(&w, alloc_bitset->data, n_needed_unsigneds(alloc_bitset->bit_len) * sizeof(alloc_bitset->data[0]));
+    }
+    knit_image_put_u32(&w, w.outside.len);
+    for (int i=0; i<w.outside.len; i++)
+        knit_image_put_u32(&w, w.outside.data[i]->u.ktype);
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+            knit_image_put_u32(&w, cls->refcounts[i]);
+            knit_image_put_object(&w, knit_heap_class_object(cls, i));
+        }
+    }
+    for (int i=0; i<w.outside.len; i++)
+        knit_image_put_object(&w, w.outside.data[i]);
+    uint32_t nglobals = 0;
+    knit_vars_jadwal_begin_iterator(&knit->ex.global_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter); knit_vars_jadwal_iter_next(&knit->ex.global_ht, &iter))
+        nglobals++;
+    knit_image_put_u32(&w, nglobals);
+    knit_vars_jadwal_begin_iterator(&knit->ex.global_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter); knit_vars_jadwal_iter_next(&knit->ex.global_ht, &iter)) {
+        knit_image_put_u32(&w, iter.pair->key.len);
+        knit_image_put(&w, iter.pair->key.str, iter.pair->key.len);
+        knit_image_put(&w, "", 1);
+        knit_image_put_u32(&w, knit_image_ref(&w, iter.pair->value));
+    }
+    if (ferror(f))
+        rv = knit_error(knit, KNIT_RUNTIME_ERR, "knitx_save_image(): writing the image failed");
+cleanup:
+    knit_objp_darray_deinit(&w.outside);
+    knit_objmap_deinit(&w.ids);
+    return rv;
+}
+
+/*LOADING*/
+//a dict's pairs are read after every object, keys are hashed by value and may come later in the image
+struct knit_image_pending_dict {
+    struct knit_obj *dict;
+    size_t pos;
+    uint32_t npairs;
+};
+struct knit_image_reader {
+    struct knit *knit;
+    const char *data;
+    size_t len;
+    size_t pos;
+    struct knit_obj **outside;
+    uint32_t *outside_types; //what the objects outside the heap will be, they're nulls until they're read
+    uint32_t noutside;
+    struct knit_image_pending_dict *dicts;
+    int ndicts;
+    int dicts_cap;
+};
+
+static int knit_image_corrupt(struct knit_image_reader *r, const char *what) {
+    return knit_error(r->knit, KNIT_RUNTIME_ERR, "knitx_load_image(): corrupt image, %s at offset %lu", what, (unsigned long) r->pos);
+}
+static int knit_image_get(struct knit_image_reader *r, void *p, size_t n) {
+    if (n > r->len - r->pos)
+        return knit_image_corrupt(r, "truncated");
+    memcpy(p, r->data + r->pos, n);
+    r->pos += n;
+    return KNIT_OK;
+}
+static int knit_image_get_u32(struct knit_image_reader *r, uint32_t *v) {
+    return knit_image_get(r, v, sizeof *v);
+}
+//NUL terminated bytes that stay in the image
+static int knit_image_get_bytes(struct knit_image_reader *r, uint32_t len, char **s) {
+    if (len >= r->len - r->pos || r->data[r->pos + len] != '\0')
+        return knit_image_corrupt(r, "bad string");
+    *s = (char *) r->data + r->pos;
+    r->pos += len + 1;
+    return KNIT_OK;
+}
+static int knit_image_get_ref(struct knit_image_reader *r, struct knit_obj **obj) {
+    static const struct knit_bvalue *values[] = {&ktrue, &kfalse, &knull};
+    uint32_t ref = 0;
+    int rv = knit_image_get_u32(r, &ref);
+    if (rv != KNIT_OK)
+        return rv;
+    uint32_t tag = ref >> KNIT_IMAGE_REF_SHIFT;
+    uint32_t idx = ref & KNIT_IMAGE_REF_INDEX_MASK;
+    if (tag == KNIT_IMAGE_REF_NULL && !idx) {
+        *obj = NULL;
+    }
+    else if (tag >= KNIT_IMAGE_REF_HEAP && tag < KNIT_IMAGE_REF_OUTSIDE) {
+        struct knit_heap_class *cls = &r->knit->ex.heap.classes[tag - KNIT_IMAGE_REF_HEAP];
+        if (idx >= (uint32_t) cls->capacity || !bitset_get_bit(&cls->alloc_bitset, idx))
+            return knit_image_corrupt(r, "reference to a free cell");
+        *obj = knit_heap_class_object(cls, idx);
+    }
+    else if (tag == KNIT_IMAGE_REF_OUTSIDE && idx < r->noutside) {
+        *obj = r->outside[idx];
+    }
+    else if (tag == KNIT_IMAGE_REF_VALUE && idx < 3) {
+        *obj = (struct knit_obj *) values[idx];
+    }
+    else if (tag == KNIT_IMAGE_REF_BUILTIN && idx < (uint32_t) KNIT_IMAGE_NBUILTINS) {
+        *obj = (struct knit_obj *) &((const struct knit_cfunc *) &kbuiltins)[idx];
+    }
+    else {
+        return knit_image_corrupt(r, "bad reference");
+    }
+    return KNIT_OK;
+}
+
+static int knit_image_get_block(struct knit_image_reader *r, struct knit_block **blockp) {
+    uint32_t nargs, nlocals, lineno, n;
+    int rv;
+    if ((rv = knit_image_get_u32(r, &nargs)) != KNIT_OK ||
+        (rv = knit_image_get_u32(r, &nlocals)) != KNIT_OK ||
+        (rv = knit_image_get_u32(r, &lineno)) != KNIT_OK)
+        return rv;
+    void *p = NULL;
+    if ((rv = knitx_tmalloc(r->knit, sizeof(struct knit_block), &p)) != KNIT_OK)
+        return rv;
+    struct knit_block *block = p;
+    if ((rv = knitx_block_init(r->knit, block)) != KNIT_OK) {
+        knitx_tfree(r->knit, block);
+        return rv;
+    }
+    block->nargs = nargs;
+    block->nlocals = nlocals;
+    block->lineno = lineno;
+    *blockp = block;
+
+    if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+        return rv;
+    for (uint32_t i=0; i<n; i++) {
+        uint32_t v;
+        if ((rv = knit_image_get_u32(r, &v)) != KNIT_OK)
+            return rv;
+        struct knit_insn insn = {.insn_type = v & 0xff, .op1 = (short) (v >> 16)};
+        if (insns_darray_push(&block->insns, &insn) != INSNS_DARRAY_OK)
+            return knit_error(r->knit, KNIT_NOMEM, "knitx_load_image(): couldn't load a block's instructions");
+    }
+    if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+        return rv;
+    for (uint32_t i=0; i<n; i++) {
+        struct knit_obj *obj;
+        if ((rv = knit_image_get_ref(r, &obj)) != KNIT_OK)
+            return rv;
+        if (knit_objp_darray_push(&block->constants, &obj) != KNIT_OBJP_DARRAY_OK)
+            return knit_error(r->knit, KNIT_NOMEM, "knitx_load_image(): couldn't load a block's constants");
+    }
+    if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+        return rv;
+    for (uint32_t i=0; i<n; i++) {
+        uint32_t ip, line;
+        if ((rv = knit_image_get_u32(r, &ip)) != KNIT_OK || (rv = knit_image_get_u32(r, &line)) != KNIT_OK)
+            return rv;
+        struct knit_line l = {.ip = ip, .lineno = line};
+        if (knit_lines_darray_push(&block->lines, &l) != KNIT_LINES_DARRAY_OK)
+            return knit_error(r->knit, KNIT_NOMEM, "knitx_load_image(): couldn't load a block's lines");
+    }
+    if (!knitx_block_insns_valid(block))
+        return knit_image_corrupt(r, "bad instruction");
+    block->generator = knitx_block_has_yield(block);
+    return KNIT_OK;
+}
+
+static int knit_image_get_pairs(struct knit_image_reader *r, struct knit_image_pending_dict *pending) {
+    r->pos = pending->pos;
+    for (uint32_t i=0; i<pending->npairs; i++) {
+        struct knit_obj *key, *value;
+        int rv;
+        if ((rv = knit_image_get_ref(r, &key)) != KNIT_OK || (rv = knit_image_get_ref(r, &value)) != KNIT_OK)
+            return rv;
+        if (!key)
+            return knit_image_corrupt(r, "NULL dict key");
+        knit_jadwal_use(&r->knit->allocator);
+        if (kobj_jadwal_insert(&pending->dict->u.dict.ht, &key, &value) != KOBJ_JADWAL_OK)
+            return knit_error(r->knit, KNIT_NOMEM, "knitx_load_image(): couldn't load a dict");
+    }
+    return KNIT_OK;
+}
+
+//obj was allocated for the type in the image and is a null until it's read
+static int knit_image_get_object(struct knit_image_reader *r, struct knit_obj *obj, int ktype) {
+    uint32_t t, n;
+    int rv;
+    if ((rv = knit_image_get_u32(r, &t)) != KNIT_OK)
+        return rv;
+    if (t != (uint32_t) ktype)
+        return knit_image_corrupt(r, "unexpected object type");
+    if (ktype == KNIT_INT) {
+        if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+            return rv;
+        knitx_int_init(r->knit, &obj->u.integer, (int) n);
+    }
+    else if (ktype == KNIT_STR) {
+        char *s = NULL;
+        if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK || (rv = knit_image_get_bytes(r, n, &s)) != KNIT_OK)
+            return rv;
+        knitx_str_init(r->knit, &obj->u.str);
+        obj->u.str.str = s;
+        obj->u.str.len = n;
+    }
+    else if (ktype == KNIT_LIST) {
+        if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+            return rv;
+        if (n > (r->len - r->pos) / 4)
+            return knit_image_corrupt(r, "list too long");
+        if ((rv = knitx_list_init(r->knit, &obj->u.list, n)) != KNIT_OK)
+            return rv;
+        for (uint32_t i=0; i<n; i++) {
+            if ((rv = knit_image_get_ref(r, &obj->u.list.items[i])) != KNIT_OK)
+                return rv;
+            obj->u.list.len++;
+        }
+    }
+    else if (ktype == KNIT_DICT) {
+        if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+            return rv;
+        if (n > (r->len - r->pos) / 8)
+            return knit_image_corrupt(r, "dict too long");
+        if ((rv = knitx_dict_init(r->knit, &obj->u.dict, 0)) != KNIT_OK)
+            return rv;
+        if (r->ndicts == r->dicts_cap) {
+            struct knit_allocator *a = &r->knit->allocator;
+            int cap = r->dicts_cap ? r->dicts_cap * 2 : 64;
+            void *p = a->realloc(a->ud, r->dicts, cap * sizeof r->dicts[0]);
+            if (!p)
+                return knit_error(r->knit, KNIT_NOMEM, "knitx_load_image(): couldn't load a dict");
+            r->dicts = p;
+            r->dicts_cap = cap;
+        }
+        struct knit_image_pending_dict pending = {.dict = obj, .pos = r->pos, .npairs = n};
+        r->dicts[r->ndicts++] = pending;
+        r->pos += (size_t) n * 8;
+    }
+    else if (ktype == KNIT_KFUNC) {
+        //it stays a null if its block couldn't be made
+        struct knit_block *block = NULL;
+        rv = knit_image_get_block(r, &block);
+        if (block) {
+            obj->u.kfunc.ktype = KNIT_KFUNC;
+            obj->u.kfunc.block = block;
+        }
+        return rv;
+    }
+    else if (ktype != KNIT_NULL) {
+        return knit_image_corrupt(r, "unexpected object type");
+    }
+    return KNIT_OK;
+}
+
+static int knit_image_peek_u32(struct knit_image_reader *r, uint32_t *v) {
+    if (sizeof *v > r->len - r->pos)
+        return knit_image_corrupt(r, "truncated");
+    memcpy(v, r->data + r->pos, sizeof *v);
+    return KNIT_OK;
+}
+static int knit_image_get_header(struct knit_image_reader *r, uint32_t *capacity, uint32_t *count) {
+    char magic[sizeof KNIT_IMAGE_MAGIC];
+    uint32_t version, byte_order, nclasses, cell_size;
+    int rv;
+    if ((rv = knit_image_get(r, magic, sizeof magic)) != KNIT_OK)
+        return rv;
+    if (memcmp(magic, KNIT_IMAGE_MAGIC, sizeof magic) != 0)
+        return knit_error(r->knit, KNIT_RUNTIME_ERR, "knitx_load_image(): not an image");
+    if ((rv = knit_image_get_u32(r, &version)) != KNIT_OK ||
+        (rv = knit_image_get_u32(r, &byte_order)) != KNIT_OK ||
+        (rv = knit_image_get_u32(r, &nclasses)) != KNIT_OK)
+        return rv;
+    if (version != KNIT_IMAGE_VERSION || byte_order != KNIT_IMAGE_BYTE_ORDER || nclasses != KNIT_HEAP_NCLASSES)
+        return knit_error(r->knit, KNIT_RUNTIME_ERR, "knitx_load_image(): the image was written by another version or on another machine");
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        if ((rv = knit_image_get_u32(r, &capacity[c])) != KNIT_OK ||
+            (rv = knit_image_get_u32(r, &count[c])) != KNIT_OK ||
+            (rv = knit_image_get_u32(r, &cell_size)) != KNIT_OK)
+            return rv;
+        if (cell_size != (uint32_t) r->knit->ex.heap.classes[c].cell_size)
+            return knit_error(r->knit, KNIT_RUNTIME_ERR, "knitx_load_image(): the image was written by another version or on another machine");
+        if (!capacity[c] || capacity[c] > KNIT_IMAGE_REF_INDEX_MASK || count[c] > capacity[c])
+            return knit_image_corrupt(r, "bad class size");
+    }
+    return KNIT_OK;
+}
+//the alloc bitsets are read into new classes, which replace the heap's when they're valid
+static int knit_image_get_classes(struct knit_image_reader *r, uint32_t *capacity, uint32_t *count) {
+    struct knit_heap *heap = &r->knit->ex.heap;
+    struct knit_heap_class classes[KNIT_HEAP_NCLASSES];
+    int rv = KNIT_OK;
+    int c;
+    for (c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        if ((rv = knit_heap_class_init(r->knit, &classes[c], heap->classes[c].cell_size, heap->classes[c].has_refs, capacity[c])) != KNIT_OK)
+            goto cleanup_classes;
+    }
+    for (int i=0; i<KNIT_HEAP_NCLASSES; i++) {
+        struct knit_bitset *alloc_bitset = &classes[i].alloc_bitset;
+        if ((rv = knit_image_get(r, alloc_bitset->data, n_needed_unsigneds(alloc_bitset->bit_len) * sizeof(alloc_bitset->data[0]))) != KNIT_OK)
+            goto cleanup_classes;
+        uint32_t n = 0;
+        long last = -1;
+        for (long j = bitset_find_true_bit(alloc_bitset, 0); j != -1; j = bitset_find_true_bit(alloc_bitset, j + 1)) {
+            last = j;
+            n++;
+        }
+        if (last >= (long) capacity[i] || n != count[i]) {
+            rv = knit_image_corrupt(r, "bad alloc bitset");
+            goto cleanup_classes;
+        }
+        classes[i].count = n;
+    }
+    heap->count = 0;
+    for (c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &classes[c];
+        knit_heap_class_deinit(r->knit, &heap->classes[c]);
+        knit_gc_rebuild_free_list(r->knit, cls);
+        //objects that fail to load stay nulls
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+            knit_gc_obj_null(r->knit, knit_heap_class_object(cls, i));
+            cls->refcounts[i] = 0;
+        }
+        heap->classes[c] = *cls;
+        heap->count += cls->count;
+    }
+    return KNIT_OK;
+
+cleanup_classes:
+    while (c--)
+        knit_heap_class_deinit(r->knit, &classes[c]);
+    return rv;
+}
+
+//objects outside the heap are allocated before any is read, so references to them can be resolved
+static int knit_image_get_outside(struct knit_image_reader *r) {
+    uint32_t n;
+    int rv;
+    if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+        return rv;
+    if (n > (r->len - r->pos) / 4)
+        return knit_image_corrupt(r, "too many objects");
+    if (!n)
+        return KNIT_OK;
+    r->outside = r->knit->allocator.alloc(r->knit->allocator.ud, n * sizeof r->outside[0]);
+    r->outside_types = r->knit->allocator.alloc(r->knit->allocator.ud, n * sizeof r->outside_types[0]);
+    if (!r->outside || !r->outside_types)
+        return knit_error(r->knit, KNIT_NOMEM, "knitx_load_image(): couldn't allocate the objects outside the heap");
+    for (; r->noutside < n; r->noutside++) {
+        uint32_t ktype;
+        void *p = NULL;
+        if ((rv = knit_image_get_u32(r, &ktype)) != KNIT_OK)
+            return rv;
+        if (ktype != KNIT_INT && ktype != KNIT_STR && ktype != KNIT_LIST && ktype != KNIT_DICT && ktype != KNIT_KFUNC)
+            return knit_image_corrupt(r, "unexpected object type");
+        if ((rv = knitx_tmalloc(r->knit, knit_obj_type_size(ktype), &p)) != KNIT_OK)
+            return rv;
+        knit_gc_obj_null(r->knit, p);
+        if ((rv = knitx_own_object(r->knit, p)) != KNIT_OK) {
+            knitx_tfree(r->knit, p);
+            return rv;
+        }
+        r->outside[r->noutside] = p;
+        r->outside_types[r->noutside] = ktype;
+    }
+    return KNIT_OK;
+}
+
+static int knit_image_get_globals(struct knit_image_reader *r) {
+    uint32_t n;
+    int rv;
+    if ((rv = knit_image_get_u32(r, &n)) != KNIT_OK)
+        return rv;
+    for (uint32_t i=0; i<n; i++) {
+        struct knit_str name;
+        struct knit_obj *value;
+        uint32_t len;
+        knitx_str_init(r->knit, &name);
+        if ((rv = knit_image_get_u32(r, &len)) != KNIT_OK ||
+            (rv = knit_image_get_bytes(r, len, &name.str)) != KNIT_OK ||
+            (rv = knit_image_get_ref(r, &value)) != KNIT_OK)
+            return rv;
+        name.len = len;
+        //the name is borrowed from the image like every global name is borrowed, the reference was counted when saving
+        knit_jadwal_use(&r->knit->allocator);
+        if (knit_vars_jadwal_insert(&r->knit->ex.global_ht, &name, &value) != KNIT_VARS_JADWAL_OK)
+            return knit_error(r->knit, KNIT_NOMEM, "knitx_load_image(): couldn't load the globals");
+    }
+    return KNIT_OK;
+}
+
+//knit was just initialized, its heap and globals are replaced by the image's
+static int knit_image_load(struct knit *knit, const char *data, size_t len) {
+    struct knit_image_reader r = {.knit = knit, .data = data, .len = len};
+    struct knit_heap *heap = &knit->ex.heap;
+    uint32_t capacity[KNIT_HEAP_NCLASSES], count[KNIT_HEAP_NCLASSES];
+    int rv;
+    if ((rv = knit_image_get_header(&r, capacity, count)) != KNIT_OK)
+        return rv;
+    if ((rv = knit_image_get_classes(&r, capacity, count)) != KNIT_OK)
+        return rv;
+    if ((rv = knit_image_get_outside(&r)) != KNIT_OK)
+        goto cleanup;
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+            uint32_t refcount = 0, ktype = KNIT_NULL;
+            if ((rv = knit_image_get_u32(&r, &refcount)) != KNIT_OK || (rv = knit_image_peek_u32(&r, &ktype)) != KNIT_OK)
+                goto cleanup;
+            //the cell must be big enough for the object
+            if (refcount > INT_MAX || (ktype != KNIT_NULL && knit_heap_class_of_type(ktype) != c)) {
+                rv = knit_image_corrupt(&r, "bad cell");
+                goto cleanup;
+            }
+            if ((rv = knit_image_get_object(&r, knit_heap_class_object(cls, i), ktype)) != KNIT_OK)
+                goto cleanup;
+            cls->refcounts[i] = refcount;
+        }
+    }
+    for (uint32_t i=0; i<r.noutside; i++) {
+        if ((rv = knit_image_get_object(&r, r.outside[i], r.outside_types[i])) != KNIT_OK)
+            goto cleanup;
+    }
+    if ((rv = knit_image_get_globals(&r)) != KNIT_OK)
+        goto cleanup;
+    if (r.pos != r.len) {
+        rv = knit_image_corrupt(&r, "trailing bytes");
+        goto cleanup;
+    }
+    for (int i=0; i<r.ndicts; i++) {
+        if ((rv = knit_image_get_pairs(&r, &r.dicts[i])) != KNIT_OK)
+            goto cleanup;
+    }
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++) {
+        struct knit_heap_class *cls = &heap->classes[c];
+        for (long i = bitset_find_true_bit(&cls->alloc_bitset, 0); i != -1; i = bitset_find_true_bit(&cls->alloc_bitset, i + 1)) {
+            if (!cls->refcounts[i])
+                knit_gc_zct_add(knit, cls, i);
+        }
+    }
+cleanup:
+    knit->allocator.free(knit->allocator.ud, r.outside);
+    knit->allocator.free(knit->allocator.ud, r.outside_types);
+    knit->allocator.free(knit->allocator.ud, r.dicts);
+    return rv;
+}
+
+#endif
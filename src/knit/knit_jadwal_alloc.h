@@ -0,0 +1,62 @@
+#ifndef KNIT_JADWAL_ALLOC_H
+#define KNIT_JADWAL_ALLOC_H
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "kdata.h"
+
+/*
+    jadwal (a submodule) allocates the dict and global tables with calloc(), malloc(), realloc() and free(),
+    kdata.h turns those into the functions below while the generated headers are included.
+    there is no way to pass an allocator to jadwal, so one is picked per thread:
+    knit_jadwal_use() is called right before every init or insert and the memory comes from that allocator
+    (NULL means libc, frozen dicts use it since their region outlives the instance that built them).
+    each block starts with a copy of the allocator it came from, so it's freed by the same one,
+    whatever was passed to knit_jadwal_use() last.
+*/
+union knit_jadwal_hdr {
+    struct knit_allocator allocator;
+    max_align_t align;
+};
+
+static _Thread_local const struct knit_allocator *knit_jadwal_current;
+
+static void knit_jadwal_use(const struct knit_allocator *allocator) {
+    knit_jadwal_current = allocator;
+}
+static void *knit_jadwal_malloc(size_t sz) {
+    const struct knit_allocator *allocator = knit_jadwal_current ? knit_jadwal_current : &knit_libc_allocator;
+    if (sz > SIZE_MAX - sizeof(union knit_jadwal_hdr))
+        return NULL;
+    union knit_jadwal_hdr *hdr = allocator->alloc(allocator->ud, sizeof *hdr + sz);
+    if (!hdr)
+        return NULL;
+    hdr->allocator = *allocator;
+    return hdr + 1;
+}
+static void *knit_jadwal_calloc(size_t n, size_t sz) {
+    if (sz && n > SIZE_MAX / sz)
+        return NULL;
+    void *p = knit_jadwal_malloc(n * sz);
+    if (p)
+        memset(p, 0, n * sz);
+    return p;
+}
+static void *knit_jadwal_realloc(void *p, size_t sz) {
+    if (!p)
+        return knit_jadwal_malloc(sz);
+    if (sz > SIZE_MAX - sizeof(union knit_jadwal_hdr))
+        return NULL;
+    union knit_jadwal_hdr *hdr = (union knit_jadwal_hdr *) p - 1;
+    struct knit_allocator allocator = hdr->allocator;
+    hdr = allocator.realloc(allocator.ud, hdr, sizeof *hdr + sz);
+    return hdr ? hdr + 1 : NULL;
+}
+static void knit_jadwal_free(void *p) {
+    if (!p)
+        return;
+    union knit_jadwal_hdr *hdr = (union knit_jadwal_hdr *) p - 1;
+    hdr->allocator.free(hdr->allocator.ud, hdr);
+}
+#endif
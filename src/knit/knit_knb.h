@@ -0,0 +1,347 @@
+#ifndef KNIT_KNB_H
+#define KNIT_KNB_H
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "kdata.h"
+
+/*
+    compiled bytecode files (.knb):
+    the top level block of a program and the functions it defines, so a script that didn't change
+    runs without being lexed, parsed or compiled again. a file is mapped and its instructions run in place,
+    strings point into it too (see knit_mapped.h).
+    layout, all integers are 32 bit in the byte order of the machine that wrote it:
+        header: magic, version, byte order mark, instruction size and layout, file size, source length and hash
+        the top level block
+    a block is nargs, nlocals, lineno, the instruction, line and constant counts, then:
+        the instructions as they are in memory (struct knit_insn, padding zeroed)
+        the lines: ip and lineno
+        the constants: their type followed by an int's value, a string's length and bytes (plus a '\0', padded to 4 bytes)
+        or a function's block
+    everything stays 4 byte aligned, so the instructions can be used where they are.
+    KNIT_KNB_VERSION must change when the compiler emits different code for the same source.
+    like an image (see knit_image.h) a file is trusted like a script: its structure and the operands the vm
+    relies on are checked, not what the code does.
+*/
+#define KNIT_KNB_MAGIC "KNITKNB"
+#define KNIT_KNB_VERSION 1
+#define KNIT_KNB_BYTE_ORDER 0x01020304u
+#define KNIT_KNB_HEADER_SIZE (sizeof KNIT_KNB_MAGIC + 8 * 4)
+#define KNIT_KNB_MAX_DEPTH 256 //functions nested deeper than this are rejected, the reader is recursive
+
+//FNV-1a, identifies the source a file was compiled from
+static uint64_t knit_knb_hash(const char *src, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i=0; i<len; i++) {
+        h ^= (unsigned char) src[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+//instructions used in place aren't owned by their block, a push fails instead of reallocating the mapping
+static void *knit_knb_borrowed_realloc(void *ud, void *p, size_t sz) {
+    (void) ud; (void) p; (void) sz;
+    return NULL;
+}
+static void knit_knb_borrowed_free(void *ud, void *p) {
+    (void) ud; (void) p;
+}
+static const struct dyn_allocator knit_knb_borrowed = {
+    .realloc = knit_knb_borrowed_realloc,
+    .free = knit_knb_borrowed_free,
+};
+
+/*WRITING*/
+static void knit_knb_put_u32(FILE *f, uint32_t v) {
+    fwrite(&v, sizeof v, 1, f);
+}
+static void knit_knb_pad(FILE *f, size_t n) {
+    static const char zeros[4] = {0};
+    fwrite(zeros, 1, (4 - n % 4) % 4, f);
+}
+
+//KNIT_RUNTIME_ERR without reporting it, the bytecode cache just doesn't write a block it can't
+static int knit_knb_put_block(FILE *f, struct knit_block *block) {
+    knit_knb_put_u32(f, block->nargs);
+    knit_knb_put_u32(f, block->nlocals);
+    knit_knb_put_u32(f, block->lineno);
+    knit_knb_put_u32(f, block->insns.len);
+    knit_knb_put_u32(f, block->lines.len);
+    knit_knb_put_u32(f, block->constants.len);
+    for (int i=0; i<block->insns.len; i++) {
+        struct knit_insn insn;
+        memset(&insn, 0, sizeof insn);
+        insn.insn_type = block->insns.data[i].insn_type;
+        insn.op1 = block->insns.data[i].op1;
+        fwrite(&insn, sizeof insn, 1, f);
+    }
+    knit_knb_pad(f, block->insns.len * sizeof(struct knit_insn));
+    for (int i=0; i<block->lines.len; i++) {
+        knit_knb_put_u32(f, block->lines.data[i].ip);
+        knit_knb_put_u32(f, block->lines.data[i].lineno);
+    }
+    for (int i=0; i<block->constants.len; i++) {
+        struct knit_obj *obj = block->constants.data[i];
+        knit_knb_put_u32(f, obj->u.ktype);
+        if (obj->u.ktype == KNIT_INT) {
+            knit_knb_put_u32(f, (uint32_t) obj->u.integer.value);
+        }
+        else if (obj->u.ktype == KNIT_STR) {
+            knit_knb_put_u32(f, obj->u.str.len);
+            fwrite(obj->u.str.str, 1, obj->u.str.len, f);
+            fwrite("", 1, 1, f);
+            knit_knb_pad(f, obj->u.str.len + 1);
+        }
+        else if (obj->u.ktype == KNIT_KFUNC) {
+            int rv = knit_knb_put_block(f, obj->u.kfunc.block);
+            if (rv != KNIT_OK)
+                return rv;
+        }
+        else {
+            return KNIT_RUNTIME_ERR;
+        }
+    }
+    return KNIT_OK;
+}
+static int knit_knb_write(struct knit_block *block, const char *src, size_t srclen, FILE *f) {
+    uint64_t hash = knit_knb_hash(src, srclen);
+    fwrite(KNIT_KNB_MAGIC, 1, sizeof KNIT_KNB_MAGIC, f);
+    knit_knb_put_u32(f, KNIT_KNB_VERSION);
+    knit_knb_put_u32(f, KNIT_KNB_BYTE_ORDER);
+    knit_knb_put_u32(f, sizeof(struct knit_insn));
+    knit_knb_put_u32(f, offsetof(struct knit_insn, op1));
+    knit_knb_put_u32(f, 0); //the file size, known at the end
+    knit_knb_put_u32(f, (uint32_t) srclen);
+    knit_knb_put_u32(f, (uint32_t) hash);
+    knit_knb_put_u32(f, (uint32_t) (hash >> 32));
+    int rv = knit_knb_put_block(f, block);
+    if (rv != KNIT_OK)
+        return rv;
+    long size = ftell(f);
+    if (size < 0 || fseek(f, sizeof KNIT_KNB_MAGIC + 4 * 4, SEEK_SET) != 0)
+        return KNIT_RUNTIME_ERR;
+    knit_knb_put_u32(f, (uint32_t) size);
+    return ferror(f) ? KNIT_RUNTIME_ERR : KNIT_OK;
+}
+
+//writes a temporary file next to path and renames it, so a reader never maps a partly written file
+static int knit_knb_save_file(struct knit *knit, struct knit_block *block, const char *src, size_t srclen, const char *path) {
+    size_t len = strlen(path);
+    void *p = NULL;
+    if (knitx_rmalloc(knit, len + sizeof ".tmp", &p) != KNIT_OK)
+        return KNIT_NOMEM;
+    char *tmp = p;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", sizeof ".tmp");
+    int rv = KNIT_RUNTIME_ERR;
+    FILE *f = fopen(tmp, "wb");
+    if (f) {
+        rv = knit_knb_write(block, src, srclen, f);
+        if (fclose(f) != 0 && rv == KNIT_OK)
+            rv = KNIT_RUNTIME_ERR;
+        //rename() doesn't replace an existing file everywhere
+        if (rv == KNIT_OK && rename(tmp, path) != 0 && (remove(path) != 0 || rename(tmp, path) != 0))
+            rv = KNIT_RUNTIME_ERR;
+        if (rv != KNIT_OK)
+            remove(tmp);
+    }
+    knitx_rfree(knit, tmp);
+    return rv;
+}
+
+/*READING*/
+struct knit_knb_reader {
+    struct knit *knit;
+    const char *data;
+    size_t len;
+    size_t pos;
+    int depth;
+    int quiet; //corrupt data isn't reported, KNIT_RUNTIME_ERR is only returned
+};
+
+static int knit_knb_corrupt(struct knit_knb_reader *r, const char *what) {
+    if (r->quiet)
+        return KNIT_RUNTIME_ERR;
+    return knit_error(r->knit, KNIT_RUNTIME_ERR, "knitx_exec_bytecode(): corrupt bytecode, %s at offset %lu", what, (unsigned long) r->pos);
+}
+static int knit_knb_get_u32(struct knit_knb_reader *r, uint32_t *v) {
+    if (sizeof *v > r->len - r->pos)
+        return knit_knb_corrupt(r, "truncated");
+    memcpy(v, r->data + r->pos, sizeof *v);
+    r->pos += sizeof *v;
+    return KNIT_OK;
+}
+//n bytes that stay in the file, then the padding after them
+static int knit_knb_get_in_place(struct knit_knb_reader *r, size_t n, const char **p) {
+    size_t padded = n + (4 - n % 4) % 4;
+    if (padded < n || padded > r->len - r->pos)
+        return knit_knb_corrupt(r, "truncated");
+    *p = r->data + r->pos;
+    r->pos += padded;
+    return KNIT_OK;
+}
+
+static int knit_knb_get_block(struct knit_knb_reader *r, struct knit_block **blockp); //fwd
+static int knit_knb_get_constant(struct knit_knb_reader *r, struct knit_obj **objp) {
+    uint32_t ktype = 0, n = 0;
+    void *p = NULL;
+    int rv;
+    if ((rv = knit_knb_get_u32(r, &ktype)) != KNIT_OK)
+        return rv;
+    if (ktype == KNIT_INT) {
+        struct knit_int *integer;
+        if ((rv = knit_knb_get_u32(r, &n)) != KNIT_OK)
+            return rv;
+        //like the compiler's int constants (see kexpr_save_constant())
+        if ((rv = knitx_int_new_gcobj(r->knit, &integer, (int) n)) != KNIT_OK)
+            return rv;
+        *objp = ktobj(integer);
+    }
+    else if (ktype == KNIT_STR) {
+        const char *s = NULL;
+        if ((rv = knit_knb_get_u32(r, &n)) != KNIT_OK)
+            return rv;
+        if (n >= r->len - r->pos)
+            return knit_knb_corrupt(r, "bad string");
+        if ((rv = knit_knb_get_in_place(r, (size_t) n + 1, &s)) != KNIT_OK)
+            return rv;
+        if (s[n] != '\0')
+            return knit_knb_corrupt(r, "bad string");
+        if ((rv = knitx_str_new(r->knit, (struct knit_str **) &p)) != KNIT_OK)
+            return rv;
+        struct knit_str *str = p;
+        str->str = (char *) s;
+        str->len = n;
+        str->cap = -1; //borrowed from the file
+        if ((rv = knitx_own_object(r->knit, ktobj(str))) != KNIT_OK) {
+            knitx_tfree(r->knit, str);
+            return rv;
+        }
+        *objp = ktobj(str);
+    }
+    else if (ktype == KNIT_KFUNC) {
+        if ((rv = knitx_tmalloc(r->knit, sizeof(struct knit_kfunc), &p)) != KNIT_OK)
+            return rv;
+        struct knit_kfunc *kfunc = p;
+        kfunc->ktype = KNIT_KFUNC;
+        if ((rv = knit_knb_get_block(r, &kfunc->block)) != KNIT_OK) {
+            knitx_tfree(r->knit, kfunc);
+            return rv;
+        }
+        if ((rv = knitx_own_object(r->knit, ktobj(kfunc))) != KNIT_OK) {
+            knit_kfunc_deinit(r->knit, kfunc);
+            knitx_tfree(r->knit, kfunc);
+            return rv;
+        }
+        *objp = ktobj(kfunc);
+    }
+    else {
+        return knit_knb_corrupt(r, "unexpected constant type");
+    }
+    return KNIT_OK;
+}
+
+static int knit_knb_get_block(struct knit_knb_reader *r, struct knit_block **blockp) {
+    uint32_t nargs = 0, nlocals = 0, lineno = 0, ninsns = 0, nlines = 0, nconstants = 0;
+    int rv;
+    if (++r->depth > KNIT_KNB_MAX_DEPTH)
+        return knit_knb_corrupt(r, "functions nested too deep");
+    if ((rv = knit_knb_get_u32(r, &nargs)) != KNIT_OK ||
+        (rv = knit_knb_get_u32(r, &nlocals)) != KNIT_OK ||
+        (rv = knit_knb_get_u32(r, &lineno)) != KNIT_OK ||
+        (rv = knit_knb_get_u32(r, &ninsns)) != KNIT_OK ||
+        (rv = knit_knb_get_u32(r, &nlines)) != KNIT_OK ||
+        (rv = knit_knb_get_u32(r, &nconstants)) != KNIT_OK)
+        return rv;
+    //every constant takes 8 bytes at least
+    size_t remaining = r->len - r->pos;
+    if (ninsns > remaining / sizeof(struct knit_insn) || nlines > remaining / 8 || nconstants > remaining / 8 ||
+        ninsns > INT16_MAX || nargs > INT16_MAX || nlocals > INT16_MAX)
+        return knit_knb_corrupt(r, "bad block size");
+    const char *insns = NULL;
+    if ((rv = knit_knb_get_in_place(r, ninsns * sizeof(struct knit_insn), &insns)) != KNIT_OK)
+        return rv;
+
+    void *p = NULL;
+    if ((rv = knitx_tmalloc(r->knit, sizeof(struct knit_block), &p)) != KNIT_OK)
+        return rv;
+    struct knit_block *block = p;
+    memset(block, 0, sizeof *block);
+    block->nargs = nargs;
+    block->nlocals = nlocals;
+    block->lineno = lineno;
+    block->insns.data = (struct knit_insn *) insns;
+    block->insns.len = block->insns.cap = ninsns;
+    block->insns.allocator = &knit_knb_borrowed;
+    if (knit_lines_darray_init_with_allocator(&block->lines, nlines, &r->knit->container_allocator) != KNIT_LINES_DARRAY_OK) {
+        rv = knit_error(r->knit, KNIT_NOMEM, "knitx_exec_bytecode(): couldn't load a block's lines");
+        goto cleanup_block;
+    }
+    if (knit_objp_darray_init_with_allocator(&block->constants, nconstants, &r->knit->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        rv = knit_error(r->knit, KNIT_NOMEM, "knitx_exec_bytecode(): couldn't load a block's constants");
+        goto cleanup_lines;
+    }
+    for (uint32_t i=0; i<nlines; i++) {
+        uint32_t ip = 0, line = 0;
+        if ((rv = knit_knb_get_u32(r, &ip)) != KNIT_OK || (rv = knit_knb_get_u32(r, &line)) != KNIT_OK)
+            goto cleanup_constants;
+        block->lines.data[block->lines.len].ip = ip;
+        block->lines.data[block->lines.len].lineno = line;
+        block->lines.len++;
+    }
+    for (uint32_t i=0; i<nconstants; i++) {
+        struct knit_obj *obj = NULL;
+        if ((rv = knit_knb_get_constant(r, &obj)) != KNIT_OK)
+            goto cleanup_constants;
+        int idx;
+        //can't fail, the darray has room for every constant
+        knitx_block_add_constant(r->knit, block, obj, &idx);
+    }
+    if (!knitx_block_insns_valid(block)) {
+        rv = knit_knb_corrupt(r, "bad instruction");
+        goto cleanup_constants;
+    }
+    block->generator = knitx_block_has_yield(block);
+    r->depth--;
+    *blockp = block;
+    return KNIT_OK;
+
+cleanup_constants:
+    knit_objp_darray_deinit(&block->constants);
+cleanup_lines:
+    knit_lines_darray_deinit(&block->lines);
+cleanup_block:
+    knitx_tfree(r->knit, block);
+    return rv;
+}
+
+//boolean, whether data is bytecode this version wrote for src. it's not an error if it isn't
+static int knit_knb_matches(const char *data, size_t len, const char *src, size_t srclen) {
+    uint32_t header[8];
+    if (len < KNIT_KNB_HEADER_SIZE || memcmp(data, KNIT_KNB_MAGIC, sizeof KNIT_KNB_MAGIC) != 0)
+        return 0;
+    memcpy(header, data + sizeof KNIT_KNB_MAGIC, sizeof header);
+    if (header[0] != KNIT_KNB_VERSION || header[1] != KNIT_KNB_BYTE_ORDER ||
+        header[2] != sizeof(struct knit_insn) || header[3] != offsetof(struct knit_insn, op1) || header[4] != len)
+        return 0;
+    if (!src)
+        return 1;
+    uint64_t hash = knit_knb_hash(src, srclen);
+    return header[5] == (uint32_t) srclen && header[6] == (uint32_t) hash && header[7] == (uint32_t) (hash >> 32);
+}
+//data was checked with knit_knb_matches(), *blockp is the top level block
+//quiet is for a cache, a file that doesn't load is compiled again instead (see knitx_exec_cached())
+static int knit_knb_read(struct knit *knit, const char *data, size_t len, int quiet, struct knit_block **blockp) {
+    struct knit_knb_reader r = {.knit = knit, .data = data, .len = len, .pos = KNIT_KNB_HEADER_SIZE, .quiet = quiet};
+    int rv = knit_knb_get_block(&r, blockp);
+    if (rv != KNIT_OK)
+        return rv;
+    if (r.pos != r.len) {
+        knitx_block_deinit(knit, *blockp);
+        knitx_tfree(knit, *blockp);
+        return knit_knb_corrupt(&r, "trailing bytes");
+    }
+    return KNIT_OK;
+}
+#endif
@@ -0,0 +1,99 @@
+#ifndef KNIT_MAPPED_H
+#define KNIT_MAPPED_H
+#include <stdio.h>
+#include "kdata.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define KNIT_HAVE_MMAP
+#endif
+
+/*
+    files an instance loaded objects from (heap images, compiled bytecode, scripts).
+    the objects use the file in place: strings and the source of functions that aren't compiled yet point into it and bytecode runs from it,
+    so a file stays mapped read only until knitx_deinit(). where mmap() isn't available it's read into memory
+*/
+
+//who is the API function reported in errors, when it's NULL a file that doesn't exist or is empty
+//isn't an error, KNIT_NOT_FOUND is returned
+static int knit_map_file(struct knit *knit, const char *who, const char *path, struct knit_mapped_file **mfp) {
+    void *p = NULL;
+    int rv = knitx_rmalloc(knit, sizeof(struct knit_mapped_file), &p);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_mapped_file *mf = p;
+#ifdef KNIT_HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        knitx_rfree(knit, mf);
+        return who ? knit_error(knit, KNIT_RUNTIME_ERR, "%s: couldn't open '%s'", who, path) : KNIT_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        knitx_rfree(knit, mf);
+        return who ? knit_error(knit, KNIT_RUNTIME_ERR, "%s: '%s' is empty or can't be read", who, path) : KNIT_NOT_FOUND;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        knitx_rfree(knit, mf);
+        return who ? knit_error(knit, KNIT_RUNTIME_ERR, "%s: couldn't map '%s'", who, path) : KNIT_NOT_FOUND;
+    }
+    mf->addr = addr;
+    mf->len = st.st_size;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        knitx_rfree(knit, mf);
+        return who ? knit_error(knit, KNIT_RUNTIME_ERR, "%s: couldn't open '%s'", who, path) : KNIT_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void *addr = NULL;
+    if (len <= 0 || knitx_rmalloc(knit, len, &addr) != KNIT_OK || fread(addr, 1, len, f) != (size_t) len) {
+        if (addr)
+            knitx_rfree(knit, addr);
+        fclose(f);
+        knitx_rfree(knit, mf);
+        return who ? knit_error(knit, KNIT_RUNTIME_ERR, "%s: couldn't read '%s'", who, path) : KNIT_NOT_FOUND;
+    }
+    fclose(f);
+    mf->addr = addr;
+    mf->len = len;
+#endif
+    mf->next = knit->mapped;
+    knit->mapped = mf;
+    *mfp = mf;
+    return KNIT_OK;
+}
+//for a file that turned out to be unusable, nothing may point into it
+static void knit_unmap_file(struct knit *knit, struct knit_mapped_file *mf) {
+    struct knit_mapped_file **link = &knit->mapped;
+    while (*link != mf)
+        link = &(*link)->next;
+    *link = mf->next;
+#ifdef KNIT_HAVE_MMAP
+    munmap(mf->addr, mf->len);
+#else
+    knitx_rfree(knit, mf->addr);
+#endif
+    knitx_rfree(knit, mf);
+}
+static void knit_unmap_files(struct knit *knit) {
+    while (knit->mapped)
+        knit_unmap_file(knit, knit->mapped);
+}
+//boolean
+static int knit_mapped_contains(struct knit *knit, const void *p) {
+    for (struct knit_mapped_file *mf = knit->mapped; mf; mf = mf->next) {
+        if ((const char *) p >= (const char *) mf->addr && (const char *) p < (const char *) mf->addr + mf->len)
+            return 1;
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,239 @@
+#ifndef KNIT_MODULE_H
+#define KNIT_MODULE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "kdata.h"
+#include "knit_program.h"
+
+/*
+    modules (import(), see kruntime.h):
+    a module is compiled once per process for each version of its file, found by path, modification time and size.
+    it's kept as a knit_program (see knit_program.h), every instance that imports it runs the same blocks.
+    each entry has an id that its blocks are marked with, an instance keeps the module's globals by that id (see knitxr_import()).
+    an instance holds the entries it imported until knitx_deinit() (a clone holds its source's too).
+    when a file changes the entries for its older versions leave the cache, they're freed once no instance holds them.
+    so the cache has one entry per path plus the old versions still in use, knitx_module_cache_clear() frees all of it
+    when the process is done with modules
+*/
+struct knit_module_cache_entry {
+    struct knit_module_cache_entry *next;
+    char *path;
+    long long mtime; //nanoseconds where stat() has them
+    long long size;
+    struct knit_program *prog;
+    int users; //the instances holding it
+    int stale; //a newer version replaced it, it's in knit_module_stale
+};
+//in an instance's ex.imports
+struct knit_module_ref {
+    struct knit_module_ref *next;
+    struct knit_module_cache_entry *entry;
+};
+static struct knit_module_cache_entry *knit_module_cache = NULL;
+static struct knit_module_cache_entry *knit_module_stale = NULL; //replaced entries that are still held
+static int knit_module_last_id = 0;
+#ifdef KNIT_HAVE_PTHREADS
+static pthread_mutex_t knit_module_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define KNIT_MODULE_CACHE_LOCK()   pthread_mutex_lock(&knit_module_cache_lock)
+#define KNIT_MODULE_CACHE_UNLOCK() pthread_mutex_unlock(&knit_module_cache_lock)
+#else
+#define KNIT_MODULE_CACHE_LOCK()
+#define KNIT_MODULE_CACHE_UNLOCK()
+#endif
+
+//NULL if there's none, the caller holds the lock
+static struct knit_module_cache_entry *knit_module_cache_find(const char *path, long long mtime, long long size) {
+    for (struct knit_module_cache_entry *e = knit_module_cache; e; e = e->next) {
+        if (e->mtime == mtime && e->size == size && strcmp(e->path, path) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+//before the program is in the cache, nothing else can see it yet
+static void knit_module_set_id(struct knit_block *block, int id) {
+    block->module = id;
+    for (int i=0; i<block->constants.len; i++) {
+        if (block->constants.data[i]->u.ktype == KNIT_KFUNC)
+            knit_module_set_id(block->constants.data[i]->u.kfunc.block, id);
+    }
+}
+
+static char *knit_module_read(const char *path, long *lenp) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *src = len >= 0 ? malloc(len + 1) : NULL;
+    if (src && fread(src, 1, len, f) != (size_t) len) {
+        free(src);
+        src = NULL;
+    }
+    fclose(f);
+    *lenp = len;
+    return src;
+}
+
+static void knit_module_entry_free(struct knit_module_cache_entry *e) {
+    knit_program_free(e->prog);
+    free(e->path);
+    free(e);
+}
+static void knit_module_entry_free_all(struct knit_module_cache_entry *e) {
+    while (e) {
+        struct knit_module_cache_entry *next = e->next;
+        knit_module_entry_free(e);
+        e = next;
+    }
+}
+
+//the entries for other versions of path leave the cache, the ones nobody holds are moved to *unusedp, the caller holds the lock
+static void knit_module_cache_evict(const char *path, struct knit_module_cache_entry **unusedp) {
+    struct knit_module_cache_entry **pp = &knit_module_cache;
+    while (*pp) {
+        struct knit_module_cache_entry *old = *pp;
+        if (strcmp(old->path, path) != 0) {
+            pp = &old->next;
+            continue;
+        }
+        *pp = old->next;
+        struct knit_module_cache_entry **to = old->users ? &knit_module_stale : unusedp;
+        old->stale = 1;
+        old->next = *to;
+        *to = old;
+    }
+}
+
+//errors are reported in knit
+static int knit_module_compile(struct knit *knit, const char *path, struct knit_program **progp) {
+    long len = 0;
+    char *src = knit_module_read(path, &len);
+    if (!src)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "import(): couldn't read '%s'", path);
+    int rv = knit_program_build(knit, "import()", src, len, progp);
+    free(src);
+    return rv;
+}
+
+//compiled without the lock, another thread may get there first and then its entry is used.
+//*ep is held by the caller
+static int knit_module_add(struct knit *knit, const char *path, long long mtime, long long size, struct knit_module_cache_entry **ep) {
+    struct knit_program *prog = NULL;
+    int rv = knit_module_compile(knit, path, &prog);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_module_cache_entry *ne = malloc(sizeof *ne);
+    char *pathcpy = malloc(strlen(path) + 1);
+    if (!ne || !pathcpy) {
+        free(ne);
+        free(pathcpy);
+        knit_program_free(prog);
+        return knit_error(knit, KNIT_NOMEM, "import(): couldn't cache '%s'", path);
+    }
+    strcpy(pathcpy, path);
+    *ne = (struct knit_module_cache_entry) {.path = pathcpy, .mtime = mtime, .size = size, .prog = prog};
+    struct knit_module_cache_entry *unused = NULL;
+    KNIT_MODULE_CACHE_LOCK();
+    struct knit_module_cache_entry *e = knit_module_cache_find(path, mtime, size);
+    if (e == NULL) {
+        knit_module_cache_evict(path, &unused);
+        knit_module_set_id(prog->block, ++knit_module_last_id);
+        ne->next = knit_module_cache;
+        knit_module_cache = e = ne;
+        ne = NULL;
+    }
+    e->users++;
+    KNIT_MODULE_CACHE_UNLOCK();
+    if (ne)
+        knit_module_entry_free(ne);
+    knit_module_entry_free_all(unused);
+    *ep = e;
+    return KNIT_OK;
+}
+
+//*progp stays in the cache until the instance is deinitialized, it's run like any other program
+static int knit_module_load(struct knit *knit, const char *path, struct knit_program **progp) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return knit_error(knit, KNIT_RUNTIME_ERR, "import(): couldn't find '%s'", path);
+    long long mtime = (long long) st.st_mtime * 1000000000;
+#ifdef __linux__
+    mtime += st.st_mtim.tv_nsec;
+#endif
+    long long size = st.st_size;
+
+    void *p = NULL;
+    int rv = knitx_tmalloc(knit, sizeof(struct knit_module_ref), &p);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_module_ref *ref = p;
+    KNIT_MODULE_CACHE_LOCK();
+    struct knit_module_cache_entry *e = knit_module_cache_find(path, mtime, size);
+    if (e)
+        e->users++;
+    KNIT_MODULE_CACHE_UNLOCK();
+    if (!e && (rv = knit_module_add(knit, path, mtime, size, &e)) != KNIT_OK) {
+        knitx_tfree(knit, ref);
+        return rv;
+    }
+    ref->entry = e;
+    ref->next = knit->ex.imports;
+    knit->ex.imports = ref;
+    *progp = e->prog;
+    return KNIT_OK;
+}
+
+//dst holds the entries src holds, see knitx_clone()
+static int knit_module_hold_imports(struct knit *dst, struct knit *src) {
+    for (struct knit_module_ref *sref = src->ex.imports; sref; sref = sref->next) {
+        void *p = NULL;
+        int rv = knitx_tmalloc(dst, sizeof(struct knit_module_ref), &p);
+        if (rv != KNIT_OK)
+            return rv;
+        struct knit_module_ref *ref = p;
+        KNIT_MODULE_CACHE_LOCK();
+        sref->entry->users++;
+        KNIT_MODULE_CACHE_UNLOCK();
+        ref->entry = sref->entry;
+        ref->next = dst->ex.imports;
+        dst->ex.imports = ref;
+    }
+    return KNIT_OK;
+}
+
+//knitx_deinit() lets go of the entries the instance held, an old version nobody holds anymore is freed
+static void knit_module_release(struct knit *knit) {
+    struct knit_module_cache_entry *unused = NULL;
+    KNIT_MODULE_CACHE_LOCK();
+    while (knit->ex.imports) {
+        struct knit_module_ref *ref = knit->ex.imports;
+        struct knit_module_cache_entry *e = ref->entry;
+        knit->ex.imports = ref->next;
+        knitx_tfree(knit, ref);
+        if (--e->users || !e->stale)
+            continue;
+        struct knit_module_cache_entry **pp = &knit_module_stale;
+        while (*pp != e)
+            pp = &(*pp)->next;
+        *pp = e->next;
+        e->next = unused;
+        unused = e;
+    }
+    KNIT_MODULE_CACHE_UNLOCK();
+    knit_module_entry_free_all(unused);
+}
+
+//frees every entry, it's called after every instance that imported a module was deinitialized
+static void knitx_module_cache_clear(void) {
+    KNIT_MODULE_CACHE_LOCK();
+    knit_module_entry_free_all(knit_module_cache);
+    knit_module_entry_free_all(knit_module_stale);
+    knit_module_cache = NULL;
+    knit_module_stale = NULL;
+    KNIT_MODULE_CACHE_UNLOCK();
+}
+#endif
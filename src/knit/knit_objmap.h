@@ -0,0 +1,69 @@
+#ifndef KNIT_OBJMAP_H
+#define KNIT_OBJMAP_H
+#include "kdata.h"
+
+/*
+    a map keyed by object address, used by passes that visit an object graph once (see knit_clone.h, knit_image.h).
+    open addressing with linear probing, a NULL key is an empty slot. its memory comes from the instance allocator directly
+*/
+struct knit_objmap_entry {
+    struct knit_obj *key;
+    uintptr_t value; //a copy's address, an index...
+};
+struct knit_objmap {
+    struct knit *knit;
+    struct knit_objmap_entry *entries;
+    int len;
+    int cap;
+};
+
+static void knit_objmap_init(struct knit *knit, struct knit_objmap *map) {
+    memset(map, 0, sizeof *map);
+    map->knit = knit;
+}
+static void knit_objmap_deinit(struct knit_objmap *map) {
+    map->knit->allocator.free(map->knit->allocator.ud, map->entries);
+    map->entries = NULL;
+    map->len = map->cap = 0;
+}
+static struct knit_objmap_entry *knit_objmap_slot(struct knit_objmap_entry *entries, int cap, struct knit_obj *key) {
+    uintptr_t p = (uintptr_t) key;
+    unsigned slot = ((unsigned) ((p >> 4) ^ (p >> 20)) * 2654435761u) & (cap - 1);
+    while (entries[slot].key && entries[slot].key != key)
+        slot = (slot + 1) & (cap - 1);
+    return &entries[slot];
+}
+//boolean, *value is set if key was found
+static int knit_objmap_find(struct knit_objmap *map, struct knit_obj *key, uintptr_t *value) {
+    if (!map->len)
+        return 0;
+    struct knit_objmap_entry *e = knit_objmap_slot(map->entries, map->cap, key);
+    if (!e->key)
+        return 0;
+    *value = e->value;
+    return 1;
+}
+//key must not be in the map already
+static int knit_objmap_insert(struct knit_objmap *map, struct knit_obj *key, uintptr_t value) {
+    struct knit_allocator *a = &map->knit->allocator;
+    if ((map->len + 1) * 2 > map->cap) {
+        int cap = map->cap ? map->cap * 2 : 64;
+        struct knit_objmap_entry *entries = a->alloc(a->ud, cap * sizeof entries[0]);
+        if (!entries)
+            return KNIT_NOMEM;
+        memset(entries, 0, cap * sizeof entries[0]);
+        for (int i=0; i<map->cap; i++) {
+            if (map->entries[i].key)
+                *knit_objmap_slot(entries, cap, map->entries[i].key) = map->entries[i];
+        }
+        a->free(a->ud, map->entries);
+        map->entries = entries;
+        map->cap = cap;
+    }
+    struct knit_objmap_entry *e = knit_objmap_slot(map->entries, map->cap, key);
+    e->key = key;
+    e->value = value;
+    map->len++;
+    return KNIT_OK;
+}
+#endif
@@ -0,0 +1,393 @@
+#ifndef KNIT_PARALLEL_H
+#define KNIT_PARALLEL_H
+#include <stdlib.h>
+#include <string.h>
+#include "kdata.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+    #include <pthread.h>
+    #include <unistd.h>
+    #define KNIT_HAVE_PTHREADS
+#endif
+
+/*
+    parallel compilation (see knitx_exec_parallel()):
+    a program is compiled as units, separate sources or one source split after top level statements.
+    a top level statement can be compiled on its own, the variables it assigns are globals that are looked up by name when it runs.
+    each thread compiles the units it takes in an instance of its own, an instance (its heap, its error state,
+    the host's allocator) can't be shared. the units are compiled completely, function bodies included.
+    when all are done their blocks are copied into the calling instance in source order, their constants made again
+    the way the compiler makes them (int constants are gc objects), and the worker instances are deinitialized.
+    they allocate with malloc(), the host's allocator may not be usable from another thread.
+    without threads the units are compiled one after the other the same way.
+*/
+#define KNIT_PARALLEL_MIN_UNIT 8192 //bytes, a smaller unit costs more to set up and copy than it saves
+#define KNIT_PARALLEL_UNITS_PER_THREAD 4 //more units than threads evens out units that take longer
+
+struct knit_parallel_unit {
+    const char *src; //borrowed, not null terminated
+    int len;
+    int lineno; //of its first line in the program
+    int worker; //the index of the worker that compiled it, -1 until one takes it
+    int rv; //KNIT_NOMEM until it's compiled
+    struct knit_prs prs; //prs.curblk->block is the unit, it's in the worker's pool
+};
+
+/*POOL*/
+//every allocation is linked to its pool, so a knit_program or a knit_frozen can be freed without walking its objects
+struct knit_parallel_pool_hdr {
+    struct knit_parallel_pool_hdr *prev;
+    struct knit_parallel_pool_hdr *next;
+};
+#define KNIT_PARALLEL_POOL_HDR_SIZE 16 //keeps malloc()'s alignment for what follows the header
+struct knit_parallel_pool {
+    struct knit_parallel_pool_hdr head; //a circular list, head is its own neighbor when the pool is empty
+};
+
+static void knit_parallel_pool_link(struct knit_parallel_pool *pool, struct knit_parallel_pool_hdr *hdr) {
+    hdr->prev = &pool->head;
+    hdr->next = pool->head.next;
+    pool->head.next->prev = hdr;
+    pool->head.next = hdr;
+}
+static void knit_parallel_pool_unlink(struct knit_parallel_pool_hdr *hdr) {
+    hdr->prev->next = hdr->next;
+    hdr->next->prev = hdr->prev;
+}
+static struct knit_parallel_pool_hdr *knit_parallel_pool_hdr(void *p) {
+    return (struct knit_parallel_pool_hdr *) ((char *) p - KNIT_PARALLEL_POOL_HDR_SIZE);
+}
+static void *knit_parallel_pool_alloc(void *ud, size_t sz) {
+    struct knit_parallel_pool_hdr *hdr = malloc(KNIT_PARALLEL_POOL_HDR_SIZE + sz);
+    if (!hdr)
+        return NULL;
+    knit_parallel_pool_link(ud, hdr);
+    return (char *) hdr + KNIT_PARALLEL_POOL_HDR_SIZE;
+}
+static void knit_parallel_pool_free(void *ud, void *p) {
+    (void) ud;
+    if (!p)
+        return;
+    struct knit_parallel_pool_hdr *hdr = knit_parallel_pool_hdr(p);
+    knit_parallel_pool_unlink(hdr);
+    free(hdr);
+}
+static void *knit_parallel_pool_realloc(void *ud, void *p, size_t sz) {
+    if (!p)
+        return knit_parallel_pool_alloc(ud, sz);
+    struct knit_parallel_pool_hdr *hdr = knit_parallel_pool_hdr(p);
+    knit_parallel_pool_unlink(hdr);
+    struct knit_parallel_pool_hdr *nhdr = realloc(hdr, KNIT_PARALLEL_POOL_HDR_SIZE + sz);
+    if (!nhdr) {
+        knit_parallel_pool_link(ud, hdr);
+        return NULL;
+    }
+    knit_parallel_pool_link(ud, nhdr);
+    return (char *) nhdr + KNIT_PARALLEL_POOL_HDR_SIZE;
+}
+static void knit_parallel_pool_init(struct knit_parallel_pool *pool) {
+    pool->head.prev = pool->head.next = &pool->head;
+}
+static void knit_parallel_pool_release(struct knit_parallel_pool *pool) {
+    while (pool->head.next != &pool->head) {
+        struct knit_parallel_pool_hdr *hdr = pool->head.next;
+        knit_parallel_pool_unlink(hdr);
+        free(hdr);
+    }
+}
+
+/*SPLITTING*/
+//boolean, whether s[i] to s[len] is only whitespace and comments, which the parser doesn't take as a program
+static int knit_parallel_blank(const char *s, int i, int len) {
+    int lines = 0;
+    while ((i = knit_scan_space(s, i, len, &lines)) < len && s[i] == '#') {
+        const char *nl = memchr(s + i, '\n', len - i);
+        i = nl ? nl - s : len;
+    }
+    return i >= len;
+}
+//the offset after the first newline outside brackets, strings and comments at or after min that ends a statement, len if there's none.
+//*lines is increased by the newlines passed, like the lexer counts them (not those in strings)
+static int knit_parallel_next_cut(const char *s, int i, int len, int min, int *lines) {
+    int depth = 0, stmt = 0;
+    while (i < len) {
+        char c = s[i];
+        if (c == '\n') {
+            (*lines)++;
+            if (++i >= min && depth == 0 && stmt)
+                return i;
+        }
+        else if (c == '\'' || c == '"') {
+            i++;
+            while ((i = knit_scan_quote(s, i, len, c)) < len && s[i] == '\\')
+                i += 2;
+            i++;
+        }
+        else if (c == '#') {
+            const char *nl = memchr(s + i, '\n', len - i);
+            i = nl ? nl - s : len;
+        }
+        else {
+            depth += (c == '(' || c == '[' || c == '{') - (c == ')' || c == ']' || c == '}');
+            stmt |= !knit_scan_is_space(c);
+            i++;
+        }
+    }
+    return len;
+}
+//units has room for len / unitlen + 1 of them, returns how many there are.
+//blank lines and comments at the end go with the last statement
+static int knit_parallel_split(const char *program, int len, int unitlen, struct knit_parallel_unit *units) {
+    int n = 0, begin = 0, lineno = 1;
+    do {
+        units[n].src = program + begin;
+        units[n].lineno = lineno;
+        int end = knit_parallel_next_cut(program, begin, len, begin + unitlen, &lineno);
+        if (end < len && knit_parallel_blank(program, end, len))
+            end = len;
+        units[n++].len = end - begin;
+        begin = end;
+    } while (begin < len);
+    return n;
+}
+
+/*COMPILING*/
+struct knit_parallel_worker {
+    struct knit knit;
+    struct knit_parallel *par;
+    int index;
+    int init_rv;
+#ifdef KNIT_HAVE_PTHREADS
+    pthread_t thread;
+#endif
+};
+struct knit_parallel {
+    struct knit_parallel_unit *units;
+    int nunits;
+    int next; //the next unit to take
+#ifdef KNIT_HAVE_PTHREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+//-1 when there are none left
+static int knit_parallel_take(struct knit_parallel *par) {
+#ifdef KNIT_HAVE_PTHREADS
+    pthread_mutex_lock(&par->lock);
+#endif
+    int i = par->next < par->nunits ? par->next++ : -1;
+#ifdef KNIT_HAVE_PTHREADS
+    pthread_mutex_unlock(&par->lock);
+#endif
+    return i;
+}
+static void *knit_parallel_work(void *arg) {
+    struct knit_parallel_worker *w = arg;
+    struct knit *knit = &w->knit;
+    int i;
+    while ((i = knit_parallel_take(w->par)) != -1) {
+        struct knit_parallel_unit *unit = &w->par->units[i];
+        unit->worker = w->index;
+        knitx_prs_init1(knit, &unit->prs);
+        knitx_lexer_init_buf(knit, &unit->prs.lex, unit->src, unit->len);
+        unit->prs.lex.lineno = unit->lineno;
+        int rv = knitx_prog(knit, &unit->prs);
+        if (rv == KNIT_OK)
+            rv = knitx_block_compile_all(knit, &unit->prs.curblk->block);
+        unit->rv = rv;
+        if (rv != KNIT_OK)
+            break; //the error stays in the instance, the other units can't run anyway
+    }
+    return NULL;
+}
+//err_policy is the calling instance's
+static void knit_parallel_worker_init(struct knit_parallel_worker *w, struct knit_parallel *par, int index, int err_policy) {
+    w->par = par;
+    w->index = index;
+    w->init_rv = knitx_init_with_allocator(&w->knit, err_policy, NULL);
+}
+static void knit_parallel_worker_deinit(struct knit_parallel_worker *w) {
+    if (w->init_rv == KNIT_OK)
+        knitx_deinit(&w->knit);
+}
+
+//how many threads to use when the caller asks for 0
+static int knit_parallel_ncores(void) {
+#if defined(KNIT_HAVE_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+#else
+    return 1;
+#endif
+}
+
+/*COPYING*/
+static int knit_parallel_copy_block(struct knit *knit, struct knit_block *src, struct knit_block **blockp); //fwd
+
+//made like kexpr_save_constant() and kexpr_funcdef() make them
+static int knit_parallel_copy_constant(struct knit *knit, struct knit_obj *obj, struct knit_obj **copyp) {
+    int rv;
+    if (obj->u.ktype == KNIT_INT) {
+        struct knit_int *integer;
+        if ((rv = knitx_int_new_gcobj(knit, &integer, obj->u.integer.value)) != KNIT_OK)
+            return rv;
+        *copyp = ktobj(integer);
+    }
+    else if (obj->u.ktype == KNIT_STR) {
+        struct knit_str *str;
+        if ((rv = knitx_str_new(knit, &str)) != KNIT_OK)
+            return rv;
+        if ((rv = knitx_own_object(knit, ktobj(str))) != KNIT_OK) {
+            knitx_str_destroy(knit, str);
+            return rv;
+        }
+        if ((rv = knitx_str_strlcpy(knit, str, obj->u.str.str, obj->u.str.len)) != KNIT_OK)
+            return rv;
+        *copyp = ktobj(str);
+    }
+    else if (obj->u.ktype == KNIT_KFUNC) {
+        void *p = NULL;
+        if ((rv = knitx_tmalloc(knit, sizeof(struct knit_kfunc), &p)) != KNIT_OK)
+            return rv;
+        struct knit_kfunc *kfunc = p;
+        kfunc->ktype = KNIT_KFUNC;
+        if ((rv = knit_parallel_copy_block(knit, obj->u.kfunc.block, &kfunc->block)) != KNIT_OK) {
+            knitx_tfree(knit, kfunc);
+            return rv;
+        }
+        if ((rv = knitx_own_object(knit, ktobj(kfunc))) != KNIT_OK) {
+            knit_kfunc_deinit(knit, kfunc);
+            knitx_tfree(knit, kfunc);
+            return rv;
+        }
+        *copyp = ktobj(kfunc);
+    }
+    else {
+        return knit_error(knit, KNIT_RUNTIME_ERR, "knitx_exec_parallel(): unexpected constant type %s", knitx_obj_type_name(knit, obj));
+    }
+    return KNIT_OK;
+}
+//src was compiled completely by a worker, *blockp is a copy that belongs to knit
+static int knit_parallel_copy_block(struct knit *knit, struct knit_block *src, struct knit_block **blockp) {
+    knit_assert_h(!src->src, "knitx_exec_parallel(): a function wasn't compiled");
+    void *p = NULL;
+    int rv = knitx_tmalloc(knit, sizeof(struct knit_block), &p);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_block *block = p;
+    *block = *src;
+    if (insns_darray_init_with_allocator(&block->insns, src->insns.len, &knit->container_allocator) != INSNS_DARRAY_OK) {
+        rv = knit_error(knit, KNIT_NOMEM, "knitx_exec_parallel(): couldn't copy a block's instructions");
+        goto cleanup_block;
+    }
+    if (knit_objp_darray_init_with_allocator(&block->constants, src->constants.len, &knit->container_allocator) != KNIT_OBJP_DARRAY_OK) {
+        rv = knit_error(knit, KNIT_NOMEM, "knitx_exec_parallel(): couldn't copy a block's constants");
+        goto cleanup_insns;
+    }
+    if (knit_lines_darray_init_with_allocator(&block->lines, src->lines.len, &knit->container_allocator) != KNIT_LINES_DARRAY_OK) {
+        rv = knit_error(knit, KNIT_NOMEM, "knitx_exec_parallel(): couldn't copy a block's lines");
+        goto cleanup_constants;
+    }
+    memcpy(block->insns.data, src->insns.data, src->insns.len * sizeof src->insns.data[0]);
+    block->insns.len = src->insns.len;
+    memcpy(block->lines.data, src->lines.data, src->lines.len * sizeof src->lines.data[0]);
+    block->lines.len = src->lines.len;
+    *blockp = block;
+    for (int i=0; i<src->constants.len; i++) {
+        struct knit_obj *copy = NULL;
+        int idx;
+        if ((rv = knit_parallel_copy_constant(knit, src->constants.data[i], &copy)) != KNIT_OK)
+            return rv;
+        if ((rv = knitx_block_add_constant(knit, block, copy, &idx)) != KNIT_OK)
+            return rv;
+    }
+    return KNIT_OK;
+
+cleanup_constants:
+    knit_objp_darray_deinit(&block->constants);
+cleanup_insns:
+    insns_darray_deinit(&block->insns);
+cleanup_block:
+    knitx_tfree(knit, block);
+    return rv;
+}
+
+/*
+    compiles the units on nthreads threads (the calling one included), copies them into knit and runs them in order.
+    a unit that doesn't compile stops everything before any unit runs, with the error the worker reported
+*/
+static int knit_parallel_exec(struct knit *knit, struct knit_parallel_unit *units, int nunits, int nthreads) {
+    struct knit_parallel par = {.units = units, .nunits = nunits};
+    struct knit_parallel_worker *workers = NULL;
+    struct knit_block **blocks = NULL;
+    int rv, i;
+    if (nthreads <= 0)
+        nthreads = knit_parallel_ncores();
+#ifndef KNIT_HAVE_PTHREADS
+    nthreads = 1;
+#endif
+    if (nthreads > nunits)
+        nthreads = nunits;
+    if ((rv = knitx_rmalloc(knit, nthreads * sizeof workers[0], (void **) &workers)) != KNIT_OK)
+        return rv;
+    if ((rv = knitx_rmalloc(knit, nunits * sizeof blocks[0], (void **) &blocks)) != KNIT_OK)
+        goto cleanup_workers;
+    for (i=0; i<nunits; i++) {
+        units[i].rv = KNIT_NOMEM;
+        units[i].worker = -1;
+    }
+    for (i=0; i<nthreads; i++)
+        knit_parallel_worker_init(&workers[i], &par, i, knit->err_policy);
+
+    int nstarted = 1;
+#ifdef KNIT_HAVE_PTHREADS
+    pthread_mutex_init(&par.lock, NULL);
+    //a thread that can't be started leaves its units to the others
+    for (; nstarted<nthreads; nstarted++) {
+        if (workers[nstarted].init_rv != KNIT_OK ||
+            pthread_create(&workers[nstarted].thread, NULL, knit_parallel_work, &workers[nstarted]) != 0)
+            break;
+    }
+#endif
+    if (workers[0].init_rv == KNIT_OK)
+        knit_parallel_work(&workers[0]);
+#ifdef KNIT_HAVE_PTHREADS
+    for (i=1; i<nstarted; i++)
+        pthread_join(workers[i].thread, NULL);
+    pthread_mutex_destroy(&par.lock);
+#endif
+
+    int ncopied = 0;
+    for (; ncopied<nunits && rv == KNIT_OK; ncopied++) {
+        struct knit_parallel_unit *unit = &units[ncopied];
+        if (unit->rv != KNIT_OK) {
+            struct knit *w = &workers[unit->worker].knit;
+            if (unit->rv == KNIT_NOMEM && par.next <= ncopied)
+                rv = knit_error(knit, KNIT_NOMEM, "knitx_exec_parallel(): no thread could compile the program");
+            else
+                rv = knit_error(knit, unit->rv, "%s", w->err_msg ? w->err_msg : "knitx_exec_parallel(): a unit didn't compile");
+            break;
+        }
+        rv = knit_parallel_copy_block(knit, &unit->prs.curblk->block, &blocks[ncopied]);
+    }
+    for (i=0; i<nunits; i++) {
+        struct knit_parallel_unit *unit = &units[i];
+        if (unit->worker == -1)
+            continue;
+        knitx_lexer_deinit(&workers[unit->worker].knit, &unit->prs.lex);
+        knitx_prs_deinit(&workers[unit->worker].knit, &unit->prs);
+    }
+    for (i=0; i<nthreads; i++)
+        knit_parallel_worker_deinit(&workers[i]);
+    for (i=0; i<ncopied; i++) {
+        if (rv == KNIT_OK)
+            knitx_exec_toplevel(knit, blocks[i]);
+        knitx_block_deinit(knit, blocks[i]);
+        knitx_tfree(knit, blocks[i]);
+    }
+    knitx_rfree(knit, blocks);
+cleanup_workers:
+    knitx_rfree(knit, workers);
+    return rv;
+}
+#endif
@@ -0,0 +1,133 @@
+#ifndef KNIT_PROGRAM_H
+#define KNIT_PROGRAM_H
+#include <stdlib.h>
+#include <string.h>
+#include "kdata.h"
+#include "knit_parallel.h"
+
+/*
+    compiled programs (see knitx_program_compile()):
+    a block the compiler makes belongs to its instance, its int constants are gc objects in its heap,
+    compaction patches its constants and a function's body is compiled into it on the first call.
+    a knit_program is compiled once and doesn't belong to any instance: it's compiled completely in a throwaway instance,
+    then its blocks and constants are copied out of it into memory of the program's own.
+    none of its objects are in a heap, the gc doesn't count or move them, and its blocks are marked shared so nothing patches them.
+    so it's never written after it's made, and any number of instances can run it at the same time on their own threads.
+    the globals an instance assigns borrow their names from the program, it's freed after every instance that ran it.
+    its memory comes from malloc(), an instance's allocator may not be usable from another thread
+*/
+struct knit_program {
+    struct knit_parallel_pool pool; //everything the program owns, released at once by knitx_program_free()
+    struct dyn_allocator allocator; //the pool, for the blocks' darrays
+    struct knit_block *block; //the top level
+};
+
+static void *knit_program_alloc(struct knit_program *prog, size_t sz) {
+    return knit_parallel_pool_alloc(&prog->pool, sz);
+}
+
+static int knit_program_copy_block(struct knit_program *prog, struct knit_block *src, struct knit_block **blockp); //fwd
+//ints and strings are plain copies, nothing else is a constant
+static int knit_program_copy_constant(struct knit_program *prog, struct knit_obj *obj, struct knit_obj **copyp) {
+    if (obj->u.ktype != KNIT_INT && obj->u.ktype != KNIT_STR && obj->u.ktype != KNIT_KFUNC)
+        return KNIT_RUNTIME_ERR;
+    size_t sz = knit_obj_type_size(obj->u.ktype);
+    struct knit_obj *copy = knit_program_alloc(prog, sz);
+    if (!copy)
+        return KNIT_NOMEM;
+    memcpy(copy, obj, sz);
+    *copyp = copy;
+    if (obj->u.ktype == KNIT_STR) {
+        char *s = knit_program_alloc(prog, obj->u.str.len + 1);
+        if (!s)
+            return KNIT_NOMEM;
+        memcpy(s, obj->u.str.str, obj->u.str.len);
+        s[obj->u.str.len] = '\0';
+        copy->u.str.str = s;
+        copy->u.str.cap = -1; //not owned by any instance
+    }
+    else if (obj->u.ktype == KNIT_KFUNC) {
+        return knit_program_copy_block(prog, obj->u.kfunc.block, &copy->u.kfunc.block);
+    }
+    return KNIT_OK;
+}
+static int knit_program_copy_block(struct knit_program *prog, struct knit_block *src, struct knit_block **blockp) {
+    knit_assert_h(!src->src, "knitx_program_compile(): a function wasn't compiled");
+    struct knit_block *block = knit_program_alloc(prog, sizeof *block);
+    if (!block)
+        return KNIT_NOMEM;
+    *block = *src;
+    block->gc_epoch = 0;
+    block->shared = 1;
+    *blockp = block;
+    //the darrays are never freed or grown, the pool goes as a whole
+    if (insns_darray_init_with_allocator(&block->insns, src->insns.len, &prog->allocator) != INSNS_DARRAY_OK ||
+        knit_objp_darray_init_with_allocator(&block->constants, src->constants.len, &prog->allocator) != KNIT_OBJP_DARRAY_OK ||
+        knit_lines_darray_init_with_allocator(&block->lines, src->lines.len, &prog->allocator) != KNIT_LINES_DARRAY_OK)
+        return KNIT_NOMEM;
+    memcpy(block->insns.data, src->insns.data, src->insns.len * sizeof src->insns.data[0]);
+    block->insns.len = src->insns.len;
+    memcpy(block->lines.data, src->lines.data, src->lines.len * sizeof src->lines.data[0]);
+    block->lines.len = src->lines.len;
+    for (int i=0; i<src->constants.len; i++) {
+        int rv = knit_program_copy_constant(prog, src->constants.data[i], &block->constants.data[i]);
+        if (rv != KNIT_OK)
+            return rv;
+    }
+    block->constants.len = src->constants.len;
+    return KNIT_OK;
+}
+
+static void knit_program_free(struct knit_program *prog) {
+    if (!prog)
+        return;
+    knit_parallel_pool_release(&prog->pool);
+    free(prog);
+}
+
+//what is the API function the error is reported for, like knit_map_file()'s
+static int knit_program_build(struct knit *knit, const char *what, const char *src, int len, struct knit_program **progp) {
+    struct knit_program *prog = malloc(sizeof *prog);
+    struct knit_parallel_worker *w = malloc(sizeof *w);
+    if (!prog || !w) {
+        free(prog);
+        free(w);
+        return knit_error(knit, KNIT_NOMEM, "%s: couldn't allocate a program", what);
+    }
+    knit_parallel_pool_init(&prog->pool);
+    prog->allocator = (struct dyn_allocator) {
+        .realloc = knit_parallel_pool_realloc,
+        .free = knit_parallel_pool_free,
+        .ud = &prog->pool,
+    };
+    prog->block = NULL;
+
+    int rv;
+    knit_parallel_worker_init(w, NULL, 0, knit->err_policy);
+    if ((rv = w->init_rv) == KNIT_OK) {
+        struct knit_prs prs;
+        knitx_prs_init1(&w->knit, &prs);
+        knitx_lexer_init_buf(&w->knit, &prs.lex, src, len);
+        rv = knitx_prog(&w->knit, &prs);
+        if (rv == KNIT_OK)
+            rv = knitx_block_compile_all(&w->knit, &prs.curblk->block);
+        if (rv != KNIT_OK)
+            rv = knit_error(knit, rv, "%s: %s", what, w->knit.err_msg ? w->knit.err_msg : "the program didn't compile");
+        else if ((rv = knit_program_copy_block(prog, &prs.curblk->block, &prog->block)) != KNIT_OK)
+            rv = knit_error(knit, rv, "%s: couldn't copy the program out of the compiler", what);
+        knitx_lexer_deinit(&w->knit, &prs.lex);
+        knitx_prs_deinit(&w->knit, &prs);
+    }
+    else {
+        rv = knit_error(knit, rv, "%s: couldn't start a compiler", what);
+    }
+    knit_parallel_worker_deinit(w);
+    free(w);
+    if (rv != KNIT_OK) {
+        knit_program_free(prog);
+        return rv;
+    }
+    *progp = prog;
+    return KNIT_OK;
+}
+#endif
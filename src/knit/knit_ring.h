@@ -0,0 +1,97 @@
+#ifndef KNIT_RING_H
+#define KNIT_RING_H
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+    a bounded multi producer multi consumer queue of pointers, lock free, used by executors and channels.
+    a ring of sequenced cells: a cell's seq says whose turn it is, pos when it's free for the pos-th push
+    and pos + 1 when it holds that push's item. a push and a pop only contend on the position they advance.
+    it never blocks, sleeping when it's full or empty is up to its user
+*/
+#ifdef KNIT_HAVE_PTHREADS
+#include <stdatomic.h>
+
+#define KNIT_RING_LINE 64 //cache line size
+
+struct knit_ring_cell {
+    atomic_size_t seq;
+    void *item;
+};
+struct knit_ring {
+    struct knit_ring_cell *cells;
+    size_t mask; //the number of cells - 1
+    //apart by a cache line, producers and consumers don't contend on each other's
+    char pad0[KNIT_RING_LINE];
+    atomic_size_t enqueue_pos;
+    char pad1[KNIT_RING_LINE];
+    atomic_size_t dequeue_pos;
+    char pad2[KNIT_RING_LINE]; //what follows the ring in its user's struct is apart too
+};
+
+//len is rounded up to a power of two, at least 2. boolean, 0 if the cells couldn't be allocated
+static int knit_ring_init(struct knit_ring *ring, int len) {
+    size_t ncells = 2;
+    while (ncells < (size_t) len)
+        ncells *= 2;
+    ring->cells = malloc(ncells * sizeof ring->cells[0]);
+    if (!ring->cells)
+        return 0;
+    ring->mask = ncells - 1;
+    for (size_t i=0; i<ncells; i++)
+        atomic_init(&ring->cells[i].seq, i);
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    return 1;
+}
+static void knit_ring_deinit(struct knit_ring *ring) {
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+//boolean, 0 if it's full
+static int knit_ring_push(struct knit_ring *ring, void *item) {
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        struct knit_ring_cell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->item = item;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 1;
+            }
+        }
+        else if (diff < 0) {
+            return 0; //the cell still holds an item from a lap ago
+        }
+        else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+//NULL if it's empty
+static void *knit_ring_pop(struct knit_ring *ring) {
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        struct knit_ring_cell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                void *item = cell->item;
+                atomic_store_explicit(&cell->seq, pos + ring->mask + 1, memory_order_release);
+                return item;
+            }
+        }
+        else if (diff < 0) {
+            return NULL;
+        }
+        else {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+#endif
+#endif
@@ -0,0 +1,172 @@
+#ifndef KNIT_SCAN_H
+#define KNIT_SCAN_H
+#include <string.h>
+#include "kdata.h"
+
+/*
+    character scanning for the lexer: the end of a run of identifier characters, digits or whitespace,
+    and the next quote or backslash in a string literal.
+    with gcc or clang on x86 16 bytes (32 with AVX2) are classified at once while a whole chunk fits in the input,
+    the rest is checked a byte at a time. each function returns the offset of the first byte that ends the run,
+    len if there's none.
+    keywords are found with a perfect hash of the first and last characters and the length, then one memcmp.
+*/
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__AVX2__))
+    #define KNIT_SCAN_SIMD
+    #include <immintrin.h>
+#endif
+
+static int knit_scan_is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+static int knit_scan_is_ident(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || knit_scan_is_digit(c) || c == '_';
+}
+static int knit_scan_is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+#ifdef KNIT_SCAN_SIMD
+/*
+    each chunk function returns a mask with a bit set for each byte that is in the class.
+    range checks are signed compares, bytes >= 0x80 are negative and fall outside every range
+*/
+#ifdef __AVX2__
+#define KNIT_SCAN_CHUNK 32
+typedef __m256i knit_scan_vec;
+#define knit_scan_load(p)       _mm256_loadu_si256((const __m256i *) (p))
+#define knit_scan_set1(c)       _mm256_set1_epi8(c)
+#define knit_scan_eq(a, b)      _mm256_cmpeq_epi8(a, b)
+#define knit_scan_gt(a, b)      _mm256_cmpgt_epi8(a, b)
+#define knit_scan_or(a, b)      _mm256_or_si256(a, b)
+#define knit_scan_and(a, b)     _mm256_and_si256(a, b)
+#define knit_scan_mask(v)       ((uint32_t) _mm256_movemask_epi8(v))
+#else
+#define KNIT_SCAN_CHUNK 16
+typedef __m128i knit_scan_vec;
+#define knit_scan_load(p)       _mm_loadu_si128((const __m128i *) (p))
+#define knit_scan_set1(c)       _mm_set1_epi8(c)
+#define knit_scan_eq(a, b)      _mm_cmpeq_epi8(a, b)
+#define knit_scan_gt(a, b)      _mm_cmpgt_epi8(a, b)
+#define knit_scan_or(a, b)      _mm_or_si128(a, b)
+#define knit_scan_and(a, b)     _mm_and_si128(a, b)
+#define knit_scan_mask(v)       ((uint32_t) _mm_movemask_epi8(v))
+#endif
+#define KNIT_SCAN_FULL ((uint32_t) (((uint64_t) 1 << KNIT_SCAN_CHUNK) - 1))
+
+//lo <= v <= hi
+static knit_scan_vec knit_scan_range(knit_scan_vec v, char lo, char hi) {
+    return knit_scan_and(knit_scan_gt(v, knit_scan_set1(lo - 1)), knit_scan_gt(knit_scan_set1(hi + 1), v));
+}
+static uint32_t knit_scan_digit_mask(const char *p) {
+    return knit_scan_mask(knit_scan_range(knit_scan_load(p), '0', '9'));
+}
+static uint32_t knit_scan_ident_mask(const char *p) {
+    knit_scan_vec v = knit_scan_load(p);
+    knit_scan_vec lower = knit_scan_or(v, knit_scan_set1(0x20)); //'A'-'Z' to 'a'-'z'
+    knit_scan_vec m = knit_scan_or(knit_scan_range(lower, 'a', 'z'), knit_scan_range(v, '0', '9'));
+    return knit_scan_mask(knit_scan_or(m, knit_scan_eq(v, knit_scan_set1('_'))));
+}
+static uint32_t knit_scan_space_mask(const char *p, uint32_t *newlines) {
+    knit_scan_vec v = knit_scan_load(p);
+    knit_scan_vec nl = knit_scan_eq(v, knit_scan_set1('\n'));
+    *newlines = knit_scan_mask(nl);
+    //'\t' '\n' '\v' '\f' '\r' are 9 to 13
+    return knit_scan_mask(knit_scan_or(knit_scan_eq(v, knit_scan_set1(' ')), knit_scan_range(v, '\t', '\r')));
+}
+static uint32_t knit_scan_quote_mask(const char *p, char delim) {
+    knit_scan_vec v = knit_scan_load(p);
+    return knit_scan_mask(knit_scan_or(knit_scan_eq(v, knit_scan_set1(delim)), knit_scan_eq(v, knit_scan_set1('\\'))));
+}
+#endif
+
+static int knit_scan_ident(const char *s, int i, int len) {
+#ifdef KNIT_SCAN_SIMD
+    for (; i + KNIT_SCAN_CHUNK <= len; i += KNIT_SCAN_CHUNK) {
+        uint32_t m = knit_scan_ident_mask(s + i);
+        if (m != KNIT_SCAN_FULL)
+            return i + __builtin_ctz(~m);
+    }
+#endif
+    while (i < len && knit_scan_is_ident(s[i]))
+        i++;
+    return i;
+}
+
+static int knit_scan_digits(const char *s, int i, int len) {
+#ifdef KNIT_SCAN_SIMD
+    for (; i + KNIT_SCAN_CHUNK <= len; i += KNIT_SCAN_CHUNK) {
+        uint32_t m = knit_scan_digit_mask(s + i);
+        if (m != KNIT_SCAN_FULL)
+            return i + __builtin_ctz(~m);
+    }
+#endif
+    while (i < len && knit_scan_is_digit(s[i]))
+        i++;
+    return i;
+}
+
+//*lines is increased by the newlines skipped
+static int knit_scan_space(const char *s, int i, int len, int *lines) {
+#ifdef KNIT_SCAN_SIMD
+    for (; i + KNIT_SCAN_CHUNK <= len; i += KNIT_SCAN_CHUNK) {
+        uint32_t newlines;
+        uint32_t m = knit_scan_space_mask(s + i, &newlines);
+        if (m != KNIT_SCAN_FULL) {
+            int n = __builtin_ctz(~m);
+            *lines += __builtin_popcount(newlines & (((uint32_t) 1 << n) - 1));
+            return i + n;
+        }
+        *lines += __builtin_popcount(newlines);
+    }
+#endif
+    for (; i < len && knit_scan_is_space(s[i]); i++)
+        *lines += s[i] == '\n';
+    return i;
+}
+
+//the next delim or backslash
+static int knit_scan_quote(const char *s, int i, int len, char delim) {
+#ifdef KNIT_SCAN_SIMD
+    for (; i + KNIT_SCAN_CHUNK <= len; i += KNIT_SCAN_CHUNK) {
+        uint32_t m = knit_scan_quote_mask(s + i, delim);
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+#endif
+    while (i < len && s[i] != delim && s[i] != '\\')
+        i++;
+    return i;
+}
+
+struct knit_scan_keyword {
+    const char *word; //NULL for an empty slot
+    int len;
+    int toktype;
+};
+//no two keywords have the same hash, a new one may need other multipliers (or a bigger table)
+#define KNIT_SCAN_KEYWORD_HASH(first, last, len) (((unsigned char) (first) * 3u + (unsigned char) (last) * 5u + (unsigned) (len)) & 31u)
+static const struct knit_scan_keyword knit_scan_keywords[32] = {
+    [KNIT_SCAN_KEYWORD_HASH('f', 'n', 8)] = {"function", 8, KAT_FUNCTION},
+    [KNIT_SCAN_KEYWORD_HASH('r', 'n', 6)]   = {"return", 6, KAT_RETURN},
+    [KNIT_SCAN_KEYWORD_HASH('f', 'e', 5)]    = {"false", 5, KAT_FALSE},
+    [KNIT_SCAN_KEYWORD_HASH('w', 'e', 5)]    = {"while", 5, KAT_WHILE},
+    [KNIT_SCAN_KEYWORD_HASH('y', 'd', 5)]    = {"yield", 5, KAT_YIELD},
+    [KNIT_SCAN_KEYWORD_HASH('t', 'e', 4)]     = {"true", 4, KAT_TRUE},
+    [KNIT_SCAN_KEYWORD_HASH('n', 'l', 4)]     = {"null", 4, KAT_NULL},
+    [KNIT_SCAN_KEYWORD_HASH('e', 'e', 4)]     = {"else", 4, KAT_ELSE},
+    [KNIT_SCAN_KEYWORD_HASH('a', 'd', 3)]      = {"and", 3, KAT_LAND},
+    [KNIT_SCAN_KEYWORD_HASH('f', 'r', 3)]      = {"for", 3, KAT_FOR},
+    [KNIT_SCAN_KEYWORD_HASH('o', 'r', 2)]       = {"or", 2, KAT_LOR},
+    [KNIT_SCAN_KEYWORD_HASH('i', 'f', 2)]       = {"if", 2, KAT_IF},
+};
+//the keyword's token type, KAT_VAR if it's a name
+static int knit_scan_keyword(const char *s, int len) {
+    if (len < 2 || len > 8)
+        return KAT_VAR;
+    const struct knit_scan_keyword *kw = &knit_scan_keywords[KNIT_SCAN_KEYWORD_HASH(s[0], s[len - 1], len)];
+    if (kw->len == len && memcmp(kw->word, s, len) == 0)
+        return kw->toktype;
+    return KAT_VAR;
+}
+#endif
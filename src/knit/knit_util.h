@@ -5,6 +5,10 @@
 static void knit_assert_h(int condition, const char *fmt, ...);
 static int knitx_obj_dump(struct knit *knit, struct knit_obj *obj); //fwd
 static int knit_error(struct knit *knit, int err_type, const char *fmt, ...);
+static void knit_alloc_sample(struct knit *knit, size_t sz); //fwd
+
+//only a branch when sampling is off
+#define KALLOC_SAMPLE(knit, sz) do { if ((knit)->alloc_sampler.interval) knit_alloc_sample(knit, sz); } while (0)
 
 #ifdef KNIT_MEM_STATS
 #define KNIT_MAX_ALIGNMENT_REQ 8
@@ -62,16 +66,35 @@ static size_t ptr_wrap_get_sz(void *p) {
 
 
 
+static void *knit_libc_alloc(void *ud, size_t sz) {
+    (void) ud;
+    return malloc(sz);
+}
+static void *knit_libc_realloc(void *ud, void *p, size_t sz) {
+    (void) ud;
+    return realloc(p, sz);
+}
+static void knit_libc_free(void *ud, void *p) {
+    (void) ud;
+    free(p);
+}
+static const struct knit_allocator knit_libc_allocator = {
+    .alloc = knit_libc_alloc,
+    .realloc = knit_libc_realloc,
+    .free = knit_libc_free,
+    .ud = NULL,
+};
+
 static int knitx_rfree(struct knit *knit, void *p) {
-    (void) knit;
     KMEMSTAT_FREE(knit, ptr_wrap_get_sz(p));
-    free(ptr_unwrap(p));
+    knit->allocator.free(knit->allocator.ud, ptr_unwrap(p));
     return KNIT_OK;
 }
 static int knitx_rmalloc(struct knit *knit, size_t sz, void **m) {
     KMEMSTAT_ALLOC(knit, sz);
+    KALLOC_SAMPLE(knit, sz);
     knit_assert_h(sz, "knit_malloc(): 0 size passed");
-    void *p = malloc(ptr_wrap_needed_sz(sz));
+    void *p = knit->allocator.alloc(knit->allocator.ud, ptr_wrap_needed_sz(sz));
     *m = NULL;
     if (!p)
         return knit_error(knit, KNIT_NOMEM, "knitx_malloc(): malloc() returned NULL");
@@ -80,12 +103,15 @@ static int knitx_rmalloc(struct knit *knit, size_t sz, void **m) {
 }
 static int knitx_rrealloc(struct knit *knit, void *p, size_t sz, void **m) {
     KMEMSTAT_REALLOC(knit, ptr_wrap_get_sz(p), sz);
+    //the previous size is only known with KNIT_MEM_STATS, otherwise the whole new size counts
+    if (sz > ptr_wrap_get_sz(p))
+        KALLOC_SAMPLE(knit, sz - ptr_wrap_get_sz(p));
     if (!sz) {
         int rv = knitx_rfree(knit, p);
         *m = NULL;
         return rv;
     }
-    void *np = realloc(ptr_unwrap(p), ptr_wrap_needed_sz(sz));
+    void *np = knit->allocator.realloc(knit->allocator.ud, ptr_unwrap(p), ptr_wrap_needed_sz(sz));
     if (!np) {
         return knit_error(knit, KNIT_NOMEM, "knitx_realloc(): realloc() returned NULL");
     }
@@ -42,6 +42,8 @@ int knitx_list_append(struct knit *kstate) {
     }
     struct knit_list *self_l = (struct knit_list *) self;
     rv = knitx_list_push(kstate, self_l, pushed);
+    if (rv != KNIT_OK)
+        return rv;
 
     knitx_creturns(kstate, 0);
     return KNIT_OK;
@@ -177,15 +179,40 @@ static int knitxr_gcwalk(struct knit *kstate) {
     if (nargs != 0) { 
         return knit_error(kstate, KNIT_NARGS, "knitxr_walk() was called with a wrong number of arguments, expecting 0 arguments");
     }
-    knit_gc_cycle(kstate);
+    knit_gc_cycle(kstate, KNIT_GC_TRIGGER_EXPLICIT);
 
     knitx_creturns(kstate, 0);
     return KNIT_OK;
 }
-static int knitxr_meminfo(struct knit *kstate) {
+static int knitxr_gccompact(struct knit *kstate) {
     int nargs = knitx_nargs(kstate);
     if (nargs != 0) { 
-        return knit_error(kstate, KNIT_NARGS, "knitxr_meminfo(obj) was called with a wrong number of arguments, expecting 0 arguments");
+        return knit_error(kstate, KNIT_NARGS, "knitxr_gccompact() was called with a wrong number of arguments, expecting 0 arguments");
+    }
+    int rv = knit_gc_compact(kstate);
+    if (rv != KNIT_OK)
+        return rv;
+
+    knitx_creturns(kstate, 0);
+    return KNIT_OK;
+}
+//meminfo(path) also writes a json heap snapshot to path
+static int knitxr_meminfo(struct knit *kstate) {
+    int nargs = knitx_nargs(kstate);
+    if (nargs > 1) { 
+        return knit_error(kstate, KNIT_NARGS, "knitxr_meminfo(obj) was called with a wrong number of arguments, expecting 0 or 1 arguments");
+    }
+    if (nargs == 1) {
+        struct knit_obj *path = NULL;
+        int rv = knitx_get_arg(kstate, 0, &path); 
+        if (rv != KNIT_OK) 
+            return rv;
+        if (path->u.ktype != KNIT_STR) {
+            return knit_error(kstate, KNIT_INVALID_TYPE_ERR, "knitxr_meminfo(path) was called with an unexpected type, expecting str");
+        }
+        rv = knitx_heap_snapshot(kstate, path->u.str.str);
+        if (rv != KNIT_OK)
+            return rv;
     }
     printf("hey\n");
     #ifdef KNIT_MEM_STATS
@@ -195,6 +222,249 @@ static int knitxr_meminfo(struct knit *kstate) {
     return KNIT_OK;
 }
 
+static int knitxr_gcstats_set(struct knit *kstate, struct knit_dict *dict, const char *key, uint64_t value) {
+    struct knit_str *key_str = NULL;
+    struct knit_int *value_int = NULL;
+    int rv = knitx_str_new_strcpy_gcobj(kstate, &key_str, key);
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_int_new_gcobj(kstate, &value_int, value > INT_MAX ? INT_MAX : (int) value);
+    if (rv != KNIT_OK)
+        return rv;
+    return knitx_dict_set(kstate, dict, ktobj(key_str), ktobj(value_int));
+}
+//returns a dict of gc counters, times are in microseconds since knit ints are too small for nanoseconds
+static int knitxr_gcstats(struct knit *kstate) {
+    int nargs = knitx_nargs(kstate);
+    if (nargs != 0) { 
+        return knit_error(kstate, KNIT_NARGS, "knitxr_gcstats() was called with a wrong number of arguments, expecting 0 arguments");
+    }
+    const struct knit_gc_stats *st = knitx_gc_stats(kstate);
+    uint64_t elapsed_ns = knit_gc_stats_elapsed_ns(st->start_ns, knit_gc_stats_now_ns());
+    struct knit_dict *dict = NULL;
+    int rv = knitx_dict_new_gcobj(kstate, &dict, 16);
+    if (rv != KNIT_OK)
+        return rv;
+    struct { const char *key; uint64_t value; } entries[] = {
+        {"cycles",      st->ncycles},
+        {"explicit",    st->ncycles_by_trigger[KNIT_GC_TRIGGER_EXPLICIT]},
+        {"zct",         st->ncycles_by_trigger[KNIT_GC_TRIGGER_ZCT]},
+        {"compact",     st->ncycles_by_trigger[KNIT_GC_TRIGGER_COMPACT]},
+        {"arena",       st->ncycles_by_trigger[KNIT_GC_TRIGGER_ARENA]},
+        {"freed",       st->total_freed},
+        {"bytes_freed", st->total_bytes_freed},
+        {"p50_us",      knit_gc_stats_pause_percentile(st, 50) / 1000},
+        {"p99_us",      knit_gc_stats_pause_percentile(st, 99) / 1000},
+        {"max_us",      st->max_pause_ns / 1000},
+        {"gc_us",       st->total_pause_ns / 1000},
+        {"elapsed_us",  elapsed_ns / 1000},
+    };
+    for (int i=0; i < (int) (sizeof entries / sizeof entries[0]); i++) {
+        rv = knitxr_gcstats_set(kstate, dict, entries[i].key, entries[i].value);
+        if (rv != KNIT_OK)
+            return rv;
+    }
+    knitx_stack_rpush(kstate, &kstate->ex.stack, ktobj(dict));
+    knitx_creturns(kstate, 1);
+    return KNIT_OK;
+}
+
+//the dict of the modules an instance imported, by path. it's a global so that the gc, knitx_clone() and images see it
+static int knitxr_import_registry(struct knit *kstate, struct knit_dict **registryp) {
+    struct knit_str name;
+    int rv = knitx_str_init_const_str(kstate, &name, "__modules__");
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_vars_jadwal_iter iter;
+    if (knit_vars_jadwal_find(&kstate->ex.global_ht, &name, &iter) == KNIT_VARS_JADWAL_OK && iter.pair->value->u.ktype == KNIT_DICT) {
+        *registryp = &iter.pair->value->u.dict;
+        return KNIT_OK;
+    }
+    struct knit_dict *registry = NULL;
+    rv = knitx_dict_new_gcobj(kstate, &registry, 8);
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_do_global_assign(kstate, NULL, &name, ktobj(registry));
+    *registryp = registry;
+    return rv;
+}
+//the module's blocks find dict in exs->modules, it's a root of the gc like a global
+static int knitxr_import_bind(struct knit *kstate, int id, struct knit_dict *dict) {
+    struct knit_objp_darray *modules = &kstate->ex.modules;
+    struct knit_obj *none = NULL;
+    while (modules->len <= id) {
+        if (knit_objp_darray_push(modules, &none) != KNIT_OBJP_DARRAY_OK)
+            return knit_error(kstate, KNIT_NOMEM, "import(): couldn't add a module");
+    }
+    knitx_obj_incref(kstate, ktobj(dict));
+    if (modules->data[id])
+        knitx_obj_decref(kstate, modules->data[id]);
+    modules->data[id] = ktobj(dict);
+    return KNIT_OK;
+}
+/*
+    import(path) runs the script in path once per instance and returns its module: the dict of its globals.
+    each module has globals of its own, its code (and its functions, wherever they're called from) assigns and looks up names there,
+    a name it never assigned is looked up in the instance's globals, that's where the builtins are.
+    changing the dict changes the module's globals. exs->modules finds it by the module id of the running block.
+    a module that's being imported (an import cycle) is returned as it is so far.
+    it's compiled once per process and shared by the instances that import it, see knit_module.h
+*/
+static int knitxr_import(struct knit *kstate) {
+    int nargs = knitx_nargs(kstate);
+    if (nargs != 1) {
+        return knit_error(kstate, KNIT_NARGS, "import() was called with a wrong number of arguments, expecting 1 argument");
+    }
+    struct knit_obj *path = NULL;
+    int rv = knitx_get_arg(kstate, 0, &path);
+    if (rv != KNIT_OK)
+        return rv;
+    if (path->u.ktype != KNIT_STR) {
+        return knit_error(kstate, KNIT_INVALID_TYPE_ERR, "import(path) was called with an unexpected type, expecting str");
+    }
+    struct knit_dict *registry = NULL;
+    rv = knitxr_import_registry(kstate, &registry);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_obj *module = NULL;
+    if (knitx_dict_lookup(kstate, registry, path, &module) == KNIT_OK) {
+        knitx_stack_rpush(kstate, &kstate->ex.stack, module);
+        knitx_creturns(kstate, 1);
+        return KNIT_OK;
+    }
+
+    struct knit_program *prog = NULL;
+    rv = knit_module_load(kstate, path->u.str.str, &prog);
+    if (rv != KNIT_OK)
+        return rv;
+    struct knit_dict *dict = NULL;
+    rv = knitx_dict_new_gcobj(kstate, &dict, 8);
+    if (rv == KNIT_OK)
+        rv = knitx_dict_set(kstate, registry, path, ktobj(dict));
+    if (rv == KNIT_OK)
+        rv = knitxr_import_bind(kstate, prog->block->module, dict);
+    if (rv == KNIT_OK)
+        rv = knitx_stack_rpush(kstate, &kstate->ex.stack, ktobj(dict));
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_block_exec(kstate, prog->block, 0, 0);
+    if (rv != KNIT_OK)
+        return rv;
+    knitx_creturns(kstate, 1); //the module is on top again
+    return KNIT_OK;
+}
+
+//the channel is the first argument of send(), recv(), trysend() and tryrecv(), see knit_channel.h
+static int knitxr_channel_arg(struct knit *kstate, const char *fname, int nargs, struct knit_obj **chp) {
+    if (knitx_nargs(kstate) != nargs) {
+        return knit_error(kstate, KNIT_NARGS, "%s() was called with a wrong number of arguments, expecting %d", fname, nargs);
+    }
+    int rv = knitx_get_arg(kstate, 0, chp);
+    if (rv != KNIT_OK)
+        return rv;
+    if ((*chp)->u.ktype != KNIT_CHANNEL) {
+        return knit_error(kstate, KNIT_INVALID_TYPE_ERR, "%s(ch, ...) was called with an unexpected type, expecting a channel", fname);
+    }
+#ifndef KNIT_HAVE_PTHREADS
+    return knit_error(kstate, KNIT_RUNTIME_ERR, "%s(): channels need pthreads", fname);
+#endif
+    return KNIT_OK;
+}
+static int knitxr_send_(struct knit *kstate, const char *fname, int block) {
+    struct knit_obj *ch = NULL;
+    struct knit_obj *value = NULL;
+    int rv = knitxr_channel_arg(kstate, fname, 2, &ch);
+    if (rv != KNIT_OK)
+        return rv;
+    if ((rv = knitx_get_arg(kstate, 1, &value)) != KNIT_OK)
+        return rv;
+    int sent = 0;
+#ifdef KNIT_HAVE_PTHREADS
+    if ((rv = knit_channel_send(kstate, (struct knit_channel *) ch, value, block, &sent)) != KNIT_OK)
+        return rv;
+#endif
+    if (block) {
+        knitx_creturns(kstate, 0);
+        return KNIT_OK;
+    }
+    knitx_stack_rpush(kstate, &kstate->ex.stack, sent ? ktobj(&ktrue) : ktobj(&kfalse));
+    knitx_creturns(kstate, 1);
+    return KNIT_OK;
+}
+static int knitxr_recv_(struct knit *kstate, const char *fname, int block) {
+    struct knit_obj *ch = NULL;
+    struct knit_obj *value = ktobj(&knull);
+    int rv = knitxr_channel_arg(kstate, fname, 1, &ch);
+    if (rv != KNIT_OK)
+        return rv;
+#ifdef KNIT_HAVE_PTHREADS
+    if ((rv = knit_channel_recv(kstate, (struct knit_channel *) ch, block, &value)) != KNIT_OK)
+        return rv;
+#endif
+    rv = knitx_stack_rpush(kstate, &kstate->ex.stack, value);
+    if (rv != KNIT_OK)
+        return rv;
+    knitx_creturns(kstate, 1);
+    return KNIT_OK;
+}
+//send(ch, value) waits for room, trysend(ch, value) returns false when the channel is full
+static int knitxr_send(struct knit *kstate) {
+    return knitxr_send_(kstate, "send", 1);
+}
+static int knitxr_trysend(struct knit *kstate) {
+    return knitxr_send_(kstate, "trysend", 0);
+}
+//recv(ch) waits for a value, tryrecv(ch) returns null when the channel is empty. both return null once a closed channel is empty
+static int knitxr_recv(struct knit *kstate) {
+    return knitxr_recv_(kstate, "recv", 1);
+}
+static int knitxr_tryrecv(struct knit *kstate) {
+    return knitxr_recv_(kstate, "tryrecv", 0);
+}
+
+//the generator is the only argument of next() and done(), see knit_generator.h
+static int knitxr_generator_arg(struct knit *kstate, const char *fname, struct knit_gen **genp) {
+    struct knit_obj *obj = NULL;
+    if (knitx_nargs(kstate) != 1) {
+        return knit_error(kstate, KNIT_NARGS, "%s() was called with a wrong number of arguments, expecting 1", fname);
+    }
+    int rv = knitx_get_arg(kstate, 0, &obj);
+    if (rv != KNIT_OK)
+        return rv;
+    if (obj->u.ktype != KNIT_GENERATOR) {
+        return knit_error(kstate, KNIT_INVALID_TYPE_ERR, "%s(g) was called with an unexpected type, expecting a generator", fname);
+    }
+    *genp = obj->u.generator.gen;
+    return KNIT_OK;
+}
+//next(g) runs g until its next yield and returns the yielded value, null once it returned
+static int knitxr_next(struct knit *kstate) {
+    struct knit_gen *gen = NULL;
+    struct knit_obj *value = NULL;
+    int rv = knitxr_generator_arg(kstate, "next", &gen);
+    if (rv != KNIT_OK)
+        return rv;
+    if ((rv = knitx_gen_resume(kstate, gen, &value)) != KNIT_OK)
+        return rv;
+    rv = knitx_stack_rpush(kstate, &kstate->ex.stack, value);
+    if (rv != KNIT_OK)
+        return rv;
+    knitx_creturns(kstate, 1);
+    return KNIT_OK;
+}
+//done(g) is true once g returned, a loop calls next() and then checks it
+static int knitxr_done(struct knit *kstate) {
+    struct knit_gen *gen = NULL;
+    int rv = knitxr_generator_arg(kstate, "done", &gen);
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_stack_rpush(kstate, &kstate->ex.stack, gen->state == KNIT_GEN_DONE ? ktobj(&ktrue) : ktobj(&kfalse));
+    if (rv != KNIT_OK)
+        return rv;
+    knitx_creturns(kstate, 1);
+    return KNIT_OK;
+}
+
 const struct knit_builtins kbuiltins = {
     .kstr = {
         .strip = {
@@ -233,9 +503,45 @@ const struct knit_builtins kbuiltins = {
             .ktype = KNIT_CFUNC,
             .fptr = knitxr_gcwalk,
         },
+        .gccompact = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_gccompact,
+        },
         .meminfo = {
             .ktype = KNIT_CFUNC,
             .fptr = knitxr_meminfo,
+        },
+        .gcstats = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_gcstats,
+        },
+        .import = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_import,
+        },
+        .send = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_send,
+        },
+        .recv = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_recv,
+        },
+        .trysend = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_trysend,
+        },
+        .tryrecv = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_tryrecv,
+        },
+        .next = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_next,
+        },
+        .done = {
+            .ktype = KNIT_CFUNC,
+            .fptr = knitxr_done,
         }
     }
 };
@@ -248,11 +554,15 @@ static int knitx_register_cfunction(struct knit *kstate, const char *funcname, k
     struct knit_cfunc *func = p;
     func->ktype = KNIT_CFUNC;
     func->fptr = cfunc;
+    if ((rv = knitx_own_object(kstate, ktobj(func))) != KNIT_OK) {
+        knitx_tfree(kstate, func);
+        return rv;
+    }
     struct knit_str funcname_str;
     rv = knitx_str_init_const_str(kstate, &funcname_str, funcname); 
     if (rv != KNIT_OK)
         return rv;
-    rv = knitx_do_global_assign(kstate, &funcname_str, ktobj(func));
+    rv = knitx_do_global_assign(kstate, NULL, &funcname_str, ktobj(func));
     return rv;
 }
 
@@ -261,7 +571,7 @@ static int knitx_register_constcfunction(struct knit *kstate, const char *funcna
     int rv = knitx_str_init_const_str(kstate, &funcname_str, funcname); 
     if (rv != KNIT_OK)
         return rv;
-    rv = knitx_do_global_assign(kstate, &funcname_str, ktobj(func)); 
+    rv = knitx_do_global_assign(kstate, NULL, &funcname_str, ktobj(func)); 
     if (rv != KNIT_OK)
         return rv;
     return KNIT_OK;
@@ -284,9 +594,36 @@ static int knitxr_register_stdlib(struct knit *kstate) {
     if (rv != KNIT_OK)
         return rv;
     rv = knitx_register_constcfunction(kstate, "gcwalk", &kbuiltins.funcs.gcwalk); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "gccompact", &kbuiltins.funcs.gccompact); 
     if (rv != KNIT_OK)
         return rv;
     rv = knitx_register_constcfunction(kstate, "meminfo", &kbuiltins.funcs.meminfo); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "gcstats", &kbuiltins.funcs.gcstats); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "import", &kbuiltins.funcs.import); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "send", &kbuiltins.funcs.send); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "recv", &kbuiltins.funcs.recv); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "trysend", &kbuiltins.funcs.trysend); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "tryrecv", &kbuiltins.funcs.tryrecv); 
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "next", &kbuiltins.funcs.next);
+    if (rv != KNIT_OK)
+        return rv;
+    rv = knitx_register_constcfunction(kstate, "done", &kbuiltins.funcs.done);
     if (rv != KNIT_OK)
         return rv;
     return KNIT_OK;
@@ -8,19 +8,36 @@
     #include <unistd.h>
     #define KNIT_HAVE_ISATTY
 #endif
+#if defined(__linux__) || defined(__APPLE__)
+    #include <errno.h>
+    #include <sys/stat.h>
+    #define KNIT_HAVE_MKDIR
+#endif
 
 static struct knopts {
     int verbose;
     int interactive;
     char *infile;
+    long alloc_sample_interval; //0 if -A wasn't passed
+    int request_arena_cells; //0 if -R wasn't passed
+    char *save_image; //written when the program ends
+    char *load_image; //used instead of registering the stdlib
+    int no_cache; //-B, don't use __knitcache__
 } knopts = {0};
 
+static void idie(const char *fmt, ...); //fwd
+
 static void help(char *progname) {
     fprintf(stderr, "./%s OPTION [ file ]\n"
             "-f     : input file\n"
             "-v     : verbose\n"
             "-i     : interactive\n"
-            "-h     : help\n", progname == NULL ? "knit" : progname);
+            "-A[N]  : sample allocations every N bytes (default %d), the folded stacks are written to stderr at exit\n"
+            "-B     : don't read or write compiled files in __knitcache__\n"
+            "-R[N]  : allocate the objects of each execution from an arena of N cells per class (default %d)\n"
+            "--save-image FILE : write the heap and globals to FILE when the program ends\n"
+            "--load-image FILE : start from an image written with --save-image\n"
+            "-h     : help\n", progname == NULL ? "knit" : progname, KNIT_ALLOC_SAMPLE_DEFAULT_INTERVAL, KNIT_REQUEST_ARENA_DEFAULT_CELLS);
     exit(0);
 }
 
@@ -33,9 +50,37 @@ static void parse_argv(char *argv[], int argc) {
         else if (strcmp(argv[i], "-i") == 0) {
             knopts.interactive = 1;
         }
+        else if (strcmp(argv[i], "-B") == 0) {
+            knopts.no_cache = 1;
+        }
         else if (strcmp(argv[i], "-h") == 0) {
             help(argv[0]);
         }
+        else if (strncmp(argv[i], "-A", 2) == 0) {
+            knopts.alloc_sample_interval = KNIT_ALLOC_SAMPLE_DEFAULT_INTERVAL;
+            if (strlen(argv[i]) > 2) {
+                knopts.alloc_sample_interval = atol(argv[i] + 2);
+                if (knopts.alloc_sample_interval <= 0)
+                    idie("invalid sampling interval: '%s'", argv[i] + 2);
+            }
+        }
+        else if (strncmp(argv[i], "-R", 2) == 0) {
+            knopts.request_arena_cells = KNIT_REQUEST_ARENA_DEFAULT_CELLS;
+            if (strlen(argv[i]) > 2) {
+                knopts.request_arena_cells = atoi(argv[i] + 2);
+                if (knopts.request_arena_cells <= 0)
+                    idie("invalid arena size: '%s'", argv[i] + 2);
+            }
+        }
+        else if (strcmp(argv[i], "--save-image") == 0 || strcmp(argv[i], "--load-image") == 0) {
+            if (argc <= i + 1)
+                idie("%s needs a file", argv[i]);
+            if (argv[i][2] == 's')
+                knopts.save_image = argv[i+1];
+            else
+                knopts.load_image = argv[i+1];
+            i++;
+        }
         else if (strncmp(argv[i], "-f", 2) == 0) {
             if (strlen(argv[i]) > 2) {
                 knopts.infile = argv[i] + 2;
@@ -79,10 +124,35 @@ char *readordie(const char *filename) {
     return m;
 }
 
+static void setup(struct knit *knit) {
+    if (knopts.load_image) {
+        knitx_load_image(knit, KNIT_POLICY_EXIT, knopts.load_image);
+    }
+    else {
+        knitx_init(knit, KNIT_POLICY_EXIT);
+        knitxr_register_stdlib(knit);
+    }
+    if (knopts.alloc_sample_interval)
+        knitx_alloc_sampling(knit, knopts.alloc_sample_interval);
+    if (knopts.request_arena_cells)
+        knitx_request_arena(knit, knopts.request_arena_cells);
+}
+static void teardown(struct knit *knit) {
+#ifdef KNIT_DEBUG_PRINT
+    if (KNIT_DBG_PRINT) {
+        knitx_globals_dump(knit);
+    }
+#endif
+    if (knopts.save_image)
+        knitx_save_image(knit, knopts.save_image);
+    if (knopts.alloc_sample_interval)
+        knitx_alloc_sample_report(knit, stderr);
+    knitx_deinit(knit);
+}
+
 void interactive(const char *n) {
     struct knit knit;
-    knitx_init(&knit, KNIT_POLICY_EXIT);
-    knitxr_register_stdlib(&knit);
+    setup(&knit);
 
 
 #define BBUFFSZ 4096
@@ -132,31 +202,52 @@ void interactive(const char *n) {
     }
 #undef BBUFFSZ 
 
-#ifdef KNIT_DEBUG_PRINT
-    if (KNIT_DBG_PRINT) {
-        knitx_globals_dump(&knit);
-    }
-#endif
-    knitx_deinit(&knit);
+    teardown(&knit);
 }
 
 void read_stdin(const char *n) {
     interactive(n);
 }
 
+//like __pycache__, the bytecode of dir/name.kn is kept in dir/__knitcache__/name.knb. NULL when there is no cache
+static char *cache_path(const char *filename) {
+#ifdef KNIT_HAVE_MKDIR
+    const char *slash = strrchr(filename, '/');
+    const char *name = slash ? slash + 1 : filename;
+    int dirlen = name - filename;
+    int namelen = strlen(name);
+    if (namelen > 3 && strcmp(name + namelen - 3, ".kn") == 0)
+        namelen -= 3;
+    char *path = malloc(dirlen + namelen + sizeof "__knitcache__/" + sizeof ".knb");
+    if (!path)
+        return NULL;
+    sprintf(path, "%.*s__knitcache__", dirlen, filename);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        free(path);
+        return NULL;
+    }
+    sprintf(path + strlen(path), "/%.*s.knb", namelen, name);
+    return path;
+#else
+    return NULL;
+#endif
+}
+
 void exec_file(const char *filename) {
     struct knit knit;
-    knitx_init(&knit, KNIT_POLICY_EXIT);
-    knitxr_register_stdlib(&knit);
-    char *buf = readordie(filename);
-    knitx_exec_str(&knit, buf);
-    free(buf);
-#ifdef KNIT_DEBUG_PRINT
-    if (KNIT_DBG_PRINT) {
-        knitx_globals_dump(&knit);
+    setup(&knit);
+    char *cache = knopts.no_cache ? NULL : cache_path(filename);
+    if (knitx_exec_file(&knit, filename, cache) == KNIT_NOT_FOUND && knit.err == KNIT_OK) {
+        //empty, or it can't be mapped
+        char *buf = readordie(filename);
+        if (cache)
+            knitx_exec_cached(&knit, buf, cache);
+        else
+            knitx_exec_str(&knit, buf);
+        free(buf);
     }
-#endif
-    knitx_deinit(&knit);
+    free(cache);
+    teardown(&knit);
 }
 int main(int argc, char **argv) {
     void (*func)(const char *) = interactive;
@@ -13,6 +13,7 @@ static struct knopts {
     int all;
     int verbose;
     int testno;
+    const char *api_test; //a C API test's name
     char *infile;
 } knopts = {0};
 static void parse_argv(char *argv[], int argc) {
@@ -25,6 +26,10 @@ static void parse_argv(char *argv[], int argc) {
             knopts.all = 0;
             knopts.testno = atoi(argv[i]);
         }
+        else if (argv[i][0] >= 'a' && argv[i][0] <= 'z') {
+            knopts.all = 0;
+            knopts.api_test = argv[i];
+        }
         else {
             fprintf(stderr, "unknown arg: '%s'\n", argv[i]);
         }
@@ -223,6 +228,1261 @@ void exec_file(const char *a) {
     generic_file_test(knopts.infile);
 }
 
+/*
+    C API tests: they check what they expect and stop the test run when it isn't
+*/
+static void expect_int(struct knit *knit, const char *name, int value) {
+    struct knit_obj *obj = NULL;
+    int rv = knitx_getvar_(knit, name, &obj);
+    knit_assert_h(rv == KNIT_OK, "'%s' isn't defined", name);
+    knit_assert_h(obj->u.ktype == KNIT_INT && obj->u.integer.value == value, "expected '%s' to be %d", name, value);
+}
+
+#ifdef KNIT_HAVE_PTHREADS
+//a failed job is reported and its worker gets a new instance, the next job on it runs normally
+void test_executor_errors(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_EXIT);
+    struct knit_program *prelude = NULL;
+    int rv = knitx_program_compile(&knit, "f = function(a) { return a + 'x' }\n"
+                                          "ok = function(a) { return a * 2 }\n"
+                                          "get = function() { return count }\n"
+                                          "count = 0\n", &prelude);
+    knit_assert_h(rv == KNIT_OK, "compiling the prelude failed");
+    struct knit_executor ex;
+    rv = knitx_executor_init(&ex, 1, prelude, 8);
+    knit_assert_h(rv == KNIT_OK, "starting the executor failed");
+
+    struct knit_value arg = {.ktype = KNIT_INT, .integer = 21};
+    struct knit_job bad = {.func = "f", .args = &arg, .nargs = 1};
+    knitx_executor_submit(&ex, &bad);
+    knit_assert_h(knitx_job_wait(&ex, &bad) == KNIT_RUNTIME_ERR, "adding an int and a str didn't fail the job");
+    knit_assert_h(bad.err_msg && strstr(bad.err_msg, "unsupported types"), "the failed job has no error message");
+    knitx_job_deinit(&bad);
+
+    struct knit_job script = {.script = "count = count + 1\nx = [1] * 'y'\n"};
+    knitx_executor_submit(&ex, &script);
+    knit_assert_h(knitx_job_wait(&ex, &script) != KNIT_OK, "a failing script succeeded");
+    knitx_job_deinit(&script);
+
+    struct knit_job undefined = {.script = "y = undefined_var\n"};
+    knitx_executor_submit(&ex, &undefined);
+    knit_assert_h(knitx_job_wait(&ex, &undefined) != KNIT_OK, "reading an undefined variable succeeded");
+    knitx_job_deinit(&undefined);
+
+    struct knit_job good = {.func = "ok", .args = &arg, .nargs = 1};
+    knitx_executor_submit(&ex, &good);
+    rv = knitx_job_wait(&ex, &good);
+    knit_assert_h(rv == KNIT_OK, "a job after a failed one failed: %s", good.err_msg ? good.err_msg : "");
+    knit_assert_h(good.result.ktype == KNIT_INT && good.result.integer == 42, "wrong result after a failed job");
+    knitx_job_deinit(&good);
+
+    //the failed script's instance was thrown away with what it did
+    struct knit_job check = {.func = "get"};
+    knitx_executor_submit(&ex, &check);
+    knit_assert_h(knitx_job_wait(&ex, &check) == KNIT_OK, "reading count failed");
+    knit_assert_h(check.result.ktype == KNIT_INT && check.result.integer == 0, "the worker wasn't rebuilt after a failed job");
+    knitx_job_deinit(&check);
+
+    knitx_executor_deinit(&ex);
+    knitx_program_free(prelude);
+
+    //the prelude imports a module that stops compiling, so the instance can't be made again after a failed job
+    const char *path = "t_exec_prelude.kn";
+    FILE *f = fopen(path, "w");
+    knit_assert_h(f != NULL, "couldn't write '%s'", path);
+    fputs("value = 5\n", f);
+    fclose(f);
+    rv = knitx_program_compile(&knit, "m = import('t_exec_prelude.kn')\n"
+                                      "ok = function(a) { return a * m['value'] }\n"
+                                      "f = function(a) { return a + 'x' }\n", &prelude);
+    knit_assert_h(rv == KNIT_OK, "compiling the prelude failed");
+    rv = knitx_executor_init(&ex, 1, prelude, 8);
+    knit_assert_h(rv == KNIT_OK, "starting the executor failed");
+    f = fopen(path, "w");
+    knit_assert_h(f != NULL, "couldn't write '%s'", path);
+    fputs("value = ((\n", f);
+    fclose(f);
+    struct knit_job fails = {.func = "f", .args = &arg, .nargs = 1};
+    knitx_executor_submit(&ex, &fails);
+    knit_assert_h(knitx_job_wait(&ex, &fails) != KNIT_OK, "adding an int and a str didn't fail the job");
+    knitx_job_deinit(&fails);
+    for (int i=0; i<2; i++) {
+        struct knit_job after = {.func = "ok", .args = &arg, .nargs = 1};
+        knitx_executor_submit(&ex, &after);
+        rv = knitx_job_wait(&ex, &after);
+        knit_assert_h(rv != KNIT_OK && after.err_msg && strstr(after.err_msg, "import()"),
+                      "a job ran on a worker whose prelude failed: %s", after.err_msg ? after.err_msg : "");
+        knitx_job_deinit(&after);
+    }
+    knitx_executor_deinit(&ex);
+    knitx_program_free(prelude);
+    knitx_module_cache_clear();
+    remove(path);
+    knitx_deinit(&knit);
+}
+
+struct channel_end {
+    struct knit knit;
+    const char *script;
+    pthread_t thread;
+};
+static void *channel_end_run(void *arg) {
+    struct channel_end *end = arg;
+    knitx_exec_str(&end->knit, end->script);
+    return NULL;
+}
+static void channel_end_init(struct channel_end *end, struct knit_channel *ch, struct knit_frozen *frozen, const char *script) {
+    knitx_init(&end->knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&end->knit);
+    knitx_channel_publish(&end->knit, "ch", ch);
+    if (frozen)
+        knitx_frozen_publish(&end->knit, "fz", frozen);
+    end->script = script;
+}
+
+//a producer thread sends lists and dicts that share and reference themselves and a frozen list, the consumer thread
+//receives until the channel is closed. trysend() and tryrecv() don't wait on a full or empty channel
+void test_channel(void) {
+    struct knit owner;
+    knitx_init(&owner, KNIT_POLICY_CONTINUE);
+    knitx_exec_str(&owner, "fz = [10, 20]\n");
+    struct knit_frozen *frozen = NULL;
+    knit_assert_h(knitx_freeze(&owner, "fz", &frozen) == KNIT_OK, "freezing failed");
+
+    struct knit_channel ch;
+    knit_assert_h(knitx_channel_init(&ch, 8) == KNIT_OK, "making the channel failed");
+    struct channel_end producer, consumer;
+    channel_end_init(&producer, &ch, frozen,
+        "for (i=0; i<100; i=i+1) {\n"
+        "    shared = [i]\n"
+        "    cyc = {'n' : i}\n"
+        "    cyc['self'] = cyc\n"
+        "    l = [shared, shared, cyc]\n"
+        "    l.append(l)\n"
+        "    send(ch, l)\n"
+        "}\n"
+        "send(ch, fz)\n");
+    channel_end_init(&consumer, &ch, NULL,
+        "check = function(m) {\n"
+        "    if (len(m) == 4) {\n"
+        "        m[0].append(1)\n"
+        "        return len(m[1]) + m[2]['self']['self']['n'] + len(m[3][3][3])\n"
+        "    }\n"
+        "    return m[0] + m[1]\n"
+        "}\n"
+        "n = 0\n"
+        "total = 0\n"
+        "m = recv(ch)\n"
+        "while (m) {\n"
+        "    n = n + 1\n"
+        "    total = total + check(m)\n"
+        "    gccompact()\n"
+        "    m = recv(ch)\n"
+        "}\n");
+    knit_assert_h(pthread_create(&consumer.thread, NULL, channel_end_run, &consumer) == 0, "starting the consumer failed");
+    knit_assert_h(pthread_create(&producer.thread, NULL, channel_end_run, &producer) == 0, "starting the producer failed");
+    pthread_join(producer.thread, NULL);
+    knitx_channel_close(&ch);
+    pthread_join(consumer.thread, NULL);
+    knit_assert_h(producer.knit.err == KNIT_OK, "the producer failed: %s", producer.knit.err_msg);
+    knit_assert_h(consumer.knit.err == KNIT_OK, "the consumer failed: %s", consumer.knit.err_msg);
+    expect_int(&consumer.knit, "n", 101);
+    expect_int(&consumer.knit, "total", 100 * 6 + 99 * 100 / 2 + 30);
+
+    struct knit_channel small;
+    knit_assert_h(knitx_channel_init(&small, 4) == KNIT_OK, "making the channel failed");
+    struct channel_end both;
+    channel_end_init(&both, &small, NULL,
+        "isnull = function(v) { if (v) { return 0 } return 1 }\n"
+        "empty = isnull(tryrecv(ch))\n"
+        "sent = 0\n"
+        "while (trysend(ch, [sent])) { sent = sent + 1 }\n"
+        "got = 0\n"
+        "v = tryrecv(ch)\n"
+        "while (v) {\n"
+        "    got = got + v[0] + 1\n"
+        "    v = tryrecv(ch)\n"
+        "}\n");
+    channel_end_run(&both);
+    knit_assert_h(both.knit.err == KNIT_OK, "trysend() or tryrecv() failed: %s", both.knit.err_msg);
+    expect_int(&both.knit, "empty", 1);
+    expect_int(&both.knit, "sent", 4);
+    expect_int(&both.knit, "got", 1 + 2 + 3 + 4);
+
+    knitx_deinit(&both.knit);
+    knitx_deinit(&consumer.knit);
+    knitx_deinit(&producer.knit);
+    knitx_deinit(&owner);
+    knitx_channel_deinit(&small);
+    knitx_channel_deinit(&ch);
+    knitx_frozen_free(frozen);
+}
+#endif
+
+//a loop, calls and a generator run in slices, the instance can run other code while it's suspended
+void test_budget(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    struct knit_program *prog = NULL;
+    int rv = knitx_program_compile(&knit,
+        "fib = function(n) { if (n < 2) { return n } return fib(n-1) + fib(n-2) }\n"
+        "count = function(n) { for (i=0; i<n; i=i+1) { yield i } }\n"
+        "s = 0\n"
+        "for (i=0; i<3000; i=i+1) { s = s + i\n l = [i, {'a': i}] }\n"
+        "gen = count(500)\n"
+        "x = next(gen)\n"
+        "while (!done(gen)) { s = s + x\n x = next(gen) }\n"
+        "f = fib(15)\n"
+        "result = s + f\n", &prog);
+    knit_assert_h(rv == KNIT_OK, "compiling the program failed");
+
+    int nsuspended = 0;
+    rv = knitx_exec_program_budget(&knit, prog, 100);
+    while (rv == KNIT_SUSPENDED) {
+        nsuspended++;
+        if (nsuspended == 5) {
+            rv = knitx_exec_str(&knit, "side = 7\n");
+            knit_assert_h(rv == KNIT_OK && knit.err == KNIT_OK, "running a script while suspended failed");
+            expect_int(&knit, "side", 7);
+        }
+        rv = knitx_resume(&knit, 500);
+    }
+    knit_assert_h(rv == KNIT_OK && knit.err == KNIT_OK, "the budgeted execution failed");
+    knit_assert_h(nsuspended > 1, "the execution was suspended %d times", nsuspended);
+    expect_int(&knit, "f", 610);
+    expect_int(&knit, "result", 3000 * 2999 / 2 + 500 * 499 / 2 + 610);
+    knit_assert_h(knit.ex.stack.frames.len == 0 && knit.ex.stack.vals.len == 0, "the stacks aren't empty after the execution");
+    knitx_deinit(&knit);
+    knitx_program_free(prog);
+}
+
+//a frozen dict and the lists in it are read through a global published to another instance, collections leave them
+//alone and changing them is an error
+void test_freeze(void) {
+    static const char *changes[] = {"table['name'] = 'x'\n", "table['xs'][0] = 5\n", "table['xs'].append(4)\n"};
+    struct knit knit, reader;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knitx_exec_str(&knit, "inner = [1, 2, 3]\n"
+                          "table = {'xs' : inner, 'name' : 'abc', 'more' : {'n' : 40, 'xs' : inner}}\n");
+    struct knit_frozen *frozen = NULL;
+    int rv = knitx_freeze(&knit, "table", &frozen);
+    knit_assert_h(rv == KNIT_OK && knit.err == KNIT_OK, "freezing the table failed");
+    knitx_exec_str(&knit, "inner = null\n gcwalk()\n gccompact()\n n = table['more']['n'] + table['xs'][2]\n");
+    expect_int(&knit, "n", 43);
+
+    knitx_init(&reader, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&reader);
+    knitx_frozen_publish(&reader, "table", frozen);
+    knitx_exec_str(&reader, "l = [1, 2]\n gccompact()\n"
+                            "n = table['more']['n'] + table['xs'][2] + table['more']['xs'][1] + len(table['name'])\n"
+                            "gcwalk()\n");
+    knit_assert_h(reader.err == KNIT_OK, "reading the published table failed");
+    expect_int(&reader, "n", 48);
+
+    for (int i=0; i<(int) (sizeof changes / sizeof changes[0]); i++) {
+        struct knit writer;
+        knitx_init(&writer, KNIT_POLICY_CONTINUE);
+        knitxr_register_stdlib(&writer);
+        knitx_frozen_publish(&writer, "table", frozen);
+        knitx_exec_str(&writer, changes[i]);
+        knit_assert_h(writer.err == KNIT_RUNTIME_ERR && strstr(writer.err_msg, "frozen"), "'%s' didn't fail", changes[i]);
+        knitx_deinit(&writer);
+    }
+    knitx_exec_str(&reader, "n = table['xs'][0] + len(table['xs'])\n");
+    expect_int(&reader, "n", 4);
+    knitx_deinit(&reader);
+    knitx_deinit(&knit);
+    knitx_frozen_free(frozen);
+}
+
+//reads or overwrites n bytes of path at offset
+static void file_bytes(const char *path, long offset, void *buf, size_t n, int write) {
+    FILE *f = fopen(path, write ? "r+b" : "rb");
+    if (!f)
+        idie("failed to open '%s'", path);
+    fseek(f, offset, SEEK_SET);
+    size_t done = write ? fwrite(buf, 1, n, f) : fread(buf, 1, n, f);
+    if (done != n)
+        idie("failed to access '%s'", path);
+    fclose(f);
+}
+
+//a cache whose header matches the source but whose contents are corrupt is compiled again and rewritten, it doesn't exit
+void test_knb_cache(void) {
+    static const char *path = "t_cache.knb";
+    static const char *src = "sq = function(n) { return n * n }\n"
+                             "name = 'cached'\n"
+                             "x = sq(6) + len(name)\n";
+    unsigned char good[16], bad[16], now[16];
+    remove(path);
+    for (int i=0; i<3; i++) {
+        struct knit knit;
+        knitx_init(&knit, KNIT_POLICY_EXIT);
+        knitxr_register_stdlib(&knit);
+        if (i == 2) {
+            file_bytes(path, 40, good, sizeof good, 0);
+            memset(bad, 0xff, sizeof bad);
+            file_bytes(path, 40, bad, sizeof bad, 1);
+        }
+        knitx_exec_cached(&knit, src, path);
+        knit_assert_h(knit.err == KNIT_OK, "running from the cache failed");
+        expect_int(&knit, "x", 42);
+        knitx_deinit(&knit);
+    }
+    file_bytes(path, 40, now, sizeof now, 0);
+    knit_assert_h(memcmp(now, good, sizeof now) == 0, "the corrupt cache wasn't rewritten");
+    remove(path);
+}
+
+//instances that import the same file run the same compiled program, a module that doesn't compile or exist is an error
+void test_import(void) {
+    static const char *failing[] = {"m = import('tests/t32_broken.kn')\n", "m = import('tests/t32_missing.kn')\n"};
+    struct knit knits[2];
+    struct knit_obj *funcs[2];
+    for (int i=0; i<2; i++) {
+        knitx_init(&knits[i], KNIT_POLICY_CONTINUE);
+        knitxr_register_stdlib(&knits[i]);
+        knitx_exec_str(&knits[i], "runs = []\n m = import('tests/t32_counter.kn')\n m = import('tests/t32_counter.kn')\n"
+                                  "loads = len(runs)\n f = m['sq']\n x = f(5)\n");
+        knit_assert_h(knits[i].err == KNIT_OK, "importing failed: %s", knits[i].err_msg);
+        expect_int(&knits[i], "loads", 1);
+        expect_int(&knits[i], "x", 25);
+        knitx_getvar_(&knits[i], "f", &funcs[i]);
+    }
+    knit_assert_h(funcs[0]->u.ktype == KNIT_KFUNC && funcs[0]->u.kfunc.block->shared, "the module's function isn't the program's");
+    knit_assert_h(funcs[0]->u.kfunc.block == funcs[1]->u.kfunc.block, "the module was compiled for each instance");
+    for (int i=0; i<(int) (sizeof failing / sizeof failing[0]); i++) {
+        struct knit knit;
+        knitx_init(&knit, KNIT_POLICY_CONTINUE);
+        knitxr_register_stdlib(&knit);
+        knitx_exec_str(&knit, failing[i]);
+        knit_assert_h(knit.err != KNIT_OK && strstr(knit.err_msg, "import()"), "'%s' didn't fail", failing[i]);
+        knitx_deinit(&knit);
+    }
+    knitx_deinit(&knits[0]);
+    knitx_deinit(&knits[1]);
+    knitx_module_cache_clear();
+}
+
+//a module's code and its functions, wherever they're called from, use the module's globals, the module dict is them
+void test_module_globals(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knitx_exec_str(&knit, "name = 'main'\n"
+                          "a = import('tests/t32_ns_a.kn')\n"
+                          "b = import('tests/t32_ns_b.kn')\n"
+                          "gcwalk()\n gccompact()\n"
+                          "b['set']('b2')\n"
+                          "a['name'] = 'a2'\n"
+                          "same = name == 'main' and a['get']() == 'a2' and b['get']() == 'b2' and b['name'] == 'b2'\n");
+    knit_assert_h(knit.err == KNIT_OK, "importing failed: %s", knit.err_msg);
+    struct knit_obj *same = NULL;
+    knitx_getvar_(&knit, "same", &same);
+    knit_assert_h(same->u.ktype == KNIT_TRUE, "a module's globals aren't its own");
+    //it's in the module's globals, not the instance's
+    knit_assert_h(knitx_getvar_(&knit, "get", &same) == KNIT_NOT_FOUND, "a module's function is an instance global");
+    knit_clear_error(&knit);
+
+    //a clone's modules are its own
+    struct knit clone;
+    knit_assert_h(knitx_clone(&clone, &knit) == KNIT_OK, "cloning failed: %s", clone.err_msg);
+    knitx_exec_str(&clone, "b['set']('clone')\n same = b['get']() == 'clone'\n");
+    knit_assert_h(clone.err == KNIT_OK, "the clone failed: %s", clone.err_msg);
+    knitx_getvar_(&clone, "same", &same);
+    knit_assert_h(same->u.ktype == KNIT_TRUE, "the clone's module doesn't have its globals");
+    knitx_exec_str(&knit, "same = b['get']() == 'b2'\n");
+    knitx_getvar_(&knit, "same", &same);
+    knit_assert_h(same->u.ktype == KNIT_TRUE, "the clone changed the source's module");
+    knitx_deinit(&clone);
+    knitx_deinit(&knit);
+    knitx_module_cache_clear();
+}
+
+static void write_module(const char *path, const char *src) {
+    FILE *f = fopen(path, "w");
+    knit_assert_h(f != NULL, "couldn't write '%s'", path);
+    fputs(src, f);
+    fclose(f);
+}
+static void expect_module_entries(const char *path, int ncached, int nstale) {
+    int n[2] = {0, 0};
+    struct knit_module_cache_entry *lists[2] = {knit_module_cache, knit_module_stale};
+    for (int i=0; i<2; i++) {
+        for (struct knit_module_cache_entry *e = lists[i]; e; e = e->next)
+            n[i] += strcmp(e->path, path) == 0;
+    }
+    knit_assert_h(n[0] == ncached && n[1] == nstale, "expected %d cached and %d stale entries for '%s', found %d and %d",
+                  ncached, nstale, path, n[0], n[1]);
+}
+//a changed module replaces its old version in the cache, the old one is freed when the last instance that imported it is
+void test_module_cache(void) {
+    const char *path = "t_module_cache.kn";
+    const char *script = "m = import('t_module_cache.kn')\n v = m['get']()\n";
+    struct knit knits[3];
+    write_module(path, "value = 1\n get = function() { return value }\n");
+    for (int i=0; i<3; i++) {
+        knitx_init(&knits[i], KNIT_POLICY_CONTINUE);
+        knitxr_register_stdlib(&knits[i]);
+    }
+    knitx_exec_str(&knits[0], script);
+    expect_module_entries(path, 1, 0);
+
+    write_module(path, "value = 22\n get = function() { return value }\n");
+    knitx_exec_str(&knits[1], script);
+    expect_int(&knits[1], "v", 22);
+    expect_module_entries(path, 1, 1);
+    //the old version still runs for the instance that imported it
+    knitx_exec_str(&knits[0], "v = m['get']() + 1\n");
+    expect_int(&knits[0], "v", 2);
+    knitx_deinit(&knits[0]);
+    expect_module_entries(path, 1, 0);
+
+    write_module(path, "value = 333\n get = function() { return value }\n");
+    knitx_exec_str(&knits[2], script);
+    expect_int(&knits[2], "v", 333);
+    expect_module_entries(path, 1, 1);
+    knitx_deinit(&knits[1]);
+    expect_module_entries(path, 1, 0);
+    //the current version stays for the next instance to import it
+    knitx_deinit(&knits[2]);
+    expect_module_entries(path, 1, 0);
+    knitx_module_cache_clear();
+    expect_module_entries(path, 0, 0);
+    remove(path);
+}
+
+//function bodies are compiled on their first call, or all at once for a bytecode file. a syntax error in a body
+//is reported when it's compiled
+void test_lazy(void) {
+    static const char *path = "t_lazy.knb";
+    static const char *src = "outer = function(n) {\n"
+                             "    inner = function(m) {\n"
+                             "        helper = function(k) { return k + 1 }\n"
+                             "        return helper(m) * 2\n"
+                             "    }\n"
+                             "    return inner(n) + 1\n"
+                             "}\n"
+                             "total = 0\n"
+                             "for (i=0; i<10; i=i+1) { total = total + outer(i) }\n";
+    static const char *bad = "before = 1\n"
+                             "bad = function(n) { return n + }\n"
+                             "loaded = 1\n"
+                             "x = bad(1)\n"
+                             "after = 1\n";
+    struct knit knit, loader;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knitx_exec_str(&knit, src);
+    knit_assert_h(knit.err == KNIT_OK, "running lazy functions failed: %s", knit.err_msg);
+    expect_int(&knit, "total", 120);
+    knit_assert_h(knitx_save_bytecode(&knit, src, path) == KNIT_OK, "writing the bytecode failed");
+
+    knitx_init(&loader, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&loader);
+    knitx_exec_bytecode(&loader, path);
+    knit_assert_h(loader.err == KNIT_OK, "running the bytecode failed: %s", loader.err_msg);
+    expect_int(&loader, "total", 120);
+    knitx_deinit(&loader);
+    knitx_deinit(&knit);
+    remove(path);
+
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knitx_exec_str(&knit, bad);
+    knit_assert_h(knit.err != KNIT_OK, "calling a function with a syntax error didn't fail");
+    expect_int(&knit, "loaded", 1);
+    struct knit_obj *obj = NULL;
+    knit_clear_error(&knit);
+    knit_assert_h(knitx_getvar_(&knit, "after", &obj) == KNIT_NOT_FOUND, "the script ran on after the error");
+    knitx_deinit(&knit);
+
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knit_assert_h(knitx_save_bytecode(&knit, bad, path) != KNIT_OK, "writing bytecode with a syntax error didn't fail");
+    knitx_deinit(&knit);
+    remove(path);
+}
+
+static const char *prelude_src = "table = {'a' : [1, 2], 'b' : 'str'}\n"
+                                  "table['self'] = table\n"
+                                  "sq = function(n) { return n * n }\n"
+                                  "lazy = function(n) { return sq(n) + seven() }\n"
+                                  "count = 3\n";
+//what a copy of an instance that ran prelude_src can do on its own
+static const char *prelude_check = "x = lazy(4) + len(table['a']) + len(table['self']['b'])\n"
+                                   "table['a'].append(3)\n"
+                                   "for (i=0; i<500; i=i+1) { l = [i, {'k' : i, 's' : 'x' + 'y'}] }\n"
+                                   "gcwalk()\n"
+                                   "gccompact()\n"
+                                   "y = len(table['self']['a']) + count + sq(2)\n";
+static int test_seven(struct knit *knit) {
+    struct knit_int *num = NULL;
+    int rv = knitx_int_new_gcobj(knit, &num, 7);
+    if (rv != KNIT_OK)
+        return rv;
+    knitx_stack_rpush(knit, &knit->ex.stack, ktobj(num));
+    knitx_creturns(knit, 1);
+    return KNIT_OK;
+}
+//seven() is a host C function if host, a script function otherwise
+static void prelude_init(struct knit *knit, int host) {
+    knitx_init(knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(knit);
+    if (host)
+        knitx_register_cfunction(knit, "seven", test_seven);
+    else
+        knitx_exec_str(knit, "seven = function() { return 7 }\n");
+    knitx_exec_str(knit, prelude_src);
+    knit_assert_h(knit->err == KNIT_OK, "the prelude failed: %s", knit->err_msg);
+}
+static void prelude_expect(struct knit *knit) {
+    knitx_exec_str(knit, prelude_check);
+    knit_assert_h(knit->err == KNIT_OK, "running after the prelude failed: %s", knit->err_msg);
+    expect_int(knit, "x", 16 + 7 + 2 + 3);
+    expect_int(knit, "y", 3 + 3 + 4);
+}
+
+//a clone has the globals, functions and heap of its source and outlives it, an instance with generators can't be cloned
+void test_clone(void) {
+    struct knit src, clone;
+    prelude_init(&src, 1);
+    knit_assert_h(knitx_clone(&clone, &src) == KNIT_OK, "cloning failed");
+    prelude_expect(&clone);
+    knitx_exec_str(&src, "z = len(table['a'])\n");
+    expect_int(&src, "z", 2);
+    knitx_deinit(&src);
+    knitx_exec_str(&clone, "w = lazy(3) + len(table['a'])\n");
+    expect_int(&clone, "w", 9 + 7 + 3);
+    knitx_deinit(&clone);
+
+    prelude_init(&src, 1);
+    knitx_exec_str(&src, "gen = function() { yield 1 }\n running = gen()\n");
+    knit_assert_h(knitx_clone(&clone, &src) != KNIT_OK && strstr(src.err_msg, "generators"), "cloning an instance with a generator didn't fail");
+    knitx_deinit(&src);
+}
+
+//an image has the globals, functions and heap of the instance that saved it, host C functions and generators can't be saved
+void test_image(void) {
+    const char *path = "t_image.kni";
+    struct knit knit, loaded;
+    prelude_init(&knit, 0);
+    knit_assert_h(knitx_save_image(&knit, path) == KNIT_OK, "saving the image failed: %s", knit.err_msg);
+    knitx_deinit(&knit);
+    knit_assert_h(knitx_load_image(&loaded, KNIT_POLICY_CONTINUE, path) == KNIT_OK, "loading the image failed: %s", loaded.err_msg);
+    prelude_expect(&loaded);
+    knitx_deinit(&loaded);
+    //the file isn't changed by running what was loaded from it
+    knit_assert_h(knitx_load_image(&loaded, KNIT_POLICY_CONTINUE, path) == KNIT_OK, "loading the image again failed: %s", loaded.err_msg);
+    prelude_expect(&loaded);
+    knitx_deinit(&loaded);
+    remove(path);
+
+    prelude_init(&knit, 1);
+    knit_assert_h(knitx_save_image(&knit, path) != KNIT_OK && strstr(knit.err_msg, "C functions"), "saving a host C function didn't fail");
+    knitx_deinit(&knit);
+    prelude_init(&knit, 0);
+    knitx_exec_str(&knit, "gen = function() { yield 1 }\n running = gen()\n");
+    knit_assert_h(knitx_save_image(&knit, path) != KNIT_OK && strstr(knit.err_msg, "generators can't be saved"), "saving a generator didn't fail");
+    knitx_deinit(&knit);
+    remove(path);
+}
+
+//a script long enough to be split into units on several threads, later units call functions from earlier ones
+static char *parallel_script(int n) {
+    size_t cap = n * 160 + 256, len = 0;
+    char *buf = malloc(cap);
+    knit_assert_h(buf != NULL, "");
+    len += snprintf(buf + len, cap - len, "total = 0\nlens = 0\n");
+    for (int i=0; i<n; i++) {
+        len += snprintf(buf + len, cap - len, "f%d = function(n) { return n * 2 + %d }\n"
+                                              "v%d = f%d(%d) + f%d(1)\n"
+                                              "s%d = 'str%d'\n"
+                                              "total = total + v%d\nlens = lens + len(s%d)\n",
+                        i, i, i, i, i, i / 2, i, i, i, i);
+    }
+    snprintf(buf + len, cap - len, "last = f0(1) + f%d(1)\n", n - 1);
+    return buf;
+}
+static int global_count(struct knit *knit) {
+    struct knit_vars_jadwal_iter iter;
+    int n = 0;
+    knit_vars_jadwal_begin_iterator(&knit->ex.global_ht, &iter);
+    for (; knit_vars_jadwal_iter_check(&iter); knit_vars_jadwal_iter_next(&knit->ex.global_ht, &iter))
+        n++;
+    return n;
+}
+static void expect_same_int(struct knit *a, struct knit *b, const char *name) {
+    struct knit_obj *obj = NULL;
+    knit_assert_h(knitx_getvar_(a, name, &obj) == KNIT_OK && obj->u.ktype == KNIT_INT, "'%s' isn't an int", name);
+    expect_int(b, name, obj->u.integer.value);
+}
+
+//knitx_exec_str_parallel() leaves the same globals as knitx_exec_str() and a syntax error anywhere runs nothing
+void test_parallel(void) {
+    int n = 400;
+    char *script = parallel_script(n);
+    knit_assert_h(strlen(script) > 4 * KNIT_PARALLEL_MIN_UNIT, "the script is too short to be split");
+    struct knit serial;
+    knitx_init(&serial, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&serial);
+    knitx_exec_str(&serial, script);
+    knit_assert_h(serial.err == KNIT_OK, "the serial run failed: %s", serial.err_msg);
+    int threads[] = {1, 4, 0};
+    for (int t=0; t<(int) (sizeof threads / sizeof threads[0]); t++) {
+        struct knit par;
+        knitx_init(&par, KNIT_POLICY_CONTINUE);
+        knitxr_register_stdlib(&par);
+        knit_assert_h(knitx_exec_str_parallel(&par, script, threads[t]) == KNIT_OK && par.err == KNIT_OK, "the parallel run failed: %s", par.err_msg);
+        knit_assert_h(global_count(&par) == global_count(&serial), "the parallel run left different globals");
+        char name[32];
+        for (int i=0; i<n; i++) {
+            snprintf(name, sizeof name, "v%d", i);
+            expect_same_int(&serial, &par, name);
+        }
+        expect_same_int(&serial, &par, "total");
+        expect_same_int(&serial, &par, "lens");
+        expect_same_int(&serial, &par, "last");
+        //the functions it compiled keep working
+        knitx_exec_str(&par, "again = f7(3) + f399(0)\n");
+        expect_int(&par, "again", 6 + 7 + 399);
+        knitx_deinit(&par);
+    }
+    knitx_deinit(&serial);
+
+    //break the last function, nothing before it runs
+    char *brk = strstr(script, "last = f0(1)");
+    memcpy(brk, "last = f0(1(", 12);
+    struct knit par;
+    knitx_init(&par, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&par);
+    knit_assert_h(knitx_exec_str_parallel(&par, script, 4) != KNIT_OK || par.err != KNIT_OK, "a syntax error in the last unit didn't fail");
+    struct knit_obj *obj = NULL;
+    knit_assert_h(knitx_getvar_(&par, "total", &obj) != KNIT_OK, "the first unit ran despite the syntax error");
+    knitx_deinit(&par);
+    free(script);
+}
+
+static const char *shared_program = "name = 'prog' + 'ram'\n"
+                                    "fib = function(n) { if (n < 2) { return n } return fib(n-1) + fib(n-2) }\n"
+                                    "runs = runs + 1\n"
+                                    "l = []\n"
+                                    "for (i=0; i<200; i=i+1) { l.append({'i' : i, 's' : name}) }\n"
+                                    "gcwalk()\n"
+                                    "gccompact()\n"
+                                    "r = fib(15) + len(l) + len(l[199]['s']) + runs * 1000\n";
+struct program_run {
+    struct knit knit;
+    const struct knit_program *prog;
+    int rv;
+#ifdef KNIT_HAVE_PTHREADS
+    pthread_t thread;
+#endif
+};
+static void *program_run(void *arg) {
+    struct program_run *run = arg;
+    for (int i=0; i<3 && run->rv == KNIT_OK; i++)
+        run->rv = knitx_exec_program(&run->knit, run->prog);
+    return NULL;
+}
+static void program_run_init(struct program_run *run, const struct knit_program *prog) {
+    knitx_init(&run->knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&run->knit);
+    knitx_exec_str(&run->knit, "runs = 0\n");
+    run->prog = prog;
+    run->rv = KNIT_OK;
+}
+
+//instances running the same program get their own globals and heap, the program isn't changed by running it
+void test_program(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    struct knit_program *prog = NULL;
+    knit_assert_h(knitx_program_compile(&knit, shared_program, &prog) == KNIT_OK, "compiling the program failed");
+    struct program_run a, b;
+    program_run_init(&a, prog);
+    program_run_init(&b, prog);
+    knit_assert_h(knitx_exec_program(&a.knit, prog) == KNIT_OK && a.knit.err == KNIT_OK, "the first instance failed: %s", a.knit.err_msg);
+    knit_assert_h(knitx_exec_program(&b.knit, prog) == KNIT_OK && b.knit.err == KNIT_OK, "the second instance failed: %s", b.knit.err_msg);
+    knit_assert_h(knitx_exec_program(&a.knit, prog) == KNIT_OK && a.knit.err == KNIT_OK, "running it again failed: %s", a.knit.err_msg);
+    expect_int(&a.knit, "r", 610 + 200 + 7 + 2000);
+    expect_int(&b.knit, "r", 610 + 200 + 7 + 1000);
+    struct knit_obj *fib = NULL;
+    knitx_getvar_(&a.knit, "fib", &fib);
+    knit_assert_h(fib->u.ktype == KNIT_KFUNC && fib->u.kfunc.block->shared, "the function isn't the program's");
+    //rebinding its globals in one instance leaves the other alone
+    knitx_exec_str(&a.knit, "fib = 0\n name = 'a'\n");
+    knitx_exec_str(&b.knit, "f = fib(10) + len(name)\n");
+    expect_int(&b.knit, "f", 55 + 7);
+    knitx_deinit(&a.knit);
+    knitx_deinit(&b.knit);
+
+#ifdef KNIT_HAVE_PTHREADS
+    struct program_run runs[4];
+    for (int i=0; i<4; i++) {
+        program_run_init(&runs[i], prog);
+        knit_assert_h(pthread_create(&runs[i].thread, NULL, program_run, &runs[i]) == 0, "couldn't start a thread");
+    }
+    for (int i=0; i<4; i++) {
+        pthread_join(runs[i].thread, NULL);
+        knit_assert_h(runs[i].rv == KNIT_OK && runs[i].knit.err == KNIT_OK, "a thread failed: %s", runs[i].knit.err_msg);
+        expect_int(&runs[i].knit, "r", 610 + 200 + 7 + 3000);
+        knitx_deinit(&runs[i].knit);
+    }
+#endif
+    knitx_deinit(&knit);
+    knitx_program_free(prog);
+}
+
+//lexes len bytes of src like the parser does, looking one token ahead. the number of tokens before EOF, -1 on an error
+static int lex_all(struct knit *knit, const char *src, int len, struct knit_tok *toks, int max) {
+    struct knit_lex lxr;
+    struct knit_tok *cur, *la;
+    int n = 0, rv = knitx_lexer_init_buf(knit, &lxr, src, len);
+    while (rv == KNIT_OK && (rv = knitx_lexer_peek_cur(knit, &lxr, &cur)) == KNIT_OK && cur->toktype != KAT_EOF) {
+        struct knit_tok copy = *cur;
+        if ((rv = knitx_lexer_peek_la(knit, &lxr, &la)) != KNIT_OK)
+            break;
+        knit_assert_h(memcmp(&copy, cur, sizeof copy) == 0, "looking ahead changed the current token");
+        knit_assert_h(n < max, "too many tokens");
+        toks[n++] = copy;
+        rv = knitx_lexer_skip(knit, &lxr);
+    }
+    knitx_lexer_deinit(knit, &lxr);
+    return rv == KNIT_OK ? n : -1;
+}
+
+//a script many times longer than the lexer's window of tokens is lexed with the right offsets and lines
+void test_lexer_window(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    int nlines = 100;
+    char *src = malloc(nlines * 32);
+    knit_assert_h(src != NULL, "");
+    int len = 0;
+    for (int i=0; i<nlines; i++)
+        len += sprintf(src + len, "a%d = %d + (b%d)\n", i, i, i);
+    struct knit_tok toks[800];
+    int n = lex_all(&knit, src, len, toks, 800);
+    knit_assert_h(n == nlines * 8, "lexed %d tokens", n);
+    static const int types[] = {KAT_VAR, KAT_ASSIGN, KAT_INTLITERAL, KAT_ADD, KAT_OPAREN, KAT_VAR, KAT_CPAREN, KAT_NEWLINE};
+    for (int i=0; i<n; i++) {
+        char name[16];
+        knit_assert_h(toks[i].toktype == types[i % 8] && toks[i].lineno == i / 8 + 1, "token %d is wrong", i);
+        if (i % 8 == 0 || i % 8 == 5) {
+            int namelen = sprintf(name, "%c%d", i % 8 ? 'b' : 'a', i / 8);
+            knit_assert_h(toks[i].len == namelen && memcmp(src + toks[i].offset, name, namelen) == 0, "token %d isn't %s", i, name);
+        }
+        if (i % 8 == 2)
+            knit_assert_h(toks[i].data.integer == i / 8, "token %d has the wrong value", i);
+    }
+    free(src);
+    knitx_deinit(&knit);
+}
+
+#ifdef KNIT_SCAN_CHUNK
+#define TEST_SCAN_CHUNK KNIT_SCAN_CHUNK
+#else
+#define TEST_SCAN_CHUNK 16
+#endif
+//lexes a copy of src in a buffer of its exact length, so reading past it is caught by the sanitizers
+static int lex_exact(struct knit *knit, const char *src, int len, struct knit_tok *toks, int max) {
+    char *buf = malloc(len ? len : 1);
+    knit_assert_h(buf != NULL, "");
+    memcpy(buf, src, len);
+    int n = lex_all(knit, buf, len, toks, max);
+    free(buf);
+    return n;
+}
+
+//runs of identifier characters, digits, whitespace and string characters of every length around the scanning chunk,
+//starting at every offset in it. an unterminated string, or one ending in a backslash, is an error
+void test_lexer_chunks(void) {
+    static const char spaces[] = " \t\n\r\v\f";
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    char src[8 * TEST_SCAN_CHUNK];
+    struct knit_tok toks[4];
+    for (int pad=0; pad<TEST_SCAN_CHUNK; pad++) {
+        for (int runlen=1; runlen<=3 * TEST_SCAN_CHUNK + 1; runlen++) {
+            for (int end=0; end<2; end++) {
+                //end is a byte after the run, without it the run ends the input
+                memset(src, ' ', pad);
+                for (int i=0; i<runlen; i++)
+                    src[pad + i] = "aZ_9"[i % 4];
+                src[pad + runlen] = '+';
+                int n = lex_exact(&knit, src, pad + runlen + end, toks, 4);
+                knit_assert_h(n == 1 + end && toks[0].toktype == KAT_VAR && toks[0].offset == pad && toks[0].len == runlen,
+                              "an identifier of %d at %d was lexed wrong", runlen, pad);
+
+                memset(src + pad, '0', runlen);
+                n = lex_exact(&knit, src, pad + runlen + end, toks, 4);
+                knit_assert_h(n == 1 + end && toks[0].toktype == KAT_INTLITERAL && toks[0].len == runlen,
+                              "a number of %d at %d was lexed wrong", runlen, pad);
+
+                int nl = 0;
+                src[pad] = 'a';
+                for (int i=0; i<runlen; i++) {
+                    src[pad + 1 + i] = spaces[i % 6];
+                    nl += spaces[i % 6] == '\n';
+                }
+                src[pad + 1 + runlen] = 'b';
+                n = lex_exact(&knit, src, pad + 1 + runlen + end, toks, 4);
+                knit_assert_h(n == 1 + end && (!end || (toks[1].offset == pad + 1 + runlen && toks[1].lineno == 1 + nl)),
+                              "whitespace of %d at %d was skipped wrong", runlen, pad);
+
+                //a backslash escapes the quote after it, wherever it falls in a chunk
+                src[pad] = '\'';
+                for (int i=0; i<runlen; i++)
+                    src[pad + 1 + i] = i == runlen - 2 ? '\\' : 's';
+                src[pad + 1 + runlen] = '\'';
+                n = lex_exact(&knit, src, pad + 2 + runlen, toks, 4);
+                knit_assert_h(n == 1 && toks[0].toktype == KAT_STRLITERAL && toks[0].len == runlen + 2,
+                              "a string of %d at %d was lexed wrong", runlen, pad);
+            }
+            //unterminated, then with its last byte a backslash
+            memset(src + pad + 1, 's', runlen);
+            for (int esc=0; esc<2; esc++) {
+                src[pad + runlen] = esc ? '\\' : 's';
+                knit_assert_h(lex_exact(&knit, src, pad + runlen + 1, toks, 4) == -1 && knit.err == KNIT_SYNTAX_ERR,
+                              "an unterminated string of %d at %d wasn't an error", runlen, pad);
+                knit_clear_error(&knit);
+            }
+        }
+    }
+    knitx_deinit(&knit);
+}
+
+static const char *unterminated_src = "f = function(n) { return n + k }\n"
+                                      "k = 5\n"
+                                      "v = f(1) + k";
+//a script that doesn't end in a null byte compiles and runs, its functions are compiled later from their source.
+//a mapped script of exactly a page has nothing after it either
+void test_lexer_buf(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    int len = strlen(unterminated_src);
+    char *buf = malloc(len);
+    knit_assert_h(buf != NULL, "");
+    memcpy(buf, unterminated_src, len);
+    struct knit_prs prs;
+    knit_assert_h(knitx_compile_buf(&knit, &prs, buf, len) == KNIT_OK, "compiling the buffer failed: %s", knit.err_msg);
+    knitx_exec_toplevel(&knit, &prs.curblk->block);
+    knitx_lexer_deinit(&knit, &prs.lex);
+    knitx_prs_deinit(&knit, &prs);
+    free(buf);
+    knit_assert_h(knit.err == KNIT_OK, "running the buffer failed: %s", knit.err_msg);
+    expect_int(&knit, "v", 11);
+    knitx_exec_str(&knit, "w = f(2)\n");
+    expect_int(&knit, "w", 7);
+    knitx_deinit(&knit);
+
+#ifdef KNIT_HAVE_MMAP
+    const char *path = "t_page.kn";
+    long pagesz = sysconf(_SC_PAGESIZE);
+    FILE *f = fopen(path, "wb");
+    knit_assert_h(f && pagesz > len, "couldn't write '%s'", path);
+    for (long i=0; i<pagesz - len; i++)
+        fputc(i % 64 == 63 ? '\n' : ' ', f);
+    fwrite(unterminated_src, 1, len, f);
+    fclose(f);
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knit_assert_h(knitx_exec_file(&knit, path, NULL) == KNIT_OK && knit.err == KNIT_OK, "running '%s' failed: %s", path, knit.err_msg);
+    expect_int(&knit, "v", 11);
+    knitx_exec_str(&knit, "w = f(3)\n");
+    expect_int(&knit, "w", 8);
+    knitx_deinit(&knit);
+
+    //a script that doesn't compile or fails when it runs is reported to a caller that doesn't exit on errors,
+    //with or without the bytecode cache
+    static const char *failing[] = {"x = (1\n", "x = [1] + 'a'\n", "x = undefined_var\n"};
+    const char *cache = "t_page.knb";
+    for (int i=0; i<3; i++) {
+        for (int cached=0; cached<3; cached++) { //the third run reads the cache the second wrote
+            f = fopen(path, "wb");
+            knit_assert_h(f != NULL, "couldn't write '%s'", path);
+            fputs(failing[i], f);
+            fclose(f);
+            knitx_init(&knit, KNIT_POLICY_CONTINUE);
+            int rv = knitx_exec_file(&knit, path, cached ? cache : NULL);
+            knit_assert_h(rv != KNIT_OK && rv == knit.err, "running '%s' didn't fail", failing[i]);
+            knitx_deinit(&knit);
+        }
+    }
+    remove(cache);
+    remove(path);
+#endif
+}
+
+//the samples as folded stacks: returns the number of lines, checks each is well formed and they're biggest first
+static int sample_report(struct knit *knit, size_t interval, char lines[][128], unsigned long long *bytes, int max) {
+    FILE *f = tmpfile();
+    knit_assert_h(f != NULL, "couldn't make a temporary file");
+    knitx_alloc_sample_report(knit, f);
+    rewind(f);
+    int n = 0;
+    for (; n < max && fgets(lines[n], 128, f); n++) {
+        char *sp = strrchr(lines[n], ' ');
+        knit_assert_h(sp && sp[strlen(sp) - 1] == '\n', "a report line has no bytes: %s", lines[n]);
+        *sp = '\0';
+        bytes[n] = strtoull(sp + 1, NULL, 10);
+        knit_assert_h(bytes[n] && bytes[n] % interval == 0, "%llu bytes isn't a number of intervals", bytes[n]);
+        knit_assert_h(n == 0 || bytes[n] <= bytes[n - 1], "the report isn't sorted");
+        for (char *frame = strtok(lines[n], ";"), *end; frame; frame = strtok(NULL, ";")) {
+            int ok = !strcmp(frame, "<compile>") || !strcmp(frame, "<builtin>") ||
+                     (!strncmp(frame, "main:", 5) && strtol(frame + 5, &end, 10) > 0 && !*end) ||
+                     (!strncmp(frame, "function@", 9) && strtol(frame + 9, &end, 10) > 0 && *end == ':' && strtol(end + 1, &end, 10) > 0 && !*end);
+            knit_assert_h(ok, "'%s' isn't a frame", frame);
+            if (frame != lines[n])
+                frame[-1] = ';'; //strtok cut the line there
+        }
+    }
+    knit_assert_h(!fgets(lines[0], 128, f), "too many report lines");
+    fclose(f);
+    return n;
+}
+
+//allocations are charged to the stack that made them: the call's line in main, then the function's definition and line
+void test_sampler(void) {
+    size_t interval = 256;
+    char lines[32][128];
+    unsigned long long bytes[32], total = 0;
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knitx_alloc_sampling(&knit, interval);
+    knitx_exec_str(&knit, "x = 0\n"
+                          "mk = function(n) {\n"
+                          "    l = []\n"
+                          "    for (i=0; i<n; i=i+1) { l.append([i, i, i]) }\n"
+                          "    return l\n"
+                          "}\n"
+                          "big = mk(2000)\n");
+    knit_assert_h(knit.err == KNIT_OK, "the script failed: %s", knit.err_msg);
+    int n = sample_report(&knit, interval, lines, bytes, 32);
+    int builtin = 0;
+    for (int i=0; i<n; i++) {
+        total += bytes[i];
+        builtin |= !strcmp(lines[i], "main:7;function@2:4;<builtin>");
+    }
+    knit_assert_h(n > 1 && !strcmp(lines[0], "main:7;function@2:4"), "the loop isn't where most memory went: %s", lines[0]);
+    knit_assert_h(bytes[0] >= 2000 * 3 * sizeof(struct knit_obj *), "the loop was charged %llu bytes", bytes[0]);
+    knit_assert_h(builtin, "append() growing the list wasn't sampled");
+
+    //stopped, nothing more is recorded
+    knitx_alloc_sampling(&knit, 0);
+    knitx_exec_str(&knit, "more = mk(1000)\n");
+    unsigned long long after = 0;
+    n = sample_report(&knit, interval, lines, bytes, 32);
+    for (int i=0; i<n; i++)
+        after += bytes[i];
+    knit_assert_h(after == total, "sampling didn't stop");
+    knitx_deinit(&knit);
+}
+
+#define COUNTING_MAGIC 0x6b6e6974u
+//prefixes each block with its size, so what's outstanding is known and a pointer it didn't make is caught
+struct counting_allocator {
+    long live, nallocs;
+    size_t live_bytes;
+    long nchunks; //blocks the size of a parser arena chunk
+    size_t max_sz; //the biggest block since it was last reset
+};
+struct counting_hdr {
+    size_t sz;
+    unsigned magic;
+    unsigned pad; //keeps malloc()'s alignment for the block
+};
+static void *counting_alloc(void *ud, size_t sz) {
+    struct counting_allocator *ca = ud;
+    struct counting_hdr *hdr = malloc(sizeof *hdr + sz);
+    if (!hdr)
+        return NULL;
+    hdr->sz = sz;
+    hdr->magic = COUNTING_MAGIC;
+    ca->live++;
+    ca->nallocs++;
+    ca->nchunks += sz == ptr_wrap_needed_sz(knit_arena_align(sizeof(struct knit_arena_chunk)) + KNIT_ARENA_CHUNK_SZ);
+    ca->live_bytes += sz;
+    if (sz > ca->max_sz)
+        ca->max_sz = sz;
+    return hdr + 1;
+}
+static struct counting_hdr *counting_hdr(void *p) {
+    struct counting_hdr *hdr = (struct counting_hdr *) p - 1;
+    knit_assert_h(hdr->magic == COUNTING_MAGIC, "%p wasn't allocated by the instance's allocator", p);
+    return hdr;
+}
+static void counting_free(void *ud, void *p) {
+    struct counting_allocator *ca = ud;
+    if (!p)
+        return;
+    struct counting_hdr *hdr = counting_hdr(p);
+    ca->live--;
+    ca->live_bytes -= hdr->sz;
+    hdr->magic = 0;
+    free(hdr);
+}
+static void *counting_realloc(void *ud, void *p, size_t sz) {
+    if (!p)
+        return counting_alloc(ud, sz);
+    void *np = counting_alloc(ud, sz);
+    if (!np)
+        return NULL;
+    size_t old = counting_hdr(p)->sz;
+    memcpy(np, p, old < sz ? old : sz);
+    counting_free(ud, p);
+    return np;
+}
+
+//everything an instance allocates, including the parser arena's chunks, comes from its allocator and is given back by knitx_deinit()
+void test_allocator(void) {
+    struct counting_allocator ca = {0};
+    const struct knit_allocator allocator = {counting_alloc, counting_realloc, counting_free, &ca};
+    //one statement whose parse tree is bigger than an arena chunk
+    int nterms = 4000;
+    char *big = malloc(nterms * 8 + 64);
+    knit_assert_h(big != NULL, "");
+    int len = sprintf(big, "big = 0");
+    for (int i=0; i<nterms; i++)
+        len += sprintf(big + len, " + %d", i % 10);
+    sprintf(big + len, "\n");
+
+    struct knit knit;
+    knit_assert_h(knitx_init_with_allocator(&knit, KNIT_POLICY_CONTINUE, &allocator) == KNIT_OK, "initializing failed");
+    knitxr_register_stdlib(&knit);
+    knitx_exec_str(&knit, big);
+    knit_assert_h(ca.nchunks > 1, "the parser arena didn't get its chunks from the allocator");
+    knitx_exec_str(&knit, "mk = function(n) { l = []\n for (i=0; i<n; i=i+1) { l.append({'i' : i, 's' : 'a' + 'b'}) }\n return l }\n"
+                          "gen = function(n) { for (i=0; i<n; i=i+1) { yield i } }\n"
+                          "d = {'big' : [big], 'l' : mk(3000)}\n"
+                          "g2 = gen(5)\n"
+                          "first = next(g2)\n"
+                          "gcwalk()\n"
+                          "gccompact()\n"
+                          "n = len(d['big']) + len(d['l']) + next(g2)\n");
+    knit_assert_h(knit.err == KNIT_OK, "the script failed: %s", knit.err_msg);
+    expect_int(&knit, "big", nterms / 10 * 45);
+    expect_int(&knit, "n", 1 + 3000 + 1);
+    knit_assert_h(ca.live > 0, "nothing is allocated");
+    knitx_deinit(&knit);
+    knit_assert_h(ca.live == 0 && ca.live_bytes == 0, "%ld blocks of %lu bytes weren't freed", ca.live, (unsigned long) ca.live_bytes);
+    free(big);
+}
+
+//the tables behind globals and dicts are allocated, grown and freed through the instance allocator too
+void test_table_growth(void) {
+    struct counting_allocator ca = {0};
+    const struct knit_allocator allocator = {counting_alloc, counting_realloc, counting_free, &ca};
+    struct knit knit;
+    knit_assert_h(knitx_init_with_allocator(&knit, KNIT_POLICY_CONTINUE, &allocator) == KNIT_OK, "initializing failed");
+    knitxr_register_stdlib(&knit);
+
+    int nglobals = 2000;
+    char name[32];
+    ca.max_sz = 0;
+    long nallocs = ca.nallocs;
+    for (int i=0; i<nglobals; i++) {
+        sprintf(name, "global%d", i);
+        knit_assert_h(knitx_set_str(&knit, name, "v") == KNIT_OK, "setting %s failed", name);
+    }
+    knit_assert_h(ca.nallocs - nallocs > nglobals, "the globals table didn't grow through the allocator");
+    knit_assert_h(ca.max_sz >= nglobals * sizeof(struct knit_str), "the globals table didn't grow through the allocator");
+
+    int nkeys = 10000;
+    knitx_exec_str(&knit, "d = {}\n");
+    ca.max_sz = 0;
+    knitx_exec_str(&knit, "for (i=0; i<10000; i=i+1) { d[i] = i }\n"
+                          "n = d[9999] + 1\n");
+    knit_assert_h(knit.err == KNIT_OK, "the script failed: %s", knit.err_msg);
+    expect_int(&knit, "n", nkeys);
+    knit_assert_h(ca.max_sz >= nkeys * 2 * sizeof(struct knit_obj *), "the dict's table didn't grow through the allocator");
+    knitx_deinit(&knit);
+    knit_assert_h(ca.live == 0 && ca.live_bytes == 0, "%ld blocks of %lu bytes weren't freed", ca.live, (unsigned long) ca.live_bytes);
+}
+
+static void expect_arena_empty(struct knit *knit) {
+    for (int c=0; c<KNIT_HEAP_NCLASSES; c++)
+        knit_assert_h(knit->ex.heap.arena.classes[c].count == 0, "class %d of the request arena wasn't reset", c);
+}
+
+//what an execution leaves reachable from globals, heap containers it stored into or a generator is moved to the heap,
+//the rest is dropped with the arena without reaching the heap. an arena that fills up is reset during the execution
+void test_request_arena(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knit_assert_h(knitx_request_arena(&knit, 256) == KNIT_OK, "enabling the request arena failed");
+    knitx_exec_str(&knit, "keep = []\n"
+                          "table = {'n' : 0}\n"
+                          "gen = function(n) { for (i=0; i<n; i=i+1) { yield [i, 'g' + 'en'] } }\n"
+                          "running = gen(100)\n");
+    expect_arena_empty(&knit);
+    uint64_t resets = knit.gc_stats.ncycles_by_trigger[KNIT_GC_TRIGGER_ARENA];
+    int heap_count = 0;
+    for (int round=0; round<20; round++) {
+        //1000 lists of garbage fill the arena several times over
+        knitx_exec_str(&knit, "for (i=0; i<500; i=i+1) { junk = [i, {'a' : [i]}, 'x' + 'y'] }\n"
+                              "keep.append([len(keep), {'s' : 'k' + 'eep'}])\n"
+                              "table['last'] = [len(keep)]\n"
+                              "table['n'] = table['n'] + 1\n"
+                              "got = next(running)\n");
+        knit_assert_h(knit.err == KNIT_OK, "round %d failed: %s", round, knit.err_msg);
+        expect_arena_empty(&knit);
+        knit_gc_cycle(&knit, KNIT_GC_TRIGGER_EXPLICIT); //what the kept objects replaced
+        if (round == 1)
+            heap_count = knit.ex.heap.count;
+        //the garbage never reaches the heap, only what's kept does
+        knit_assert_h(round < 2 || knit.ex.heap.count - heap_count <= (round - 1) * 8, "round %d left %d objects in the heap", round, knit.ex.heap.count - heap_count);
+    }
+    knit_assert_h(knit.gc_stats.ncycles_by_trigger[KNIT_GC_TRIGGER_ARENA] - resets > 20, "the arena wasn't reset while it was full");
+    knitx_exec_str(&knit, "gcwalk()\n gccompact()\n");
+    knitx_exec_str(&knit, "sum = 0\n"
+                          "for (i=0; i<len(keep); i=i+1) { sum = sum + keep[i][0] + len(keep[i][1]['s']) }\n"
+                          "n = table['n'] + table['last'][0]\n"
+                          "last = next(running)[0] + len(got[1])\n");
+    knit_assert_h(knit.err == KNIT_OK, "reading what was kept failed: %s", knit.err_msg);
+    expect_int(&knit, "sum", 19 * 20 / 2 + 20 * 4);
+    expect_int(&knit, "n", 20 + 20);
+    expect_int(&knit, "last", 20 + 3);
+
+    //turned off, objects come from the heap again
+    knit_assert_h(knitx_request_arena(&knit, 0) == KNIT_OK && !knit.ex.heap.arena.enabled, "disabling the request arena failed");
+    knitx_exec_str(&knit, "keep.append([100, {'s' : 'heap'}])\n x = len(keep)\n");
+    expect_int(&knit, "x", 21);
+    knitx_deinit(&knit);
+}
+
+//every cycle is timed with a clock that only goes forward, the pauses fit in the time since the instance was made
+void test_gc_stats(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    uint64_t before = knit_gc_stats_now_ns();
+    knitx_exec_str(&knit, "for (i=0; i<20; i=i+1) { l = [i, {'a' : [i]}]\n gcwalk()\n gccompact() }\n");
+    uint64_t after = knit_gc_stats_now_ns();
+    const struct knit_gc_stats *st = knitx_gc_stats(&knit);
+    knit_assert_h(after >= before && st->start_ns <= before, "the clock went backwards");
+    knit_assert_h(st->ncycles == 40, "%llu cycles were recorded", (unsigned long long) st->ncycles);
+    knit_assert_h(st->max_pause_ns > 0 && st->total_pause_ns <= after - st->start_ns, "the pauses don't add up");
+    knit_assert_h(knit_gc_stats_pause_percentile(st, 50) <= st->max_pause_ns, "p50 is above the max pause");
+    double share = knit_gc_stats_share(st);
+    knit_assert_h(share > 0 && share <= 1, "the gc time share is %f", share);
+    knitx_deinit(&knit);
+}
+
+//the number after prefix, after the start of the snapshot's json or *from
+static long long snapshot_number(const char *json, const char **from, const char *prefix) {
+    const char *p = strstr(from && *from ? *from : json, prefix);
+    knit_assert_h(p != NULL, "the snapshot has no %s", prefix);
+    if (from)
+        *from = p + strlen(prefix);
+    return strtoll(p + strlen(prefix), NULL, 10);
+}
+
+//the snapshot counts every object by type, the totals add up and the biggest root is the one holding the most
+void test_heap_snapshot(void) {
+#ifdef KNIT_HAVE_MMAP
+    char path[] = "/tmp/knit_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    knit_assert_h(fd != -1, "couldn't make a temporary file");
+    close(fd);
+#else
+    char path[] = "t_snapshot.json";
+#endif
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knitx_exec_str(&knit, "kept = []\n"
+                          "for (i=0; i<50; i=i+1) { kept.append([i, 'item']) }\n"
+                          "names = {'first' : 'a name', 'big' : [1, 2, 3, 4, 5, 6, 7, 8]}\n");
+    knit_assert_h(knitx_heap_snapshot(&knit, path) == KNIT_OK, "writing the snapshot failed: %s", knit.err_msg);
+    knitx_deinit(&knit);
+
+    char json[8192];
+    FILE *f = fopen(path, "rb");
+    knit_assert_h(f != NULL, "couldn't read '%s'", path);
+    size_t len = fread(json, 1, sizeof json - 1, f);
+    fclose(f);
+    remove(path);
+    json[len] = '\0';
+    knit_assert_h(len > 0 && len < sizeof json - 1, "the snapshot is %lu bytes", (unsigned long) len);
+
+    long long count = 0, bytes = 0;
+    const char *from = strstr(json, "\"types\"");
+    knit_assert_h(from != NULL, "the snapshot has no types");
+    const char *end = strstr(from, "\"largest\"");
+    while (from && (from = strstr(from, "{\"count\": ")) && (!end || from < end)) {
+        count += snapshot_number(json, &from, "{\"count\": ");
+        bytes += snapshot_number(json, &from, "\"bytes\": ");
+    }
+    knit_assert_h(count == snapshot_number(json, NULL, "\"objects\": "), "the types don't add up to the objects");
+    knit_assert_h(bytes == snapshot_number(json, NULL, "\"bytes\": "), "the types don't add up to the bytes");
+    //kept, the 50 lists in it and names['big']
+    knit_assert_h(snapshot_number(json, NULL, "\"list\": {\"count\": ") == 52, "wrong number of lists");
+    knit_assert_h(snapshot_number(json, NULL, "\"dict\": {\"count\": ") == 1, "wrong number of dicts");
+    //the 50 indexes in kept, the 8 in names['big'] and i
+    knit_assert_h(snapshot_number(json, NULL, "\"int\": {\"count\": ") == 59, "wrong number of ints");
+    knit_assert_h(strstr(json, "\"largest\": [\n    {\"type\": \"list\"") && strstr(json, "\"path\": \"kept\"}"), "kept isn't the largest object");
+    knit_assert_h(strstr(json, "\"roots\": [\n    {\"root\": \"kept\"") != NULL, "kept isn't the biggest root");
+    from = strstr(json, "{\"root\": \"kept\"");
+    //kept, its lists, their ints and the 'item' they share
+    knit_assert_h(snapshot_number(json, &from, "\"objects\": ") == 1 + 50 * 2 + 1, "kept doesn't retain its lists and ints");
+}
+
+//each class holds as many live objects as the heap did before it was split, dicts too
+void test_heap_capacity(void) {
+    struct knit knit;
+    knitx_init(&knit, KNIT_POLICY_CONTINUE);
+    knitxr_register_stdlib(&knit);
+    knitx_exec_str(&knit, "dicts = []\n"
+                          "for (i=0; i<20000; i=i+1) { dicts.append({}) }\n"
+                          "n = len(dicts)\n");
+    knit_assert_h(knit.err == KNIT_OK, "allocating 20000 dicts failed: %s", knit.err_msg);
+    expect_int(&knit, "n", 20000);
+    knit_assert_h(knit.ex.heap.classes[KNIT_HEAP_LARGE].count >= 20000, "the dicts aren't in the large class");
+    knitx_deinit(&knit);
+}
+
+struct api_test {
+    const char *name;
+    void (*func)(void);
+};
+static const struct api_test api_tests[] = {
+#ifdef KNIT_HAVE_PTHREADS
+    {"executor_errors", test_executor_errors},
+    {"channel", test_channel},
+#endif
+    {"budget", test_budget},
+    {"freeze", test_freeze},
+    {"knb_cache", test_knb_cache},
+    {"import", test_import},
+    {"module_globals", test_module_globals},
+    {"module_cache", test_module_cache},
+    {"lazy", test_lazy},
+    {"clone", test_clone},
+    {"image", test_image},
+    {"parallel", test_parallel},
+    {"program", test_program},
+    {"lexer_window", test_lexer_window},
+    {"lexer_chunks", test_lexer_chunks},
+    {"lexer_buf", test_lexer_buf},
+    {"sampler", test_sampler},
+    {"allocator", test_allocator},
+    {"table_growth", test_table_growth},
+    {"request_arena", test_request_arena},
+    {"gc_stats", test_gc_stats},
+    {"heap_snapshot", test_heap_snapshot},
+    {"heap_capacity", test_heap_capacity},
+};
+
+static void run_api_test(const struct api_test *t) {
+    printf("Running %s\n", t->name);
+    t->func();
+}
+
 void (*funcs[])(const char *unused) = {
     t1,
     t2,
@@ -256,10 +1516,23 @@ int main(int argc, char **argv) {
     parse_argv(argv, argc);
     if (knopts.verbose)
         KNIT_DBG_PRINT = 1;
+    int napi = sizeof api_tests / sizeof api_tests[0];
     if (knopts.all) {
-        for (int i=1; i<=26; i++) {
+        for (int i=1; i<=32; i++) {
             run_test(i);
         }
+        for (int i=0; i<napi; i++) {
+            run_api_test(&api_tests[i]);
+        }
+    }
+    else if (knopts.api_test) {
+        for (int i=0; i<napi; i++) {
+            if (strcmp(api_tests[i].name, knopts.api_test) == 0) {
+                run_api_test(&api_tests[i]);
+                return 0;
+            }
+        }
+        idie("unknown test: '%s'", knopts.api_test);
     }
     else {
         run_test(knopts.testno);